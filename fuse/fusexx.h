@@ -119,6 +119,16 @@ namespace fusexx
                                 struct fuse_file_info *) {
                 FUSE_RET
             }
+#if FUSE_VERSION >= 29
+            static int f_read_buf (const char *, struct fuse_bufvec **,
+                                   size_t, off_t, struct fuse_file_info *) {
+                FUSE_RET
+            }
+            static int f_write_buf (const char *, struct fuse_bufvec *, off_t,
+                                    struct fuse_file_info *) {
+                FUSE_RET
+            }
+#endif
             static int f_statfs (const char *, struct statvfs *) {
                 FUSE_RET
             }
@@ -197,6 +207,10 @@ namespace fusexx
                 operations.open = T::f_open;
                 operations.read = T::f_readn;
                 operations.write = T::f_write;
+#if FUSE_VERSION >= 29
+                operations.read_buf = T::f_read_buf;
+                operations.write_buf = T::f_write_buf;
+#endif
                 operations.statfs = T::f_statfs;
                 operations.flush = T::f_flush;
                 operations.release = T::f_release;
@@ -63,6 +63,8 @@ static int dbg_mlogsize(struct pfuse_debug_driver *dd);
 static int dbg_mlogmask_read(char *buf, size_t size, off_t offset);
 static int dbg_mlogmask_write(const char *buf, size_t size, off_t offset);
 static int dbg_mlogreopen_write(const char *buf, size_t size, off_t offset);
+static int dbg_metricsize(struct pfuse_debug_driver *dd);
+static int dbg_metrics_read(char *buf, size_t size, off_t offset);
 
 static struct pfuse_debug_driver pfuse_dbgfiles[] = {
     { "debug",      dbg_sizer, Plfs::dbg_debug_read, NULL },
@@ -70,6 +72,7 @@ static struct pfuse_debug_driver pfuse_dbgfiles[] = {
     { "msgbuf",     dbg_msgbufsz, dbg_msgbuf_read, NULL },
     { "mlogmask",   dbg_mlogsize, dbg_mlogmask_read, dbg_mlogmask_write },
     { "mlogreopen", NULL, NULL, dbg_mlogreopen_write },
+    { "metrics",    dbg_metricsize, dbg_metrics_read, NULL },
 };
 
 // the reason we need this struct is because we want to know the original
@@ -89,8 +92,10 @@ struct OpenFile {
 // we need it because we want to track when an opendir handle is
 // seeked backwards.  In such a case we probably need to refetch the
 // directory contents.
+// the entries come with their attributes if the mount computes them,
+// see plfs_readdirplus and smallfile_readdirplus in plfsrc(5)
 typedef struct OpenDirStruct {
-    set<string> entries;
+    map<string, struct stat> entries;
     off_t last_offset;
 } OpenDir;
 
@@ -103,9 +108,10 @@ class generic_exception: public exception
 
 
 #ifdef FUSE_COLLECT_TIMES
-#define START_TIMES double begin, end; begin = plfs_wtime();
+#define START_TIMES double begin, end; begin = plfs_wtime(); \
+                    static const int stat_id = plfs_stat_id(__FUNCTION__);
 #define END_TIMES   end = plfs_wtime(); \
-                        plfs_stat_add( __FUNCTION__, end-begin, (ret<0) );
+                        plfs_stat_add( stat_id, end-begin, (ret<0) );
 #define START_MESSAGE \
        funct_id << setw(16) << fixed << setprecision(16)          \
         << begin << " PLFS::" << __FUNCTION__                 \
@@ -844,7 +850,8 @@ int Plfs::f_opendir( const char *path, struct fuse_file_info *fi )
     OpenDir *opendir = new OpenDir;
     opendir->last_offset = 0;
     fi->fh = (uint64_t)NULL;
-    plfs_error_t err = plfs_readdir(strPath.c_str(),(void *)(&(opendir->entries)));
+    plfs_error_t err = plfs_readdirplus(strPath.c_str(),
+                                        (void *)(&(opendir->entries)));
     if (err==PLFS_SUCCESS) {
         fi->fh = (uint64_t)opendir;
     } else {
@@ -876,21 +883,24 @@ int Plfs::f_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
         mlog(FUSE_DCOMMON, "Rereading dir %s",strPath.c_str());
         opendir->last_offset = offset;
         opendir->entries.clear();
-        err = plfs_readdir(strPath.c_str(),(void *)(&(opendir->entries)));
+        err = plfs_readdirplus(strPath.c_str(),(void *)(&(opendir->entries)));
     }
     // now iterate through for all entries so long as filler has room
     // only return entries that weren't previously returned (use offset)
     // plfs_readdir used to take a vector so we could use offset as random
     // access but w/ multiple backends, it's easy to use a set which
     // automatically collapses redundant entries
-    set<string>::iterator itr;
+    // an entry whose attributes are unknown (st_mode 0) is passed w/o them
+    map<string, struct stat>::iterator itr;
     int i =0;
     for(itr=opendir->entries.begin();
             ! EOD && err==PLFS_SUCCESS && itr!=opendir->entries.end(); itr++,i++) {
-        mlog(FUSE_DCOMMON, "Returning dirent %s", (*itr).c_str());
+        mlog(FUSE_DCOMMON, "Returning dirent %s", itr->first.c_str());
         opendir->last_offset=i;
         if ( i >= offset ) {
-            if ( 0 != filler(buf,(*itr).c_str(),NULL,i+1) ) {
+            const struct stat *stbuf =
+                itr->second.st_mode ? &(itr->second) : NULL;
+            if ( 0 != filler(buf,itr->first.c_str(),stbuf,i+1) ) {
                 mlog(FUSE_DCOMMON, "%s: filler is full",__FUNCTION__);
                 break;
             }
@@ -1232,6 +1242,184 @@ int Plfs::f_readn(const char *path, char *buf, size_t size, off_t offset,
     FUSE_PLFS_EXIT;
 }
 
+#if FUSE_VERSION >= 29
+/*
+ * staging buffers for f_write_buf.  when libfuse hands us fd/pipe
+ * buffers (splice_read) we have to gather them into memory before
+ * calling plfs_write.  keep a small free list of request-sized buffers
+ * so this doesn't malloc/free up to max_write bytes per request.
+ * read_buf memory can't come from here: libfuse frees it after replying.
+ */
+#define PFUSE_POOLBUFSZ (128*1024)   /* default FUSE max_write */
+#define PFUSE_POOLMAX   64           /* at most 8MB kept around */
+
+static vector<char *> pfuse_bufpool;
+static pthread_mutex_t pfuse_bufpool_mux = PTHREAD_MUTEX_INITIALIZER;
+
+static char *pfuse_getbuf(size_t size)
+{
+    char *buf = NULL;
+    if (size > PFUSE_POOLBUFSZ) {
+        return((char *)malloc(size));
+    }
+    pthread_mutex_lock(&pfuse_bufpool_mux);
+    if (!pfuse_bufpool.empty()) {
+        buf = pfuse_bufpool.back();
+        pfuse_bufpool.pop_back();
+    }
+    pthread_mutex_unlock(&pfuse_bufpool_mux);
+    if (buf == NULL) {
+        buf = (char *)malloc(PFUSE_POOLBUFSZ);
+    }
+    return(buf);
+}
+
+static void pfuse_putbuf(char *buf, size_t size)
+{
+    if (size <= PFUSE_POOLBUFSZ) {
+        pthread_mutex_lock(&pfuse_bufpool_mux);
+        if (pfuse_bufpool.size() < PFUSE_POOLMAX) {
+            pfuse_bufpool.push_back(buf);
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&pfuse_bufpool_mux);
+    }
+    free(buf);
+}
+
+static struct fuse_bufvec *pfuse_newbufvec(void)
+{
+    struct fuse_bufvec *bv;
+    bv = (struct fuse_bufvec *)malloc(sizeof(*bv));
+    if (bv != NULL) {
+        memset(bv, 0, sizeof(*bv));
+        bv->count = 1;
+        bv->buf[0].fd = -1;
+    }
+    return(bv);
+}
+
+// ask the kernel to take our read replies by splice when it can, so
+// fd-backed read_buf results never pass through user memory
+void *Plfs::f_init(struct fuse_conn_info *conn)
+{
+    conn->want |= (conn->capable &
+                   (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE));
+    return(fuse_get_context()->private_data);
+}
+
+// zero-copy read.  if PLFS can map the whole request onto one range of
+// a backing fd (flat files, container reads served by one dropping) we
+// return that fd and libfuse splices the data straight to the kernel.
+// otherwise (holes, reads spanning droppings) read into memory which
+// libfuse frees once it has replied.
+// returns 0 or -err
+int Plfs::f_read_buf(const char *path, struct fuse_bufvec **bufp,
+                     size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    // debug files are small and generated, just copy them
+    if (get_dbgdrv(path) != NULL) {
+        struct fuse_bufvec *dbv = pfuse_newbufvec();
+        int dret;
+        if (dbv == NULL || (dbv->buf[0].mem = malloc(size)) == NULL) {
+            free(dbv);
+            return(-ENOMEM);
+        }
+        dret = f_readn(path, (char *)dbv->buf[0].mem, size, offset, fi);
+        if (dret < 0) {
+            free(dbv->buf[0].mem);
+            free(dbv);
+            return(dret);
+        }
+        dbv->buf[0].size = dret;
+        *bufp = dbv;
+        return(0);
+    }
+    FUSE_PLFS_ENTER;
+    GET_OPEN_FILE;
+    plfs_error_t err;
+    struct fuse_bufvec *bv;
+    int fd;
+    off_t fdoff;
+    size_t len;
+    ssize_t bytes_read;
+    // calls plfs_sync to flush in-memory index.
+    if (of) {
+        plfs_sync( of );
+    }
+    syncIfOpen(strPath);
+    bv = pfuse_newbufvec();
+    if (bv == NULL) {
+        err = PLFS_ENOMEM;
+    } else {
+        err = plfs_read_fdextent( of, size, offset, &fd, &fdoff, &len );
+    }
+    if (err == PLFS_SUCCESS) {
+        bv->buf[0].size = len;
+        bv->buf[0].flags = (enum fuse_buf_flags)
+                           (FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+        bv->buf[0].fd = fd;
+        bv->buf[0].pos = fdoff;
+    } else if (err == PLFS_ENOTSUP) {
+        bv->buf[0].mem = malloc(size);
+        if (bv->buf[0].mem == NULL) {
+            err = PLFS_ENOMEM;
+        } else {
+            err = plfs_read( of, (char *)bv->buf[0].mem, size, offset,
+                             &bytes_read );
+            bv->buf[0].size = (err == PLFS_SUCCESS) ? bytes_read : 0;
+        }
+    }
+    if (err == PLFS_SUCCESS) {
+        *bufp = bv;
+    } else {
+        if (bv) {
+            free(bv->buf[0].mem);
+        }
+        free(bv);
+        ret = -(plfs_error_to_errno(err));
+    }
+    FUSE_PLFS_EXIT;
+}
+
+// a single memory buffer goes straight to f_write.  anything else
+// (pipe buffers from splice_read, multi-segment vectors) is gathered
+// into a pooled buffer first.
+// returns bytes written or -err
+int Plfs::f_write_buf(const char *path, struct fuse_bufvec *src,
+                      off_t offset, struct fuse_file_info *fi)
+{
+    size_t size = fuse_buf_size(src);
+    struct fuse_bufvec dst;
+    ssize_t copied;
+    char *buf;
+    int ret;
+
+    if (src->count == 1 && src->idx == 0 && src->off == 0 &&
+        !(src->buf[0].flags & FUSE_BUF_IS_FD)) {
+        return(f_write(path, (const char *)src->buf[0].mem, size,
+                       offset, fi));
+    }
+    buf = pfuse_getbuf(size);
+    if (buf == NULL) {
+        return(-ENOMEM);
+    }
+    memset(&dst, 0, sizeof(dst));
+    dst.count = 1;
+    dst.buf[0].size = size;
+    dst.buf[0].mem = buf;
+    dst.buf[0].fd = -1;
+    copied = fuse_buf_copy(&dst, src, (enum fuse_buf_copy_flags)0);
+    if (copied < 0) {
+        ret = (int)copied;
+    } else {
+        ret = f_write(path, buf, copied, offset, fi);
+    }
+    pfuse_putbuf(buf, size);
+    return(ret);
+}
+#endif
+
 // fd_mutex should be held when this is called
 string Plfs::openFilesToString(bool verbose)
 {
@@ -1601,6 +1789,38 @@ static int dbg_log_read(char *buf, size_t size, off_t offset)
     return validsize;
 }
 
+/*
+ * counters keep moving between getattr and read, so pad the reported
+ * size a bit; reads past the real end just come back short.
+ */
+#define DEBUGMETRICSLACK 1024
+
+/**
+ * dbg_metricsize: get the size of the metrics JSON
+ */
+static int dbg_metricsize(struct pfuse_debug_driver * /* dd */)
+{
+    string metrics;
+    plfs_metrics( &metrics );
+    return(metrics.size() + DEBUGMETRICSLACK);
+}
+
+/**
+ * dbg_metrics_read: read the counters/histograms as JSON
+ */
+static int dbg_metrics_read(char *buf, size_t size, off_t offset)
+{
+    string metrics;
+    size_t validsize;
+    plfs_metrics( &metrics );
+    if ( offset >= (off_t)metrics.size() ) {
+        return(0);
+    }
+    validsize = min(size, metrics.size() - (size_t)offset);
+    memcpy( buf, metrics.data() + offset, validsize );
+    return(validsize);
+}
+
 /**
  * dbg_msgbufsz: get the message buffer size
  */
@@ -45,6 +45,10 @@ class Plfs : public fusexx::fuse<Plfs>
         static int f_readlink (const char *, char *, size_t);
         static int f_readn(const char *, char *, size_t,
                            off_t, struct fuse_file_info *);
+#if FUSE_VERSION >= 29
+        static int f_read_buf(const char *, struct fuse_bufvec **, size_t,
+                              off_t, struct fuse_file_info *);
+#endif
         static int f_readdir (const char *, void *,
                               fuse_fill_dir_t, off_t, struct fuse_file_info *);
         static int f_release(const char *path, struct fuse_file_info *fi);
@@ -58,6 +62,11 @@ class Plfs : public fusexx::fuse<Plfs>
         static int f_utime (const char *path, struct utimbuf *ut);
         static int f_write (const char *, const char *, size_t,
                             off_t, struct fuse_file_info *);
+#if FUSE_VERSION >= 29
+        static int f_write_buf(const char *, struct fuse_bufvec *, off_t,
+                               struct fuse_file_info *);
+        static void *f_init(struct fuse_conn_info *conn);
+#endif
 
         // not overloaded.  something I added to parse command line args
         int init( int *argc, char **argv );
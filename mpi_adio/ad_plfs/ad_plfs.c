@@ -108,8 +108,8 @@ plfs_error_t plfs_getattr(Plfs_fd *fd, const char *path, struct stat *st, int si
     return PLFS_ENOSYS; /* never gets here */
 }
 
-size_t container_gethostdir_id(char *)  __attribute__ ((weak));
-size_t container_gethostdir_id(char *id)
+size_t container_gethostdir_id(char *, char *)  __attribute__ ((weak));
+size_t container_gethostdir_id(char *id, char *filename)
 {
     no_link_abort();
     return 1; /* never gets here */
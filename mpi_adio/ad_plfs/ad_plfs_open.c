@@ -241,8 +241,14 @@ void ADIOI_PLFS_Open(ADIO_File fd, int *error_code)
     }
     if (fd->access_mode & ADIO_CREATE) {
         //rather then call creat directly, call open w/ O_CREAT to avoid truncate
-        //of existing files
-        plfs_err = plfs_open(&pfd, fd->filename, amode|O_CREAT, rank, perm, NULL);
+        //of existing files.  everyone in the comm will write it, so size
+        //the hostdirs for that many writers
+        Plfs_open_opt open_opt;
+        memset(&open_opt, 0, sizeof(Plfs_open_opt));
+        open_opt.pinter = PLFS_MPIIO;
+        MPI_Comm_size(fd->comm, &open_opt.num_writers);
+        plfs_err = plfs_open(&pfd, fd->filename, amode|O_CREAT, rank, perm,
+                             &open_opt);
         if ( plfs_err != PLFS_SUCCESS ) {
             *error_code = MPIO_Err_create_code(MPI_SUCCESS, MPIR_ERR_RECOVERABLE,
                                               myname, __LINE__, MPI_ERR_IO,
@@ -327,7 +333,7 @@ int adplfs_open_helper(ADIO_File fd,Plfs_fd **pfd,int *error_code,int perm,
     if (write_mode) {
         char *hostname;
         plfs_gethostname(&hostname);
-        size_t color = container_gethostdir_id(hostname);
+        size_t color = container_gethostdir_id(hostname, fd->filename);
         err = MPI_Comm_split(fd->comm,color,rank,&hostdir_comm);
         if(err!=MPI_SUCCESS) {
             return err;
@@ -89,6 +89,7 @@ void ADIOI_PLFS_Resize(ADIO_File fd, ADIO_Offset size, int *error_code)
         open_opt.pinter = PLFS_MPIIO;
         open_opt.index_stream = NULL;
         open_opt.reopen = 1;
+        open_opt.num_writers = 0;
         open_opt.buffer_index = 0;
         if (flatten != -1) {
             open_opt.buffer_index = flatten;
@@ -111,6 +111,7 @@ fi
 %{_sbindir}/plfs_map
 %{_sbindir}/plfs_query
 %{_sbindir}/plfs_recover
+%{_sbindir}/plfs_compact
 %{_bindir}/plfs_check_config
 %{_bindir}/plfs_flatten_index
 %{_bindir}/plfs_ls
@@ -132,6 +133,7 @@ fi
 %{_mandir}/man1/plfs_flatten_index.1.gz
 %{_mandir}/man1/plfs_map.1.gz
 %{_mandir}/man1/plfs_recover.1.gz
+%{_mandir}/man1/plfs_compact.1.gz
 %{_mandir}/man1/plfs_query.1.gz
 %{_mandir}/man1/plfs_version.1.gz
 %{_mandir}/man1/plfs_ls.1.gz
@@ -0,0 +1,121 @@
+#include <string.h>
+#include <pthread.h>
+#include "Crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78U      /* reflected Castagnoli polynomial */
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static uint32_t crc32c_table[8][256];
+static bool crc32c_sse42;
+
+static void
+crc32c_init()
+{
+    uint32_t crc;
+    int i, j;
+
+    for (i = 0 ; i < 256 ; i++) {
+        crc = i;
+        for (j = 0 ; j < 8 ; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (i = 0 ; i < 256 ; i++) {
+        crc = crc32c_table[0][i];
+        for (j = 1 ; j < 8 ; j++) {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[j][i] = crc;
+        }
+    }
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    crc32c_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/* slicing-by-8: eight table lookups per 8 bytes */
+static uint32_t
+crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint32_t lo, hi;
+
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc32c_table[7][lo & 0xff] ^
+              crc32c_table[6][(lo >> 8) & 0xff] ^
+              crc32c_table[5][(lo >> 16) & 0xff] ^
+              crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xff] ^
+              crc32c_table[2][(hi >> 8) & 0xff] ^
+              crc32c_table[1][(hi >> 16) & 0xff] ^
+              crc32c_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return(crc);
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64, v;
+
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+        len--;
+    }
+    crc64 = crc;
+    while (len >= 8) {
+        memcpy(&v, p, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (len-- > 0) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    }
+    return(crc);
+}
+#endif
+
+uint32_t
+crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+
+    pthread_once(&crc32c_once, crc32c_init);
+    crc = ~crc;
+#if defined(__GNUC__) && defined(__x86_64__)
+    if (crc32c_sse42) {
+        return(~crc32c_hw(crc, p, len));
+    }
+#endif
+    return(~crc32c_sw(crc, p, len));
+}
+
+uint32_t
+crc32c_table8(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return(~crc32c_sw(~crc, (const unsigned char *)buf, len));
+}
+
+bool
+crc32c_hardware()
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return(crc32c_sse42);
+}
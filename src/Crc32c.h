@@ -0,0 +1,41 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Crc32c: the CRC32C (Castagnoli) checksum used for data droppings.
+ *
+ * the SSE4.2 crc32 instruction is used when the cpu has it, otherwise
+ * a slicing-by-8 table.  both give the same result.
+ */
+
+/**
+ * Update a CRC32C with more data, like zlib's crc32(): start with 0
+ * and pass the previous result to continue a checksum.
+ *
+ * @param crc the checksum of the data before buf (0 to start)
+ * @param buf the data
+ * @param len its length
+ * @return the checksum of all the data so far
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * crc32c() with the slicing-by-8 table, whatever the cpu has.  It is
+ * there so that the tests can check that both ways agree.
+ *
+ * @param crc the checksum of the data before buf (0 to start)
+ * @param buf the data
+ * @param len its length
+ * @return the checksum of all the data so far
+ */
+uint32_t crc32c_table8(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * @return true if crc32c() uses the cpu's crc32 instruction
+ */
+bool crc32c_hardware();
+
+#endif
@@ -163,7 +163,13 @@ TruncateOp::do_op(const char *path, unsigned char isfile, IOStore *store)
     }
     // we made it here, we don't ignore it
     // do we want to do an unlink or a truncate?
-    if (open_file) {
+    // a dropping with other links is shared with a clone (see plfs_clone),
+    // truncating it would take the data from the other file too.  no one
+    // has a shared dropping open for writing (files open for writing are
+    // not cloned, and later opens write new droppings), so we can unlink it
+    struct stat st;
+    if (open_file && (store->Lstat(path, &st) != PLFS_SUCCESS ||
+                      st.st_nlink < 2)) {
         return store->Truncate(path,0);
     } else {
         return store->Unlink(path);
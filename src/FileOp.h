@@ -86,6 +86,7 @@ class
 
 // this class is used to truncate to 0
 // if the file is open, it truncates each physical file to 0
+// (but unlinks the ones shared with a clone)
 // if the file is closed, it unlinks all physical files
 // the caller should tell it to ignore special files
 class
@@ -43,6 +43,11 @@ class IOStore {
     virtual plfs_error_t Truncate (const char *bpath, off_t length)=0;
     virtual plfs_error_t Unlink(const char *bpath)=0;
     virtual plfs_error_t Utime(const char *bpath, const struct utimbuf *times)=0;
+    /* hard link, only for stores that have them (see plfs_clone) */
+    virtual plfs_error_t Link(const char * /* bpath1 */,
+                              const char * /* bpath2 */) {
+        return(PLFS_ENOTSUP);
+    }
     virtual ~IOStore() { }
 
     /* two simple compat APIs that can be inlined by the compiler */
@@ -69,6 +74,8 @@ class IOSHandle {
     virtual plfs_error_t Fsync(void)=0;
     virtual plfs_error_t Ftruncate(off_t length)=0;
     virtual plfs_error_t GetDataBuf(void **bufp, size_t length)=0;
+    /* optional: expose the kernel fd for zero-copy (splice) readers */
+    virtual plfs_error_t GetFd(int * /* fdp */) { return(PLFS_ENOTSUP); }
     virtual plfs_error_t Pread(void *buf, size_t nbytes, off_t offset, ssize_t *bytes_read)=0;
     virtual plfs_error_t Pwrite(const void *buf, size_t nbytes, off_t offset, ssize_t *bytes_written)=0;
     virtual plfs_error_t Read(void *buf, size_t offset, ssize_t *bytes_read)=0;
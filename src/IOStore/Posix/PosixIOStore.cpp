@@ -86,6 +86,12 @@ PosixIOSHandle::GetDataBuf(void **bufp, size_t length) {
     return(get_err(ret));
 }
 
+plfs_error_t
+PosixIOSHandle::GetFd(int *fdp) {
+    *fdp = this->fd;
+    return(PLFS_SUCCESS);
+}
+
 plfs_error_t
 PosixIOSHandle::Pread(void* buf, size_t count, off_t offset, ssize_t *bytes_read) {
     POSIX_IO_ENTER(this->bpath.c_str());
@@ -352,3 +358,12 @@ PosixIOStore::Utime(const char* path, const struct utimbuf *times) {
     POSIX_IO_EXIT(path,rv);
     return(get_err(rv));
 }
+
+plfs_error_t
+PosixIOStore::Link(const char* oldpath, const char* newpath) {
+    POSIX_IO_ENTER(oldpath);
+    int rv;
+    rv = link(oldpath, newpath);
+    POSIX_IO_EXIT(oldpath,rv);
+    return(get_err(rv));
+}
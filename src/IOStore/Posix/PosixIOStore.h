@@ -17,6 +17,7 @@ class PosixIOSHandle: public IOSHandle {
     plfs_error_t Fsync();
     plfs_error_t Ftruncate(off_t length);
     plfs_error_t GetDataBuf(void **bufp, size_t length);
+    plfs_error_t GetFd(int *fdp);
     plfs_error_t Pread(void* buf, size_t count, off_t offset, ssize_t *bytes_read);
     plfs_error_t Pwrite(const void* buf, size_t count, off_t offset,
                         ssize_t *bytes_written);
@@ -66,6 +67,7 @@ public:
     plfs_error_t Truncate(const char*, off_t);
     plfs_error_t Unlink(const char*);
     plfs_error_t Utime(const char*, const utimbuf*);
+    plfs_error_t Link(const char*, const char*);
 };
 
 
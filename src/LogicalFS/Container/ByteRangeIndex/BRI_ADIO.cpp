@@ -568,7 +568,12 @@ ByteRangeIndex::index_stream(Container_OpenFile **pfd, char **buffer,
      * where we lock the index outside of ByteRangeIndex.cpp).
      */
     Util::MutexLock(&idx->bri_mutex, __FUNCTION__);
-    ret = idx->global_to_stream((void **) buffer, &length);
+    ret = idx->lazy_load(*pfd);
+    if (ret == PLFS_SUCCESS) {
+        ret = idx->global_to_stream((void **) buffer, &length);
+    } else {
+        length = 0;
+    }
     Util::MutexUnlock(&idx->bri_mutex, __FUNCTION__);
 
     mlog(INT_DAPI, "BRI::index_stream global to stream has size %lu ret=%d",
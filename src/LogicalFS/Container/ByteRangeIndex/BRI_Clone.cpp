@@ -0,0 +1,273 @@
+/*
+ * BRI_Clone.cpp  byte-range index droppings for plfs_clone
+ */
+
+#include <math.h>
+#include <float.h>
+
+#include "plfs_private.h"
+#include "Container.h"
+#include "ContainerIndex.h"
+#include "ContainerOpenFile.h"
+#include "ByteRangeIndex.h"
+#include "Metrics.h"
+#include "container_checksum.h"
+
+/*
+ * a clone is a normal container.  each data dropping of the source
+ * that its index still uses is hard linked into a hostdir of the
+ * clone on the same backend, and a new index dropping next to it gets
+ * the source's (flattened) index entries for it.  the link count of
+ * the dropping on the backend counts the files using it, so either
+ * file can be unlinked without the other noticing.
+ *
+ * a dropping is only appended to by the open that created it (each
+ * open names its droppings with its own timestamp), and a file that is
+ * open for writing is not cloned (see ContainerFileSystem::clone).  so
+ * the droppings we share are never written again, and later writes to
+ * either file go to new droppings of that file (copy-on-write).  the
+ * one other place a dropping is changed in place is a truncate to zero
+ * of an open file: TruncateOp unlinks shared droppings instead, which
+ * is safe because no one has them open for writing.
+ */
+
+/**
+ * clone_dropping: link a dropping into a hostdir of the clone.  if
+ * the backend can't link it we copy it.
+ *
+ * @param from bpath of the dropping
+ * @param fromback its backend
+ * @param to bpath of the dropping in the clone
+ * @param toback its backend
+ * @return PLFS_SUCCESS or error code
+ */
+static plfs_error_t
+clone_dropping(const string& from, struct plfs_backend *fromback,
+               const string& to, struct plfs_backend *toback)
+{
+    plfs_error_t ret = PLFS_EXDEV;
+
+    if (fromback == toback) {
+        ret = toback->store->Link(from.c_str(), to.c_str());
+    }
+    if (ret == PLFS_ENOTSUP || ret == PLFS_EXDEV) {
+        mlog(IDX_DRARE, "%s: cannot link %s, copying it", __FUNCTION__,
+             from.c_str());
+        ret = Util::CopyFile(from.c_str(), fromback->store, to.c_str(),
+                             toback->store);
+        if (ret == PLFS_SUCCESS) {
+            Metrics::add(PM_CLONE_COPIES, 1);
+        }
+    } else if (ret == PLFS_SUCCESS) {
+        Metrics::add(PM_CLONE_LINKS, 1);
+    }
+    return(ret);
+}
+
+/**
+ * clone_writeindex: write a new index dropping for the clone
+ *
+ * @param ipath bpath of the index dropping
+ * @param iback its backend
+ * @param ents the records to put in it
+ * @return PLFS_SUCCESS or error code
+ */
+static plfs_error_t
+clone_writeindex(const string& ipath, struct plfs_backend *iback,
+                 vector<HostEntry> &ents)
+{
+    plfs_error_t ret, rv;
+    IOSHandle *fh;
+    ssize_t x;
+
+    ret = iback->store->Open(ipath.c_str(), O_WRONLY|O_CREAT|O_EXCL,
+                             DROPPING_MODE, &fh);
+    if (ret != PLFS_SUCCESS) {
+        mlog(IDX_DRARE, "%s: open %s: %s", __FUNCTION__, ipath.c_str(),
+             strplfserr(ret));
+        return(ret);
+    }
+    ret = Util::Writen(&ents.front(), ents.size() * sizeof(HostEntry),
+                       fh, &x);
+    rv = iback->store->Close(fh);
+    if (ret == PLFS_SUCCESS) {
+        ret = rv;
+    }
+    return(ret);
+}
+
+/**
+ * ByteRangeIndex::index_droppings_clone: make the droppings of a clone
+ * of a file we have open.  the clone's container has been created
+ * already (and is empty).
+ *
+ * @param cof the open file to clone
+ * @param dst path info for the clone
+ * @param lastoffp the size of the file is placed here
+ * @param tbytesp the number of bytes in the clone is placed here
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+ByteRangeIndex::index_droppings_clone(Container_OpenFile *cof,
+                                      struct plfs_physpathinfo *dst,
+                                      off_t *lastoffp, size_t *tbytesp) {
+    plfs_error_t ret;
+    map<pid_t, multimap<double,HostEntry> > chunks; /* chunk# -> records */
+    map<pid_t, multimap<double,HostEntry> >::iterator citr;
+    multimap<double,HostEntry>::iterator eitr;
+    map<off_t,ContainerEntry>::iterator itr;
+    map<struct plfs_backend *, struct plfs_pathback> hostdirs;
+    struct plfs_pathback hostdir;
+    map<string, pid_t> byname;
+    vector<pid_t> alias;
+    vector<HostEntry> ents;
+    HostEntry htmp, eofent;
+    ContainerEntry *ent;
+    string name, rest;
+    size_t lcv, slash;
+    double now, last;
+    pid_t pid;
+    char *host;
+
+    Util::MutexLock(&this->bri_mutex, __FUNCTION__);
+
+    ret = this->lazy_load(cof);
+    if (ret != PLFS_SUCCESS) {
+        Util::MutexUnlock(&this->bri_mutex, __FUNCTION__);
+        return(ret);
+    }
+
+    /* group the records by data dropping */
+    for (lcv = 0 ; lcv < this->chunk_map.size() ; lcv++) {
+        alias.push_back(byname.insert(make_pair(this->chunk_map[lcv].bpath,
+                                                lcv)).first->second);
+    }
+    *tbytesp = 0;
+    lcv = 0;
+    itr = this->idx.begin();
+    while (1) {
+        if (this->shared != NULL && lcv < this->shared_nents) {
+            ent = &this->shared_ents[lcv++];
+        } else if (this->shared == NULL && itr != this->idx.end()) {
+            ent = &itr->second;
+            itr++;
+        } else {
+            break;
+        }
+        htmp.logical_offset = ent->logical_offset;
+        htmp.physical_offset = ent->physical_offset;
+        htmp.length = ent->length;
+        htmp.begin_timestamp = ent->begin_timestamp;
+        htmp.end_timestamp = ent->end_timestamp;
+        chunks[alias[ent->id]].insert(make_pair(htmp.begin_timestamp, htmp));
+        *tbytesp += ent->length;
+    }
+    *lastoffp = this->eof_tracker;
+
+    /*
+     * a zero length record at EOF keeps the size of the file if it
+     * ends in a hole.  it goes in the first index dropping we write.
+     */
+    now = Util::getTime();
+    eofent.logical_offset = this->eof_tracker;
+    eofent.physical_offset = 0;
+    eofent.length = 0;
+    eofent.begin_timestamp = eofent.end_timestamp = now;
+
+    for (citr = chunks.begin() ; citr != chunks.end() ; citr++) {
+        ChunkFile &cf = this->chunk_map[citr->first];
+
+        slash = cf.bpath.rfind('/');
+        name = cf.bpath.substr(slash + 1);
+        if (slash == string::npos ||
+            name.compare(0, sizeof(DATAPREFIX) - 1, DATAPREFIX) != 0) {
+            mlog(IDX_CRIT, "%s: bad chunk path %s", __FUNCTION__,
+                 cf.bpath.c_str());
+            ret = PLFS_EINVAL;
+            break;
+        }
+        rest = name.substr(sizeof(DATAPREFIX) - 1);   /* SEC.USEC.HOST.PID */
+        pid = atoi(rest.substr(rest.rfind('.') + 1).c_str());
+
+        if (hostdirs.find(cf.backend) == hostdirs.end()) {
+            ret = Container::establish_clonehostdir(dst->canbpath,
+                                                    dst->canback, cf.backend,
+                                                    hostdir.bpath,
+                                                    &hostdir.back);
+            if (ret != PLFS_SUCCESS) {
+                break;
+            }
+            hostdirs[cf.backend] = hostdir;
+        }
+        hostdir = hostdirs[cf.backend];
+
+        ret = clone_dropping(cf.bpath, cf.backend,
+                             hostdir.bpath + "/" + name, hostdir.back);
+        if (ret == PLFS_SUCCESS &&
+            cf.backend->store->Access(sum_dropping_path(cf.bpath).c_str(),
+                                      F_OK) == PLFS_SUCCESS) {
+            ret = clone_dropping(sum_dropping_path(cf.bpath), cf.backend,
+                                 hostdir.bpath + "/" + SUMPREFIX + rest,
+                                 hostdir.back);
+        }
+        if (ret != PLFS_SUCCESS) {
+            break;
+        }
+
+        /*
+         * the pieces of a write that was split by later overwrites
+         * share its timestamps.  rewriting an index dropping (see
+         * trunc_writemap) needs them unique, so space them apart.
+         */
+        ents.clear();
+        last = -DBL_MAX;
+        for (eitr = citr->second.begin() ; eitr != citr->second.end() ;
+             eitr++) {
+            HostEntry hent(eitr->second);
+            hent.id = pid;
+            if (hent.begin_timestamp <= last) {
+                hent.begin_timestamp = nextafter(last, DBL_MAX);
+                hent.end_timestamp = max(hent.end_timestamp,
+                                         hent.begin_timestamp);
+            }
+            last = hent.begin_timestamp;
+            ents.push_back(hent);
+        }
+        if (citr == chunks.begin()) {
+            eofent.id = pid;
+            ents.push_back(eofent);
+        }
+        ret = clone_writeindex(hostdir.bpath + "/" + INDEXPREFIX + rest,
+                               hostdir.back, ents);
+        if (ret != PLFS_SUCCESS) {
+            break;
+        }
+    }
+
+    /* no data at all, the EOF record gets an index dropping of its own */
+    if (ret == PLFS_SUCCESS && chunks.empty() && this->eof_tracker > 0) {
+        ostringstream ipath;
+
+        ret = Container::establish_clonehostdir(dst->canbpath, dst->canback,
+                                                dst->canback, hostdir.bpath,
+                                                &hostdir.back);
+        if (ret == PLFS_SUCCESS) {
+            ret = Util::hostname(&host);
+        }
+        if (ret == PLFS_SUCCESS) {
+            ipath.setf(ios::fixed,ios::floatfield);
+            ipath << hostdir.bpath << "/" << INDEXPREFIX << now << "."
+                  << host << "." << getpid();
+            eofent.id = getpid();
+            ents.assign(1, eofent);
+            ret = clone_writeindex(ipath.str(), hostdir.back, ents);
+        }
+    }
+
+    Util::MutexUnlock(&this->bri_mutex, __FUNCTION__);
+
+    mlog(IDX_DAPI, "%s: %s -> %s, %lu droppings: %s", __FUNCTION__,
+         cof->pathcpy.canbpath.c_str(), dst->canbpath.c_str(),
+         (unsigned long)chunks.size(), strplfserr(ret));
+    return(ret);
+}
@@ -81,10 +81,10 @@ HostEntry::overlap(const HostEntry& other)
 bool
 HostEntry::follows( const HostEntry& other )
 {
-    return(other.logical_offset + other.length ==
-                                   (unsigned int)this->logical_offset && 
-           other.physical_offset + other.length ==
-                                   (unsigned int)this->physical_offset &&
+    return(other.logical_offset + (off_t)other.length ==
+                                   this->logical_offset &&
+           other.physical_offset + (off_t)other.length ==
+                                   this->physical_offset &&
            other.id == this->id);
 }
 
@@ -92,10 +92,10 @@ HostEntry::follows( const HostEntry& other )
 bool
 HostEntry::preceeds( const HostEntry& other )
 {
-    return(this->logical_offset + this->length ==
-                                   (unsigned int)other.logical_offset &&
-           this->physical_offset + this->length ==
-                                    (unsigned int)other.physical_offset &&
+    return(this->logical_offset + (off_t)this->length ==
+                                   other.logical_offset &&
+           this->physical_offset + (off_t)this->length ==
+                                    other.physical_offset &&
            this->id == other.id);
 }
 
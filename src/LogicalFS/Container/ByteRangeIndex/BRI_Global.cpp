@@ -52,7 +52,22 @@ plfs_error_t ByteRangeIndex::global_from_stream(void *addr) {
     addr = (void *)&(entries[quant]);
     mlog(IDX_DCOMMON, "%s of %p now parsing data chunk paths",
          __FUNCTION__,this);
-    
+
+    ret = this->chunks_from_stream((char *)addr);
+    return(ret);
+}
+
+/**
+ * ByteRangeIndex::chunks_from_stream: load chunk_map from the chunk
+ * paths at the end of a global index stream (or a shared index image).
+ *
+ * @param paths the newline separated, null terminated chunk paths
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t ByteRangeIndex::chunks_from_stream(char *paths) {
+    plfs_error_t ret = PLFS_SUCCESS;
+    void *addr = paths;
+
     vector<string> chunk_paths;
     Util::tokenize((char *)addr,"\n",chunk_paths); /* inefficient... */
 
@@ -133,7 +148,7 @@ ByteRangeIndex::global_to_stream(void **buffer, size_t *length)
     char *ptr;
     map<off_t,ContainerEntry>::iterator itr;
     
-    quant = this->idx.size();
+    quant = (this->shared != NULL) ? this->shared_nents : this->idx.size();
 
     /*
      * first build vector of chunk paths.  we used to optimize a bit by
@@ -174,6 +189,11 @@ ByteRangeIndex::global_to_stream(void **buffer, size_t *length)
 
         /* copy in each container entry */
         centry_length = sizeof(ContainerEntry);
+        if (this->shared != NULL) {
+            /* a shared image is already in stream order */
+            ptr = memcpy_helper(ptr, this->shared_ents,
+                                quant * centry_length);
+        }
         for( itr = this->idx.begin(); itr != this->idx.end(); itr++ ) {
             void *start = &(itr->second);
             ptr = memcpy_helper(ptr, start, centry_length);
@@ -5,6 +5,7 @@
 #include "plfs_private.h"
 #include "ContainerIndex.h"
 #include "ByteRangeIndex.h"
+#include "Metrics.h"
 
 #include "Container.h"
 
@@ -149,6 +150,7 @@ ByteRangeIndex::populateIndex(const string& path, struct plfs_backend *canback,
     plfs_error_t ret = PLFS_SUCCESS;
     IOSHandle *idx_fh = NULL;
     string global_path;
+    double begin = Util::getTime();
 
     mlog(IDX_DAPI, "%s on %s %s attempt to use flattened index",
          __FUNCTION__, path.c_str(), (use_global?"will":"will not"));
@@ -193,6 +195,18 @@ ByteRangeIndex::populateIndex(const string& path, struct plfs_backend *canback,
         ret = ByteRangeIndex::aggregateIndices(path, canback, bri,
                                                uniform_restart, uniform_rank);
     }
-    
+
+    /* cut back whatever was written before a later truncate */
+    if (ret == PLFS_SUCCESS) {
+        vector<TruncRecord> tlog;
+        ret = ByteRangeIndex::trunc_log_read(path, canback, tlog);
+        ByteRangeIndex::trunc_apply(bri->idx, &bri->eof_tracker, tlog);
+    }
+
+    if (ret == PLFS_SUCCESS) {
+        Metrics::add(PM_INDEX_LOADS, 1);
+        Metrics::add(PM_INDEX_EXTENTS, bri->idx.size());
+        Metrics::time(PMH_INDEX_LOAD, Util::getTime() - begin);
+    }
     return(ret);
 }
@@ -111,40 +111,54 @@ ByteRangeIndex::query_helper(Container_OpenFile *cof, off_t input_offset,
 }
 
 /*
- * ByteRangeIndex::query_helper_getrec: get a single record for a
- * given offset
+ * the entries of a shared index image (see BRI_Shared.cpp) are a
+ * sorted array rather than a map.  query_helper_walk() takes either
+ * kind of iterator and gets at the entry with query_entry().
+ */
+static inline ContainerEntry &
+query_entry(map<off_t,ContainerEntry>::iterator itr) {
+    return(itr->second);
+}
+
+static inline ContainerEntry &
+query_entry(ContainerEntry *itr) {
+    return(*itr);
+}
+
+/**
+ * ByteRangeIndex::entry_before: lower_bound() comparison for a
+ * shared index image.
  *
- * @param cof the open file (in case we want to print a filename)
+ * @param ent the entry to compare
+ * @param ptr the offset we are looking for
+ * @return true if ent starts before ptr
+ */
+bool
+ByteRangeIndex::entry_before(const ContainerEntry &ent, off_t ptr) {
+    return(ent.logical_offset < ptr);
+}
+
+/*
+ * ByteRangeIndex::query_helper_walk: fill in the record for ptr
+ * given the result of the stab query.
+ *
+ * @param begin the first entry of the index
+ * @param end the end marker of the index
+ * @param qitr the first entry at or after ptr (may be end)
  * @param ptr starting offset of query
  * @param len length of query
  * @param irp ptr to where the results should go
- * @return PLFS_SUCCESS or error code
  */
-plfs_error_t
-ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
-                                    size_t len, index_record *irp) {
+template <class QItr> void
+ByteRangeIndex::query_helper_walk(QItr begin, QItr end, QItr qitr, off_t ptr,
+                                  size_t len, index_record *irp) {
 
-    map<off_t,ContainerEntry>::iterator qitr, next, prev;
-
-    /*
-     * if the index is empty, treat it like /dev/null and signal EOF
-     */
-    if (this->idx.size() == 0) {
-        irp->length = 0;
-        return(PLFS_SUCCESS);
-    }
-
-    /*
-     * do a stab query at the given offset.  if we get a hit, qitr
-     * will point at the entry matching the offset.  otherwise, we
-     * get the first entry after "ptr" (which may be end()).
-     */
-    qitr = this->idx.lower_bound(ptr);
+    QItr next, prev;
 
     /*
      * case 1: direct hit on "ptr" in this->idx
      */
-    if (qitr != this->idx.end() && ptr == qitr->second.logical_offset) {
+    if (qitr != end && ptr == query_entry(qitr).logical_offset) {
 
         next = qitr;   /* next is entry past the direct hit */
         next++;
@@ -154,9 +168,9 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
          * in a hole or at EOF (e.g. for a file that has been extended
          * with a truncate operation).
          */
-        if (qitr->second.length == 0) {
+        if (query_entry(qitr).length == 0) {
 
-            if (next == this->idx.end()) {
+            if (next == end) {
 
                 irp->length = 0;         /* our entry is an EOF marker */
                 irp->lastrecord = true;  /* just to doc it */
@@ -165,7 +179,7 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
 
                 /* in a hole, scoot forward to next record */
                 irp->length = min((off_t)len,
-                                  next->second.logical_offset - ptr);
+                                  query_entry(next).logical_offset - ptr);
                 irp->lastrecord = false;
 
             }
@@ -178,13 +192,13 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
 
         } else {   /* case 1b: direct hit on non-zero length entry */
 
-            irp->length = min(len, qitr->second.length);
-            this->query_helper_load_irec(ptr, irp, qitr,
-                                         next == this->idx.end());
+            irp->length = min(len, query_entry(qitr).length);
+            this->query_helper_load_irec(ptr, irp, query_entry(qitr),
+                                         next == end);
 
         }
         
-        return(PLFS_SUCCESS);    /* end of case 1 */
+        return;    /* end of case 1 */
     }
     
     /*
@@ -194,16 +208,17 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
      */
 
     /* case 2a: hole at beginning of file */
-    if (qitr == this->idx.begin()) {
+    if (qitr == begin) {
 
-        irp->length = min((off_t)len, qitr->second.logical_offset - ptr);
+        irp->length = min((off_t)len,
+                          query_entry(qitr).logical_offset - ptr);
         irp->hole = true;
         irp->lastrecord = false;
         /* init the rest, just to be safe */
         irp->datapath = "";
         irp->databack = NULL;
         irp->chunk_offset = 0;
-        return(PLFS_SUCCESS);
+        return;
     }
 
     /* dig out previous entry */
@@ -211,13 +226,15 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
     prev--;
 
     /* case 2b: we are in the previous entry */
-    if (ptr < prev->second.logical_offset + (off_t)prev->second.length) {
+    if (ptr < query_entry(prev).logical_offset +
+        (off_t)query_entry(prev).length) {
 
-        irp->length = min(len, (prev->second.logical_offset +
-                                prev->second.length) - ptr);
-        this->query_helper_load_irec(ptr, irp, prev, qitr == this->idx.end());
+        irp->length = min(len, (query_entry(prev).logical_offset +
+                                query_entry(prev).length) - ptr);
+        this->query_helper_load_irec(ptr, irp, query_entry(prev),
+                                    qitr == end);
         
-        return(PLFS_SUCCESS);
+        return;
     }
 
     /*
@@ -225,7 +242,7 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
      * either be at or past EOF, or in a hole between the previous
      * entry and the next one.
      */
-    if (qitr == this->idx.end()) {
+    if (qitr == end) {
 
         irp->length = 0;    /* at or past EOF */
         irp->lastrecord = true;  /* just to doc it */
@@ -233,7 +250,8 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
     } else {
 
         /* in an in-between hole */
-        irp->length = min((off_t)len, qitr->second.logical_offset - ptr);
+        irp->length = min((off_t)len,
+                          query_entry(qitr).logical_offset - ptr);
         irp->hole = true;
         irp->lastrecord = false;
         /* init the rest, just to be safe */
@@ -242,7 +260,51 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
         irp->chunk_offset = 0;
 
     }
-    
+}
+
+/*
+ * ByteRangeIndex::query_helper_getrec: get a single record for a
+ * given offset
+ *
+ * @param cof the open file (in case we want to print a filename)
+ * @param ptr starting offset of query
+ * @param len length of query
+ * @param irp ptr to where the results should go
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
+                                    size_t len, index_record *irp) {
+
+    ContainerEntry *sbegin, *send;
+
+    /*
+     * if the index is empty, treat it like /dev/null and signal EOF
+     */
+    if ((this->shared == NULL && this->idx.size() == 0) ||
+        (this->shared != NULL && this->shared_nents == 0)) {
+        irp->length = 0;
+        return(PLFS_SUCCESS);
+    }
+
+    /*
+     * do a stab query at the given offset.  if we get a hit, the
+     * iterator will point at the entry matching the offset.
+     * otherwise, we get the first entry after "ptr" (which may be
+     * end()).
+     */
+    if (this->shared != NULL) {
+        sbegin = this->shared_ents;
+        send = sbegin + this->shared_nents;
+        this->query_helper_walk(sbegin, send,
+                                lower_bound(sbegin, send, ptr,
+                                            ByteRangeIndex::entry_before),
+                                ptr, len, irp);
+    } else {
+        this->query_helper_walk(this->idx.begin(), this->idx.end(),
+                                this->idx.lower_bound(ptr), ptr, len, irp);
+    }
+
     return(PLFS_SUCCESS);
 }
 
@@ -254,18 +316,19 @@ ByteRangeIndex::query_helper_getrec(Container_OpenFile * /* cof */, off_t ptr,
  *
  * @param ptr the offset we are currently at
  * @param irp the index_record we are loading
- * @param qitr iterator ptr to the ContainerEntry we are loading from
+ * @param ent the ContainerEntry we are loading from
+ * @param at_end true if ent is the last entry of the index
  */
 void
 ByteRangeIndex::query_helper_load_irec(off_t ptr, index_record *irp,
-                            map<off_t,ContainerEntry>::iterator qitr,
+                                       const ContainerEntry &ent,
                                        bool at_end) {
 
     off_t my_offset;
     pid_t my_chunk;
 
-    my_offset = ptr - qitr->second.logical_offset;   /* from ent start */
-    my_chunk = qitr->second.id;    /* get my chunk id */
+    my_offset = ptr - ent.logical_offset;   /* from ent start */
+    my_chunk = ent.id;    /* get my chunk id */
 
     /* should never happen, but check anyway */
     if (my_chunk < 0 || (unsigned)my_chunk >= this->chunk_map.size()) {
@@ -273,10 +336,10 @@ ByteRangeIndex::query_helper_load_irec(off_t ptr, index_record *irp,
         assert(0);
     }
 
-    irp->hole = false;
+    irp->hole = (ent.physical_offset & ZERO_OFFSET_FLAG) != 0;
     irp->datapath = this->chunk_map[my_chunk].bpath;/* c++ string malloc/copy*/
     irp->databack = this->chunk_map[my_chunk].backend;
-    irp->chunk_offset = qitr->second.physical_offset + my_offset;
+    irp->chunk_offset = ent.physical_offset + my_offset;
     irp->lastrecord = (at_end &&
-                       irp->length + my_offset == qitr->second.length);
+                       irp->length + my_offset == ent.length);
 }
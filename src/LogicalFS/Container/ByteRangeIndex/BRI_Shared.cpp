@@ -0,0 +1,353 @@
+/*
+ * BRI_Shared.cpp  byte-range index shared by the readers on a node
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "plfs_private.h"
+#include "Container.h"
+#include "ContainerIndex.h"
+#include "ContainerOpenFile.h"
+#include "ByteRangeIndex.h"
+#include "FileOp.h"
+#include "Metrics.h"
+
+/*
+ * with the shared_index mount option, a container opened O_RDONLY by
+ * many processes on one node (e.g. all the ranks of a restart without
+ * MPI) is only read and merged by the first of them.  it builds the
+ * global index and writes it to an image in POSIX shared memory.  the
+ * other processes map the image and query its entries in place (see
+ * query_helper_getrec) without ever changing them, so the node holds
+ * one copy of the index no matter how many readers it has.
+ *
+ * image format: <BRISharedImage> [ContainerEntry list] [chunk paths]
+ *
+ * the entries and chunk paths are the same as in a global index
+ * stream (see BRI_Global.cpp): the entries are sorted by logical
+ * offset and do not overlap, and the chunk paths are full physical
+ * paths, so nothing in the image depends on where it is mapped.
+ *
+ * the image is named after the container and its metadir.  every
+ * writer that closes the container adds a meta dropping to the metadir
+ * (and truncate renames them), so a new image is built once the
+ * container has changed.  containers that are open for writing are
+ * never shared.  the last process to detach removes the image.
+ *
+ * images of processes that die while attached are left behind in
+ * /dev/shm until they are removed by hand.
+ */
+
+#define BRI_SHARED_MAGIC    0x49524253   /* "SBRI" */
+#define BRI_SHARED_VERSION  1
+#define BRI_SHARED_WAIT     300          /* secs to wait for a builder */
+#define BRI_SHARED_TRIES    3            /* to get around unlink races */
+
+#define BRI_SHARED_BUILDING 0            /* the initial zero fill */
+#define BRI_SHARED_READY    1
+#define BRI_SHARED_FAILED   2            /* builder failed, don't wait */
+
+struct BRISharedImage {
+    uint32_t magic;
+    uint32_t version;
+    volatile int32_t state;   /* BRI_SHARED_* */
+    int32_t refs;             /* attached processes (atomic ops only) */
+    off_t eof;                /* eof_tracker of the index */
+    off_t backing_bytes;      /* backing_bytes of the index */
+    uint64_t nentries;        /* number of ContainerEntry records */
+    uint64_t paths_len;       /* chunk paths, including the null */
+};
+
+/**
+ * shared_image_name: generate the shm_open() name of the image of a
+ * container.
+ *
+ * @param ppip the container
+ * @param name the resulting name
+ * @return PLFS_SUCCESS, or an error if the container should not be shared
+ */
+static plfs_error_t
+shared_image_name(struct plfs_physpathinfo *ppip, string &name) {
+    plfs_error_t ret;
+    string metadir, fullpath, listing;
+    struct stat st;
+    set<string> entries;
+    set<string>::iterator itr;
+    ostringstream oss;
+    time_t now = time(NULL);
+
+    metadir = Container::getMetaDirPath(ppip->canbpath);
+    ret = ppip->canback->store->Lstat(metadir.c_str(), &st);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+
+    ReaddirOp rop(NULL, &entries, false, true);
+    ret = rop.op(metadir.c_str(), DT_DIR, ppip->canback->store);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    for (itr = entries.begin() ; itr != entries.end() ; itr++) {
+        if (Container::liveOpenrecord(*itr, now, NULL)) {
+            return(PLFS_EBUSY);   /* being written, may still change */
+        }
+        listing += *itr + "/";
+    }
+
+    fullpath = string(ppip->canback->prefix) + ppip->canbpath;
+    oss << hex << "/plfs.bri." << Util::hashValue(fullpath.c_str()) << "."
+        << (unsigned long)st.st_ino << "." << (unsigned long)st.st_mtime
+        << "." << Util::hashValue(listing.c_str());
+    name = oss.str();
+    return(PLFS_SUCCESS);
+}
+
+/**
+ * ByteRangeIndex::shared_open: load the index of a container opened
+ * O_RDONLY through a shared image, building the image if we are the
+ * first.  anything that keeps us from sharing it (e.g. the container
+ * is open for writing or /dev/shm is full) makes us fall back to
+ * a private index.
+ *
+ * @param cof the open file
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+ByteRangeIndex::shared_open(Container_OpenFile *cof) {
+    plfs_error_t ret;
+    string name;
+    int fd, tries;
+
+    ret = shared_image_name(&cof->pathcpy, name);
+
+    for (tries = 0 ; ret == PLFS_SUCCESS && tries < BRI_SHARED_TRIES ;
+         tries++) {
+
+        fd = shm_open(name.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+        if (fd >= 0) {
+            this->shared_name = name;
+            return(this->shared_build(cof, fd));   /* closes fd */
+        }
+        if (errno != EEXIST) {
+            ret = errno_to_plfs_error(errno);
+            break;
+        }
+
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                continue;   /* removed by its last user, try again */
+            }
+            ret = errno_to_plfs_error(errno);
+            break;
+        }
+        this->shared_name = name;
+        ret = this->shared_attach(fd);   /* closes fd */
+        if (ret != PLFS_EAGAIN) {
+            break;
+        }
+        ret = PLFS_SUCCESS;   /* it is going away, try again */
+    }
+
+    if (ret == PLFS_SUCCESS && this->shared != NULL) {
+        Metrics::add(PM_INDEX_SHARED_ATTACHES, 1);
+        return(PLFS_SUCCESS);
+    }
+
+    mlog(IDX_DCOMMON, "BRI::%s %s: private index (%s)", __FUNCTION__,
+         cof->pathcpy.canbpath.c_str(),
+         (ret == PLFS_SUCCESS) ? "busy" : strplfserr(ret));
+    return(ByteRangeIndex::populateIndex(cof->pathcpy.canbpath,
+                                         cof->pathcpy.canback,
+                                         this, true, false, 0));
+}
+
+/**
+ * ByteRangeIndex::shared_build: we created the image, so load the
+ * index and copy it in.  the other openers wait until it is ready.
+ * the index stays loaded (privately) if we fail to share it.
+ *
+ * @param cof the open file
+ * @param fd the new (empty) shared memory object, we close it
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+ByteRangeIndex::shared_build(Container_OpenFile *cof, int fd) {
+    plfs_error_t ret;
+    ostringstream chunks;
+    struct BRISharedImage *image;
+    ContainerEntry *ents;
+    map<off_t,ContainerEntry>::iterator itr;
+    string paths;
+    size_t len;
+    void *addr;
+
+    ret = ByteRangeIndex::populateIndex(cof->pathcpy.canbpath,
+                                        cof->pathcpy.canback,
+                                        this, true, false, 0);
+
+    /* same chunk path format as global_to_stream */
+    for (unsigned i = 0; i < this->chunk_map.size(); i++) {
+        chunks << this->chunk_map[i].backend->prefix
+               << this->chunk_map[i].bpath << endl;
+    }
+    paths = chunks.str();
+    len = sizeof(*image) + this->idx.size() * sizeof(ContainerEntry) +
+        paths.length() + 1;
+
+    addr = MAP_FAILED;
+    if (ret == PLFS_SUCCESS && ftruncate(fd, len) == 0) {
+        addr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (addr == MAP_FAILED) {
+        /* tell the waiters not to wait for us, then get out of the way */
+        if (ftruncate(fd, sizeof(*image)) == 0) {
+            addr = mmap(NULL, sizeof(*image), PROT_READ|PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                ((struct BRISharedImage *)addr)->state = BRI_SHARED_FAILED;
+                munmap(addr, sizeof(*image));
+            }
+        }
+        shm_unlink(this->shared_name.c_str());
+        close(fd);
+        mlog(IDX_DRARE, "BRI::%s %s: not shared: %s", __FUNCTION__,
+             this->shared_name.c_str(), strplfserr(ret));
+        return(ret);   /* private index, if populateIndex worked */
+    }
+    close(fd);
+
+    image = (struct BRISharedImage *)addr;
+    ents = (ContainerEntry *)(image + 1);
+    for (itr = this->idx.begin() ; itr != this->idx.end() ; itr++) {
+        *ents++ = itr->second;
+    }
+    memcpy((char *)ents, paths.c_str(), paths.length() + 1);
+    image->magic = BRI_SHARED_MAGIC;
+    image->version = BRI_SHARED_VERSION;
+    image->refs = 1;
+    image->eof = this->eof_tracker;
+    image->backing_bytes = this->backing_bytes;
+    image->nentries = this->idx.size();
+    image->paths_len = paths.length() + 1;
+    __sync_synchronize();   /* the image must be complete before READY */
+    image->state = BRI_SHARED_READY;
+
+    /* switch to the image, the chunk_map stays as it is */
+    this->shared = image;
+    this->shared_len = len;
+    this->shared_ents = (ContainerEntry *)(image + 1);
+    this->shared_nents = image->nentries;
+    this->idx.clear();
+
+    mlog(IDX_DCOMMON, "BRI::%s %s: %lu entries, %lu bytes", __FUNCTION__,
+         this->shared_name.c_str(), (unsigned long)this->shared_nents,
+         (unsigned long)len);
+    return(PLFS_SUCCESS);
+}
+
+/**
+ * ByteRangeIndex::shared_attach: map an image that someone else
+ * created, waiting for it to be built if need be.
+ *
+ * @param fd the shared memory object, we close it
+ * @return PLFS_SUCCESS if attached, PLFS_EAGAIN if the image is being
+ *         removed, or another error if it cannot be used
+ */
+plfs_error_t
+ByteRangeIndex::shared_attach(int fd) {
+    plfs_error_t ret = PLFS_SUCCESS;
+    struct BRISharedImage *image = NULL;
+    struct stat st;
+    double start;
+    void *addr = NULL;
+
+    /* the builder sizes it once the index is loaded */
+    start = Util::getTime();
+    while (true) {
+        if (fstat(fd, &st) != 0) {
+            ret = errno_to_plfs_error(errno);
+            break;
+        }
+        if (st.st_size >= (off_t)sizeof(*image)) {
+            addr = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+                        fd, 0);
+            if (addr == MAP_FAILED) {
+                ret = errno_to_plfs_error(errno);
+                break;
+            }
+            image = (struct BRISharedImage *)addr;
+            while (image->state == BRI_SHARED_BUILDING &&
+                   Util::getTime() - start < BRI_SHARED_WAIT) {
+                usleep(1000);
+            }
+            break;
+        }
+        if (Util::getTime() - start >= BRI_SHARED_WAIT) {
+            ret = PLFS_EBUSY;
+            break;
+        }
+        usleep(1000);
+    }
+    close(fd);
+    if (image == NULL) {
+        return(ret);
+    }
+    __sync_synchronize();
+
+    if (image->state != BRI_SHARED_READY ||
+        image->magic != BRI_SHARED_MAGIC ||
+        image->version != BRI_SHARED_VERSION ||
+        (off_t)(sizeof(*image) + image->nentries * sizeof(ContainerEntry) +
+                image->paths_len) != st.st_size) {
+        ret = (image->state == BRI_SHARED_BUILDING) ? PLFS_EBUSY :
+            PLFS_EINVAL;
+        munmap(addr, st.st_size);
+        return(ret);
+    }
+
+    /* refs of 0 means the last user has already decided to remove it */
+    if (__sync_add_and_fetch(&image->refs, 1) == 1) {
+        __sync_sub_and_fetch(&image->refs, 1);
+        munmap(addr, st.st_size);
+        return(PLFS_EAGAIN);
+    }
+
+    this->shared = image;
+    this->shared_len = st.st_size;
+    this->shared_ents = (ContainerEntry *)(image + 1);
+    this->shared_nents = image->nentries;
+    this->eof_tracker = image->eof;
+    this->backing_bytes = image->backing_bytes;
+    ret = this->chunks_from_stream((char *)(this->shared_ents +
+                                            this->shared_nents));
+    if (ret != PLFS_SUCCESS) {
+        this->shared_close();
+        this->chunk_map.clear();
+    }
+    return(ret);
+}
+
+/**
+ * ByteRangeIndex::shared_close: detach from our image, removing it if
+ * we are the last user.
+ */
+void
+ByteRangeIndex::shared_close() {
+    if (this->shared == NULL) {
+        return;
+    }
+    if (__sync_sub_and_fetch(&this->shared->refs, 1) == 0) {
+        shm_unlink(this->shared_name.c_str());
+    }
+    munmap(this->shared, this->shared_len);
+    this->shared = NULL;
+    this->shared_len = 0;
+    this->shared_ents = NULL;
+    this->shared_nents = 0;
+}
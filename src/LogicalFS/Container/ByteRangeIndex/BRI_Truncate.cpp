@@ -1,5 +1,5 @@
 /*
- * BRI_Truncate.cpp  index dropping truncation editor
+ * BRI_Truncate.cpp  truncate log and index dropping truncation editor
  */
 
 #include "plfs_private.h"
@@ -13,32 +13,6 @@
  * level, so we assume we are safe.
  */
 
-/**
- * filematch: filename matching (remove directory component)
- *
- * @param fullpath full path name of file we are looking at
- * @param filename the filename we are looking for
- * @return 1 if it matches, zero otherwise
- */
-static int
-filematch(string fullpath, string filename) {
-    size_t lastslash;
-
-    lastslash = fullpath.rfind("/");
-    if (lastslash == string::npos) {
-        lastslash = 0;
-    } else {
-        lastslash++;
-    }
-
-    if (fullpath.size() - lastslash == filename.size() &&
-        fullpath.find(filename, lastslash) != string::npos) {
-        return(1);
-    }
-    
-    return(0);
-}
-
 /**
  * getnextent: find next file in dir using a filter (nextdropping helper fn)
  *
@@ -168,38 +142,223 @@ nextdropping(const string& canbpath, struct plfs_backend *canback,
 }
 
 /**
- * ByteRangeIndex::trunc_map: truncate a C++ index map (low-level helper fn)
+ * tlog_read: read a truncate log file.  a missing file is an empty
+ * log.  the records are returned in the order they are in the file.
  *
- * @param mymap the map to truncate
- * @param nzo non-zero offset to truncate to
+ * @param logpath the log file
+ * @param canback backend the log lives on
+ * @param log the records are placed here
+ * @return PLFS_SUCCESS or error code
  */
-void
-ByteRangeIndex::trunc_map(map<off_t,ContainerEntry> &mymap, off_t nzo) {
-    map<off_t,ContainerEntry>::iterator itr, prev;
-    bool first;
+static plfs_error_t
+tlog_read(const string &logpath, struct plfs_backend *canback,
+          vector<TruncRecord> &log) {
+    plfs_error_t ret, rv;
+    IOSHandle *fh;
+    off_t len;
+    ssize_t got;
+
+    log.clear();
+    ret = canback->store->Open(logpath.c_str(), O_RDONLY, &fh);
+    if (ret != PLFS_SUCCESS) {
+        return((ret == PLFS_ENOENT) ? PLFS_SUCCESS : ret);
+    }
+    ret = fh->Size(&len);
+    if (ret == PLFS_SUCCESS && len >= (off_t)sizeof(TruncRecord)) {
+        log.resize(len / sizeof(TruncRecord));  /* ignore partials */
+        ret = fh->Pread(&log.front(), log.size() * sizeof(TruncRecord), 0,
+                        &got);
+        if (ret == PLFS_SUCCESS &&
+            got != (ssize_t)(log.size() * sizeof(TruncRecord))) {
+            ret = PLFS_EIO;   /* shrunk under us? */
+        }
+    }
+    rv = canback->store->Close(fh);
+    if (ret == PLFS_SUCCESS) {
+        ret = rv;
+    }
+    if (ret != PLFS_SUCCESS) {
+        mlog(IDX_ERR, "%s: %s: %s", __FUNCTION__, logpath.c_str(),
+             strplfserr(ret));
+        log.clear();
+    }
+    return(ret);
+}
 
-    if (mymap.size() == 0) {   /* no entries? then nothing to do... */
-        return;
+/**
+ * tlog_write: append records to a truncate log file, creating it if
+ * needed.
+ *
+ * @param logpath the log file
+ * @param canback backend the log lives on
+ * @param recs the records to append
+ * @param nrecs the number of records
+ * @return PLFS_SUCCESS or error code
+ */
+static plfs_error_t
+tlog_write(const string &logpath, struct plfs_backend *canback,
+           const TruncRecord *recs, size_t nrecs) {
+    plfs_error_t ret, rv;
+    IOSHandle *fh;
+    mode_t old_mode;
+    ssize_t x;
+
+    old_mode = umask(0);
+    ret = canback->store->Open(logpath.c_str(), O_WRONLY|O_APPEND|O_CREAT,
+                               DROPPING_MODE, &fh);
+    umask(old_mode);
+    if (ret != PLFS_SUCCESS) {
+        mlog(IDX_ERR, "%s: open %s: %s", __FUNCTION__, logpath.c_str(),
+             strplfserr(ret));
+        return(ret);
     }
-    
-    /* use stab query to find first element with offset >= nzo */
-    itr = mymap.lower_bound(nzo);
-    first = ( itr == mymap.begin() );
+    /* one small O_APPEND write, so concurrent appends don't mix */
+    ret = Util::Writen(recs, nrecs * sizeof(TruncRecord), fh, &x);
+    rv = canback->store->Close(fh);
+    if (ret == PLFS_SUCCESS) {
+        ret = rv;
+    }
+    return(ret);
+}
 
-    /* remove everything past nzo */
-    mymap.erase(itr, mymap.end());
-    
-    /* see if previous entry (if any) needs to be internally truncated */
-    if (!first) {
-        prev = itr;
-        prev--;
+/**
+ * ByteRangeIndex::trunc_log_read: read the container's truncate log.
+ * a container that has never been shrunk has no log, that is not an
+ * error.  the records are returned in timestamp order.
+ *
+ * @param canbpath canonical container bpath
+ * @param canback backend the canonical container lives on
+ * @param log the records are placed here
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+ByteRangeIndex::trunc_log_read(const string &canbpath,
+                               struct plfs_backend *canback,
+                               vector<TruncRecord> &log) {
+    plfs_error_t ret;
+
+    ret = tlog_read(canbpath + "/" + TRUNCLOG, canback, log);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+
+    /*
+     * appends from different hosts may not be in time order.  bubble
+     * sort is fine here, the log is short and almost always sorted.
+     */
+    for (size_t i = 1 ; i < log.size() ; i++) {
+        for (size_t j = i ; j > 0 &&
+             log[j].timestamp < log[j-1].timestamp ; j--) {
+            swap(log[j], log[j-1]);
+        }
+    }
+    return(ret);
+}
+
+/**
+ * ByteRangeIndex::trunc_log_append: record a truncate to a non-zero
+ * offset in the container's truncate log.  the records are applied
+ * when an index is loaded (trunc_apply), so we don't have to rewrite
+ * every index dropping in the container.
+ *
+ * @param canbpath canonical container bpath
+ * @param canback backend the canonical container lives on
+ * @param offset the new size of the file
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+ByteRangeIndex::trunc_log_append(const string &canbpath,
+                                 struct plfs_backend *canback,
+                                 off_t offset) {
+    plfs_error_t ret;
+    TruncRecord rec;
 
-        if (prev->second.logical_offset + (off_t)prev->second.length > nzo) {
+    rec.offset = offset;
+    rec.timestamp = Util::getTime();
+    ret = tlog_write(canbpath + "/" + TRUNCLOG, canback, &rec, 1);
 
-            prev->second.length = nzo - prev->second.logical_offset;
+    mlog(IDX_DCOMMON, "%s: %s to %ld at %.6f: %s", __FUNCTION__,
+         canbpath.c_str(), (long)offset, rec.timestamp, strplfserr(ret));
+    return(ret);
+}
+
+/**
+ * ByteRangeIndex::trunc_apply: apply a truncate log to an index map.
+ * data written before a truncate can't extend past its offset, while
+ * data written after it is left alone.  the map holds only the
+ * visible (newest) part of each range, and whatever it hides is older
+ * still, so each entry can be cut back on its own.  the EOF is
+ * recomputed and never falls below the size set by the latest
+ * truncate: if the data left ends before it, we add a zero length
+ * entry there, just like extending a file with a zero byte write.
+ *
+ * @param mymap the map to truncate
+ * @param eof_trk the EOF of the map, updated here
+ * @param log the truncate log, in timestamp order
+ * @return the number of entries cut back or removed
+ */
+size_t
+ByteRangeIndex::trunc_apply(map<off_t,ContainerEntry> &mymap,
+                            off_t *eof_trk, vector<TruncRecord> &log) {
+    map<off_t,ContainerEntry>::iterator itr;
+    vector<off_t> limit;    /* limit[i]: min offset of log[i..] */
+    size_t nlog, cut, lo, hi;
+    ContainerEntry marker;
+    off_t eof;
+
+    nlog = log.size();
+    if (nlog == 0 || mymap.size() == 0) {
+        return(0);
+    }
+    marker = mymap.begin()->second;   /* gives us a valid chunk id */
+    limit.resize(nlog);
+    limit[nlog-1] = log[nlog-1].offset;
+    for (size_t i = nlog - 1 ; i > 0 ; i--) {
+        limit[i-1] = min(log[i-1].offset, limit[i]);
+    }
+
+    cut = 0;
+    eof = 0;
+    itr = mymap.begin();
+    while (itr != mymap.end()) {
+        ContainerEntry &ent = itr->second;
+
+        /* find the first truncate after the write began */
+        lo = 0;
+        hi = nlog;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (log[mid].timestamp <= ent.begin_timestamp) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
         }
+        if (lo < nlog && ent.logical_offset >= limit[lo]) {
+            mymap.erase(itr++);        /* totally out of range */
+            cut++;
+            continue;
+        }
+        if (lo < nlog && ent.logical_tail() >= limit[lo]) {
+            ent.length = limit[lo] - ent.logical_offset;
+            cut++;
+        }
+        eof = max(eof, ent.logical_offset + (off_t)ent.length);
+        itr++;
     }
-}   
+
+    if (cut > 0 && eof < log[nlog-1].offset) {
+        marker.logical_offset = log[nlog-1].offset;
+        marker.length = 0;
+        marker.begin_timestamp = log[nlog-1].timestamp;
+        marker.end_timestamp = log[nlog-1].timestamp;
+        mymap[marker.logical_offset] = marker;
+        eof = marker.logical_offset;
+    }
+
+    *eof_trk = max(eof, log[nlog-1].offset);
+    return(cut);
+}
 
 /**
  * ByteRangeIndex::trunc_writemap: write map to FH (part of rewrite
@@ -268,53 +427,54 @@ ByteRangeIndex::trunc_writemap(map<off_t,ContainerEntry> &mymap,
 
 
 /**
- * ByteRangeIndex::trunc_edit_nz: edit droppings to shrink container
- * to a non-zero size.  if we are truncating an open file and we
- * edit the current index dropping, then update the filehandle for
- * it since the offsets may have changed.
+ * ByteRangeIndex::trunc_compact: apply the truncate log to the index
+ * droppings themselves and then remove the log.  this is the old
+ * rewrite-everything truncate, deferred to when an index is
+ * flattened.  the rewrite is idempotent, so if we fail part way the
+ * log is left in place and the next load still applies it.
+ *
+ * a writer appending to a dropping we rewrite would lose its
+ * records, so nothing is done while any host may have the file open
+ * for writing (an unexpired lease counts), and a dropping that grows
+ * while we rewrite it is left alone.  the log is kept in both cases.
  *
  * @param ppip pathinfo for container
- * @param nzo the non-zero offset
- * @param openidrop filename of currently open index dropping
  * @return PLFS_SUCCESS or error code
  */
 plfs_error_t
-ByteRangeIndex::trunc_edit_nz(struct plfs_physpathinfo *ppip, off_t nzo,
-                              string openidrop) {
+ByteRangeIndex::trunc_compact(struct plfs_physpathinfo *ppip) {
     plfs_error_t ret = PLFS_SUCCESS;
-    size_t slashoff;
-    string openifn, indexfile;
+    vector<TruncRecord> log, aside, extra;
+    string indexfile, tmpfile, logpath, asidepath, host;
     struct plfs_backend *indexback;
     IOSDirHandle *candir, *subdir;
     string hostdirpath;
+    ostringstream tag;
+    char *hostname;
+    bool busy;
     int dropping;
 
-    mlog(IDX_DAPI, "%s on %s to %ld", __FUNCTION__, ppip->canbpath.c_str(),
-         (unsigned long)nzo);
- 
-    /*
-     * isolate the filename in openidrop.  in theory we should be
-     * able to just compare the whole thing, but PLFS sometimes
-     * puts in extra "/" chars in filenames and that could mess
-     * us up: e.g.  /m/plfs/dir/file  vs /m/plfs/dir//file
-     * should be the same, but the "//" will fool strcmps.
-     */
-    if (openidrop.size() == 0) {
-        openifn = "";
-    } else {
-        slashoff = openidrop.rfind("/");
-        if (slashoff == string::npos) {
-            openifn = openidrop;
-        } else {
-            openifn = openidrop.substr(slashoff + 1, string::npos);
-        }
+    ret = ByteRangeIndex::trunc_log_read(ppip->canbpath, ppip->canback, log);
+    if (ret != PLFS_SUCCESS || log.size() == 0) {
+        return(ret);
+    }
+    if (Container::hasOpenrecord(ppip->canbpath, ppip->canback, true,
+                                 NULL, &host)) {
+        mlog(IDX_DCOMMON, "%s: %s is open on %s, keeping the log",
+             __FUNCTION__, ppip->canbpath.c_str(), host.c_str());
+        return(PLFS_SUCCESS);
     }
 
+    mlog(IDX_DAPI, "%s on %s with %lu records", __FUNCTION__,
+         ppip->canbpath.c_str(), (unsigned long)log.size());
+    Util::hostname(&hostname);
+    tag << "." << hostname << "." << getpid();
+
     /*
      * this code goes through each index dropping and rewrites it
-     * preserving only entries that contain data prior to truncate
-     * offset...
+     * preserving only entries that survive the truncate log...
      */
+    busy = false;
     candir = subdir = NULL;
     while ((ret = nextdropping(ppip->canbpath, ppip->canback,
                                &indexfile, &indexback,
@@ -327,12 +487,17 @@ ByteRangeIndex::trunc_edit_nz(struct plfs_physpathinfo *ppip, off_t nzo,
         /* read dropping file into a tmp index map */
         map<off_t,ContainerEntry> tmpidx;
         vector<ChunkFile> tmpcnk;
+        struct stat before, after;
         off_t eof, bytes;
         IOSHandle *fh;
 
         eof = bytes = 0;
-        ret = ByteRangeIndex::merge_dropping(tmpidx, tmpcnk, &eof,
-                                             &bytes, indexfile, indexback);
+        ret = indexback->store->Lstat(indexfile.c_str(), &before);
+        if (ret == PLFS_SUCCESS) {
+            ret = ByteRangeIndex::merge_dropping(tmpidx, tmpcnk, &eof,
+                                                 &bytes, indexfile,
+                                                 indexback);
+        }
         
         if (ret != PLFS_SUCCESS) {
             mlog(IDX_CRIT, "Failed to read index file %s: %s",
@@ -340,53 +505,101 @@ ByteRangeIndex::trunc_edit_nz(struct plfs_physpathinfo *ppip, off_t nzo,
             break;
         }
             
-        /* we have to rewrite only if it had data past our new eof (nzo) */
-        if (eof > nzo) {
-            mlog(IDX_DCOMMON, "%s %s at %ld", __FUNCTION__, indexfile.c_str(),
-                 (unsigned long)nzo);
-
-            ByteRangeIndex::trunc_map(tmpidx, nzo);
-
-            /*
-             * XXX: copied from old code.  should this write to a tmp
-             * file and then rename?
-             */
-            ret = indexback->store->Open(indexfile.c_str(),
-                                         O_TRUNC|O_WRONLY, &fh);
-            if ( ret != PLFS_SUCCESS ) {
-                mlog(IDX_CRIT, "Couldn't overwrite index file %s: %s",
-                     indexfile.c_str(), strplfserr( ret ));
-                return(ret);
-            }
+        /* we have to rewrite only if the log cut something */
+        if (ByteRangeIndex::trunc_apply(tmpidx, &eof, log) == 0) {
+            continue;
+        }
+        mlog(IDX_DCOMMON, "%s %s", __FUNCTION__, indexfile.c_str());
+
+        /* rewrite to a tmp file and rename it over the dropping */
+        tmpfile = hostdirpath + "/" TMPPREFIX +
+            indexfile.substr(indexfile.rfind('/') + 1) + tag.str();
+        ret = indexback->store->Open(tmpfile.c_str(),
+                                     O_WRONLY|O_CREAT|O_EXCL,
+                                     DROPPING_MODE, &fh);
+        if ( ret != PLFS_SUCCESS ) {
+            mlog(IDX_CRIT, "Couldn't rewrite index file %s: %s",
+                 indexfile.c_str(), strplfserr( ret ));
+            break;
+        }
 
-            ret = ByteRangeIndex::trunc_writemap(tmpidx, fh);
-
-            /*
-             * if we just rewrote our currently open index, swap our
-             * iwritefh to be the rewritten fh and let the old one get
-             * closed off (below).  we do this because we've edited
-             * the open write index dropping (made it smaller) and
-             * the old filehandle is now pointing to a bad spot in
-             * the file.
-             */
-            if (openifn.size() > 0 && indexback == this->iwriteback &&
-                filematch(indexfile, openifn)) {
-                IOSHandle *tmp;
-                tmp = this->iwritefh;
-                this->iwritefh = fh;
-                fh = tmp;
-            }
+        ret = ByteRangeIndex::trunc_writemap(tmpidx, fh);
+        plfs_error_t rv = indexback->store->Close(fh);
+        if (ret == PLFS_SUCCESS) {
+            ret = rv;
+        }
+        if (ret == PLFS_SUCCESS) {
+            ret = indexback->store->Lstat(indexfile.c_str(), &after);
+        }
+        if (ret == PLFS_SUCCESS && after.st_size != before.st_size) {
+            mlog(IDX_DCOMMON, "%s: %s is being written, keeping the log",
+                 __FUNCTION__, indexfile.c_str());
+            busy = true;
+        } else if (ret == PLFS_SUCCESS) {
+            ret = indexback->store->Rename(tmpfile.c_str(),
+                                           indexfile.c_str());
+        }
+        if (ret != PLFS_SUCCESS || busy) {
+            indexback->store->Unlink(tmpfile.c_str());
+            break;
+        }
+    }
+    if (candir != NULL) {     /* stopped early on an error */
+        if (subdir != NULL) {
+            indexback->store->Closedir(subdir);
+        }
+        ppip->canback->store->Closedir(candir);
+    }
+    if (ret != PLFS_SUCCESS || busy) {
+        mlog(IDX_DAPI, "%s on %s ret: %d", __FUNCTION__,
+             ppip->canbpath.c_str(), ret);
+        return(ret);
+    }
 
-            /* XXX: do we care about return value from Close? */
-            indexback->store->Close(fh);
+    /*
+     * move the log aside rather than removing it, so a truncate that
+     * comes in now starts a new log.  a record that got into the old
+     * one after we read it has not been applied to the droppings, so
+     * it goes to the new log too.
+     */
+    logpath = ppip->canbpath + "/" + TRUNCLOG;
+    asidepath = logpath + tag.str();
+    ret = ppip->canback->store->Rename(logpath.c_str(), asidepath.c_str());
+    if (ret == PLFS_ENOENT) {
+        ret = PLFS_SUCCESS;   /* another flatten got it */
+    } else if (ret == PLFS_SUCCESS) {
+        ret = tlog_read(asidepath, ppip->canback, aside);
+        for (size_t i = 0 ; ret == PLFS_SUCCESS && i < aside.size() ; i++) {
+            size_t j;
+            for (j = 0 ; j < log.size() ; j++) {
+                if (log[j].offset == aside[i].offset &&
+                    log[j].timestamp == aside[i].timestamp) {
+                    break;
+                }
+            }
+            if (j == log.size()) {
+                extra.push_back(aside[i]);
+            }
+        }
+        if (ret == PLFS_SUCCESS && extra.size() > 0) {
+            ret = tlog_write(logpath, ppip->canback, &extra.front(),
+                             extra.size());
+        }
+        if (ret == PLFS_SUCCESS) {
+            ret = ppip->canback->store->Unlink(asidepath.c_str());
+        } else {
+            /* put it back, it is still right, just not compacted */
+            ppip->canback->store->Rename(asidepath.c_str(),
+                                         logpath.c_str());
         }
     }
 
-    mlog(IDX_DAPI, "%s on %s to %ld ret: %d",
-         __FUNCTION__, ppip->canbpath.c_str(), (long)nzo, ret);
+    mlog(IDX_DAPI, "%s on %s ret: %d", __FUNCTION__,
+         ppip->canbpath.c_str(), ret);
     return(ret);
 }
 
+
 #if 0
 
 // XXXCDC: CHECK truncateMeta in all 4 cases
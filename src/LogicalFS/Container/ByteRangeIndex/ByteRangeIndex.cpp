@@ -7,6 +7,7 @@
 #include "ContainerIndex.h"
 #include "ContainerOpenFile.h"
 #include "ByteRangeIndex.h"
+#include "Metrics.h"
 
 /*
  * ostream function to print out an index.  only used by plfs_map tool
@@ -25,9 +26,13 @@ ostream& operator <<(ostream& os, const ByteRangeIndex& bri) {
     }
 
     map<off_t,ContainerEntry>::const_iterator itr;
-    os << "# Entry Count: " << bri.idx.size() << endl;
+    os << "# Entry Count: "
+       << (bri.shared ? bri.shared_nents : bri.idx.size()) << endl;
     os << "# ID Logical_offset Length Begin_timestamp End_timestamp "
        << " Logical_tail ID.Chunk_offset " << endl;
+    for(size_t i = 0; bri.shared && i < bri.shared_nents; i++) {
+        os << bri.shared_ents[i] << endl;
+    }
     for(itr = bri.idx.begin(); itr != bri.idx.end(); itr++) {
         os << itr->second << endl;
     }
@@ -45,12 +50,14 @@ ostream& operator <<(ostream& os, const ByteRangeIndex& bri) {
  *
  * @param dropbpath dropping bpath
  * @param dropback the backend the dropping lives on
+ * @param tlog the container's truncate log
  * @param eofp end of file returned here
  * @param bytesp byte count returned here
  * @return PLFS_SUCCESS or error
  */
 plfs_error_t
 ByteRangeIndex::scan_idropping(string dropbpath, struct plfs_backend *dropback,
+                               vector<TruncRecord> &tlog,
                                off_t *eofp, off_t *bytesp) {
     plfs_error_t ret;
     map<off_t,ContainerEntry> tmpidx;   /* discarded on return */
@@ -59,6 +66,9 @@ ByteRangeIndex::scan_idropping(string dropbpath, struct plfs_backend *dropback,
     *eofp = *bytesp = 0;
     ret = ByteRangeIndex::merge_dropping(tmpidx, tmpcnk, 
                                          eofp, bytesp, dropbpath, dropback);
+    if (ret == PLFS_SUCCESS) {
+        ByteRangeIndex::trunc_apply(tmpidx, eofp, tlog);
+    }
     return(ret);
 }
     
@@ -111,13 +121,21 @@ ByteRangeIndex::ByteRangeIndex(PlfsMount *) {
     this->iwritefh = NULL;
     this->iwriteback = NULL;
     this->backing_bytes = 0;
-    /* init'd by C++: writebuf, idx, chunk_map */
+    this->shared = NULL;
+    this->shared_len = 0;
+    this->shared_ents = NULL;
+    this->shared_nents = 0;
+    this->lazy_pending = false;
+    this->lazy_urestart = false;
+    this->lazy_upid = 0;
+    /* init'd by C++: writebuf, idx, chunk_map, shared_name */
 }
 
 /**
  * ByteRangeIndex::ByteRangeIndex: destructor
  */
 ByteRangeIndex::~ByteRangeIndex() {
+    this->shared_close();   /* in case we were not closed */
     pthread_mutex_destroy(&this->bri_mutex);
 };
 
@@ -134,8 +152,6 @@ ByteRangeIndex::index_open(Container_OpenFile *cof, int rw_flags,
                            Plfs_open_opt *open_opt) {
 
     plfs_error_t ret = PLFS_SUCCESS;
-    bool urestart;
-    pid_t upid;
 
     if (this->isopen) {    /* quick sanity check, shouldn't be possible */
         mlog(IDX_CRIT, "index_open: double open?");
@@ -166,19 +182,43 @@ ByteRangeIndex::index_open(Container_OpenFile *cof, int rw_flags,
              * it.
              */
             ret = this->global_from_stream(open_opt->index_stream);
+            if (ret == PLFS_SUCCESS) {
+                vector<TruncRecord> tlog;
+                ret = ByteRangeIndex::trunc_log_read(cof->pathcpy.canbpath,
+                                                     cof->pathcpy.canback,
+                                                     tlog);
+                ByteRangeIndex::trunc_apply(this->idx, &this->eof_tracker,
+                                            tlog);
+            }
 
         } else {
 
             if (open_opt) {
-                urestart = open_opt->uniform_restart_enable;
-                upid = open_opt->uniform_restart_rank;
+                this->lazy_urestart = open_opt->uniform_restart_enable;
+                this->lazy_upid = open_opt->uniform_restart_rank;
+            } else {
+                this->lazy_urestart = false;
+                this->lazy_upid = 0;     /* rather than garbage */
+            }
+
+            /*
+             * many RDONLY opens never read (e.g. cp -a, file(1)),
+             * and getattr on an open file gets the size from the
+             * metadir, so we put off loading a RDONLY index until the
+             * first query needs it.  RDWR loads it here for the eof
+             * tracker, unless it is opened O_APPEND (the append
+             * counter has the eof then, and reads reload the index).
+             * a put off load still has to fail the open of a container
+             * that is not there, as the load would have.
+             */
+            this->lazy_pending = true;
+            if (rw_flags != O_RDONLY && cof->append == NULL) {
+                ret = this->lazy_load(cof);
             } else {
-                urestart = false;
-                upid = 0;     /* rather than garbage */
+                struct stat st;
+                ret = cof->pathcpy.canback->store->Lstat(
+                    cof->pathcpy.canbpath.c_str(), &st);
             }
-            ret = ByteRangeIndex::populateIndex(cof->pathcpy.canbpath,
-                                                cof->pathcpy.canback,
-                                                this, true, urestart, upid);
 
         }
             
@@ -198,12 +238,56 @@ ByteRangeIndex::index_open(Container_OpenFile *cof, int rw_flags,
     if (ret == PLFS_SUCCESS) {
         this->isopen = true;
         this->brimode = rw_flags;
+    } else {
+        this->lazy_pending = false;
     }
 
     Util::MutexUnlock(&this->bri_mutex, __FUNCTION__);
     return(ret);
 }
 
+/**
+ * ByteRangeIndex::lazy_load: load a readable index if index_open put
+ * it off.  the BRI should already be locked by the caller.  if the
+ * load fails, the next caller tries again.
+ *
+ * @param cof the open file
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+ByteRangeIndex::lazy_load(Container_OpenFile *cof) {
+    plfs_error_t ret;
+
+    if (!this->lazy_pending) {
+        return(PLFS_SUCCESS);
+    }
+
+    /*
+     * a full RDONLY index can be shared with the other readers on
+     * this node (see BRI_Shared.cpp).
+     */
+    if (cof->rwflags == O_RDONLY && !this->lazy_urestart &&
+        cof->pathcpy.mnt_pt->shared_index) {
+        ret = this->shared_open(cof);
+    } else {
+        ret = ByteRangeIndex::populateIndex(cof->pathcpy.canbpath,
+                                            cof->pathcpy.canback,
+                                            this, true, this->lazy_urestart,
+                                            this->lazy_upid);
+    }
+
+    if (ret == PLFS_SUCCESS) {
+        this->lazy_pending = false;
+    } else {
+        /* drop whatever a failed load has left */
+        this->idx.clear();
+        this->chunk_map.clear();
+        this->eof_tracker = 0;
+        this->backing_bytes = 0;
+    }
+    return(ret);
+}
+
 /**
  * ByteRangeIndex::index_close: close off an open index.   lastoffp
  * should get set to the largest offset we know about (to help track
@@ -261,6 +345,11 @@ ByteRangeIndex::index_close(Container_OpenFile * /* cof */, off_t *lastoffp,
 
     /* free read-side memory */
     if (this->brimode != O_WRONLY) {
+        if (this->lazy_pending) {
+            Metrics::add(PM_INDEX_LOADS_SKIPPED, 1);  /* never needed it */
+            this->lazy_pending = false;
+        }
+        this->shared_close();
         this->idx.clear();
         this->chunk_map.clear();
         this->backing_bytes = 0;
@@ -275,6 +364,30 @@ ByteRangeIndex::index_close(Container_OpenFile * /* cof */, off_t *lastoffp,
     return(ret);
 }
 
+/*
+ * flush_buffered_droppings: compressed data droppings keep the frame
+ * being filled in memory, and the records that point into it must not
+ * reach the index dropping (where readers find them) before it does.
+ * so write out those frames first.  the caller holds cof_mux.
+ *
+ * @param cof the open file
+ * @return PLFS_SUCCESS or error code
+ */
+static plfs_error_t
+flush_buffered_droppings(Container_OpenFile *cof) {
+    map<pid_t,writefh>::iterator pid_itr;
+    plfs_error_t ret = PLFS_SUCCESS;
+
+    if (!cof->pathcpy.mnt_pt->compress_droppings) {
+        return(PLFS_SUCCESS);
+    }
+    for (pid_itr = cof->fhs.begin() ;
+         ret == PLFS_SUCCESS && pid_itr != cof->fhs.end() ; pid_itr++) {
+        ret = pid_itr->second.wfh->Fsync();
+    }
+    return(ret);
+}
+
 /**
  * ByteRangeIndex::index_add: add an index record to a writeable index
  *
@@ -288,7 +401,7 @@ ByteRangeIndex::index_close(Container_OpenFile * /* cof */, off_t *lastoffp,
  * @return PLFS_SUCCESS or error code
  */
 plfs_error_t
-ByteRangeIndex::index_add(Container_OpenFile * /* cof */, size_t nbytes,
+ByteRangeIndex::index_add(Container_OpenFile *cof, size_t nbytes,
                           off_t offset, pid_t pid, off_t physoffset,
                           double begin, double end) {
 
@@ -308,7 +421,9 @@ ByteRangeIndex::index_add(Container_OpenFile * /* cof */, size_t nbytes,
         !this->writebuf.empty() &&
         this->writebuf.back().id == pid &&
         this->writebuf.back().logical_offset + 
-        (off_t)this->writebuf.back().length == offset) {
+        (off_t)this->writebuf.back().length == offset &&
+        this->writebuf.back().physical_offset +
+        (off_t)this->writebuf.back().length == physoffset) {
 
         /* extend! */
         this->writebuf.back().end_timestamp = end;
@@ -333,7 +448,10 @@ ByteRangeIndex::index_add(Container_OpenFile * /* cof */, size_t nbytes,
 
     /* XXX: carried over hardwired 1024 from old code */
     if ((this->write_count % 1024) == 0) {
-        ret = this->flush_writebuf();
+        ret = flush_buffered_droppings(cof);
+        if (ret == PLFS_SUCCESS) {
+            ret = this->flush_writebuf();
+        }
     }
 
  done:
@@ -407,13 +525,16 @@ ByteRangeIndex::index_query(Container_OpenFile *cof, off_t input_offset,
 
     } else {
 
-        target = this;   /* RDONLY, should already be in memory */
+        target = this;   /* RDONLY, loaded on first query */
 
     }
     
     Util::MutexLock(&target->bri_mutex, __FUNCTION__);
 
-    ret = target->query_helper(cof, input_offset, input_length, result);
+    ret = target->lazy_load(cof);
+    if (ret == PLFS_SUCCESS) {
+        ret = target->query_helper(cof, input_offset, input_length, result);
+    }
 
     Util::MutexUnlock(&target->bri_mutex, __FUNCTION__);
 
@@ -448,7 +569,7 @@ ByteRangeIndex::index_truncate(Container_OpenFile *cof, off_t offset) {
     vector<HostEntry> new_wbuf;
     vector<HostEntry>::iterator itr;
 
-    /* regenerate index dropping filename from cof, needed in all cases */
+    /* regenerate index dropping filename from cof, to reopen it on zero */
     ts.setf(ios::fixed,ios::floatfield);
     ts << cof->createtime;
             
@@ -510,7 +631,9 @@ ByteRangeIndex::index_truncate(Container_OpenFile *cof, off_t offset) {
     this->writebuf = new_wbuf;   /* replace old wbuf with new edited one */
     this->eof_tracker = offset;  /* move EOF back */
 
-    ret = this->trunc_edit_nz(&cof->pathcpy, offset, idrop_pathstream.str());
+    /* readers cut back the rest of the data when they load the index */
+    ret = ByteRangeIndex::trunc_log_append(cof->pathcpy.canbpath,
+                                           cof->pathcpy.canback, offset);
     
     Util::MutexUnlock(&this->bri_mutex, __FUNCTION__);
 
@@ -632,6 +755,16 @@ ByteRangeIndex::index_optimize(Container_OpenFile *cof) {
 
     Util::MutexLock(&target->bri_mutex, __FUNCTION__);
 
+    ret = target->lazy_load(cof);
+    if (ret != PLFS_SUCCESS) {
+        Util::MutexUnlock(&target->bri_mutex, __FUNCTION__);
+        if (cof->rwflags != O_RDONLY) {
+            target->index_close(cof, NULL, NULL, NULL);
+            delete target;
+        }
+        return(ret);
+    }
+
     /* generate paths */
     destname << cof->pathcpy.canbpath << "/" << GLOBALINDEX;
     tmpname.setf(ios::fixed,ios::floatfield);
@@ -660,6 +793,16 @@ ByteRangeIndex::index_optimize(Container_OpenFile *cof) {
             canback->store->Unlink(tmpname.str().c_str());
         }
     }
+
+    /*
+     * now that the global index has the truncates applied, it is a
+     * good time to fold the truncate log into the droppings.  we
+     * skip this if we have the file open for writing, since we'd be
+     * rewriting our own open index dropping.
+     */
+    if (ret == PLFS_SUCCESS && cof->rwflags == O_RDONLY) {
+        ret = this->trunc_compact(&cof->pathcpy);
+    }
     
     Util::MutexUnlock(&target->bri_mutex, __FUNCTION__);
 
@@ -716,12 +859,17 @@ ByteRangeIndex::index_droppings_getattrsize(struct plfs_physpathinfo *ppip,
     plfs_error_t ret = PLFS_SUCCESS;
     vector<plfs_pathback> indices;
     vector<plfs_pathback>::iterator pitr;
+    vector<TruncRecord> tlog;
 
     mlog(IDX_DAPI, "BRI::dropget: %s", ppip->canbpath.c_str());
 
     /* generate a list of all index droppings in container */
     ret = ByteRangeIndex::collectIndices(ppip->canbpath, ppip->canback,
                                          indices, true);
+    if (ret == PLFS_SUCCESS) {
+        ret = ByteRangeIndex::trunc_log_read(ppip->canbpath, ppip->canback,
+                                             tlog);
+    }
     mlog(IDX_DCOMMON, "BRI::dropget: %s collected=%d", ppip->canbpath.c_str(),
          (int)indices.size());
 
@@ -778,7 +926,7 @@ ByteRangeIndex::index_droppings_getattrsize(struct plfs_physpathinfo *ppip,
          * now read the dropping itself to update our offset/size info
          */
         ret = ByteRangeIndex::scan_idropping(mydrop.bpath, mydrop.back,
-                                             &drop_eof, &drop_bytes);
+                                             tlog, &drop_eof, &drop_bytes);
         if (ret == PLFS_SUCCESS) {
             stbuf->st_blocks += Container::bytesToBlocks(drop_bytes);
             stbuf->st_size = max(stbuf->st_size, drop_eof);
@@ -810,9 +958,10 @@ plfs_error_t ByteRangeIndex::index_droppings_rename(
 /**
  * index_droppings_trunc: this should be called when the truncate
  * offset is less than the current size of the file.  we don't actually
- * remove any data here, we just edit index files and meta droppings.
- * when a file is truncated to zero, that is handled separately and
- * that does actually remove data files.
+ * remove any data here, we just add a record to the truncate log (the
+ * caller updates the meta droppings).  when a file is truncated to
+ * zero, that is handled separately and that does actually remove data
+ * files.
  *
  * @param ppip container to truncate
  * @param offset the new max offset (>=1)
@@ -829,7 +978,8 @@ ByteRangeIndex::index_droppings_trunc(struct plfs_physpathinfo *ppip,
      * helper functions.   locking may not be needed, since we are
      * not hitting on any in-memory shared data.
      */
-    ret = this->trunc_edit_nz(ppip, offset, "");
+    ret = ByteRangeIndex::trunc_log_append(ppip->canbpath, ppip->canback,
+                                           offset);
     
     Util::MutexUnlock(&this->bri_mutex, __FUNCTION__);
     return(ret);
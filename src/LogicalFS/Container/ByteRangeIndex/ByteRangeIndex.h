@@ -2,6 +2,7 @@
  * ByteRangeIndex.h  all ByteRangeIndex indexing structures
  */
 class ByteRangeIndex;   /* forward decl the main class */
+struct BRISharedImage;  /* node-local shared index, see BRI_Shared.cpp */
 
 #include <deque>        /* used for index read tasks */
 
@@ -93,6 +94,19 @@ class ContainerEntry : HostEntry
     friend class ByteRangeIndex;
 };
 
+/*
+ * TruncRecord: the on-disk format of the container's TRUNCLOG file
+ *
+ * a truncate to a non-zero offset appends one of these rather than
+ * rewriting every index dropping.  when an index is loaded, all data
+ * written before the timestamp is cut back to the offset (see
+ * BRI_Truncate.cpp).
+ */
+typedef struct {
+    off_t offset;                 /* the new size of the file */
+    double timestamp;             /* time of the truncate */
+} TruncRecord;
+
 /*
  * ChunkFile: a way to associate an int with a local file so that
  * we only need an int in the aggregated index (saves space).
@@ -169,6 +183,9 @@ public:
                                        off_t offset);
     plfs_error_t index_droppings_unlink(struct plfs_physpathinfo *ppip);
     plfs_error_t index_droppings_zero(struct plfs_physpathinfo *ppip);
+    plfs_error_t index_droppings_clone(Container_OpenFile *cof,
+                                       struct plfs_physpathinfo *dst,
+                                       off_t *lastoffp, size_t *tbytesp);
 
     /*
      * XXX: this public functions are for the MPI optimizations.
@@ -232,6 +249,7 @@ public:
                                       pid_t uniform_rank);
 
     plfs_error_t global_from_stream(void *addr);
+    plfs_error_t chunks_from_stream(char *paths);
     plfs_error_t global_to_stream(void **buffer, size_t *length);
     plfs_error_t global_to_file(IOSHandle *fh, struct plfs_backend *canback);
 
@@ -240,16 +258,27 @@ public:
                               list<index_record> &result);
     plfs_error_t query_helper_getrec(Container_OpenFile *cof, off_t ptr,
                                      size_t len, index_record *irp);
+    template <class QItr> void query_helper_walk(QItr begin, QItr end,
+                                                 QItr qitr, off_t ptr,
+                                                 size_t len,
+                                                 index_record *irp);
     void query_helper_load_irec(off_t ptr, index_record *irp,
-                                map<off_t,ContainerEntry>::iterator qitr,
-                                bool at_end);
+                                const ContainerEntry &ent, bool at_end);
+    static bool entry_before(const ContainerEntry &ent, off_t ptr);
     plfs_error_t flush_writebuf(void);
     static plfs_error_t scan_idropping(string dropbpath,
                                        struct plfs_backend *dropback,
+                                       vector<TruncRecord> &tlog,
                                        off_t *ep, off_t *bp);
-    plfs_error_t trunc_edit_nz(struct plfs_physpathinfo *ppip, off_t nzo,
-                               string openidrop);
-    static void trunc_map(map<off_t,ContainerEntry> &mymap, off_t nzo);
+    static plfs_error_t trunc_log_read(const string &canbpath,
+                                       struct plfs_backend *canback,
+                                       vector<TruncRecord> &log);
+    static plfs_error_t trunc_log_append(const string &canbpath,
+                                         struct plfs_backend *canback,
+                                         off_t offset);
+    static size_t trunc_apply(map<off_t,ContainerEntry> &mymap,
+                              off_t *eof_trk, vector<TruncRecord> &log);
+    plfs_error_t trunc_compact(struct plfs_physpathinfo *ppip);
     static plfs_error_t trunc_writemap(map<off_t,ContainerEntry> &mymap,
                                        IOSHandle *fh);
 
@@ -262,6 +291,12 @@ public:
                                               string path,
                                               struct plfs_backend *backend);
 
+    plfs_error_t lazy_load(Container_OpenFile *cof);
+    plfs_error_t shared_open(Container_OpenFile *cof);
+    plfs_error_t shared_build(Container_OpenFile *cof, int fd);
+    plfs_error_t shared_attach(int fd);
+    void shared_close(void);
+
 
     pthread_mutex_t bri_mutex;       /* to lock this data structure */
     bool isopen;                     /* true if index is open */
@@ -277,9 +312,24 @@ public:
     struct plfs_backend *iwriteback; /* backend index is on */
 
     /* data structures for the read side */
+    bool lazy_pending;               /* RDONLY: not loaded until queried */
+    bool lazy_urestart;              /* uniform restart for lazy_load */
+    pid_t lazy_upid;                 /* uniform restart rank, ditto */
     map<off_t,ContainerEntry> idx;   /* global index (aggregated) */
     vector<ChunkFile> chunk_map;     /* filenames for idx */
     /* note: next avail chunk_id is chunk_map.size() */
+
+    /*
+     * RDONLY with the shared_index mount option: idx stays empty and
+     * queries go to the sorted entries of an image in POSIX shared
+     * memory that all the readers of the container on this node map.
+     * chunk_map is still private (it holds backend ptrs and fhs).
+     */
+    struct BRISharedImage *shared;   /* NULL if not attached */
+    size_t shared_len;               /* mapped length of the image */
+    string shared_name;              /* shm_open() name of the image */
+    ContainerEntry *shared_ents;     /* sorted by logical offset */
+    size_t shared_nents;
     off_t backing_bytes;             /* see below */
     /*
      * backing_bytes includes overwrites.  this field is only used
@@ -8,6 +8,7 @@
 #include "ContainerFS.h"
 #include "ContainerIndex.h"
 #include "ContainerOpenFile.h"
+#include "container_append.h"
 
 /*
  * local prototypes
@@ -17,7 +18,7 @@ static plfs_error_t createMetalink(struct plfs_backend *canback,
                                    const string& canonical_hostdir,
                                    string& physical_hostdir,
                                    struct plfs_backend **physbackp,
-                                   bool& use_metalink);
+                                   bool& use_metalink, size_t nhostdirs);
 
 /**
  * fetchMeta: get data from metafile name.  these get generated
@@ -79,6 +80,37 @@ makeAccess(const string& path, struct plfs_backend *b, mode_t mode)
     return makeDroppingReal( path, b, mode );
 }
 
+/*
+ * the fan-out file holds the number of hostdirs of the container in
+ * ascii.  containers without one use the num_hostdirs of the plfsrc.
+ */
+static plfs_error_t
+makeFanout(const string& path, struct plfs_backend *b, size_t nhostdirs)
+{
+    ostringstream oss;
+    IOSHandle *fh;
+    ssize_t written;
+    plfs_error_t ret, ret2;
+
+    oss << nhostdirs << endl;
+    mode_t save_umask = umask(0);
+    ret = b->store->Open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC,
+                         DROPPING_MODE, &fh);
+    umask(save_umask);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    ret = Util::Writen(oss.str().data(), oss.str().size(), fh, &written);
+    ret2 = b->store->Close(fh);
+    if (ret == PLFS_SUCCESS) {
+        ret = ret2;
+    }
+    if (ret != PLFS_SUCCESS) {
+        b->store->Unlink(path.c_str());
+    }
+    return(ret);
+}
+
 /*
  * XXX: there is a redundant one of these in FileOps that we'd like
  * to get rid of (this should be here).
@@ -116,7 +148,8 @@ makeSubdir( const string& path, mode_t mode, struct plfs_backend *b )
 // returns PLFS_SUCCESS or PLFS_E*
 static plfs_error_t
 makeHostDir(const string& path, struct plfs_backend *back,
-            const string& host, mode_t mode, parentStatus pstat)
+            const string& host, mode_t mode, parentStatus pstat,
+            size_t nhostdirs)
 {   
     plfs_error_t ret = PLFS_SUCCESS;
     if (pstat == PARENT_ABSENT) {
@@ -124,7 +157,8 @@ makeHostDir(const string& path, struct plfs_backend *back,
         ret = makeSubdir(path.c_str(),mode, back);
     }
     if (ret == PLFS_SUCCESS) {
-        ret = makeSubdir(Container::getHostDirPath(path,host,PERM_SUBDIR),
+        ret = makeSubdir(Container::getHostDirPath(path,host,PERM_SUBDIR,
+                                                   nhostdirs),
                          mode, back);
     }
     return(ret);
@@ -145,7 +179,8 @@ makeHostDir(const string& path, struct plfs_backend *back,
 static plfs_error_t
 makeTopLevel(const string& expanded_path, struct plfs_backend *canback,
              const string& hostname, mode_t mode, int flags,
-             pid_t pid, unsigned mnt_pt_checksum, bool lazy_subdir )
+             pid_t pid, unsigned mnt_pt_checksum, bool lazy_subdir,
+             size_t nhostdirs )
 {
     plfs_error_t rv;
     /*
@@ -197,6 +232,16 @@ makeTopLevel(const string& expanded_path, struct plfs_backend *canback,
         }
         return(saverv);
     }
+    // the fan-out goes in before the rename so that every writer
+    // sees the same number of hostdirs as soon as the container
+    // is there.  without it we just get num_hostdirs.
+    string tmpFanout( tmpName + "/" + FANOUTFILE );
+    if (nhostdirs && (rv = makeFanout(tmpFanout, canback, nhostdirs))
+        != PLFS_SUCCESS) {
+        mlog(CON_DRARE, "create fanout file in %s failed: %s",
+             tmpName.c_str(), strplfserr(rv) );
+        nhostdirs = 0;
+    }
     // ok, this rename sometimes takes a long time
     // what if we check first to see if the dir already exists
     // and if it does don't bother with the rename
@@ -233,6 +278,9 @@ makeTopLevel(const string& expanded_path, struct plfs_backend *canback,
                 mlog(CON_DRARE, "unlink of temporary %s failed : %s",
                      tmpAccess.c_str(), strplfserr(rv) );
             }
+            if (nhostdirs) {
+                canback->store->Unlink(tmpFanout.c_str());
+            }
             rv = canback->store->Rmdir(tmpName.c_str());
             if ( rv != PLFS_SUCCESS ) {
                 mlog(CON_DRARE, "rmdir of temporary %s failed : %s",
@@ -313,7 +361,8 @@ makeTopLevel(const string& expanded_path, struct plfs_backend *canback,
             }
             if (create_subdir) {
                 if ((rv = makeHostDir(expanded_path,canback,hostname,
-                                      mode,PARENT_CREATED)) != PLFS_SUCCESS) {
+                                      mode,PARENT_CREATED,
+                                      nhostdirs)) != PLFS_SUCCESS) {
                     // EEXIST means a sibling raced us and make one for us
                     // or a metalink exists at the specified location, which
                     // is ok. plfs::addWriter will do it lazily.
@@ -348,12 +397,170 @@ makeTopLevel(const string& expanded_path, struct plfs_backend *canback,
     return PLFS_SUCCESS;
 }
 
+/*
+ * coordinated_create: the containers and hostdirs this process has
+ * made or found, and when.  entries go stale after KNOWN_DIR_SECS
+ * since another node may have removed the file since then.
+ */
+#define KNOWN_DIR_SECS   5
+#define CREATE_WAIT_SECS 30        /* before we assume the creator died */
+#define CREATE_MAX_POLL  100000    /* usecs, backoff limit */
+static pthread_mutex_t known_dirs_mux = PTHREAD_MUTEX_INITIALIZER;
+static map<string,double> known_dirs;
+
+static bool
+known_dir(const string& path)
+{
+    map<string,double>::iterator itr;
+    bool ret = false;
+
+    Util::MutexLock(&known_dirs_mux, __FUNCTION__);
+    itr = known_dirs.find(path);
+    if (itr != known_dirs.end()) {
+        if (Util::getTime() - itr->second < KNOWN_DIR_SECS) {
+            ret = true;
+        } else {
+            known_dirs.erase(itr);
+        }
+    }
+    Util::MutexUnlock(&known_dirs_mux, __FUNCTION__);
+    return(ret);
+}
+
+static void
+remember_dir(const string& path)
+{
+    Util::MutexLock(&known_dirs_mux, __FUNCTION__);
+    known_dirs[path] = Util::getTime();
+    Util::MutexUnlock(&known_dirs_mux, __FUNCTION__);
+}
+
+/*
+ * open_lease: the expiry of the lease record this process last made
+ * (or found made) for each container, by canonical bpath.
+ */
+static pthread_mutex_t leases_mux = PTHREAD_MUTEX_INITIALIZER;
+static map<string,time_t> leases;
+
+static void
+forgetOpenlease(const string& canbpath)
+{
+    Util::MutexLock(&leases_mux, __FUNCTION__);
+    leases.erase(canbpath);
+    Util::MutexUnlock(&leases_mux, __FUNCTION__);
+}
+
+/**
+ * Container::forgetContainer: drop what coordinated_create remembers
+ * about a container (and its hostdirs) we are removing or renaming,
+ * and our open_lease on it.
+ *
+ * @param canbpath the bpath to the canonical container
+ */
+void
+Container::forgetContainer(const string& canbpath)
+{
+    map<string,double>::iterator itr;
+    string prefix = canbpath + "/";
+
+    Util::MutexLock(&known_dirs_mux, __FUNCTION__);
+    known_dirs.erase(canbpath);
+    itr = known_dirs.lower_bound(prefix);
+    while (itr != known_dirs.end() &&
+           itr->first.compare(0, prefix.size(), prefix) == 0) {
+        known_dirs.erase(itr++);
+    }
+    Util::MutexUnlock(&known_dirs_mux, __FUNCTION__);
+    forgetOpenlease(canbpath);
+}
+
+/*
+ * the marker is a hidden sibling of the container, so it doesn't
+ * show up in a listing of the parent while the container is made.
+ */
+static string
+create_marker_path(const string& expanded_path)
+{
+    size_t lastslash = expanded_path.rfind('/');
+    if (lastslash == string::npos) {
+        return("." TMPPREFIX "create." + expanded_path);
+    }
+    return(expanded_path.substr(0, lastslash + 1) + "." TMPPREFIX "create." +
+           expanded_path.substr(lastslash + 1));
+}
+
+// coordinated_create version of makeTopLevel.  when thousands of procs
+// open-create the same file, makeTopLevel has every one of them do
+// mkdir/create/rename and then undo it when they lose the race.  here
+// only the proc that gets the exclusive create of the marker does that,
+// the others just poll for the container to show up.
+// returns PLFS_E* or PLFS_SUCCESS
+static plfs_error_t
+makeTopLevelCoordinated(const string& expanded_path,
+                        struct plfs_backend *canback,
+                        const string& hostname, mode_t mode, int flags,
+                        pid_t pid, unsigned mnt_pt_checksum, bool lazy_subdir,
+                        size_t nhostdirs)
+{
+    plfs_error_t rv;
+    string marker = create_marker_path(expanded_path);
+    IOSHandle *fh;
+    struct stat st;
+    struct plfs_pathback pb;
+    double start;
+    useconds_t delay;
+
+    mode_t save_umask = umask(0);
+    rv = canback->store->Open(marker.c_str(), O_WRONLY|O_CREAT|O_EXCL,
+                              DROPPING_MODE, &fh);
+    umask(save_umask);
+    if (rv == PLFS_SUCCESS) {
+        canback->store->Close(fh);
+        rv = makeTopLevel(expanded_path, canback, hostname, mode, flags,
+                          pid, mnt_pt_checksum, lazy_subdir, nhostdirs);
+        canback->store->Unlink(marker.c_str());
+        return(rv);
+    }
+    if (rv != PLFS_EEXIST) {
+        mlog(CON_DRARE, "create of marker %s failed: %s", marker.c_str(),
+             strplfserr(rv));
+        return(makeTopLevel(expanded_path, canback, hostname, mode, flags,
+                            pid, mnt_pt_checksum, lazy_subdir, nhostdirs));
+    }
+
+    /* someone else is making it, wait for them */
+    pb.bpath = expanded_path;
+    pb.back = canback;
+    start = Util::getTime();
+    delay = 1000;
+    while (Util::getTime() - start < CREATE_WAIT_SECS) {
+        usleep(delay);
+        delay = min(delay * 2, (useconds_t)CREATE_MAX_POLL);
+        if (Container::isContainer(&pb, NULL)) {
+            mlog(CON_DCOMMON, "%s: %s made by another proc after %.3fs",
+                 __FUNCTION__, expanded_path.c_str(), Util::getTime() - start);
+            return((flags & O_EXCL) ? PLFS_EEXIST : PLFS_SUCCESS);
+        }
+        if (canback->store->Lstat(marker.c_str(), &st) == PLFS_ENOENT) {
+            break;    /* creator failed, try it ourselves */
+        }
+    }
+
+    mlog(CON_DRARE, "%s: gave up waiting for %s after %.3fs", __FUNCTION__,
+         expanded_path.c_str(), Util::getTime() - start);
+    rv = makeTopLevel(expanded_path, canback, hostname, mode, flags,
+                      pid, mnt_pt_checksum, lazy_subdir, nhostdirs);
+    if (rv == PLFS_SUCCESS) {
+        canback->store->Unlink(marker.c_str());   /* in case it is stale */
+    }
+    return(rv);
+}
 
 // return PLFS_SUCCESS or PLFS_E*
 static plfs_error_t
 createHelper(struct plfs_physpathinfo *ppip, const string& hostname,
              mode_t mode, int flags, int * /* extra_attempts */,
-             pid_t pid, bool lazy_subdir)
+             pid_t pid, bool lazy_subdir, size_t nhostdirs)
 {
     // this below comment is specific to FUSE
     // TODO we're in a mutex here so only one thread will
@@ -370,6 +577,7 @@ createHelper(struct plfs_physpathinfo *ppip, const string& hostname,
     struct plfs_pathback pb;
     pb.bpath = ppip->canbpath;
     pb.back = ppip->canback;
+    bool coordinated = (ppip->mnt_pt->coordinated_create != 0);
     bool tmpres = Container::isContainer( &pb, &existing_mode );
     // check if someone is trying to overwrite a directory?
     if (!tmpres && S_ISDIR(existing_mode)) {
@@ -395,12 +603,36 @@ createHelper(struct plfs_physpathinfo *ppip, const string& hostname,
                  ppip->canbpath.c_str(), strplfserr(ret));
             return(ret);
         }
+        if (existing_container) {
+            append_truncate_path(ppip, 0);
+        }
+    }
+    /*
+     * an existing container is only made again to lose the race to
+     * it, coordinated_create skips that.  we always look for it here
+     * (another node may have removed it), the cache is only for the
+     * writers that open it next (see establish_writehostdir).
+     */
+    if (coordinated && existing_container) {
+        remember_dir(ppip->canbpath);
+        return(PLFS_SUCCESS);
     }
     mlog(CON_DCOMMON, "Making top level container %s %x",
          ppip->canbpath.c_str(),mode);
     begin_time = time(NULL);
-    ret = makeTopLevel( ppip->canbpath, ppip->canback, hostname, mode,
-                        flags, pid, ppip->mnt_pt->checksum, lazy_subdir );
+    if (coordinated) {
+        ret = makeTopLevelCoordinated(ppip->canbpath, ppip->canback,
+                                      hostname, mode, flags, pid,
+                                      ppip->mnt_pt->checksum, lazy_subdir,
+                                      nhostdirs);
+        if (ret == PLFS_SUCCESS) {
+            remember_dir(ppip->canbpath);
+        }
+    } else {
+        ret = makeTopLevel( ppip->canbpath, ppip->canback, hostname, mode,
+                            flags, pid, ppip->mnt_pt->checksum, lazy_subdir,
+                            nhostdirs );
+    }
     end_time = time(NULL);
     if ( end_time - begin_time > 2 ) {
         mlog(CON_WARN, "WTF: TopLevel create of %s took %.2f",
@@ -569,6 +801,168 @@ Container::removeOpenrecord(const string& path,struct plfs_backend *canback,
     return canback->store->Unlink( openrecord.c_str() );
 }
 
+static string
+get_openlease( const string& path, const char *host, time_t expiry)
+{
+    ostringstream oss;
+    oss << Container::getMetaDirPath( path ) << "/" <<
+        OPENPREFIX << host << "." << LEASETAG << expiry;
+    return oss.str();
+}
+
+/**
+ * Container::touchOpenlease: the open_lease version of addOpenrecord.
+ * the record says the host may have the file open until the expiry in
+ * its name, and is never removed by a close.  expiries are rounded to
+ * half the lease, so all the procs of a host that open the file in the
+ * same half lease share one record and a proc only makes a new one
+ * (removing the one it replaces) when the old one has less than half
+ * the lease left.
+ *
+ * @param canbpath the bpath to the canonical container
+ * @param canback the backend the canonical container resides on
+ * @param hostname the host to create the record under
+ * @param lease the length of the lease in seconds
+ * @param renew the time to call us again to keep the lease is put here
+ * @return PLFS_SUCCESS on success otherwise PLFS_E*
+ */
+plfs_error_t
+Container::touchOpenlease(const string& canbpath,
+                          struct plfs_backend *canback,
+                          const char *hostname, int lease, time_t *renew)
+{
+    time_t half = max(lease / 2, 1);
+    time_t expiry = Container::openleaseRenewal(lease) + half;
+    time_t old = 0;
+    map<string,time_t>::iterator itr;
+    plfs_error_t ret;
+
+    *renew = expiry - half;
+    Util::MutexLock(&leases_mux, __FUNCTION__);
+    itr = leases.find(canbpath);
+    if (itr != leases.end()) {
+        old = itr->second;
+    }
+    Util::MutexUnlock(&leases_mux, __FUNCTION__);
+    if (old >= expiry) {
+        return(PLFS_SUCCESS);      /* still has half the lease left */
+    }
+
+    string openlease = get_openlease( canbpath, hostname, expiry );
+    ret = Util::MakeFile(openlease.c_str(), DROPPING_MODE, canback->store);
+    if (ret == PLFS_ENOENT || ret == PLFS_ENOTDIR) {
+        makeSubdir( getMetaDirPath(canbpath), CONTAINER_MODE, canback );
+        ret = Util::MakeFile(openlease.c_str(), DROPPING_MODE, canback->store);
+    }
+    if ( ret != PLFS_SUCCESS ) {
+        mlog(CON_INFO, "Couldn't make open lease %s: %s",
+             openlease.c_str(), strplfserr( ret ) );
+        return(ret);
+    }
+    if (old) {
+        /* the new record covers the host, another proc may beat us */
+        string oldlease = get_openlease( canbpath, hostname, old );
+        canback->store->Unlink( oldlease.c_str() );
+    }
+    Util::MutexLock(&leases_mux, __FUNCTION__);
+    leases[canbpath] = expiry;
+    Util::MutexUnlock(&leases_mux, __FUNCTION__);
+    return(PLFS_SUCCESS);
+}
+
+/**
+ * Container::openleaseRenewal: when a lease made now has to be renewed
+ * (it then has half the lease left).  procs that share a lease but do
+ * not make it (e.g. the ranks of an MPI job but rank 0) use this to
+ * keep it going if they outlive its maker.
+ *
+ * @param lease the length of the lease in seconds
+ * @return the time to renew at
+ */
+time_t
+Container::openleaseRenewal(int lease)
+{
+    time_t half = max(lease / 2, 1);
+    return((time(NULL) / half + 1) * half);
+}
+
+/**
+ * Container::liveOpenrecord: see if a metadir dropping says a host may
+ * have the file open: an open record, or a lease that hasn't expired.
+ * the name is open.host.pid or open.host.leaseEXPIRY.  the host can
+ * contain the "." character as part of a FQDN (maybe we should have
+ * used something other than "."?), so we look for the last one.
+ *
+ * @param dropping the name of the dropping
+ * @param now the time to check lease expiry against
+ * @param host the host is put here if it is live (may be NULL)
+ * @return true if it is a live open record
+ */
+bool
+Container::liveOpenrecord(const string& dropping, time_t now, string *host)
+{
+    size_t lastdot;
+
+    if (!istype(dropping,OPENPREFIX)) {
+        return(false);
+    }
+    lastdot = dropping.rfind(".");
+    if (dropping.compare(lastdot + 1, strlen(LEASETAG), LEASETAG) == 0 &&
+        atol(dropping.c_str() + lastdot + 1 + strlen(LEASETAG)) <= now) {
+        return(false);             /* expired lease */
+    }
+    if (host) {
+        *host = dropping.substr(strlen(OPENPREFIX),
+                                lastdot - strlen(OPENPREFIX));
+    }
+    return(true);
+}
+
+/**
+ * Container::hasOpenrecord: see if some host may have the container
+ * open for writing.  an unexpired lease outlives the open that made
+ * it, so the caller says whether it counts.
+ *
+ * @param canbpath the bpath to the canonical container
+ * @param canback the backend the canonical container resides on
+ * @param leases true if unexpired leases count as open records
+ * @param except the records of this host don't count (may be NULL)
+ * @param host the host of the first record found is put here (may be NULL)
+ * @return true if a live open record (or lease) was found
+ */
+bool
+Container::hasOpenrecord(const string& canbpath,
+                         struct plfs_backend *canback, bool leases,
+                         const char *except, string *host)
+{
+    set<string> entries;
+    set<string>::iterator itr;
+    ReaddirOp rop(NULL,&entries,false,true);
+    time_t now = time(NULL);
+    string recordhost;
+    size_t lastdot;
+
+    if (rop.op(getMetaDirPath(canbpath).c_str(), DT_DIR,
+               canback->store) != PLFS_SUCCESS) {
+        return(false);        /* no metadir, no open records */
+    }
+    for (itr = entries.begin() ; itr != entries.end() ; itr++) {
+        if (!liveOpenrecord(*itr, now, &recordhost) ||
+            (except != NULL && recordhost == except)) {
+            continue;
+        }
+        lastdot = itr->rfind(".");
+        if (leases || itr->compare(lastdot + 1, strlen(LEASETAG),
+                                   LEASETAG) != 0) {
+            if (host) {
+                *host = recordhost;
+            }
+            return(true);
+        }
+    }
+    return(false);
+}
+
 #define BLKSIZE 512
 
 blkcnt_t
@@ -584,12 +978,13 @@ Container::bytesToBlocks( size_t total_bytes )
 plfs_error_t
 Container::create(struct plfs_physpathinfo *ppip,
                    const string& hostname, mode_t mode, int flags,
-                   int *extra_attempts, pid_t pid, bool lazy_subdir)
+                   int *extra_attempts, pid_t pid, bool lazy_subdir,
+                   size_t nhostdirs)
 {
     plfs_error_t ret = PLFS_SUCCESS;
     do {
         ret = createHelper(ppip, hostname, mode, flags, extra_attempts,
-                           pid, lazy_subdir);
+                           pid, lazy_subdir, nhostdirs);
         if ( ret != PLFS_SUCCESS ) {
             if ( ret != PLFS_EEXIST && ret != PLFS_ENOENT && ret != PLFS_EISDIR
                     && ret != PLFS_ENOTEMPTY ) {
@@ -639,18 +1034,25 @@ Container::establish_writehostdir(const ContainerPaths& paths,
              paths.canonical.c_str());
         ret = createMetalink(paths.canonicalback,paths.shadowback,
                              paths.canonical_hostdir, physical_hostdir,
-                             phys_backp, use_metalink);
+                             phys_backp, use_metalink, paths.nhostdirs);
     } else {
         use_metalink = false;
         // make the canonical container and hostdir
         mlog(CON_DCOMMON,"Making canonical hostdir at %s w/parent",
              paths.canonical.c_str());
-        ret = makeSubdir(paths.canonical.c_str(),mode,paths.canonicalback);
+        /* coordinated_create: a container we just made or found */
+        bool known = known_dir(paths.canonical);
+        if (known) {
+            ret = PLFS_SUCCESS;
+        } else {
+            ret = makeSubdir(paths.canonical.c_str(),mode,
+                             paths.canonicalback);
+        }
 
         if (ret == PLFS_SUCCESS ||
             ret == PLFS_EEXIST || ret == PLFS_EISDIR) { /* otherwise fail */
-            PlfsConf *pconf = get_plfs_conf();
-            size_t current_hostdir = getHostDirId(hostname), id = 0;
+            size_t current_hostdir = getHostDirId(hostname, paths.nhostdirs);
+            size_t id = 0;
             bool subdir = false;
             string canonical_path_without_id =
                 paths.canonical + '/' + HOSTDIRPREFIX;
@@ -669,13 +1071,23 @@ Container::establish_writehostdir(const ContainerPaths& paths,
              * directory or use the first existing one (or try to find
              * a valid metalink if all else fails)
              */
-            for(size_t i = 0; i < (unsigned int) pconf->num_hostdirs; i ++ ) {
-                id = (current_hostdir + i)%pconf->num_hostdirs;
+            for(size_t i = 0; i < paths.nhostdirs; i ++ ) {
+                id = (current_hostdir + i)%paths.nhostdirs;
                 oss.str(std::string());
                 oss << canonical_path_without_id << id;
+                if (known && known_dir(oss.str())) {
+                    ret = PLFS_SUCCESS;
+                    subdir = true;
+                    physical_hostdir = oss.str();
+                    *phys_backp = paths.canonicalback;
+                    break;
+                }
                 ret = makeSubdir(oss.str().c_str(),mode,paths.canonicalback);
                 if (Util::isDirectory(oss.str().c_str(),
                                       paths.canonicalback->store)) {
+                    if (known) {
+                        remember_dir(oss.str());
+                    }
                     /* made subdir (or another proc did it for us) */
                     ret = PLFS_SUCCESS;
                     subdir = true;
@@ -728,6 +1140,58 @@ Container::establish_writehostdir(const ContainerPaths& paths,
     return(ret);
 }
 
+/**
+ * Container::establish_clonehostdir: make a hostdir for plfs_clone on
+ * a given backend, so the droppings of the source file there can be
+ * linked into it.  it is a subdir of the canonical container if that
+ * is on the backend, otherwise a shadow hostdir behind a metalink.  as
+ * with writers, we may get a hostdir on another backend if there are
+ * no free slots.
+ *
+ * @param canbpath bpath of the canonical container
+ * @param canback backend of the canonical container
+ * @param back the backend we want the hostdir on
+ * @param physical_hostdir bpath of resulting hostdir goes here
+ * @param phys_backp physical_hostdir's backend is placed here
+ * @return PLFS_SUCCESS or PLFS_E*
+ */
+plfs_error_t
+Container::establish_clonehostdir(const string& canbpath,
+                                  struct plfs_backend *canback,
+                                  struct plfs_backend *back,
+                                  string& physical_hostdir,
+                                  struct plfs_backend **phys_backp) {
+    char *hostname;
+    size_t nhostdirs, current_hostdir, i;
+    ostringstream oss;
+    bool use_metalink;
+    plfs_error_t ret;
+
+    Util::hostname(&hostname);
+    nhostdirs = getFanout(canbpath, canback);
+    current_hostdir = getHostDirId(hostname, nhostdirs);
+
+    if (back != canback) {
+        oss << canbpath << "/" << HOSTDIRPREFIX << current_hostdir;
+        return(createMetalink(canback, back, oss.str(), physical_hostdir,
+                              phys_backp, use_metalink, nhostdirs));
+    }
+
+    /* skip slots already taken by metalinks */
+    ret = PLFS_EEXIST;
+    for (i = 0 ; i < nhostdirs && ret == PLFS_EEXIST ; i++) {
+        oss.str(std::string());
+        oss << canbpath << "/" << HOSTDIRPREFIX
+            << (current_hostdir + i) % nhostdirs;
+        ret = makeSubdir(oss.str(), DROPPING_MODE, canback);
+    }
+    if (ret == PLFS_SUCCESS) {
+        physical_hostdir = oss.str();
+        *phys_backp = canback;
+    }
+    return(ret);
+}
+
 /**
  * findContainerPaths: generates a bunch of derived paths from a bnode
  * and PlfsMount
@@ -737,13 +1201,14 @@ Container::establish_writehostdir(const ContainerPaths& paths,
  * @param canbpath canonical container path
  * @param canback canonical backend
  * @param paths resulting paths are placed here
+ * @param nhostdirs hostdir fan-out of the container (0 for num_hostdirs)
  * @return PLFS_SUCCESS or PLFS_E*
  */
 plfs_error_t
 Container::findContainerPaths(const string& bnode, PlfsMount *pmnt,
                               const string& canbpath,
                               struct plfs_backend *canback,
-                              ContainerPaths& paths) {
+                              ContainerPaths& paths, size_t nhostdirs) {
     /*
      * example: logical file = /m/plfs/dir/file, mount point=/m/plfs,
      *          backends =/m/pan34, /m/pan23
@@ -766,11 +1231,12 @@ Container::findContainerPaths(const string& bnode, PlfsMount *pmnt,
     int hash_val;
 
     hash_val = (Util::hashValue(hostname) % pmnt->nshadowback);
+    paths.nhostdirs = nhostdirs ? nhostdirs : get_plfs_conf()->num_hostdirs;
     paths.shadowback = pmnt->shadow_backends[hash_val];
     paths.shadow_backend = paths.shadowback->bmpoint;
     paths.shadow = paths.shadow_backend + "/" + bnode;
     paths.shadow_hostdir = Container::getHostDirPath(paths.shadow,hostname,
-                           PERM_SUBDIR);
+                           PERM_SUBDIR, paths.nhostdirs);
     
     /* XXX: not used? */
     paths.hostdir=paths.shadow_hostdir.substr(paths.shadow.size(),string::npos);
@@ -779,7 +1245,8 @@ Container::findContainerPaths(const string& bnode, PlfsMount *pmnt,
     paths.canonical = canbpath;
     /* canbpath == paths.canonical_backend + "/" + bnode */
     paths.canonical_hostdir=Container::getHostDirPath(paths.canonical,
-                                                      hostname, PERM_SUBDIR);
+                                                      hostname, PERM_SUBDIR,
+                                                      paths.nhostdirs);
     return PLFS_SUCCESS;  // no expansion errs.  All paths derived and returned
 }
 
@@ -797,24 +1264,90 @@ Container::getAccessFilePath(const string& path)
     return accessfile;
 }            
 
+/**
+ * Container::fanoutForWriters: pick the number of hostdirs for a new
+ * container from the number of procs expected to write it.  this is
+ * the rule the plfsrc man page gives for num_hostdirs: the lowest prime
+ * at least the square root of the number of writers.
+ *
+ * @param num_writers the hint from Plfs_open_opt (0 if none)
+ * @return the fan-out, or 0 to use num_hostdirs from the plfsrc
+ */
+size_t
+Container::fanoutForWriters(int num_writers)
+{
+    size_t n = 1, d;
+
+    if (num_writers <= 0) {
+        return(0);
+    }
+    while (n * n < (size_t)num_writers) {
+        n++;                          /* ceil(sqrt(num_writers)) */
+    }
+    for ( ; n > 1 && n < MAX_HOSTDIRS ; n++) {
+        for (d = 2; d * d <= n && n % d != 0; d++)
+            ;
+        if (d * d > n) {
+            break;                    /* n is prime */
+        }
+    }
+    return(min(n, (size_t)MAX_HOSTDIRS));
+}
+
+/**
+ * Container::getFanout: read the hostdir fan-out recorded in a
+ * container when it was created.
+ *
+ * @param canbpath canonical container path
+ * @param canback canonical backend
+ * @return the fan-out, num_hostdirs if the container has none
+ */
+size_t
+Container::getFanout(const string& canbpath, struct plfs_backend *canback)
+{
+    string fanout = canbpath + "/" + FANOUTFILE;
+    IOSHandle *fh;
+    char buf[32];
+    ssize_t got;
+    long n = 0;
+
+    if (canback->store->Open(fanout.c_str(), O_RDONLY, 0, &fh) ==
+        PLFS_SUCCESS) {
+        if (fh->Read(buf, sizeof(buf) - 1, &got) == PLFS_SUCCESS && got > 0) {
+            buf[got] = '\0';
+            n = atol(buf);
+        }
+        canback->store->Close(fh);
+        if (n <= 0 || n > MAX_HOSTDIRS) {
+            mlog(CON_DRARE, "%s: bad fan-out in %s", __FUNCTION__,
+                 fanout.c_str());
+            n = 0;
+        }
+    }
+    return(n ? (size_t)n : get_plfs_conf()->num_hostdirs);
+}
+
 size_t      
-Container::getHostDirId( const string& hostname )
+Container::getHostDirId( const string& hostname, size_t nhostdirs )
 {
-    PlfsConf *pconf = get_plfs_conf();
-    return (Util::hashValue(hostname.c_str())%pconf->num_hostdirs);
+    if (nhostdirs == 0) {
+        nhostdirs = get_plfs_conf()->num_hostdirs;
+    }
+    return (Util::hashValue(hostname.c_str())%nhostdirs);
 }           
 
 // this function is maybe one easy place where we can fix things
 // if the hostdir path includes a symlink....
 string          
 Container::getHostDirPath( const string& expanded_path,
-                           const string& hostname, subdir_type type )
+                           const string& hostname, subdir_type type,
+                           size_t nhostdirs )
 {  
     //if expanded_path contains HOSTDIRPREFIX, then return it.
     if (expanded_path.find(HOSTDIRPREFIX) != string::npos) {
         return expanded_path;
     }                    
-    size_t host_value = getHostDirId(hostname);
+    size_t host_value = getHostDirId(hostname, nhostdirs);
     ostringstream oss;
     oss << expanded_path << "/";
     if (type == TMP_SUBDIR) {
@@ -922,25 +1455,28 @@ file_mode( mode_t mode )
 /*
  * discover_openhosts: function that interates over the set of files
  * in a metadir to find hosts that have the container open.  helper
- * function for getattr.  the filename format is open.host.pid.  note
- * that the we have to be careful, as the host can contain the "."
- * character as part of a FQDN (maybe we should have used something
- * other than "."?).  the resulting set of open hostnames is returned
- * in openhosts.
+ * function for getattr.  see Container::liveOpenrecord for the
+ * filename format.  the resulting set of open hostnames is returned
+ * in openhosts.  expired open_lease records are never renewed in
+ * place (a renewal makes a new one), so we reap any we come across.
  */
 static plfs_error_t
-discover_openhosts(set<string> &entries, set<string> &openhosts)
+discover_openhosts(const string& metadir, struct plfs_backend *canback,
+                   set<string> &entries, set<string> &openhosts)
 {
     set<string>::iterator itr; 
     string host;
+    time_t now = time(NULL);
     for(itr=entries.begin(); itr!=entries.end(); itr++) {
-        if (istype(*itr,OPENPREFIX)) {
-            host = (*itr);
-            host.erase(0,strlen(OPENPREFIX));  /* remove prefix */
-            host.erase(host.rfind("."), host.size()); /* remove pid w/rfind */
+        if (Container::liveOpenrecord(*itr, now, &host)) {
             mlog(CON_DCOMMON, "Host %s has open handle", host.c_str());
             openhosts.insert(host);
-        }   
+        } else if (istype(*itr,OPENPREFIX)) {
+            /* errors ignored, the next getattr tries again */
+            string expired = metadir + "/" + *itr;
+            mlog(CON_DCOMMON, "Reaping expired lease %s", expired.c_str());
+            canback->store->Unlink(expired.c_str());
+        }
     }   
     return PLFS_SUCCESS;
 }
@@ -1007,7 +1543,8 @@ Container::getattr(struct plfs_physpathinfo *ppip, struct stat *stbuf,
     ret = PLFS_SUCCESS;
 
     /* generate set of all hosts with file open, ignores ret val. */
-    (void) discover_openhosts(entries, openHosts);
+    (void) discover_openhosts(getMetaDirPath(ppip->canbpath),
+                              ppip->canback, entries, openHosts);
     
     /* examine all last_offset/size droppings to generate size info */
     for(itr=entries.begin(); itr!=entries.end(); itr++) {
@@ -1193,6 +1730,7 @@ decomposeHostDirPath(const string& hostdir,
  * @param physical_hostdir resulting bpath to hostdir on shadow
  * @param physbackp the backend physical_hostdir is on
  * @param use_metalink set to true if using metalink
+ * @param nhostdirs hostdir fan-out of the container
  * @return PLFS_SUCCESS on success, PLFS_E* on failure
  */
 static plfs_error_t
@@ -1201,9 +1739,8 @@ createMetalink(struct plfs_backend *canback,
                const string& canonical_hostdir,
                string& physical_hostdir,
                struct plfs_backend **physbackp,
-               bool& use_metalink) {
+               bool& use_metalink, size_t nhostdirs) {
 
-    PlfsConf *pconf = get_plfs_conf();  /* for num_hostdirs */
     string container_path;              /* canonical bpath to container */
     size_t current_hostdir;             /* canonical hostdir# from caller */
     string canonical_path_without_id;   /* canonical hostdir bpath w/o id */
@@ -1214,11 +1751,6 @@ createMetalink(struct plfs_backend *canback,
 
     ret = PLFS_EIO;  /* to be safe */
 
-    /*
-     * no need to check pconf to see if it is null, if we get this far
-     * into the code, we've definitely already loaded the config.
-     */
-       
     /* break up canonical_hostdir bpath into 2 parts */
     decomposeHostDirPath(canonical_hostdir, container_path, current_hostdir);
     canonical_path_without_id = container_path + '/' + HOSTDIRPREFIX;
@@ -1239,9 +1771,9 @@ createMetalink(struct plfs_backend *canback,
      * our number is busy, we try the next.  if we can't find a free
      * slot, we can just use a hostdir from the canonical container.
      */
-    for ( i = 0, dir_id = -1 ; i < (unsigned int) pconf->num_hostdirs ; i++) {
+    for ( i = 0, dir_id = -1 ; i < nhostdirs ; i++) {
         /* start with current and go from there, wrapping as needed... */
-        id = (current_hostdir + i) % pconf->num_hostdirs;
+        id = (current_hostdir + i) % nhostdirs;
 
         /* put bpath to canonical hostdir slot we are trying in oss */
         oss.str(std::string());  /* cryptic C++, zeros oss? */
@@ -1362,6 +1894,8 @@ Container::transferCanonical(const plfs_pathback *from,
     CreateOp cop(mode);
     cop.ignoreErrno(PLFS_EEXIST);
     cop.ignoreErrno(PLFS_EISDIR);
+    /* read before the fanout file moves, for the metalinks below */
+    size_t nhostdirs = getFanout(from->bpath, from->back);
 
     /* read old canonical dir to get list of items to look at */
     ret = rop.op(from->bpath.c_str(), DT_DIR, from->back->store);
@@ -1389,10 +1923,10 @@ Container::transferCanonical(const plfs_pathback *from,
         case DT_REG:
             /*
              * all top-level files within container are zero-length
-             * except for global index.  We should really copy global
-             * index over.  Someone do that later.  Now we just ophan
-             * it.  for the zero length ones, just create them new,
-             * delete old.
+             * except for global index, the truncate log and fanout.  We should
+             * really copy global index over.  Someone do that later.  Now
+             * we just ophan it.  for the zero length ones, just create
+             * them new, delete old.
              */
             int size;
             Util::Filesize(old_path.c_str(), from->back->store, &size);
@@ -1404,6 +1938,15 @@ Container::transferCanonical(const plfs_pathback *from,
             } else {
                 if(istype(itr->first,GLOBALINDEX)) {
                     /* XXX: copy global index (currently we just discard) */
+                } else if(istype(itr->first,TRUNCLOG) ||
+                          istype(itr->first,FANOUTFILE)) {
+                    /* these must move, data depends on them */
+                    ret = Util::CopyFile(old_path.c_str(), from->back->store,
+                                         new_path.c_str(), to->back->store);
+                    if (ret == PLFS_SUCCESS) {
+                        ret = uop.op(old_path.c_str(), DT_REG,
+                                     from->back->store);
+                    }
                 } else {
                     /* something unexpected in container */
                     assert(0 && itr->first=="");  /* shouldn't happen */
@@ -1430,7 +1973,7 @@ Container::transferCanonical(const plfs_pathback *from,
 
                 ret = createMetalink(to->back, mbackout, new_path,
                                      physical_hostdir, &physback,
-                                     use_metalink);
+                                     use_metalink, nhostdirs);
             }
             if (ret==PLFS_SUCCESS) {
                 ret = uop.op(old_path.c_str(), DT_LNK, from->back->store);
@@ -1462,7 +2005,7 @@ Container::transferCanonical(const plfs_pathback *from,
 
                 ret = createMetalink(to->back, from->back,
                                      new_path, physical_hostdir, &physback,
-                                     use_metalink);
+                                     use_metalink, nhostdirs);
             } else {
                 /*
                  * something unexpected if we're here try including
@@ -33,6 +33,7 @@ typedef struct {
     string canonical_backend;            /* full path of canonical backend */
     struct plfs_backend *shadowback;     /* use to access shadow */
     struct plfs_backend *canonicalback;  /* use to access canonical */
+    size_t nhostdirs;                    /* hostdir fan-out of container */
 } ContainerPaths;
 
 /**
@@ -50,6 +51,15 @@ class Container
                                            const char *, pid_t );
     static plfs_error_t removeOpenrecord(const string&, struct plfs_backend *,
                                          const char *, pid_t );
+    static plfs_error_t touchOpenlease(const string&, struct plfs_backend *,
+                                       const char *, int lease,
+                                       time_t *renew);
+    static time_t openleaseRenewal(int lease);
+    static bool liveOpenrecord(const string& dropping, time_t now,
+                               string *host);
+    static bool hasOpenrecord(const string& canbpath,
+                              struct plfs_backend *canback, bool leases,
+                              const char *except, string *host);
 
     static blkcnt_t bytesToBlocks( size_t total_bytes );
     static plfs_error_t collectContents(const string& physical,
@@ -61,20 +71,31 @@ class Container
                                         bool full_path);
     static plfs_error_t create(struct plfs_physpathinfo *,
                                const string&, mode_t mode, int flags, 
-                               int *extra_attempts,pid_t, bool lazy_subdir );
+                               int *extra_attempts,pid_t, bool lazy_subdir,
+                               size_t nhostdirs = 0 );
+    static void forgetContainer(const string& canbpath);
     static plfs_error_t establish_writehostdir(const ContainerPaths& paths,
                                                mode_t mode,
                                                string& physical_hostdir,
                                                struct plfs_backend **phys_backp,
                                                bool& use_metalink);
+    static plfs_error_t establish_clonehostdir(const string& canbpath,
+                                        struct plfs_backend *canback,
+                                        struct plfs_backend *back,
+                                        string& physical_hostdir,
+                                        struct plfs_backend **phys_backp);
     static plfs_error_t findContainerPaths(const string&, PlfsMount *,
                                            const string&,
                                            struct plfs_backend *,
-                                           ContainerPaths&);
+                                           ContainerPaths&,
+                                           size_t nhostdirs = 0);
     static string getAccessFilePath(const string& path);
-    static size_t getHostDirId(const string&);
+    static size_t fanoutForWriters(int num_writers);
+    static size_t getFanout(const string& canbpath, struct plfs_backend *);
+    static size_t getHostDirId(const string&, size_t nhostdirs = 0);
     static string getHostDirPath(const string&,
-                                 const string&, subdir_type );
+                                 const string&, subdir_type,
+                                 size_t nhostdirs = 0 );
     static string getMetaDirPath( const string& );
     static plfs_error_t getattr(struct plfs_physpathinfo *, struct stat *,
                                 Container_OpenFile *);
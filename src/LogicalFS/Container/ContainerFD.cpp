@@ -6,10 +6,14 @@
 #include "plfs_parallel_reader.h"
 #include "mlog_oss.h"
 #include "XAttrs.h"
+#include "Metrics.h"
 #include "Container.h"
 #include "ContainerIndex.h"
 #include "ContainerFS.h"
 #include "ContainerFD.h"
+#include "container_compress.h"
+#include "container_checksum.h"
+#include "container_append.h"
 
 /*
  * note on revised reference counting: Container_fd can only be in one
@@ -49,6 +53,71 @@ Container_fd::~Container_fd()
     return;
 }
 
+/*
+ * dropping_wrapped: true if data droppings are written through one
+ * of the wrapper handles of compress_droppings and data_checksums.
+ */
+static bool dropping_wrapped(Container_OpenFile *cof) {
+    PlfsMount *pmnt = cof->pathcpy.mnt_pt;
+
+    return((pmnt->compress_droppings && pmnt->fileindex_type == CI_BYTERANGE)
+           || pmnt->data_checksums);
+}
+
+/**
+ * open_dropping_fh: open a data dropping for appending.  on mounts
+ * with compress_droppings (byterange index only) the dropping is
+ * written in compressed frames (see container_compress.h), and on
+ * mounts with data_checksums it is checksummed as it is written (see
+ * container_checksum.h).
+ *
+ * @param cof the open file structure
+ * @param path the path of the dropping
+ * @param mode the mode to create it with
+ * @param fhp the handle (output)
+ * @param physoffp the physical offset of its end for a compressed
+ *        dropping, -1 for a plain one (output)
+ * @return PLFS_SUCCESS or an error code
+ */
+static plfs_error_t open_dropping_fh(Container_OpenFile *cof,
+                                     const char *path, mode_t mode,
+                                     IOSHandle **fhp, off_t *physoffp) {
+    PlfsMount *pmnt = cof->pathcpy.mnt_pt;
+    IOStore *store = cof->subdirback->store;
+    IOSHandle *datafh;
+    plfs_error_t rv;
+    off_t vsize, dataend;
+
+    *physoffp = -1;
+    if (pmnt->compress_droppings && pmnt->fileindex_type == CI_BYTERANGE) {
+        rv = zdrop_open(store, path, mode, &datafh, &vsize);
+        if (rv == PLFS_SUCCESS) {
+            *physoffp = ZDROP_OFFSET_FLAG + vsize;
+        }
+    } else {
+        rv = store->Open(path, O_WRONLY|O_APPEND|O_CREAT, mode, &datafh);
+    }
+    if (rv != PLFS_SUCCESS || !pmnt->data_checksums) {
+        *fhp = datafh;
+        return(rv);
+    }
+
+    /* the checksums cover the stream the physical offsets are in */
+    if (*physoffp >= 0) {
+        dataend = vsize;
+    } else {
+        rv = datafh->Size(&dataend);
+    }
+    if (rv == PLFS_SUCCESS) {
+        rv = sum_open(store, sum_dropping_path(path).c_str(), mode, datafh,
+                      dataend, fhp);
+    }
+    if (rv != PLFS_SUCCESS) {
+        store->Close(datafh);
+    }
+    return(rv);
+}
+
 /**
  * try_openwritedropping: helper function that tries to and open a
  * writedropping.  establish will call this.  it may fail if the
@@ -67,6 +136,7 @@ static plfs_error_t try_openwritedropping(Container_OpenFile *cof,
     ostringstream ts, drop_pathstream;
     mode_t old_mode;
     IOSHandle *fh;
+    off_t physoff;
     
     ts.setf(ios::fixed,ios::floatfield);
     ts << cof->createtime;
@@ -75,9 +145,8 @@ static plfs_error_t try_openwritedropping(Container_OpenFile *cof,
         ts.str() << "." << cof->hostname << "." << pid;
 
     old_mode = umask(0); /* XXX: umask has no effect on non-posix iostores */
-    rv = cof->subdirback->store->Open(drop_pathstream.str().c_str(),
-                                      O_WRONLY|O_APPEND|O_CREAT,
-                                      DROPPING_MODE, &fh);
+    rv = open_dropping_fh(cof, drop_pathstream.str().c_str(),
+                          DROPPING_MODE, &fh, &physoff);
     umask(old_mode);
 
     /* tell index about new dropping */
@@ -99,9 +168,11 @@ static plfs_error_t try_openwritedropping(Container_OpenFile *cof,
         /*
          * XXX: possible for a pid to open/close/reopen dropping.
          * reuse old physoffset[pid]... or should we be stat'ing
-         * the dropping?
+         * the dropping?  (compressed droppings know their end.)
          */
-        if (cof->physoffsets.find(pid) == cof->physoffsets.end()) {
+        if (physoff >= 0) {
+            cof->physoffsets[pid] = physoff;
+        } else if (cof->physoffsets.find(pid) == cof->physoffsets.end()) {
             cof->physoffsets[pid] = 0;
         }
         cof->paths[fh] = drop_pathstream.str();
@@ -162,6 +233,24 @@ static plfs_error_t close_writedropping(Container_OpenFile *cof, pid_t pid) {
 }
 
 
+/*
+ * close_rdsums: close the sum droppings opened for reading
+ *
+ * locking: modifies cof, assume caller locked cof
+ */
+static void
+close_rdsums(Container_OpenFile *cof) {
+    map<string,struct rdchunkhand>::iterator rsi;
+
+    for (rsi = cof->rdsums.begin() ; rsi != cof->rdsums.end() ; rsi++) {
+        if (rsi->second.fh != NULL) {
+            rsi->second.backend->store->Close(rsi->second.fh);
+        }
+    }
+    cof->rdsums.clear();
+}
+
+
 /**
  * Container_fd::establish_writedroping: create a dropping for writing
  *
@@ -206,14 +295,22 @@ Container_fd::establish_writedropping(pid_t pid) {
      * fully created try and help create it, finally try the third
      * time to finish.
      */
-    for (int attempts = 0 ; attempts < 2 ; attempts++) {
+    for (int attempts = 0 ; attempts < 3 ; attempts++) {
 
         rv = try_openwritedropping(cof, pid);   /* can fail w/ENOENT */
-        if (rv != PLFS_ENOENT) {
+        if (rv != PLFS_ENOENT || attempts == 2) {
             /* we stop looping on success or !ENOENT error */
             break;
         }
 
+        /*
+         * coordinated_create: a hostdir we remembered may have been
+         * removed by another node since, so look for real this time.
+         */
+        if (attempts > 0) {
+            Container::forgetContainer(cof->pathcpy.canbpath);
+        }
+
         /*
          * if we get here, the hostdir wasn't there and we want to
          * create it (possibly creating a shadow container and a
@@ -234,7 +331,8 @@ Container_fd::establish_writedropping(pid_t pid) {
         rv = Container::findContainerPaths(cof->pathcpy.bnode,
                                            cof->pathcpy.mnt_pt,
                                            cof->pathcpy.canbpath,
-                                           cof->pathcpy.canback, xpaths);
+                                           cof->pathcpy.canback, xpaths,
+                                           cof->nhostdirs);
         if (rv != PLFS_SUCCESS) {
             break;
         }
@@ -360,7 +458,8 @@ Container_fd::open(struct plfs_physpathinfo *ppip, int openflags, pid_t pid,
          * FUSE will route O_CREAT as its own call to f_mknod first,
          * and then call open.
          */
-        ret = containerfs.xcreate(ppip, mode, openflags, pid);
+        ret = containerfs.xcreate(ppip, mode, openflags, pid,
+                                  open_opt ? open_opt->num_writers : 0);
         if (ret == PLFS_SUCCESS && (openflags & O_TRUNC)) {
             /*
              * NOTE: this assumes that containerfs.create does a truncate
@@ -437,7 +536,9 @@ Container_fd::open(struct plfs_physpathinfo *ppip, int openflags, pid_t pid,
          * here, farm it out to a helper function (below).  helper
          * will allocated a new cof and install in it our fd.
          */
-        ret = this->establish_helper(ppip, my_rwarg, pid, mode, open_opt);
+        ret = this->establish_helper(ppip, my_rwarg,
+                                     (openflags & O_APPEND) != 0, pid, mode,
+                                     open_opt);
 
     }
     
@@ -454,6 +555,7 @@ Container_fd::open(struct plfs_physpathinfo *ppip, int openflags, pid_t pid,
  *
  * @param ppip pathinfo for the new file
  * @param rwflags trimmed version of open flags (RD, WR, or RDWR)
+ * @param append opened with O_APPEND
  * @param pid the pid opening the file
  * @param mode the mode to open the file in
  * @param open_opt open options
@@ -461,7 +563,8 @@ Container_fd::open(struct plfs_physpathinfo *ppip, int openflags, pid_t pid,
  */
 plfs_error_t 
 Container_fd::establish_helper(struct plfs_physpathinfo *ppip, int my_rwarg,
-                               pid_t pid, mode_t mode, Plfs_open_opt *open_opt) 
+                               bool append, pid_t pid, mode_t mode,
+                               Plfs_open_opt *open_opt) 
 {
     plfs_error_t ret = PLFS_SUCCESS;
     Container_OpenFile *cof;
@@ -481,6 +584,10 @@ Container_fd::establish_helper(struct plfs_physpathinfo *ppip, int my_rwarg,
     cof->refcnt = 1;
     cof->cof_index = NULL;
     cof->subdirback = ppip->canback; /* init even if RDONLY */
+    cof->nhostdirs = 0;              /* num_hostdirs until we know */
+    cof->lease_renew = 0;
+    cof->append = NULL;
+    cof->sum_reads = 0;
 
     /* copypathinfo: only C++ stl mallocs, so delete will free */
     ret = plfs_copypathinfo(&cof->pathcpy, ppip);
@@ -493,6 +600,31 @@ Container_fd::establish_helper(struct plfs_physpathinfo *ppip, int my_rwarg,
     cof->pid = pid;
     cof->mode = mode;
 
+    /*
+     * shared_append: appending writers get their offsets from the
+     * append counter, so the index need not load what is already there
+     * (see index_open).  the counter only orders the writers of this
+     * node, so if another host has the file open for writing we write
+     * at the offsets we are given, as without shared_append.
+     */
+    if (append && my_rwarg != O_RDONLY && ppip->mnt_pt->shared_append) {
+        string host;
+        char *hostname;
+
+        Util::hostname(&hostname);
+        if (Container::hasOpenrecord(ppip->canbpath, ppip->canback, true,
+                                     hostname, &host)) {
+            mlog(INT_DCOMMON, "%s: %s is open for writing on %s, "
+                 "not sharing the end of file", __FUNCTION__,
+                 ppip->canbpath.c_str(), host.c_str());
+        } else {
+            ret = append_attach(ppip, &cof->append);
+            if (ret != PLFS_SUCCESS) {
+                goto done;
+            }
+        }
+    }
+
     /* allocate an index */
     cof->cof_index = container_index_alloc(ppip->mnt_pt);
     if (cof->cof_index == NULL) {
@@ -523,8 +655,10 @@ Container_fd::establish_helper(struct plfs_physpathinfo *ppip, int my_rwarg,
          * the path here.
          */
         ostringstream oss;
+        cof->nhostdirs = Container::getFanout(ppip->canbpath,
+                                              ppip->canback);
         oss << ppip->canbpath << "/" << HOSTDIRPREFIX <<
-            Container::getHostDirId(cof->hostname);
+            Container::getHostDirId(cof->hostname, cof->nhostdirs);
         cof->subdir_path = oss.str();
 
         if (!get_plfs_conf()->lazy_droppings &&
@@ -547,7 +681,17 @@ Container_fd::establish_helper(struct plfs_physpathinfo *ppip, int my_rwarg,
          */
         add_meta = (open_opt && open_opt->pinter == PLFS_MPIIO
                     && pid != 0) ? false : true;
-        if (add_meta) {
+        if (add_meta && ppip->mnt_pt->open_lease) {
+            /* a lease instead, renewed as it runs out while we are open */
+            (void) Container::touchOpenlease(ppip->canbpath, ppip->canback,
+                                             cof->hostname,
+                                             ppip->mnt_pt->open_lease,
+                                             &cof->lease_renew);
+        } else if (ppip->mnt_pt->open_lease) {
+            /* rank 0 made it, we renew it if we outlive rank 0 */
+            cof->lease_renew =
+                Container::openleaseRenewal(ppip->mnt_pt->open_lease);
+        } else if (add_meta) {
             /* ignore error ? */
             (void) Container::addOpenrecord(ppip->canbpath, ppip->canback,
                                             cof->hostname, pid);
@@ -575,6 +719,9 @@ Container_fd::establish_helper(struct plfs_physpathinfo *ppip, int my_rwarg,
             if (cof->cof_index) {
                 delete cof->cof_index;
             }
+            if (cof->append) {
+                append_detach(cof->append);
+            }
             delete cof;
         }
 
@@ -583,6 +730,36 @@ Container_fd::establish_helper(struct plfs_physpathinfo *ppip, int my_rwarg,
     return(ret);
 }
 
+/**
+ * renew_openlease: keep the open_lease of our host going while the
+ * file is open here.  called by write, sync, getattr and close, it
+ * only goes to the backend once the lease is down to half its time.
+ * the cof must not be locked by the caller, we don't hold it over the
+ * create and unlink.
+ *
+ * @param cof the open file
+ */
+static void
+renew_openlease(Container_OpenFile *cof)
+{
+    time_t renew;
+
+    Util::MutexLock(&cof->cof_mux, __FUNCTION__);
+    renew = cof->lease_renew;
+    Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
+    if (renew == 0 || time(NULL) < renew) {
+        return;                    /* no lease, or plenty left */
+    }
+    if (Container::touchOpenlease(cof->pathcpy.canbpath,
+                                  cof->pathcpy.canback, cof->hostname,
+                                  cof->pathcpy.mnt_pt->open_lease,
+                                  &renew) == PLFS_SUCCESS) {
+        Util::MutexLock(&cof->cof_mux, __FUNCTION__);
+        cof->lease_renew = renew;
+        Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
+    }
+}
+
 plfs_error_t 
 Container_fd::close(pid_t pid, uid_t uid, int /* open_flags */,
                     Plfs_close_opt *close_opt, int *num_ref)
@@ -602,6 +779,11 @@ Container_fd::close(pid_t pid, uid_t uid, int /* open_flags */,
 
     /* XXX: might compare open_flags arg with cof->rwflags, should match */
 
+    /* our host may still have it open through other fds */
+    if (cof->rwflags != O_RDONLY) {
+        renew_openlease(cof);
+    }
+
     /*
      * it is worth noting that reading and writing are handled
      * differently.  for writing, each PID has its own private log
@@ -700,9 +882,11 @@ Container_fd::close(pid_t pid, uid_t uid, int /* open_flags */,
 
                 /* XXXCDC: should check/log errors */
                 bend->store->Close(fh);
+                Metrics::add(PM_CHUNK_HANDLES, -1);
             }
 
         }
+        close_rdsums(cof);
         /*
          * note: the cof destructor will free the rest of the rdchunks map
          * when we delete cof (below).
@@ -745,14 +929,25 @@ Container_fd::close(pid_t pid, uid_t uid, int /* open_flags */,
                                cof->hostname, uid, cof->createtime,
                                close_opt ? close_opt->pinter : -1,
                                m_nproc);
-            Container::removeOpenrecord(cof->pathcpy.canbpath,
-                                        cof->pathcpy.canback,
-                                        cof->hostname,
-                                        cof->pid);
+            if (!cof->lease_renew) {  /* leases just expire */
+                Container::removeOpenrecord(cof->pathcpy.canbpath,
+                                            cof->pathcpy.canback,
+                                            cof->hostname,
+                                            cof->pid);
+            }
         }
         
     }
 
+    /*
+     * the meta dropping is down, so a new append counter would now be
+     * seeded with what we wrote.
+     */
+    if (cof->append) {
+        append_detach(cof->append);
+        cof->append = NULL;
+    }
+
     this->fd = NULL;    /* now no one else can see it */
 
     /* XXX: do we need to unlock to destroy? */
@@ -788,6 +983,165 @@ Container_fd::read(char *buf, size_t size, off_t offset, ssize_t *bytes_read)
     return(ret);
 }
 
+plfs_error_t
+Container_fd::read_fdextent(size_t size, off_t offset, int *fdp,
+                            off_t *fdoff, size_t *len)
+{
+    if (this->fd->rwflags == O_WRONLY) {
+        return(PLFS_EBADF);
+    }
+    if (this->fd->pathcpy.mnt_pt->data_checksums) {
+        return(PLFS_ENOTSUP);        /* the reader threads check the data */
+    }
+    return(plfs_parallel_reader_fdextent(this, size, offset, fdp,
+                                         fdoff, len));
+}
+
+/**
+ * Container_fd::extent_map: list the data extents of a range of the
+ * file.  holes and zero_blocks runs come back from the index as hole
+ * records, we skip them and merge the records that continue the same
+ * piece of a dropping.
+ *
+ * @param offset start of the range
+ * @param length its length
+ * @param extents the extents go here (may be NULL if *nextents is 0)
+ * @param nextents in: size of extents (0 to count), out: extents found
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+Container_fd::extent_map(off_t offset, size_t length, Plfs_extent *extents,
+                         int *nextents)
+{
+    plfs_error_t ret = PLFS_SUCCESS;
+    Container_OpenFile *cof = this->fd;
+    list<index_record> irecs;
+    list<index_record>::iterator itr;
+    map<string, int> droppings;
+    Plfs_extent scratch, *cur;
+    int id, maxext, n;
+    off_t ptr, end, physoff;
+    bool full;
+
+    if (cof->rwflags == O_WRONLY) {
+        return(PLFS_EBADF);
+    }
+    maxext = *nextents;
+    n = 0;
+    cur = NULL;
+    full = false;
+    ptr = offset;
+    end = offset + length;
+
+    while (ptr < end && !full) {
+        ret = cof->cof_index->index_query(cof, ptr, end - ptr, irecs);
+        if (ret != PLFS_SUCCESS || irecs.empty()) {
+            break;              /* error or EOF */
+        }
+        for (itr = irecs.begin() ; itr != irecs.end() ; itr++) {
+            if (!itr->hole) {
+                id = droppings.insert(make_pair(itr->datapath,
+                                      (int)droppings.size())).first->second;
+                physoff = itr->chunk_offset & ~ZDROP_OFFSET_FLAG;
+                if (cur != NULL && cur->dropping == id &&
+                    cur->logical + (off_t)cur->length == ptr &&
+                    cur->physical + (off_t)cur->length == physoff) {
+                    cur->length += itr->length;
+                } else if (maxext > 0 && n == maxext) {
+                    full = true;
+                    break;
+                } else {
+                    cur = (maxext > 0) ? &extents[n] : &scratch;
+                    n++;
+                    cur->logical = ptr;
+                    cur->physical = physoff;
+                    cur->length = itr->length;
+                    cur->dropping = id;
+                    cur->flags = (itr->chunk_offset & ZDROP_OFFSET_FLAG) ?
+                        PLFS_EXTENT_ENCODED : 0;
+                }
+            }
+            ptr += itr->length;
+        }
+        irecs.clear();
+    }
+
+    *nextents = n;
+    mlog(CON_DAPI, "%s(%s @ %ld for %ld) = %d extents", __FUNCTION__,
+         cof->pathcpy.canbpath.c_str(), (long)offset, (long)length, n);
+    return(ret);
+}
+
+/**
+ * is_zero_block: check a block for non-zero bytes.  it ORs together
+ * eight words at a time, a loop the compiler can vectorize, and only
+ * looks at the result once per 64 bytes.
+ *
+ * @param buf the block
+ * @param len its length
+ * @return true if every byte of it is zero
+ */
+static bool
+is_zero_block(const char *buf, size_t len)
+{
+    uint64_t w[8], acc;
+    size_t lcv;
+    int i;
+
+    for (lcv = 0 ; lcv + sizeof(w) <= len ; lcv += sizeof(w)) {
+        memcpy(w, buf + lcv, sizeof(w));      /* buf may be unaligned */
+        acc = 0;
+        for (i = 0 ; i < 8 ; i++) {
+            acc |= w[i];
+        }
+        if (acc != 0) {
+            return(false);
+        }
+    }
+    for (/*null*/ ; lcv < len ; lcv++) {
+        if (buf[lcv] != 0) {
+            return(false);
+        }
+    }
+    return(true);
+}
+
+/**
+ * zero_block_run: find the first run of a write for zero_blocks.  the
+ * write is cut at multiples of zblock in the file: full blocks of zeros
+ * go into zero runs, everything else (including partial blocks at the
+ * ends) into data runs.
+ *
+ * @param buf the data
+ * @param size its length
+ * @param offset its logical offset
+ * @param zblock the zero_blocks block size
+ * @param zero set to true if the run is all zero blocks (output)
+ * @return the length of the run
+ */
+static size_t
+zero_block_run(const char *buf, size_t size, off_t offset, size_t zblock,
+               bool *zero)
+{
+    size_t head, run;
+
+    head = (zblock - offset % zblock) % zblock;
+    *zero = (head == 0 && size >= zblock && is_zero_block(buf, zblock));
+    if (head == 0) {
+        run = 0;
+    } else {
+        run = min(head, size);      /* leading partial block is data */
+    }
+    while (run + zblock <= size &&
+           is_zero_block(buf + run, zblock) == *zero) {
+        run += zblock;
+    }
+    if (!*zero && run + zblock > size) {
+        run = size;                 /* so is a trailing one */
+    }
+    return(run);
+}
+
 plfs_error_t 
 Container_fd::write(const char *buf, size_t size, off_t offset, pid_t pid, 
                     ssize_t *bytes_written)
@@ -799,6 +1153,8 @@ Container_fd::write(const char *buf, size_t size, off_t offset, pid_t pid,
     off_t oldphysoff;
     ssize_t written;
     double begin, end;
+    size_t zblock, done, len;
+    bool zero;
 
     if (cof->rwflags == O_RDONLY) {
         return(PLFS_EBADF);
@@ -843,29 +1199,74 @@ Container_fd::write(const char *buf, size_t size, off_t offset, pid_t pid,
         goto done;
     }
 
-    oldphysoff = cof->physoffsets[pid];
-    
-    Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
-    begin = Util::getTime();
-    written = 0;
-    if (size != 0) {
-        ret = wfh->Write(buf, size, &written);
+    /*
+     * O_APPEND: like pwrite(2) on an fd opened with it, the data goes
+     * at the end of the file no matter what offset we were given.  the
+     * range is ours once reserved, if we fail to fill it it is a hole.
+     */
+    if (cof->append && size > 0) {
+        offset = append_reserve(cof->append, size);
     }
-    end = Util::getTime();
-    Util::MutexLock(&cof->cof_mux, __FUNCTION__);
 
-    *bytes_written = written;
-    if (written > 0) {
-        cof->physoffsets[pid] += written;
+    zblock = 0;
+    if (cof->pathcpy.mnt_pt->fileindex_type == CI_BYTERANGE) {
+        zblock = cof->pathcpy.mnt_pt->zero_blocks;
     }
 
-    if (ret == PLFS_SUCCESS) {
-        ret = cof->cof_index->index_add(cof, written, offset,
-                                        pid, oldphysoff, begin, end);
-    }
+    /*
+     * write the data in runs.  without zero_blocks there is only one.
+     * with it, runs of zero blocks are only added to the index.
+     */
+    *bytes_written = 0;
+    done = 0;
+    do {
+        len = size - done;
+        zero = false;
+        if (zblock != 0 && len != 0) {
+            len = zero_block_run(buf + done, len, offset + done, zblock,
+                                 &zero);
+        }
+
+        if (zero) {
+            begin = end = Util::getTime();
+            written = len;
+            ret = cof->cof_index->index_add(cof, len, offset + done, pid,
+                                            ZERO_OFFSET_FLAG + offset + done,
+                                            begin, end);
+            Metrics::add(PM_ZERO_BLOCK_BYTES, len);
+        } else {
+            oldphysoff = cof->physoffsets[pid];
+
+            Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
+            begin = Util::getTime();
+            written = 0;
+            if (len != 0) {
+                ret = wfh->Write(buf + done, len, &written);
+            }
+            end = Util::getTime();
+            Util::MutexLock(&cof->cof_mux, __FUNCTION__);
+
+            if (written > 0) {
+                cof->physoffsets[pid] += written;
+            }
+
+            if (ret == PLFS_SUCCESS) {
+                ret = cof->cof_index->index_add(cof, written, offset + done,
+                                                pid, oldphysoff, begin, end);
+            }
+        }
+
+        if (written > 0) {
+            done += written;
+            *bytes_written = done;
+        }
+    } while (ret == PLFS_SUCCESS && written == (ssize_t)len && done < size);
 
  done:
     Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
+    if (ret == PLFS_SUCCESS) {
+        renew_openlease(cof);
+    }
     return(ret);
 }
 
@@ -901,6 +1302,7 @@ Container_fd::sync()
         }
 
         ret = firsterr;
+        renew_openlease(cof);
     }
 
     return(ret);
@@ -917,6 +1319,16 @@ Container_fd::sync(pid_t pid)
     cof = this->fd;
 
     if (cof->rwflags != O_RDONLY) {   /* no need to sync r/o fd */
+        /*
+         * the index is shared by all the pids, so the records of the
+         * others go out too.  their data must be there first if it
+         * is buffered in a compressed frame.
+         */
+        if (cof->pathcpy.mnt_pt->compress_droppings &&
+            cof->pathcpy.mnt_pt->fileindex_type == CI_BYTERANGE) {
+            return(this->sync());
+        }
+
         /* sync data first */
         Util::MutexLock(&cof->cof_mux, __FUNCTION__);
         pid_itr = cof->fhs.find(pid);
@@ -930,6 +1342,7 @@ Container_fd::sync(pid_t pid)
         if (idxret != PLFS_SUCCESS && ret == PLFS_SUCCESS) {
             ret = idxret;  /* data ok, but index write error */
         }
+        renew_openlease(cof);
     }
 
     return(ret);
@@ -951,6 +1364,7 @@ truncate_helper_restorefds(Container_OpenFile *cof) {
     map<pid_t, writefh>::iterator pids_itr;
     map<IOSHandle *,string>::iterator paths_itr;
     string path;
+    off_t physoff;
 
     /* walk all open write droppings */
     for (pids_itr = cof->fhs.begin() ;
@@ -965,6 +1379,10 @@ truncate_helper_restorefds(Container_OpenFile *cof) {
         }
         path = paths_itr->second;
 
+        /* a wrapper must not write its buffered frame or sums back */
+        if (dropping_wrapped(cof)) {
+            (void) pids_itr->second.wfh->Ftruncate(0);
+        }
         ret = cof->subdirback->store->Close(pids_itr->second.wfh);
         if (ret != PLFS_SUCCESS)
             break;
@@ -973,10 +1391,11 @@ truncate_helper_restorefds(Container_OpenFile *cof) {
         pids_itr->second.wfh = NULL;             /* old wfh is gone/closed */
         cof->physoffsets[pids_itr->first] = 0;   /* reset to zero */
                 
-        ret = cof->subdirback->store->Open(path.c_str(),
-                                           O_WRONLY|O_APPEND|O_CREAT,
-                                           cof->mode,
-                                           &pids_itr->second.wfh);
+        ret = open_dropping_fh(cof, path.c_str(), cof->mode,
+                               &pids_itr->second.wfh, &physoff);
+        if (ret == PLFS_SUCCESS && physoff >= 0) {
+            cof->physoffsets[pids_itr->first] = physoff;
+        }
         /*
          * how to recover if the reopen fails?  let's get rid of the
          * rest of the open state and hope we can recreate it on the
@@ -1055,6 +1474,12 @@ Container_fd::trunc(off_t offset)
      */
     if (ret == PLFS_SUCCESS && !no_change) {
 
+        if (cof->append) {
+            append_truncate(cof->append, offset);
+        } else {
+            append_truncate_path(&cof->pathcpy, offset);
+        }
+
         /*
          * if we shrunk the file and we have read data droppings open,
          * the open data droppings handles may no longer be useful.
@@ -1073,7 +1498,9 @@ Container_fd::trunc(off_t offset)
 
                 rdck_itr->second.backend->store->Close(rdck_itr->second.fh);
                 cof->rdchunks.erase(rdck_itr->first);
+                Metrics::add(PM_CHUNK_HANDLES, -1);
             }
+            close_rdsums(cof);
             Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
         }
     }
@@ -1119,6 +1546,7 @@ Container_fd::getattr(struct stat *stbuf, int sz_only)
     }
     
     if (ret == PLFS_SUCCESS && writing) {
+        renew_openlease(cof);
         eofoff = wbytes = 0;
         if (cof->cof_index &&
             cof->cof_index->index_info(eofoff, wbytes) != PLFS_SUCCESS) {
@@ -1130,6 +1558,10 @@ Container_fd::getattr(struct stat *stbuf, int sz_only)
         if (eofoff > stbuf->st_size) {
             stbuf->st_size = eofoff;
         }
+        /* other appenders on this node may have reserved more */
+        if (cof->append && append_eof(cof->append) > stbuf->st_size) {
+            stbuf->st_size = append_eof(cof->append);
+        }
         if (im_lazy) {
             stbuf->st_blocks = Container::bytesToBlocks(wbytes);
         }
@@ -1347,6 +1779,7 @@ Container_fd::renamefd(struct plfs_physpathinfo *ppip_to)
         }
     }
     cof->rdchunks.clear();
+    close_rdsums(cof);
 
     /* now get rid of open write droppings at old location */
     for (witr = cof->fhs.begin() ; witr != cof->fhs.end() ; witr++) {
@@ -1361,7 +1794,7 @@ Container_fd::renamefd(struct plfs_physpathinfo *ppip_to)
     /* reset subdir info */
     ostringstream oss;
     oss << ppip_to->canbpath << "/" << HOSTDIRPREFIX <<
-        Container::getHostDirId(cof->hostname);
+        Container::getHostDirId(cof->hostname, cof->nhostdirs);
     cof->subdir_path = oss.str();
     cof->subdirback = ppip_to->canback;
 
@@ -1519,8 +1952,10 @@ Container_fd::read_chunkfh(string bpath, struct plfs_backend *backend,
     /* found it! */
     if (rcki != cof->rdchunks.end()) {
         *fhp = rcki->second.fh;
+        Metrics::add(PM_CHUNKFH_HITS, 1);
         return(PLFS_SUCCESS);
     }
+    Metrics::add(PM_CHUNKFH_MISSES, 1);
     
     /*
      * not currently open, so we must open it.  we do the open with
@@ -1551,6 +1986,7 @@ Container_fd::read_chunkfh(string bpath, struct plfs_backend *backend,
         rdc.backend = backend;
         rdc.fh = *fhp;
         cof->rdchunks[key] = rdc;
+        Metrics::add(PM_CHUNK_HANDLES, 1);
     }
     Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
 
@@ -1565,6 +2001,84 @@ Container_fd::read_chunkfh(string bpath, struct plfs_backend *backend,
     return(ret);
 }
 
+/*
+ * read_sumfh: get the read handle of the sum dropping of a chunk, and
+ * remember the ones which have none (written without data_checksums).
+ *
+ * @param cof the open file
+ * @param bpath the bpath of the data dropping
+ * @param backend the backend it is on
+ * @param fhp the handle, NULL if the chunk has no sums (output)
+ * @return PLFS_SUCCESS or error code
+ */
+static plfs_error_t
+read_sumfh(Container_OpenFile *cof, const string& bpath,
+           struct plfs_backend *backend, IOSHandle **fhp) {
+    plfs_error_t ret;
+    string sumpath, key;
+    map<string,struct rdchunkhand>::iterator rsi;
+    struct rdchunkhand rds;
+    IOSHandle *closeme = NULL;
+
+    sumpath = sum_dropping_path(bpath);
+    key = backend->prefix + sumpath;
+    Util::MutexLock(&cof->cof_mux, __FUNCTION__);
+    rsi = cof->rdsums.find(key);
+    if (rsi != cof->rdsums.end()) {
+        *fhp = rsi->second.fh;
+        Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
+        return(PLFS_SUCCESS);
+    }
+    Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
+
+    /* open with the lock dropped, like read_chunkfh */
+    ret = backend->store->Open(sumpath.c_str(), O_RDONLY, fhp);
+    if (ret == PLFS_ENOENT) {
+        *fhp = NULL;
+    } else if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    Util::MutexLock(&cof->cof_mux, __FUNCTION__);
+    rsi = cof->rdsums.find(key);
+    if (rsi != cof->rdsums.end()) {       /* lost race! */
+        closeme = *fhp;
+        *fhp = rsi->second.fh;
+    } else {
+        rds.backend = backend;
+        rds.fh = *fhp;
+        cof->rdsums[key] = rds;
+    }
+    Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
+    if (closeme != NULL) {
+        backend->store->Close(closeme);
+    }
+    return(PLFS_SUCCESS);
+}
+
+/*
+ * Container_fd::read_chunkcheck: on data_checksums mounts, check what
+ * a read task got against the chunk's sum dropping.  with
+ * data_checksums N > 1 only one task in N is checked.
+ */
+plfs_error_t
+Container_fd::read_chunkcheck(ParallelReadTask *task, IOSHandle *fh,
+                              ssize_t readlen) {
+    Container_OpenFile *cof = this->fd;
+    int every = cof->pathcpy.mnt_pt->data_checksums;
+    IOSHandle *sumfh;
+    plfs_error_t ret;
+
+    if (every == 0 || readlen <= 0 ||
+        (every > 1 && __sync_fetch_and_add(&cof->sum_reads, 1) % every)) {
+        return(PLFS_SUCCESS);
+    }
+    ret = read_sumfh(cof, task->bpath, task->backend, &sumfh);
+    if (ret != PLFS_SUCCESS || sumfh == NULL) {
+        return(ret);
+    }
+    return(sum_verify(fh, sumfh, task->buf, readlen, task->chunk_offset));
+}
+
 
 plfs_error_t
 Container_fd::extend(off_t offset)
@@ -1580,14 +2094,28 @@ Container_fd::extend(off_t offset)
         ret = PLFS_EBADF;   /* not open for writing */
 
     } else {
-        beginend = Util::getTime();
         /*
-         * since this is a zero length write, the physical offset
-         * doesn't matter.  so rather than looking it up, just set it
-         * to zero.
+         * the record has to land in an index dropping, or reads will
+         * not see the new EOF (with lazy_droppings nothing may have
+         * been written through this fd yet).
          */
-        ret = cof->cof_index->index_add(cof, 0, offset, cof->pid, 0,
-                                        beginend, beginend);
+        ret = PLFS_SUCCESS;
+        Util::MutexLock(&cof->cof_mux, __FUNCTION__);
+        if (cof->fhs.find(cof->pid) == cof->fhs.end()) {
+            ret = this->establish_writedropping(cof->pid);
+        }
+        Util::MutexUnlock(&cof->cof_mux, __FUNCTION__);
+
+        if (ret == PLFS_SUCCESS) {
+            beginend = Util::getTime();
+            /*
+             * since this is a zero length write, the physical offset
+             * doesn't matter.  so rather than looking it up, just set
+             * it to zero.
+             */
+            ret = cof->cof_index->index_add(cof, 0, offset, cof->pid, 0,
+                                            beginend, beginend);
+        }
     }
         
     return(ret);
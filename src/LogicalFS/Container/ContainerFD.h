@@ -41,6 +41,12 @@ class Container_fd : public Plfs_fd
                               list<ParallelReadTask> *tasks);
     plfs_error_t read_chunkfh(string bpath, struct plfs_backend *backend,
                               IOSHandle **fhp);
+    plfs_error_t read_chunkcheck(ParallelReadTask *task, IOSHandle *fh,
+                                 ssize_t readlen);
+    plfs_error_t read_fdextent(size_t size, off_t offset, int *fdp,
+                               off_t *fdoff, size_t *len);
+    plfs_error_t extent_map(off_t offset, size_t length,
+                            Plfs_extent *extents, int *nextents);
     
     /* ... end of LogicalFD API functions */
 
@@ -54,7 +60,8 @@ class Container_fd : public Plfs_fd
         
  private:
     plfs_error_t establish_helper(struct plfs_physpathinfo *ppip, int flags,
-                             pid_t pid, mode_t mode, Plfs_open_opt *open_opt);
+                             bool append, pid_t pid, mode_t mode,
+                             Plfs_open_opt *open_opt);
     plfs_error_t establish_writedropping(pid_t pid);
     plfs_error_t set_writesubdir(Container_OpenFile *cof);
     
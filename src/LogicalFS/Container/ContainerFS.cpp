@@ -7,6 +7,7 @@
 #include "ContainerIndex.h"
 #include "ContainerFS.h"
 #include "ContainerFD.h"
+#include "container_append.h"
 
 /*
  * containerfs is src/Plfsrc/parse_conf.cpp's link to container mode
@@ -416,7 +417,8 @@ containerfs_zero_helper(struct plfs_physpathinfo *ppip, int open_file,
     
     /*
      * now get rid of all the droppings (except for the access file,
-     * meta files, and version files).  we ignore ENOENT since it is
+     * meta files, version files, and the fan-out that says which
+     * hostdirs the writers use).  we ignore ENOENT since it is
      * possible that the set of files can contain duplicates.
      * duplicates are possible bec a backend can be defined in both
      * shadow_backends and backends.  note that "open_file" is used
@@ -433,6 +435,7 @@ containerfs_zero_helper(struct plfs_physpathinfo *ppip, int open_file,
     op.ignore(ACCESSFILE);
     op.ignore(OPENPREFIX);
     op.ignore(VERSIONPREFIX);
+    op.ignore(FANOUTFILE);
     ret = file_operation(ppip, op);
 
     if (ret != PLFS_SUCCESS) {
@@ -539,10 +542,14 @@ ContainerFileSystem::open(Plfs_fd **pfd, struct plfs_physpathinfo *ppip,
  * provided bits except for O_EXCL|O_TRUNC.  logicalfs also does not
  * return an open file descriptor... it just creates the file.  if you
  * want to do I/O to the file, you have to open with a second call.
+ *
+ * num_writers is the Plfs_open_opt hint of how many procs will write
+ * the file.  if the container is new, its hostdir fan-out is sized
+ * for that many (see Container::fanoutForWriters).
  */
 plfs_error_t
 ContainerFileSystem::xcreate(struct plfs_physpathinfo *ppip, mode_t mode,
-                             int flags, pid_t pid)
+                             int flags, pid_t pid, int num_writers)
 {
     plfs_error_t ret = PLFS_SUCCESS;
 
@@ -587,7 +594,8 @@ ContainerFileSystem::xcreate(struct plfs_physpathinfo *ppip, mode_t mode,
     char *hostname;
     Util::hostname(&hostname);
     ret =  Container::create(ppip, hostname, mode, flags, &attempt,
-                             pid, lazy_subdir);
+                             pid, lazy_subdir,
+                             Container::fanoutForWriters(num_writers));
     return(ret);
 }
 
@@ -637,6 +645,7 @@ ContainerFileSystem::rename(struct plfs_physpathinfo *ppip,
 
     mlog(INT_DAPI, "%s: %s -> %s", __FUNCTION__, ppip->canbpath.c_str(),
          ppip_to->canbpath.c_str());
+    Container::forgetContainer(ppip->canbpath);
 
     /* first check if there is a file already at dst.  If so, remove it. */
     if (is_container_file(ppip_to, NULL)) {
@@ -773,6 +782,115 @@ ContainerFileSystem::link(struct plfs_physpathinfo * /* ppip */,
     return(PLFS_ENOSYS);
 }
 
+/*
+ * clone_source_busy: true if some host has a file open for writing.
+ * its droppings are still being appended to and may be truncated in
+ * place (see TruncateOp), so they can't be shared with a clone yet.
+ * an open_lease outlives the writer that made it, so leases don't
+ * count.
+ */
+static bool
+clone_source_busy(struct plfs_physpathinfo *ppip)
+{
+    string host;
+
+    if (Container::hasOpenrecord(ppip->canbpath, ppip->canback, false,
+                                 NULL, &host)) {
+        mlog(INT_DRARE, "%s: %s is open for writing on %s",
+             __FUNCTION__, ppip->canbpath.c_str(), host.c_str());
+        return(true);
+    }
+    return(false);
+}
+
+/**
+ * ContainerFileSystem::clone: make a new file with the data of an
+ * existing one.  the data droppings are shared by the two files (see
+ * index_droppings_clone), so this doesn't copy any data.  a file that
+ * is open for writing can't be cloned (PLFS_EBUSY), we check again
+ * once the droppings are linked since a writer may open it meanwhile.
+ *
+ * @param ppip the file to clone
+ * @param ppip_to the clone, must not exist
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t
+ContainerFileSystem::clone(struct plfs_physpathinfo *ppip,
+                           struct plfs_physpathinfo *ppip_to)
+{
+    plfs_error_t ret, rv;
+    Container_fd *cfd;
+    Container_OpenFile *cof;
+    mode_t mode = 0, tomode = 0;
+    struct stat stbuf;
+    off_t lastoff = 0;
+    size_t tbytes = 0;
+    char *hostname;
+    pid_t pid;
+    int nr;
+
+    mlog(INT_DAPI, "%s: %s -> %s", __FUNCTION__, ppip->canbpath.c_str(),
+         ppip_to->canbpath.c_str());
+    if (!is_container_file(ppip, &mode)) {
+        if (mode == 0) {
+            return(PLFS_ENOENT);
+        }
+        return(S_ISDIR(mode) ? PLFS_EISDIR : PLFS_EINVAL);
+    }
+    /* create would truncate an existing file, so check first */
+    if (is_container_file(ppip_to, &tomode) || tomode != 0) {
+        return(PLFS_EEXIST);
+    }
+    if (clone_source_busy(ppip)) {
+        return(PLFS_EBUSY);
+    }
+
+    /* open the source so we get its index (including open writers) */
+    pid = getpid();
+    cfd = new Container_fd();
+    ret = cfd->open(ppip, O_RDONLY, pid, mode, NULL);
+    if (ret != PLFS_SUCCESS) {
+        delete cfd;
+        return(ret);
+    }
+    cof = cfd->get_cof();
+
+    ret = this->create(ppip_to, mode, O_CREAT, pid);
+    if (ret == PLFS_SUCCESS) {
+        ret = cof->cof_index->index_droppings_clone(cof, ppip_to, &lastoff,
+                                                    &tbytes);
+        /* a writer that opened after our check may share the droppings */
+        if (ret == PLFS_SUCCESS && clone_source_busy(ppip)) {
+            ret = PLFS_EBUSY;
+        }
+        /* a truncate that extended the file is only in its metadata */
+        if (ret == PLFS_SUCCESS &&
+            this->getattr(ppip, &stbuf, 1) == PLFS_SUCCESS &&
+            stbuf.st_size > lastoff) {
+            lastoff = stbuf.st_size;
+        }
+        if (ret == PLFS_SUCCESS) {
+            Util::hostname(&hostname);
+            ret = Container::addMeta(lastoff, tbytes, ppip_to->canbpath,
+                                     ppip_to->canback, hostname, getuid(),
+                                     Util::getTime(), -1, 1);
+        }
+        if (ret != PLFS_SUCCESS) {
+            /* don't leave half a clone behind */
+            ContainerFileSystem::unlink(ppip_to);
+        }
+    }
+
+    rv = cfd->close(pid, getuid(), O_RDONLY, NULL, &nr);
+    if (nr <= 0) {
+        delete cfd;
+    }
+    if (ret == PLFS_SUCCESS) {
+        ret = rv;
+    }
+    return(ret);
+}
+
 plfs_error_t
 ContainerFileSystem::utime(struct plfs_physpathinfo *ppip, struct utimbuf *ut)
 {
@@ -860,6 +978,7 @@ ContainerFileSystem::trunc(struct plfs_physpathinfo *ppip, off_t offset,
     }
 
     if (ret == PLFS_SUCCESS) {
+        append_truncate_path(ppip, offset);
         ret = Container::Utime(ppip->canbpath, ppip->canback, NULL);
     }
     
@@ -882,6 +1001,7 @@ ContainerFileSystem::unlink(struct plfs_physpathinfo *ppip)
     struct plfs_pathback unpb;
     unpb.bpath = unlink_canonical;
     unpb.back = ppip->canback;
+    Container::forgetContainer(unlink_canonical);
     
     struct stat stbuf; 
     if ( (ret = unpb.back->store->Lstat(unlink_canonical.c_str(),
@@ -26,6 +26,8 @@ class ContainerFileSystem : public LogicalFileSystem
                             struct plfs_physpathinfo *ppip_to);
         plfs_error_t link(struct plfs_physpathinfo *ppip, 
                           struct plfs_physpathinfo *ppip_to);
+        plfs_error_t clone(struct plfs_physpathinfo *ppip,
+                           struct plfs_physpathinfo *ppip_to);
         plfs_error_t utime(struct plfs_physpathinfo *ppip, struct utimbuf *ut);
         plfs_error_t unlink( struct plfs_physpathinfo *ppip );
 
@@ -48,7 +50,7 @@ class ContainerFileSystem : public LogicalFileSystem
 
         /* xcreate: like create, but doesn't force O_TRUNC */
         plfs_error_t xcreate(struct plfs_physpathinfo *ppip, mode_t, int flags,
-                             pid_t pid);
+                             pid_t pid, int num_writers = 0);
 };
 
 /* zero helper function, shared with ContainerFD */
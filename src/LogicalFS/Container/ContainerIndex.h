@@ -1,6 +1,14 @@
 
 class Container_OpenFile;   /* forward decl. */
 
+/*
+ * zero_blocks: a write of zeros can be added to the index with this
+ * physical offset (plus its logical offset) instead of being written
+ * to a data dropping.  a query of such an entry returns a hole, so it
+ * masks older data like a write and reads back as zeros.
+ */
+#define ZERO_OFFSET_FLAG ((off_t)1 << 61)
+
 /**
  * index_record: structure that contains the result of an index query
  */
@@ -63,6 +71,10 @@ class ContainerIndex {
         = 0;
     virtual plfs_error_t index_droppings_zero(struct plfs_physpathinfo *ppip)
         = 0;
+    virtual plfs_error_t index_droppings_clone(Container_OpenFile *cof,
+                                               struct plfs_physpathinfo *dst,
+                                               off_t *lastoffp,
+                                               size_t *tbytesp) = 0;
 };
 
 /*
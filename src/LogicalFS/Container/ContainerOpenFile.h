@@ -51,17 +51,23 @@ class Container_OpenFile {
     string subdir_path;                /* path to subdir for our droppings */
     struct plfs_backend *subdirback;   /* dropping backend */
     char *hostname;                    /* cached value of Util::hostname() */
+    size_t nhostdirs;                  /* hostdir fan-out of the container */
     /* the next three maps are protected with data_mux */
     map<pid_t, int> fhs_writers;       /* pid reference count */
     map<pid_t, writefh> fhs;           /* may delay create until first write */
     map<pid_t, off_t> physoffsets;     /* track data dropping phys offsets */
     map<IOSHandle *, string> paths;    /* retain for restore operation */
     double createtime;                 /* used in dropping filenames */
+    time_t lease_renew;                /* open_lease: when to renew, or 0 */
+    struct append_counter *append;     /* O_APPEND: where writes go */
     /* END WRITE SIDE */
 
     /* READ SIDE */
     /* map prefix+bpath => open chunk handle, protected with data_mux */
     map<string, struct rdchunkhand> rdchunks;
+    /* same for their sum droppings, fh is NULL if there is none */
+    map<string, struct rdchunkhand> rdsums;
+    unsigned long sum_reads;           /* data_checksums sampling count */
     /* END READ SIDE */
 };
 
@@ -41,6 +41,9 @@ public:
                                                off_t offset);
     plfs_error_t index_droppings_unlink(struct plfs_physpathinfo *ppip);
     plfs_error_t index_droppings_zero(struct plfs_physpathinfo *ppip);
+    plfs_error_t index_droppings_clone(Container_OpenFile *cof,
+                                       struct plfs_physpathinfo *dst,
+                                       off_t *lastoffp, size_t *tbytesp);
 
  private:
     mdhim_t *mdhix;   /* handle to any open mdhim index */
@@ -28,9 +28,15 @@ using namespace std;
  *
  * used by adplfs_open_helper on our hostname for MPI_Comm_split()
  */
-size_t container_gethostdir_id(char *hostname)
+size_t container_gethostdir_id(char *hostname, char *filename)
 {
-    return Container::getHostDirId(hostname);
+    struct plfs_physpathinfo ppi;
+    size_t nhostdirs = 0;       /* num_hostdirs if we can't tell */
+
+    if (plfs_resolvepath(skipPrefixPath(filename), &ppi) == PLFS_SUCCESS) {
+        nhostdirs = Container::getFanout(ppi.canbpath, ppi.canback);
+    }
+    return Container::getHostDirId(hostname, nhostdirs);
 }
 
 /*
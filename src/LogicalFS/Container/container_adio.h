@@ -19,12 +19,14 @@ extern "C" {
     
     /**
      * container_gethostdir_id: get the hostdir id number for a given
-     * hostname.
+     * hostname in a container (they can have different hostdir
+     * fan-outs).
      *
      * @param hostname name of host of interest
+     * @param filename logical path of the container
      * @return the id number the host maps to
      */
-    extern size_t container_gethostdir_id(char *hostname); 
+    extern size_t container_gethostdir_id(char *hostname, char *filename);
 
     /**
      * container_num_host_dirs: scans a directory that we believe is
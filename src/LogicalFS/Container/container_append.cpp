@@ -0,0 +1,393 @@
+/*
+ * container_append.cpp  the append counter of a container
+ *
+ * see container_append.h.  the counter is a small image in POSIX
+ * shared memory, created the same way as the shared index images of
+ * BRI_Shared.cpp: the creator gets it with O_EXCL, seeds it, and marks
+ * it ready.  processes that attach to it wait for that.
+ *
+ * every attached process holds a shared flock() on the image, which
+ * the kernel drops if the process dies.  so a process that gets an
+ * exclusive lock on it knows no one else is using it: a joiner then
+ * reseeds a counter that was left behind by processes that died, and
+ * a detacher removes it.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "plfs_private.h"
+#include "Container.h"
+#include "Metrics.h"
+#include "container_append.h"
+
+#define APPEND_MAGIC    0x50504141   /* "AAPP" */
+#define APPEND_VERSION  2
+#define APPEND_WAIT     60           /* secs to wait for the seeder */
+#define APPEND_TRIES    3            /* to get around unlink races */
+
+#define APPEND_SEEDING  0            /* the initial zero fill */
+#define APPEND_READY    1
+#define APPEND_FAILED   2            /* seeder failed, don't wait */
+
+struct append_image {
+    uint32_t magic;
+    uint32_t version;
+    volatile int32_t state;   /* APPEND_* */
+    int32_t pad;
+    off_t eof;                /* next append goes here (atomic ops only) */
+};
+
+struct append_counter {
+    struct append_image *image;   /* mapped, or "priv" if not shared */
+    struct append_image priv;
+    string name;                  /* shm_open() name, empty if private */
+    int fd;                       /* holds our flock(), -1 if private */
+};
+
+/**
+ * append_seed: seed a new counter from the metadata of the container
+ *
+ * @param ppip the container
+ * @param image the counter
+ * @return PLFS_SUCCESS or error code
+ */
+static plfs_error_t
+append_seed(struct plfs_physpathinfo *ppip, struct append_image *image)
+{
+    plfs_error_t ret;
+    struct stat st;
+
+    st.st_size = 0;
+    ret = Container::getattr(ppip, &st, NULL);
+    if (ret == PLFS_SUCCESS) {
+        image->magic = APPEND_MAGIC;
+        image->version = APPEND_VERSION;
+        image->eof = st.st_size;
+        Metrics::add(PM_APPEND_SEEDS, 1);
+    }
+    mlog(CON_DCOMMON, "%s %s: eof %ld: %s", __FUNCTION__,
+         ppip->canbpath.c_str(), (long)st.st_size, strplfserr(ret));
+    return(ret);
+}
+
+/**
+ * append_create: we created the shared counter, so seed it.
+ *
+ * @param ppip the container
+ * @param ac the counter to set up
+ * @param fd the new (empty) shared memory object, kept in ac
+ * @return PLFS_SUCCESS or error code
+ */
+static plfs_error_t
+append_create(struct plfs_physpathinfo *ppip, struct append_counter *ac,
+              int fd)
+{
+    plfs_error_t ret;
+    struct append_image *image;
+    void *addr = MAP_FAILED;
+
+    /* before anyone can see it READY, so joiners see us as a user */
+    if (flock(fd, LOCK_SH) == 0 && ftruncate(fd, sizeof(*image)) == 0) {
+        addr = mmap(NULL, sizeof(*image), PROT_READ|PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+    }
+    if (addr == MAP_FAILED) {
+        ret = errno_to_plfs_error(errno);
+        shm_unlink(ac->name.c_str());
+        close(fd);
+        return(ret);
+    }
+
+    image = (struct append_image *)addr;
+    ret = append_seed(ppip, image);
+    if (ret != PLFS_SUCCESS) {
+        image->state = APPEND_FAILED;   /* tell the waiters */
+        shm_unlink(ac->name.c_str());
+        munmap(addr, sizeof(*image));
+        close(fd);
+        return(ret);
+    }
+    __sync_synchronize();   /* the seed must be visible before READY */
+    image->state = APPEND_READY;
+    ac->image = image;
+    ac->fd = fd;
+    return(PLFS_SUCCESS);
+}
+
+/**
+ * append_raise: move the end of the data of a counter up to eof if
+ * it is below it.
+ *
+ * @param image the counter
+ * @param eof where the data ends at least
+ */
+static void
+append_raise(struct append_image *image, off_t eof)
+{
+    off_t old;
+
+    do {
+        old = image->eof;
+    } while (old < eof &&
+             !__sync_bool_compare_and_swap(&image->eof, old, eof));
+}
+
+/**
+ * append_join: map a counter that someone else created, waiting for
+ * it to be seeded if need be.  if no one is using it any more, it was
+ * left behind by processes that died and we seed it again.  if
+ * someone is, the data of the container may still have grown past it
+ * (writes through fds not opened with O_APPEND, or from other nodes),
+ * so we check it against the metadata.
+ *
+ * @param ppip the container
+ * @param ac the counter to set up
+ * @param fd the shared memory object, kept in ac if we attach
+ * @return PLFS_SUCCESS if attached, PLFS_EAGAIN if the counter is being
+ *         removed, or another error if it cannot be used
+ */
+static plfs_error_t
+append_join(struct plfs_physpathinfo *ppip, struct append_counter *ac,
+            int fd)
+{
+    plfs_error_t ret = PLFS_SUCCESS;
+    struct append_image *image = NULL;
+    struct stat st;
+    double start;
+    void *addr;
+    bool stale;
+
+    start = Util::getTime();
+    while (true) {
+        if (fstat(fd, &st) != 0) {
+            ret = errno_to_plfs_error(errno);
+            break;
+        }
+        if (st.st_size >= (off_t)sizeof(*image)) {
+            addr = mmap(NULL, sizeof(*image), PROT_READ|PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                ret = errno_to_plfs_error(errno);
+                break;
+            }
+            image = (struct append_image *)addr;
+            while (image->state == APPEND_SEEDING &&
+                   Util::getTime() - start < APPEND_WAIT) {
+                /* the seeder holds its lock from before the ftruncate */
+                if (flock(fd, LOCK_EX|LOCK_NB) == 0) {
+                    break;           /* so it died, we seed it */
+                }
+                usleep(1000);
+            }
+            break;
+        }
+        if (Util::getTime() - start >= APPEND_WAIT) {
+            ret = PLFS_EBUSY;
+            break;
+        }
+        usleep(1000);
+    }
+    if (image == NULL) {
+        close(fd);
+        return(ret);
+    }
+    __sync_synchronize();
+
+    /* a seeder that died leaves it SEEDING, so check this first */
+    stale = (flock(fd, LOCK_EX|LOCK_NB) == 0);
+    if (!stale && flock(fd, LOCK_SH) != 0) {
+        ret = errno_to_plfs_error(errno);
+    } else if (fstat(fd, &st) != 0) {
+        ret = errno_to_plfs_error(errno);
+    } else if (st.st_nlink == 0) {
+        ret = PLFS_EAGAIN;           /* its last user removed it */
+    } else if (stale) {
+        mlog(CON_DRARE, "%s %s: reseeding a left over counter",
+             __FUNCTION__, ppip->canbpath.c_str());
+        ret = append_seed(ppip, image);
+        if (ret == PLFS_SUCCESS) {
+            __sync_synchronize();
+            image->state = APPEND_READY;
+            if (flock(fd, LOCK_SH) != 0) {
+                ret = errno_to_plfs_error(errno);
+            }
+        }
+    } else if (image->state != APPEND_READY ||
+               image->magic != APPEND_MAGIC ||
+               image->version != APPEND_VERSION) {
+        ret = (image->state == APPEND_FAILED) ? PLFS_EAGAIN : PLFS_EBUSY;
+    } else {
+        st.st_size = 0;
+        ret = Container::getattr(ppip, &st, NULL);
+        if (ret == PLFS_SUCCESS) {
+            append_raise(image, st.st_size);
+        }
+    }
+    if (ret != PLFS_SUCCESS) {
+        munmap(image, sizeof(*image));
+        close(fd);
+        return(ret);
+    }
+    ac->image = image;
+    ac->fd = fd;
+    return(PLFS_SUCCESS);
+}
+
+/**
+ * append_name: generate the shm_open() name of the counter of a
+ * container.
+ *
+ * @param ppip the container
+ * @param name the resulting name
+ * @return PLFS_SUCCESS or error code
+ */
+static plfs_error_t
+append_name(struct plfs_physpathinfo *ppip, string &name)
+{
+    plfs_error_t ret;
+    string fullpath;
+    struct stat st;
+    ostringstream oss;
+
+    ret = ppip->canback->store->Lstat(ppip->canbpath.c_str(), &st);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    fullpath = string(ppip->canback->prefix) + ppip->canbpath;
+    oss << hex << "/plfs.app." << Util::hashValue(fullpath.c_str()) << "."
+        << (unsigned long)st.st_ino;
+    name = oss.str();
+    return(PLFS_SUCCESS);
+}
+
+plfs_error_t
+append_attach(struct plfs_physpathinfo *ppip, struct append_counter **acp)
+{
+    plfs_error_t ret;
+    struct append_counter *ac;
+    int fd, tries;
+
+    ac = new struct append_counter;
+    ac->image = NULL;
+    ac->fd = -1;
+    ret = append_name(ppip, ac->name);
+
+    for (tries = 0 ; ret == PLFS_SUCCESS && tries < APPEND_TRIES ;
+         tries++) {
+
+        fd = shm_open(ac->name.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+        if (fd >= 0) {
+            ret = append_create(ppip, ac, fd);   /* keeps or closes fd */
+            break;
+        }
+        if (errno != EEXIST) {
+            ret = errno_to_plfs_error(errno);
+            break;
+        }
+
+        fd = shm_open(ac->name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                continue;   /* removed by its last user, try again */
+            }
+            ret = errno_to_plfs_error(errno);
+            break;
+        }
+        ret = append_join(ppip, ac, fd);   /* keeps or closes fd */
+        if (ret != PLFS_EAGAIN) {
+            break;
+        }
+        ret = PLFS_SUCCESS;   /* it is going away, try again */
+    }
+
+    if (ac->image == NULL) {
+        /* can't share it, keep our own */
+        mlog(CON_DRARE, "%s %s: private counter (%s)", __FUNCTION__,
+             ppip->canbpath.c_str(),
+             (ret == PLFS_SUCCESS) ? "busy" : strplfserr(ret));
+        ac->name.clear();
+        ac->image = &ac->priv;
+        ret = append_seed(ppip, ac->image);
+        if (ret != PLFS_SUCCESS) {
+            delete ac;
+            return(ret);
+        }
+    }
+    *acp = ac;
+    return(PLFS_SUCCESS);
+}
+
+off_t
+append_reserve(struct append_counter *ac, size_t len)
+{
+    return(__sync_fetch_and_add(&ac->image->eof, (off_t)len));
+}
+
+off_t
+append_eof(struct append_counter *ac)
+{
+    return(__sync_fetch_and_add(&ac->image->eof, 0));
+}
+
+void
+append_truncate(struct append_counter *ac, off_t eof)
+{
+    off_t old;
+
+    do {
+        old = ac->image->eof;
+    } while (!__sync_bool_compare_and_swap(&ac->image->eof, old, eof));
+}
+
+void
+append_truncate_path(struct plfs_physpathinfo *ppip, off_t eof)
+{
+    struct append_counter ac;
+    struct stat st;
+    int fd;
+
+    if (append_name(ppip, ac.name) != PLFS_SUCCESS) {
+        return;
+    }
+    fd = shm_open(ac.name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return;                /* no one is appending on this node */
+    }
+    ac.image = (struct append_image *)MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(*ac.image)) {
+        ac.image = (struct append_image *)mmap(NULL, sizeof(*ac.image),
+                                               PROT_READ|PROT_WRITE,
+                                               MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (ac.image == MAP_FAILED) {
+        return;
+    }
+    /* one that isn't ready is reseeded by the next joiner anyway */
+    if (ac.image->state == APPEND_READY && ac.image->magic == APPEND_MAGIC &&
+        ac.image->version == APPEND_VERSION) {
+        append_truncate(&ac, eof);
+        mlog(CON_DCOMMON, "%s %s: eof %ld", __FUNCTION__,
+             ppip->canbpath.c_str(), (long)eof);
+    }
+    munmap(ac.image, sizeof(*ac.image));
+}
+
+void
+append_detach(struct append_counter *ac)
+{
+    if (ac->image != &ac->priv) {
+        /* if no one else holds it, we are the last user */
+        if (flock(ac->fd, LOCK_EX|LOCK_NB) == 0) {
+            shm_unlink(ac->name.c_str());
+        }
+        munmap(ac->image, sizeof(*ac->image));
+        close(ac->fd);
+    }
+    delete ac;
+}
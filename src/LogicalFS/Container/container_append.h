@@ -0,0 +1,85 @@
+#ifndef __CONTAINER_APPEND_H_
+#define __CONTAINER_APPEND_H_
+
+/*
+ * container_append.h  O_APPEND writes to containers
+ *
+ * with the shared_append mount option, a writer that opens a container
+ * with O_APPEND does not need the index of the data that is already
+ * there, only where it ends.  so it does not load the index at all
+ * (not even for O_RDWR), and gets the offset of each write from an
+ * append counter instead, ignoring the offset it was given.
+ *
+ * the counter is shared by all the processes on a node that have the
+ * container open for appending.  it lives in POSIX shared memory and
+ * is seeded from the metadata summary of the container by the first of
+ * them.  a write reserves its range with an atomic add, so concurrent
+ * appenders on a node never overlap and never take a lock.  the last
+ * process to detach removes it, and one left behind by processes that
+ * died is seeded again by the next process to attach.
+ *
+ * the counter knows nothing of other nodes.  so an appender that
+ * finds the file open for writing on another host doesn't use one
+ * (see establish_helper), but a host that opens the file after we
+ * attached can still write over our appends, and we over its writes.
+ * writes through fds not opened with O_APPEND do not move the counter
+ * (it catches up with them when another appender attaches), truncates
+ * do.
+ */
+
+#include <sys/types.h>
+#include "plfs_private.h"
+
+struct append_counter;
+
+/**
+ * Attach to the append counter of a container, creating and seeding
+ * it if we are the first.  If it can't be shared (e.g. /dev/shm is
+ * not available) we get a private one.
+ *
+ * @param ppip the container
+ * @param acp the counter is placed here
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t append_attach(struct plfs_physpathinfo *ppip,
+                           struct append_counter **acp);
+
+/**
+ * @param ac the counter
+ * @param len the length of the write
+ * @return the logical offset to write len bytes at
+ */
+off_t append_reserve(struct append_counter *ac, size_t len);
+
+/**
+ * @param ac the counter
+ * @return the end of the data reserved so far
+ */
+off_t append_eof(struct append_counter *ac);
+
+/**
+ * Move the end of the data, after a truncate.
+ *
+ * @param ac the counter
+ * @param eof the new end of the data
+ */
+void append_truncate(struct append_counter *ac, off_t eof);
+
+/**
+ * Move the end of the data of the counter of a container, if it has
+ * one on this node, after a truncate through a path or through an fd
+ * not opened with O_APPEND.
+ *
+ * @param ppip the container
+ * @param eof the new end of the data
+ */
+void append_truncate_path(struct plfs_physpathinfo *ppip, off_t eof);
+
+/**
+ * Detach from a counter and free it.
+ *
+ * @param ac the counter
+ */
+void append_detach(struct append_counter *ac);
+
+#endif
@@ -144,14 +144,16 @@ plfs_trim(struct plfs_physpathinfo *ppip, pid_t pid)
     // 3) clean up the shadow container
     ContainerPaths paths;
     ret = Container::findContainerPaths(ppip->bnode, ppip->mnt_pt,
-                                        ppip->canbpath, ppip->canback, paths);
+                                        ppip->canbpath, ppip->canback, paths,
+                                        Container::getFanout(ppip->canbpath,
+                                                             ppip->canback));
     if (ret != PLFS_SUCCESS) {
         return(ret);
     }
     char *hostname;
     Util::hostname(&hostname);
     string replica = Container::getHostDirPath(paths.canonical,hostname,
-                     TMP_SUBDIR);
+                     TMP_SUBDIR, paths.nhostdirs);
     string metalink = paths.canonical_hostdir;
     // rename replica over metalink currently at paths.canonical_hostdir
     // this could fail if a sibling was faster than us
@@ -248,7 +250,9 @@ container_protect(const char *logical, pid_t pid)
     // in canonical
     ContainerPaths paths;
     ret = Container::findContainerPaths(ppi.bnode, ppi.mnt_pt,
-                                        ppi.canbpath, ppi.canback, paths);
+                                        ppi.canbpath, ppi.canback, paths,
+                                        Container::getFanout(ppi.canbpath,
+                                                             ppi.canback));
     if (ret != PLFS_SUCCESS) {
         return(ret);
     }
@@ -256,7 +260,7 @@ container_protect(const char *logical, pid_t pid)
     Util::hostname(&hostname);
     string src = paths.shadow_hostdir;
     string dst = Container::getHostDirPath(paths.canonical,hostname,
-                                           TMP_SUBDIR);
+                                           TMP_SUBDIR, paths.nhostdirs);
     ret = paths.canonicalback->store->Mkdir(dst.c_str(), CONTAINER_MODE);
     if (ret == PLFS_EEXIST || ret == PLFS_EISDIR ) {
         ret = PLFS_SUCCESS;
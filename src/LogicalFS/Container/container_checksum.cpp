@@ -0,0 +1,407 @@
+/*
+ * container_checksum.cpp  checksums of data droppings
+ *
+ * see container_checksum.h for the layout of the sum droppings.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <vector>
+
+#include "plfs_private.h"
+#include "Crc32c.h"
+#include "Metrics.h"
+#include "container_compress.h"
+#include "container_checksum.h"
+
+using namespace std;
+
+#define SUMREC_SIZE ((off_t)sizeof(struct sum_record))
+
+string
+sum_dropping_path(const string& datapath)
+{
+    string sumpath = datapath;
+    size_t slash;
+
+    slash = sumpath.rfind('/');
+    slash = (slash == string::npos) ? 0 : slash + 1;
+    if (sumpath.compare(slash, sizeof(DATAPREFIX) - 1, DATAPREFIX) == 0) {
+        sumpath.replace(slash, sizeof(DATAPREFIX) - 1, SUMPREFIX);
+    }
+    return(sumpath);
+}
+
+/*
+ * SumWriteHandle: the write handle of a checksummed data dropping.  it
+ * wraps the handle of the data dropping (a plain or a compressed one)
+ * and keeps the running checksum of its last block in cur.
+ */
+class SumWriteHandle : public IOSHandle {
+ public:
+    SumWriteHandle(IOStore *newstore, IOSHandle *newdatafh,
+                   IOSHandle *newsumfh);
+    ~SumWriteHandle();
+
+    plfs_error_t Recover(off_t dataend);
+
+    plfs_error_t Fstat(struct stat *sb);
+    plfs_error_t Fsync();
+    plfs_error_t Ftruncate(off_t length);
+    plfs_error_t GetDataBuf(void **bufp, size_t length);
+    plfs_error_t Pread(void *buf, size_t count, off_t offset,
+                       ssize_t *bytes_read);
+    plfs_error_t Pwrite(const void *buf, size_t count, off_t offset,
+                        ssize_t *bytes_written);
+    plfs_error_t Read(void *buf, size_t count, ssize_t *bytes_read);
+    plfs_error_t ReleaseDataBuf(void *buf, size_t length);
+    plfs_error_t Size(off_t *ret_offset);
+    plfs_error_t Write(const void *buf, size_t len, ssize_t *bytes_written);
+
+ private:
+    plfs_error_t Close();
+    plfs_error_t put_records(const struct sum_record *recs, size_t nrecs,
+                             off_t first);
+
+    IOStore *store;
+    IOSHandle *datafh;
+    IOSHandle *sumfh;
+    off_t blockno;               /* the block cur is for */
+    struct sum_record cur;
+    bool active;                 /* false if we can't cover the data */
+    pthread_mutex_t mux;
+};
+
+SumWriteHandle::SumWriteHandle(IOStore *newstore, IOSHandle *newdatafh,
+                               IOSHandle *newsumfh)
+    : store(newstore), datafh(newdatafh), sumfh(newsumfh), blockno(0),
+      active(true)
+{
+    cur.crc = cur.len = 0;
+    pthread_mutex_init(&mux, NULL);
+}
+
+SumWriteHandle::~SumWriteHandle()
+{
+    pthread_mutex_destroy(&mux);
+}
+
+/* continue the checksum of the last block of a reopened dropping */
+plfs_error_t
+SumWriteHandle::Recover(off_t dataend)
+{
+    struct sum_record last;
+    ssize_t got;
+    off_t size;
+    plfs_error_t ret;
+
+    ret = sumfh->Size(&size);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    if (size < SUMREC_SIZE) {
+        active = (dataend == 0);
+        return(PLFS_SUCCESS);
+    }
+    blockno = size / SUMREC_SIZE - 1;
+    ret = sumfh->Pread(&last, sizeof(last), blockno * SUMREC_SIZE, &got);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    if (got != SUMREC_SIZE || last.len > SUMBLOCK_SIZE ||
+        blockno * SUMBLOCK_SIZE + last.len != dataend) {
+        active = false;
+    } else if (last.len == SUMBLOCK_SIZE) {
+        blockno++;
+    } else {
+        cur = last;
+    }
+    return(PLFS_SUCCESS);
+}
+
+plfs_error_t
+SumWriteHandle::put_records(const struct sum_record *recs, size_t nrecs,
+                            off_t first)
+{
+    const char *ptr = (const char *)recs;
+    size_t len = nrecs * SUMREC_SIZE;
+    off_t off = first * SUMREC_SIZE;
+    ssize_t written;
+    plfs_error_t ret;
+
+    while (len > 0) {
+        ret = sumfh->Pwrite(ptr, len, off, &written);
+        if (ret != PLFS_SUCCESS) {
+            /* stop checksumming rather than fail writes of good data */
+            mlog(CON_ERR, "%s: sum dropping write failed: %s, the rest "
+                 "of the dropping is not checksummed", __FUNCTION__,
+                 strplfserr(ret));
+            active = false;
+            return(ret);
+        }
+        ptr += written;
+        off += written;
+        len -= written;
+    }
+    return(PLFS_SUCCESS);
+}
+
+plfs_error_t
+SumWriteHandle::Write(const void *buf, size_t len, ssize_t *bytes_written)
+{
+    const char *ptr = (const char *)buf;
+    vector<struct sum_record> full;
+    size_t written, done, take;
+    plfs_error_t ret;
+
+    /* locked across the write so the checksums follow the data order */
+    Util::MutexLock(&mux, __FUNCTION__);
+    ret = datafh->Write(buf, len, bytes_written);
+    written = (*bytes_written > 0) ? *bytes_written : 0;
+    for (done = 0 ; active && done < written ; done += take) {
+        take = min(written - done, (size_t)SUMBLOCK_SIZE - cur.len);
+        cur.crc = crc32c(cur.crc, ptr + done, take);
+        cur.len += take;
+        if (cur.len == SUMBLOCK_SIZE) {
+            full.push_back(cur);
+            cur.crc = cur.len = 0;
+        }
+    }
+    if (active && !full.empty()) {
+        (void) put_records(&full[0], full.size(), blockno);
+        blockno += full.size();
+    }
+    Util::MutexUnlock(&mux, __FUNCTION__);
+    return(ret);
+}
+
+plfs_error_t
+SumWriteHandle::Fsync()
+{
+    plfs_error_t ret;
+
+    ret = datafh->Fsync();
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    Util::MutexLock(&mux, __FUNCTION__);
+    if (active && cur.len > 0) {
+        (void) put_records(&cur, 1, blockno);
+    }
+    Util::MutexUnlock(&mux, __FUNCTION__);
+    return(sumfh->Fsync());
+}
+
+plfs_error_t
+SumWriteHandle::Close()
+{
+    plfs_error_t ret;
+
+    if (active && cur.len > 0) {
+        (void) put_records(&cur, 1, blockno);
+    }
+    ret = store->Close(sumfh);
+    if (ret != PLFS_SUCCESS) {
+        store->Close(datafh);
+        return(ret);
+    }
+    return(store->Close(datafh));
+}
+
+/* only truncating to zero is supported (the whole file is truncated) */
+plfs_error_t
+SumWriteHandle::Ftruncate(off_t length)
+{
+    plfs_error_t ret;
+
+    if (length != 0) {
+        return(PLFS_ENOTSUP);
+    }
+    /* sums first, so they are never ahead of the data */
+    Util::MutexLock(&mux, __FUNCTION__);
+    ret = sumfh->Ftruncate(0);
+    if (ret == PLFS_SUCCESS) {
+        ret = datafh->Ftruncate(0);
+    }
+    if (ret == PLFS_SUCCESS) {
+        blockno = 0;
+        cur.crc = cur.len = 0;
+        active = true;
+    }
+    Util::MutexUnlock(&mux, __FUNCTION__);
+    return(ret);
+}
+
+plfs_error_t
+SumWriteHandle::Fstat(struct stat *sb)
+{
+    return(datafh->Fstat(sb));
+}
+
+plfs_error_t
+SumWriteHandle::GetDataBuf(void **bufp, size_t length)
+{
+    return(datafh->GetDataBuf(bufp, length));
+}
+
+plfs_error_t
+SumWriteHandle::Pread(void *buf, size_t count, off_t offset,
+                      ssize_t *bytes_read)
+{
+    return(datafh->Pread(buf, count, offset, bytes_read));
+}
+
+/* data must be appended through Write to be checksummed */
+plfs_error_t
+SumWriteHandle::Pwrite(const void * /* buf */, size_t /* count */,
+                       off_t /* offset */, ssize_t * /* bytes_written */)
+{
+    return(PLFS_ENOTSUP);
+}
+
+plfs_error_t
+SumWriteHandle::Read(void *buf, size_t count, ssize_t *bytes_read)
+{
+    return(datafh->Read(buf, count, bytes_read));
+}
+
+plfs_error_t
+SumWriteHandle::ReleaseDataBuf(void *buf, size_t length)
+{
+    return(datafh->ReleaseDataBuf(buf, length));
+}
+
+plfs_error_t
+SumWriteHandle::Size(off_t *ret_offset)
+{
+    return(datafh->Size(ret_offset));
+}
+
+plfs_error_t
+sum_open(IOStore *store, const char *sumpath, mode_t mode,
+         IOSHandle *datafh, off_t dataend, IOSHandle **ret_hand)
+{
+    SumWriteHandle *sfh;
+    IOSHandle *fh;
+    plfs_error_t ret;
+
+    ret = store->Open(sumpath, O_RDWR|O_CREAT, mode, &fh);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    sfh = new SumWriteHandle(store, datafh, fh);
+    ret = sfh->Recover(dataend);
+    if (ret != PLFS_SUCCESS) {
+        store->Close(fh);
+        delete sfh;
+        return(ret);
+    }
+    *ret_hand = sfh;
+    return(PLFS_SUCCESS);
+}
+
+/*
+ * read_stream: read the data at a physical offset of a data dropping,
+ * decompressing it if it is a compressed dropping.  a short read is
+ * returned as PLFS_EEOF.
+ */
+static plfs_error_t
+read_stream(IOSHandle *fh, char *buf, size_t len, off_t physoff)
+{
+    ssize_t got;
+    plfs_error_t ret;
+
+    while (len > 0) {
+        if (physoff & ZDROP_OFFSET_FLAG) {
+            ret = zdrop_pread(fh, buf, len, physoff, &got);
+        } else {
+            ret = fh->Pread(buf, len, physoff, &got);
+        }
+        if (ret != PLFS_SUCCESS) {
+            return(ret);
+        }
+        if (got <= 0) {
+            return(PLFS_EEOF);
+        }
+        buf += got;
+        physoff += got;
+        len -= got;
+    }
+    return(PLFS_SUCCESS);
+}
+
+plfs_error_t
+sum_verify(IOSHandle *datafh, IOSHandle *sumfh, const char *buf,
+           size_t len, off_t physoff)
+{
+    off_t flag = physoff & ZDROP_OFFSET_FLAG;
+    off_t off = physoff & ~ZDROP_OFFSET_FLAG;
+    off_t end = off + len;
+    off_t first, bstart, bend, lo, hi;
+    vector<struct sum_record> recs;
+    vector<char> edge;
+    uint32_t crc;
+    ssize_t got;
+    size_t i;
+    plfs_error_t ret;
+
+    if (len == 0) {
+        return(PLFS_SUCCESS);
+    }
+    first = off / SUMBLOCK_SIZE;
+    recs.resize((end - 1) / SUMBLOCK_SIZE - first + 1);
+    ret = sumfh->Pread(&recs[0], recs.size() * SUMREC_SIZE,
+                       first * SUMREC_SIZE, &got);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    /* blocks past the last record were not checksummed yet */
+    recs.resize(max(got, (ssize_t)0) / SUMREC_SIZE);
+
+    for (i = 0 ; i < recs.size() ; i++) {
+        bstart = (first + i) * SUMBLOCK_SIZE;
+        bend = bstart + recs[i].len;
+        if (recs[i].len > SUMBLOCK_SIZE) {
+            ret = PLFS_EIO;
+            break;
+        }
+        if (bend <= off) {
+            continue;
+        }
+        lo = max(off, bstart);
+        hi = min(end, bend);
+        crc = 0;
+        if (lo > bstart) {
+            edge.resize(lo - bstart);
+            ret = read_stream(datafh, &edge[0], edge.size(), flag + bstart);
+            if (ret != PLFS_SUCCESS) {
+                break;
+            }
+            crc = crc32c(crc, &edge[0], edge.size());
+        }
+        crc = crc32c(crc, buf + (lo - off), hi - lo);
+        if (hi < bend) {
+            edge.resize(bend - hi);
+            ret = read_stream(datafh, &edge[0], edge.size(), flag + hi);
+            if (ret != PLFS_SUCCESS) {
+                break;
+            }
+            crc = crc32c(crc, &edge[0], edge.size());
+        }
+        Metrics::add(PM_SUM_BLOCKS_VERIFIED, 1);
+        if (crc != recs[i].crc) {
+            ret = PLFS_EIO;
+            break;
+        }
+    }
+    if (ret == PLFS_EEOF) {
+        ret = PLFS_EIO;    /* data goes in before its sums: cut short */
+    }
+    if (ret != PLFS_SUCCESS) {
+        Metrics::add(PM_SUM_ERRORS, 1);
+        mlog(CON_ERR, "%s: checking data at physical offset %ld "
+             "(block %ld): %s", __FUNCTION__, (long)off,
+             (long)(first + i), strplfserr(ret));
+    }
+    return(ret);
+}
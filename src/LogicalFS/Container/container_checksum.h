@@ -0,0 +1,77 @@
+#ifndef __CONTAINER_CHECKSUM_H_
+#define __CONTAINER_CHECKSUM_H_
+
+/*
+ * container_checksum.h  checksums of data droppings
+ *
+ * on mounts with data_checksums set, every data dropping gets a sum
+ * dropping next to it (SUMPREFIX instead of DATAPREFIX).  it holds a
+ * sum_record for each SUMBLOCK_SIZE block of the data appended to the
+ * dropping: record k is at k * sizeof(struct sum_record) and covers
+ * the data at physical offsets [k * SUMBLOCK_SIZE, +len).  for a
+ * compressed dropping these are offsets in the uncompressed stream
+ * (see container_compress.h), so the checksums are end-to-end.
+ *
+ * the checksums follow the droppings rather than the index entries,
+ * so merging, splitting, truncating or flattening the index never
+ * needs them to be recomputed.
+ */
+
+#include <stdint.h>
+#include <string>
+#include "IOStore.h"
+
+using namespace std;
+
+#define SUMBLOCK_SIZE (64 * 1024)
+
+struct sum_record {
+    uint32_t crc;         /* CRC32C of the data in the block */
+    uint32_t len;         /* bytes covered, less for the last block */
+};
+
+/**
+ * @param datapath the path of a data dropping
+ * @return the path of its sum dropping
+ */
+string sum_dropping_path(const string& datapath);
+
+/**
+ * Wrap the write handle of a data dropping so that the data written
+ * through it is checksummed.  The sum records of complete blocks are
+ * written with the data, the record of the partial last block on
+ * Fsync and Close.  Closing the returned handle closes both droppings.
+ *
+ * If the dropping has data which is not covered by its sum dropping
+ * (e.g. data_checksums was off when it was written) the data appended
+ * now is not checksummed either.
+ *
+ * @param store the store of the droppings
+ * @param sumpath the path of the sum dropping
+ * @param mode the mode to create it with
+ * @param datafh the write handle of the data dropping
+ * @param dataend the physical offset of the end of the data dropping
+ * @param ret_hand the handle to write through (output)
+ * @return PLFS_SUCCESS or error code, datafh is not closed on error
+ */
+plfs_error_t sum_open(IOStore *store, const char *sumpath, mode_t mode,
+                      IOSHandle *datafh, off_t dataend,
+                      IOSHandle **ret_hand);
+
+/**
+ * Verify data read from a data dropping.  Blocks which are only partly
+ * in buf are completed by reading the rest of them from the dropping.
+ * Data beyond the last sum record is not checked.
+ *
+ * @param datafh read handle of the data dropping
+ * @param sumfh read handle of its sum dropping
+ * @param buf the data
+ * @param len its length
+ * @param physoff the physical offset the data was read from
+ * @return PLFS_SUCCESS, PLFS_EIO on a checksum mismatch or a dropping
+ *         shorter than its sums, or error code
+ */
+plfs_error_t sum_verify(IOSHandle *datafh, IOSHandle *sumfh,
+                        const char *buf, size_t len, off_t physoff);
+
+#endif
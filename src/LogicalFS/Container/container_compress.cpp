@@ -0,0 +1,602 @@
+/*
+ * container_compress.cpp  compressed data droppings
+ *
+ * see container_compress.h for the layout.  the codec is the LZ4 block
+ * format: a sequence is a token (literal length in the high nibble,
+ * match length - 4 in the low nibble, 15 meaning more length bytes
+ * follow), the literals, and a 2 byte little endian match offset.  the
+ * last sequence has literals only.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <vector>
+
+#include "plfs_private.h"
+#include "Metrics.h"
+#include "container_compress.h"
+
+using namespace std;
+
+#define ZHASH_LOG     12        /* 4K entry match finder table */
+#define ZMIN_MATCH    4
+#define ZLAST_LITERALS 5        /* the block ends with literals */
+#define ZMATCH_LIMIT  12        /* no match starts this close to the end */
+#define ZMAX_DISTANCE 65535
+
+static inline uint32_t
+zread32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return(v);
+}
+
+static inline uint32_t
+zhash(uint32_t v)
+{
+    return((v * 2654435761U) >> (32 - ZHASH_LOG));
+}
+
+/* write the 255-run encoding of the rest of a length */
+static inline unsigned char *
+zput_length(unsigned char *op, size_t n)
+{
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = (unsigned char)n;
+    return(op);
+}
+
+/*
+ * zput_sequence: emit one sequence, a match of mlen bytes at distance
+ * off after litlen literals (mlen == 0 for the last sequence).
+ * returns NULL if it does not fit before oend.
+ */
+static unsigned char *
+zput_sequence(unsigned char *op, unsigned char *oend,
+              const unsigned char *lit, size_t litlen, size_t off,
+              size_t mlen)
+{
+    unsigned char *token;
+
+    if ((size_t)(oend - op) < 1 + litlen + litlen / 255 + 1 + 2 +
+        mlen / 255 + 1) {
+        return(NULL);
+    }
+    token = op++;
+    if (litlen >= 15) {
+        *token = 15 << 4;
+        op = zput_length(op, litlen - 15);
+    } else {
+        *token = litlen << 4;
+    }
+    memcpy(op, lit, litlen);
+    op += litlen;
+    if (mlen == 0) {
+        return(op);
+    }
+    *op++ = off & 0xff;
+    *op++ = off >> 8;
+    mlen -= ZMIN_MATCH;
+    if (mlen >= 15) {
+        *token |= 15;
+        op = zput_length(op, mlen - 15);
+    } else {
+        *token |= mlen;
+    }
+    return(op);
+}
+
+size_t
+zdrop_compress(const char *src, size_t len, char *dst, size_t cap)
+{
+    const unsigned char *in = (const unsigned char *)src;
+    const unsigned char *end = in + len;
+    const unsigned char *ip = in, *anchor = in, *ref, *mend, *r;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *oend = op + cap;
+    uint32_t table[1 << ZHASH_LOG];
+    uint32_t seq, h;
+
+    memset(table, 0, sizeof(table));
+    while (len > ZMATCH_LIMIT && ip < end - ZMATCH_LIMIT) {
+        seq = zread32(ip);
+        h = zhash(seq);
+        ref = in + table[h];
+        table[h] = ip - in;
+        if (ref >= ip || ip - ref > ZMAX_DISTANCE || zread32(ref) != seq) {
+            /* skip faster through data that does not compress */
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        mend = ip + ZMIN_MATCH;
+        r = ref + ZMIN_MATCH;
+        while (mend < end - ZLAST_LITERALS && *mend == *r) {
+            mend++;
+            r++;
+        }
+        while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        op = zput_sequence(op, oend, anchor, ip - anchor, ip - ref,
+                           mend - ip);
+        if (op == NULL) {
+            return(0);
+        }
+        ip = anchor = mend;
+    }
+    op = zput_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (op == NULL) {
+        return(0);
+    }
+    return(op - (unsigned char *)dst);
+}
+
+/* read the 255-run encoding of the rest of a length */
+static inline bool
+zget_length(const unsigned char **ipp, const unsigned char *iend,
+            size_t *n)
+{
+    unsigned char b;
+
+    do {
+        if (*ipp >= iend) {
+            return(false);
+        }
+        b = *(*ipp)++;
+        *n += b;
+    } while (b == 255);
+    return(true);
+}
+
+ssize_t
+zdrop_decompress(const char *src, size_t len, char *dst, size_t cap)
+{
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *iend = ip + len;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *oend = op + cap;
+    const unsigned char *ref;
+    size_t lit, mlen, off;
+    unsigned char token;
+
+    while (ip < iend) {
+        token = *ip++;
+        lit = token >> 4;
+        if (lit == 15 && !zget_length(&ip, iend, &lit)) {
+            return(-1);
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+            return(-1);
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) {
+            break;                   /* the last sequence */
+        }
+        if (iend - ip < 2) {
+            return(-1);
+        }
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        mlen = token & 15;
+        if (mlen == 15 && !zget_length(&ip, iend, &mlen)) {
+            return(-1);
+        }
+        mlen += ZMIN_MATCH;
+        if (off == 0 || off > (size_t)(op - (unsigned char *)dst) ||
+            mlen > (size_t)(oend - op)) {
+            return(-1);
+        }
+        /* byte by byte: the match may overlap what it copies */
+        for (ref = op - off ; mlen > 0 ; mlen--) {
+            *op++ = *ref++;
+        }
+    }
+    return(op - (unsigned char *)dst);
+}
+
+/*
+ * ZDropWriteHandle: the write handle of a compressed dropping.  it
+ * wraps the handle of the dropping from the store.  the data of the
+ * current frame is kept in frame until the frame fills or is flushed.
+ */
+class ZDropWriteHandle : public IOSHandle {
+ public:
+    ZDropWriteHandle(IOStore *newstore, IOSHandle *newfh);
+    ~ZDropWriteHandle();
+
+    plfs_error_t Recover(off_t *vsize);
+
+    plfs_error_t Fstat(struct stat *sb);
+    plfs_error_t Fsync();
+    plfs_error_t Ftruncate(off_t length);
+    plfs_error_t GetDataBuf(void **bufp, size_t length);
+    plfs_error_t Pread(void *buf, size_t count, off_t offset,
+                       ssize_t *bytes_read);
+    plfs_error_t Pwrite(const void *buf, size_t count, off_t offset,
+                        ssize_t *bytes_written);
+    plfs_error_t Read(void *buf, size_t count, ssize_t *bytes_read);
+    plfs_error_t ReleaseDataBuf(void *buf, size_t length);
+    plfs_error_t Size(off_t *ret_offset);
+    plfs_error_t Write(const void *buf, size_t len, ssize_t *bytes_written);
+
+ private:
+    plfs_error_t Close();
+    plfs_error_t flush_frame();
+
+    IOStore *store;
+    IOSHandle *fh;
+    off_t slotno;            /* the slot of the frame being filled */
+    off_t vbase;             /* where its data starts in the stream */
+    vector<char> frame;      /* its data */
+    vector<char> slot;       /* header and payload being written */
+    pthread_mutex_t mux;
+};
+
+ZDropWriteHandle::ZDropWriteHandle(IOStore *newstore, IOSHandle *newfh)
+    : store(newstore), fh(newfh), slotno(0), vbase(0)
+{
+    frame.reserve(ZFRAME_SIZE);
+    pthread_mutex_init(&mux, NULL);
+}
+
+ZDropWriteHandle::~ZDropWriteHandle()
+{
+    pthread_mutex_destroy(&mux);
+}
+
+/* find the end of the last frame (dropping reopened), we go after it */
+plfs_error_t
+ZDropWriteHandle::Recover(off_t *vsize)
+{
+    struct zframe_header hdr;
+    ssize_t got;
+    off_t size, last;
+    plfs_error_t ret;
+
+    ret = fh->Size(&size);
+    if (ret == PLFS_SUCCESS && size > 0) {
+        last = (size - 1) / ZFRAME_SLOT;
+        ret = fh->Pread(&hdr, sizeof(hdr), last * ZFRAME_SLOT, &got);
+        if (ret == PLFS_SUCCESS && (got != (ssize_t)sizeof(hdr) ||
+                                    hdr.magic != ZFRAME_MAGIC ||
+                                    hdr.ulen > ZFRAME_SIZE)) {
+            ret = PLFS_EIO;
+        }
+        if (ret == PLFS_SUCCESS) {
+            slotno = last + 1;
+            vbase = hdr.voff + hdr.ulen;
+        }
+    }
+    *vsize = vbase;
+    return(ret);
+}
+
+/*
+ * compress the current frame, write it in its slot, and start the
+ * next one.  the frame stays buffered if this fails.
+ */
+plfs_error_t
+ZDropWriteHandle::flush_frame()
+{
+    struct zframe_header hdr;
+    size_t clen, done;
+    ssize_t written;
+    plfs_error_t ret = PLFS_SUCCESS;
+
+    slot.resize(ZFRAME_SLOT);
+    hdr.magic = ZFRAME_MAGIC;
+    hdr.ulen = frame.size();
+    hdr.flags = 0;
+    hdr.voff = vbase;
+    clen = zdrop_compress(&frame[0], frame.size(), &slot[ZFRAME_HDR],
+                          frame.size() - 1);
+    if (clen == 0) {
+        hdr.flags = ZFRAME_RAW;
+        clen = frame.size();
+        memcpy(&slot[ZFRAME_HDR], &frame[0], clen);
+    }
+    hdr.clen = clen;
+    memcpy(&slot[0], &hdr, sizeof(hdr));
+    for (done = 0 ; done < ZFRAME_HDR + clen ; done += written) {
+        ret = fh->Pwrite(&slot[done], ZFRAME_HDR + clen - done,
+                         slotno * ZFRAME_SLOT + done, &written);
+        if (ret != PLFS_SUCCESS) {
+            return(ret);
+        }
+    }
+    Metrics::add(PM_ZDROP_FRAMES, 1);
+    Metrics::add(PM_ZDROP_BYTES_IN, frame.size());
+    Metrics::add(PM_ZDROP_BYTES_STORED, ZFRAME_HDR + clen);
+    slotno++;
+    vbase += frame.size();
+    frame.clear();
+    return(ret);
+}
+
+plfs_error_t
+ZDropWriteHandle::Write(const void *buf, size_t len, ssize_t *bytes_written)
+{
+    const char *ptr = (const char *)buf;
+    plfs_error_t ret = PLFS_SUCCESS;
+    size_t done, take;
+
+    Util::MutexLock(&mux, __FUNCTION__);
+    for (done = 0 ; done < len ; done += take) {
+        take = min(len - done, (size_t)ZFRAME_SIZE - frame.size());
+        frame.insert(frame.end(), ptr + done, ptr + done + take);
+        if (frame.size() == ZFRAME_SIZE) {
+            /* the data stays buffered if this fails, next flush retries */
+            ret = flush_frame();
+            if (ret != PLFS_SUCCESS) {
+                done += take;
+                break;
+            }
+        }
+    }
+    Util::MutexUnlock(&mux, __FUNCTION__);
+    *bytes_written = done;
+    return(ret);
+}
+
+plfs_error_t
+ZDropWriteHandle::Fsync()
+{
+    plfs_error_t ret = PLFS_SUCCESS;
+
+    Util::MutexLock(&mux, __FUNCTION__);
+    if (!frame.empty()) {
+        ret = flush_frame();     /* a short frame, never rewritten */
+    }
+    Util::MutexUnlock(&mux, __FUNCTION__);
+    if (ret == PLFS_SUCCESS) {
+        ret = fh->Fsync();
+    }
+    return(ret);
+}
+
+plfs_error_t
+ZDropWriteHandle::Close()
+{
+    plfs_error_t ret = PLFS_SUCCESS, ret2;
+
+    if (!frame.empty()) {
+        ret = flush_frame();
+    }
+    ret2 = store->Close(fh);
+    return(ret != PLFS_SUCCESS ? ret : ret2);
+}
+
+/* only truncating to zero is supported (the whole file is truncated) */
+plfs_error_t
+ZDropWriteHandle::Ftruncate(off_t length)
+{
+    plfs_error_t ret;
+
+    if (length != 0) {
+        return(PLFS_ENOTSUP);
+    }
+    Util::MutexLock(&mux, __FUNCTION__);
+    ret = fh->Ftruncate(0);
+    if (ret == PLFS_SUCCESS) {
+        frame.clear();
+        slotno = 0;
+        vbase = 0;
+    }
+    Util::MutexUnlock(&mux, __FUNCTION__);
+    return(ret);
+}
+
+plfs_error_t
+ZDropWriteHandle::Size(off_t *ret_offset)
+{
+    Util::MutexLock(&mux, __FUNCTION__);
+    *ret_offset = vbase + frame.size();
+    Util::MutexUnlock(&mux, __FUNCTION__);
+    return(PLFS_SUCCESS);
+}
+
+plfs_error_t
+ZDropWriteHandle::Fstat(struct stat *sb)
+{
+    return(fh->Fstat(sb));
+}
+
+/* droppings are only appended to through this handle */
+plfs_error_t
+ZDropWriteHandle::GetDataBuf(void ** /* bufp */, size_t /* length */)
+{
+    return(PLFS_ENOTSUP);
+}
+
+plfs_error_t
+ZDropWriteHandle::Pread(void * /* buf */, size_t /* count */,
+                        off_t /* offset */, ssize_t * /* bytes_read */)
+{
+    return(PLFS_ENOTSUP);
+}
+
+plfs_error_t
+ZDropWriteHandle::Pwrite(const void * /* buf */, size_t /* count */,
+                         off_t /* offset */, ssize_t * /* bytes_written */)
+{
+    return(PLFS_ENOTSUP);
+}
+
+plfs_error_t
+ZDropWriteHandle::Read(void * /* buf */, size_t /* count */,
+                       ssize_t * /* bytes_read */)
+{
+    return(PLFS_ENOTSUP);
+}
+
+plfs_error_t
+ZDropWriteHandle::ReleaseDataBuf(void * /* buf */, size_t /* length */)
+{
+    return(PLFS_ENOTSUP);
+}
+
+plfs_error_t
+zdrop_open(IOStore *store, const char *bpath, mode_t mode,
+           IOSHandle **ret_hand, off_t *vsize)
+{
+    ZDropWriteHandle *zfh;
+    IOSHandle *fh;
+    plfs_error_t ret;
+
+    /* not O_APPEND: frames are written at their slot with pwrite */
+    ret = store->Open(bpath, O_RDWR|O_CREAT, mode, &fh);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    zfh = new ZDropWriteHandle(store, fh);
+    ret = zfh->Recover(vsize);
+    if (ret != PLFS_SUCCESS) {
+        mlog(CON_ERR, "%s: bad last frame in %s: %s", __FUNCTION__, bpath,
+             strplfserr(ret));
+        store->Close(zfh);
+        return(ret);
+    }
+    *ret_hand = zfh;
+    return(PLFS_SUCCESS);
+}
+
+/*
+ * zframe_load: read the frame in a slot (whole) or just its header.
+ * hdr->ulen is 0 past the last frame.
+ */
+static plfs_error_t
+zframe_load(IOSHandle *fh, off_t slotno, bool whole, vector<char> &slot,
+            struct zframe_header *hdr)
+{
+    ssize_t got;
+    plfs_error_t ret;
+
+    slot.resize(whole ? ZFRAME_SLOT : ZFRAME_HDR);
+    memset(hdr, 0, sizeof(*hdr));
+    ret = fh->Pread(&slot[0], slot.size(), slotno * ZFRAME_SLOT, &got);
+    if (ret != PLFS_SUCCESS || got == 0) {
+        return(ret);                               /* error or EOF */
+    }
+    memcpy(hdr, &slot[0], min((size_t)got, sizeof(*hdr)));
+    if (got < ZFRAME_HDR || hdr->magic != ZFRAME_MAGIC || hdr->ulen == 0 ||
+        hdr->ulen > ZFRAME_SIZE ||
+        (whole && hdr->clen > got - ZFRAME_HDR) ||
+        ((hdr->flags & ZFRAME_RAW) && hdr->clen != hdr->ulen)) {
+        return(PLFS_EIO);
+    }
+    return(PLFS_SUCCESS);
+}
+
+/*
+ * zframe_find: load the frame that holds voff.  it is in slot voff /
+ * ZFRAME_SIZE unless there are short frames before it, then it is in
+ * a later one: step forward by headers, doubling the step, and bisect.
+ * hdr->ulen is 0 if voff is past the end of the dropping.
+ */
+static plfs_error_t
+zframe_find(IOSHandle *fh, off_t voff, vector<char> &slot,
+            struct zframe_header *hdr, off_t *slotnop)
+{
+    off_t lo, hi, mid, step;
+    plfs_error_t ret;
+
+    lo = voff / ZFRAME_SIZE;
+    *slotnop = lo;
+    ret = zframe_load(fh, lo, true, slot, hdr);
+    if (ret != PLFS_SUCCESS || hdr->ulen == 0 ||
+        voff < (off_t)(hdr->voff + hdr->ulen)) {
+        return(ret);
+    }
+
+    /* frame lo ends at or before voff, find one that does not */
+    for (step = 1 ; ; step *= 2) {
+        hi = lo + step;
+        ret = zframe_load(fh, hi, false, slot, hdr);
+        if (ret != PLFS_SUCCESS) {
+            return(ret);
+        }
+        if (hdr->ulen == 0 || voff < (off_t)(hdr->voff + hdr->ulen)) {
+            break;
+        }
+        lo = hi;
+    }
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        ret = zframe_load(fh, mid, false, slot, hdr);
+        if (ret != PLFS_SUCCESS) {
+            return(ret);
+        }
+        if (hdr->ulen != 0 && voff >= (off_t)(hdr->voff + hdr->ulen)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    *slotnop = hi;
+    return(zframe_load(fh, hi, true, slot, hdr));
+}
+
+plfs_error_t
+zdrop_pread(IOSHandle *fh, void *buf, size_t nbytes, off_t offset,
+            ssize_t *bytes_read)
+{
+    char *out = (char *)buf;
+    struct zframe_header hdr;
+    vector<char> slot, data;
+    off_t voff, slotno, in;
+    size_t done, take;
+    ssize_t ulen;
+    plfs_error_t ret = PLFS_SUCCESS;
+
+    voff = offset & ~ZDROP_OFFSET_FLAG;
+    slotno = 0;
+    for (done = 0 ; done < nbytes ; done += take) {
+        if (done == 0) {
+            ret = zframe_find(fh, voff, slot, &hdr, &slotno);
+        } else {
+            ret = zframe_load(fh, ++slotno, true, slot, &hdr);  /* next */
+        }
+        if (ret != PLFS_SUCCESS || hdr.ulen == 0) {
+            break;                                 /* error or EOF */
+        }
+        in = voff + done - hdr.voff;
+        if (in < 0 || in >= hdr.ulen) {
+            ret = PLFS_EIO;                        /* not where it goes */
+            break;
+        }
+        take = min(nbytes - done, (size_t)(hdr.ulen - in));
+        if (hdr.flags & ZFRAME_RAW) {
+            memcpy(out + done, &slot[ZFRAME_HDR + in], take);
+            continue;
+        }
+        if (in == 0 && take == hdr.ulen) {
+            /* the whole frame is wanted, no need for a copy */
+            ulen = zdrop_decompress(&slot[ZFRAME_HDR], hdr.clen, out + done,
+                                    take);
+        } else {
+            data.resize(hdr.ulen);
+            ulen = zdrop_decompress(&slot[ZFRAME_HDR], hdr.clen, &data[0],
+                                    hdr.ulen);
+            if (ulen == (ssize_t)hdr.ulen) {
+                memcpy(out + done, &data[in], take);
+            }
+        }
+        if (ulen != (ssize_t)hdr.ulen) {
+            ret = PLFS_EIO;
+            break;
+        }
+    }
+    if (ret != PLFS_SUCCESS) {
+        mlog(CON_ERR, "%s: bad frame in slot %ld: %s", __FUNCTION__,
+             (long)slotno, strplfserr(ret));
+    }
+    *bytes_read = done;
+    return(ret);
+}
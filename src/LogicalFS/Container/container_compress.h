@@ -0,0 +1,101 @@
+#ifndef __CONTAINER_COMPRESS_H_
+#define __CONTAINER_COMPRESS_H_
+
+/*
+ * container_compress.h  compressed data droppings
+ *
+ * on mounts with compress_droppings set, data droppings are written as
+ * a sequence of frames.  each frame holds up to ZFRAME_SIZE bytes of
+ * the data appended to the dropping and is stored in a fixed size
+ * slot, so frame k always starts at k * ZFRAME_SLOT and the dropping
+ * is a sparse file.  a frame is compressed with a small built-in LZ4
+ * block format codec, or stored as is if it does not compress.
+ *
+ * a frame is written once and never rewritten: a frame that is written
+ * out before it fills (on Fsync, or before its index records are) is
+ * short, and the next data goes in a new frame in the next slot.  so
+ * each header records where the data of its frame starts in the
+ * uncompressed stream.  a frame is in slot voff / ZFRAME_SIZE if no
+ * frame before it is short, and in a later one if some are.
+ *
+ * the index does not change: its physical offsets are offsets in the
+ * uncompressed stream of the dropping with ZDROP_OFFSET_FLAG set, so
+ * that splitting, merging and truncating entries work as before and
+ * a reader can tell a compressed chunk from its offset alone.
+ */
+
+#include <stdint.h>
+#include "IOStore.h"
+
+#define ZFRAME_SIZE  (64 * 1024)         /* data bytes per frame */
+#define ZFRAME_HDR   ((off_t)sizeof(struct zframe_header))
+#define ZFRAME_SLOT  (ZFRAME_SIZE + ZFRAME_HDR)
+#define ZFRAME_MAGIC 0x5044525aU         /* "ZRDP" */
+#define ZFRAME_RAW   0x1                 /* frame is stored uncompressed */
+
+/* set on every physical offset that points into a compressed dropping */
+#define ZDROP_OFFSET_FLAG ((off_t)1 << 62)
+
+struct zframe_header {
+    uint32_t magic;       /* ZFRAME_MAGIC */
+    uint32_t ulen;        /* data bytes in the frame */
+    uint32_t clen;        /* bytes stored after the header */
+    uint32_t flags;       /* ZFRAME_RAW */
+    uint64_t voff;        /* offset of its data in the uncompressed stream */
+};
+
+/**
+ * Compress a buffer in the LZ4 block format.
+ *
+ * @param src the data to compress
+ * @param len the length of src, at most ZFRAME_SIZE
+ * @param dst the output buffer
+ * @param cap the size of dst
+ * @return the length of the compressed data, or 0 if it does not fit
+ */
+size_t zdrop_compress(const char *src, size_t len, char *dst, size_t cap);
+
+/**
+ * Decompress an LZ4 block.  Corrupt input is detected, never overruns.
+ *
+ * @param src the compressed data
+ * @param len the length of src
+ * @param dst the output buffer
+ * @param cap the size of dst
+ * @return the length of the data, or -1 if src is not a valid block
+ */
+ssize_t zdrop_decompress(const char *src, size_t len, char *dst, size_t cap);
+
+/**
+ * Open a compressed data dropping for appending.  The returned handle
+ * buffers the current frame and writes each frame in its slot as it
+ * fills; Fsync and Close write out the partial frame as a short one.
+ * If the dropping already exists appending continues in the slot after
+ * its last frame.
+ *
+ * @param store the store of the dropping
+ * @param bpath the path of the dropping
+ * @param mode the mode to create it with
+ * @param ret_hand the handle (output)
+ * @param vsize the uncompressed size of the dropping (output)
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t zdrop_open(IOStore *store, const char *bpath, mode_t mode,
+                        IOSHandle **ret_hand, off_t *vsize);
+
+/**
+ * Read from a compressed data dropping.  Every frame the read touches
+ * is read with one Pread and decompressed, after a few header reads to
+ * find the first one if there are short frames before it.
+ *
+ * @param fh a handle on the dropping from the store
+ * @param buf the buffer to read into
+ * @param nbytes number of bytes to read
+ * @param offset the physical offset from the index (ZDROP_OFFSET_FLAG set)
+ * @param bytes_read number of bytes read, short at the end (output)
+ * @return PLFS_SUCCESS or error code
+ */
+plfs_error_t zdrop_pread(IOSHandle *fh, void *buf, size_t nbytes,
+                         off_t offset, ssize_t *bytes_read);
+
+#endif
@@ -111,6 +111,7 @@ container_dump_index(FILE *fp, const char *logicalpath, int /* compress */,
     oo.reopen = 0;
     oo.uniform_restart_enable = uniform_restart;
     oo.uniform_restart_rank = uniform_restart_rank;
+    oo.num_writers = 0;
     pfd = NULL;
     ret = ppi.mnt_pt->fs_ptr->open(&pfd, &ppi, O_RDONLY, 0, 0777, &oo);
 
@@ -12,6 +12,8 @@
 #include "ThreadPool.h"
 #include "mlog_oss.h"
 #include "LogicalFD.h"
+#include "Metrics.h"
+#include "container_compress.h"
 
 /* a struct to contain the args to pass to the reader threads */
 typedef struct {
@@ -48,8 +50,18 @@ perform_read_task(ParallelReadTask *task, Plfs_fd *pfd, ssize_t *ret_readlen)
             readlen = 0;
         } else {
             /* here's where we actually read container data! */
-            err = fh->Pread(task->buf, task->length, task->chunk_offset,
-                            &readlen);
+            if (task->chunk_offset & ZDROP_OFFSET_FLAG) {
+                err = zdrop_pread(fh, task->buf, task->length,
+                                  task->chunk_offset, &readlen);
+            } else {
+                err = fh->Pread(task->buf, task->length,
+                                task->chunk_offset, &readlen);
+            }
+            Metrics::add(PM_BACKEND_READS, 1);
+            if (err == PLFS_SUCCESS) {
+                Metrics::add(PM_BACKEND_READ_BYTES, readlen);
+                err = pfd->read_chunkcheck(task, fh, readlen);
+            }
         }
         
     }
@@ -178,3 +190,43 @@ plfs_error_t plfs_parallel_reader(Plfs_fd *pfd, char *buf, size_t size,
     *bytes_read = total;
     return(plfs_error);
 }
+
+/*
+ * plfs_parallel_reader_fdextent: if the whole read is served by one
+ * data dropping we can hand the caller the dropping's fd and offset
+ * and let it move the data without a userspace copy.  holes, reads
+ * that span droppings and compressed droppings fall back to
+ * plfs_parallel_reader.
+ */
+plfs_error_t plfs_parallel_reader_fdextent(Plfs_fd *pfd, size_t size,
+                                           off_t offset, int *fdp,
+                                           off_t *fdoff, size_t *len) {
+    list<ParallelReadTask> tasks;
+    ParallelReadTask *task;
+    IOSHandle *fh;
+    plfs_error_t plfs_ret;
+
+    /* no buffer: we only want the mapping, task.buf is never used */
+    plfs_ret = pfd->read_taskgen(NULL, size, offset, &tasks);
+    if (plfs_ret != PLFS_SUCCESS) {
+        return(plfs_ret);
+    }
+    if (tasks.empty()) {
+        *len = 0;          /* EOF */
+        return(PLFS_SUCCESS);
+    }
+    task = &tasks.front();
+    if (tasks.size() != 1 || task->hole ||
+        (task->chunk_offset & ZDROP_OFFSET_FLAG)) {
+        return(PLFS_ENOTSUP);
+    }
+    plfs_ret = pfd->read_chunkfh(task->bpath, task->backend, &fh);
+    if (plfs_ret == PLFS_SUCCESS) {
+        plfs_ret = fh->GetFd(fdp);
+    }
+    if (plfs_ret == PLFS_SUCCESS) {
+        *fdoff = task->chunk_offset;
+        *len = task->length;
+    }
+    return(plfs_ret);
+}
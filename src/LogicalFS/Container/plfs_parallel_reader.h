@@ -41,5 +41,21 @@ typedef struct {
 plfs_error_t plfs_parallel_reader(Plfs_fd *pfd, char *buf, size_t size,
                                   off_t offset, ssize_t *bytes_read);
 
+/**
+ * plfs_parallel_reader_fdextent: map a read to a single backing fd range
+ *
+ * @param pfd the fd we are reading from
+ * @param size number of bytes requested
+ * @param offset offset in logical file to read from
+ * @param fdp the backing kernel fd (output)
+ * @param fdoff offset of the data in the backing fd (output)
+ * @param len number of bytes available at fdoff, 0 at EOF (output)
+ * @return PLFS_SUCCESS, PLFS_ENOTSUP if more than one task is needed,
+ *         or error code
+ */
+plfs_error_t plfs_parallel_reader_fdextent(Plfs_fd *pfd, size_t size,
+                                           off_t offset, int *fdp,
+                                           off_t *fdoff, size_t *len);
+
 
 #endif /* __PLFS_PARALLEL_READER_H__ */
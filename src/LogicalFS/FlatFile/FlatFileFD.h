@@ -20,6 +20,8 @@ class Flat_fd : public Plfs_fd
                  mode_t mode, Plfs_open_opt *open_opt);
         plfs_error_t close(pid_t, uid_t, int flags, Plfs_close_opt *, int *num_ref);
         plfs_error_t read(char *buf, size_t size, off_t offset, ssize_t *bytes_read);
+        plfs_error_t read_fdextent(size_t size, off_t offset, int *fdp,
+                                   off_t *fdoff, size_t *len);
         plfs_error_t write(const char *buf, size_t size, off_t offset, pid_t pid,
                            ssize_t *bytes_written);
         plfs_error_t sync();
@@ -109,6 +109,32 @@ Flat_fd::read(char *buf, size_t size, off_t offset, ssize_t *bytes_read)
     return(ret);
 }
 
+/*
+ * ret PLFS_SUCCESS or PLFS_E*, the flat file maps 1:1 onto its backing fd,
+ * up to its EOF (like read(), len is 0 at or past it)
+ */
+plfs_error_t
+Flat_fd::read_fdextent(size_t size, off_t offset, int *fdp, off_t *fdoff,
+                       size_t *len)
+{
+    struct stat stbuf;
+    plfs_error_t ret = this->backend_fh->GetFd(fdp);
+    if (ret == PLFS_SUCCESS) {
+        ret = this->backend_fh->Fstat(&stbuf);
+    }
+    if (ret == PLFS_SUCCESS) {
+        *fdoff = offset;
+        if (offset >= stbuf.st_size) {
+            *len = 0;
+        } else if ((off_t)size > stbuf.st_size - offset) {
+            *len = stbuf.st_size - offset;
+        } else {
+            *len = size;
+        }
+    }
+    return(ret);
+}
+
 /* ret PLFS_SUCCESS or PLFS_E */
 plfs_error_t
 Flat_fd::write(const char *buf, size_t size, off_t offset, pid_t /* pid */, 
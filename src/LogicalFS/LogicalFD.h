@@ -57,6 +57,35 @@ class Plfs_fd
                                           IOSHandle **) {
             return(PLFS_ENOTSUP);
         }
+        // read_chunkcheck: optional.
+        // verify the data a task read from its chunk, e.g. checksums
+        virtual plfs_error_t read_chunkcheck(ParallelReadTask *,
+                                             IOSHandle *, ssize_t) {
+            return(PLFS_SUCCESS);
+        }
+
+        // read_fdextent: optional.
+        // map a read onto one range of a backing kernel fd so that the
+        // caller can splice it (e.g. FUSE read_buf) instead of copying.
+        // returns PLFS_ENOTSUP if the range is not backed by a single fd.
+        virtual plfs_error_t read_fdextent(size_t /* size */,
+                                           off_t /* offset */,
+                                           int * /* fdp */,
+                                           off_t * /* fdoff */,
+                                           size_t * /* len */) {
+            return(PLFS_ENOTSUP);
+        }
+
+        // extent_map: optional.
+        // list the data extents of a range of the file for
+        // plfs_extent_map.  returns PLFS_ENOTSUP if we don't know where
+        // the holes are, the whole file is then reported as data.
+        virtual plfs_error_t extent_map(off_t /* offset */,
+                                        size_t /* length */,
+                                        Plfs_extent * /* extents */,
+                                        int * /* nextents */) {
+            return(PLFS_ENOTSUP);
+        }
 };
 
 inline Plfs_fd::~Plfs_fd() {};
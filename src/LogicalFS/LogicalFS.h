@@ -4,6 +4,7 @@
 #include "plfs.h"
 #include "LogicalFD.h"
 
+#include <map>
 #include <set>
 #include <string>
 using namespace std;
@@ -46,6 +47,11 @@ class
         virtual plfs_error_t mkdir(struct plfs_physpathinfo *ppip, mode_t) = 0;
         virtual plfs_error_t readdir(struct plfs_physpathinfo *ppip,
                             set<string> *entries) = 0;
+        // readdir with the attributes of the entries, plfs_readdirplus
+        // falls back to readdir on PLFS_ENOTSUP
+        virtual plfs_error_t readdirplus(struct plfs_physpathinfo * /* ppip */,
+                                map<string, struct stat> * /* entries */)
+                             {return PLFS_ENOTSUP;};
         virtual plfs_error_t readlink(struct plfs_physpathinfo *ppip,
                              char *buf, size_t bufsize, int *bytes) = 0;
         virtual plfs_error_t rmdir(struct plfs_physpathinfo *ppip) = 0;
@@ -57,6 +63,19 @@ class
                              {return PLFS_SUCCESS;};
         virtual plfs_error_t invalidate_cache(struct plfs_physpathinfo *)
                              {return PLFS_SUCCESS;};
+        // read the beginning of many files at once, plfs_read_many falls
+        // back to open/read/close of every file on PLFS_ENOTSUP
+        virtual plfs_error_t read_many(int /* nfiles */,
+                                       struct plfs_physpathinfo ** /* ppips */,
+                                       char ** /* bufs */,
+                                       const size_t * /* sizes */,
+                                       ssize_t * /* bytes_read */)
+                             {return PLFS_ENOTSUP;};
+        // make a new file with the data of an existing one without
+        // copying it, for plfs_clone
+        virtual plfs_error_t clone(struct plfs_physpathinfo * /* ppip */,
+                                   struct plfs_physpathinfo * /* ppip_to */)
+                             {return PLFS_ENOTSUP;};
         virtual plfs_error_t resolvepath_finish(struct plfs_physpathinfo *ppip) 
                              = 0;
 };
@@ -1,6 +1,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <errno.h>
 #include "plfs.h"
 #include "plfs_private.h"
@@ -10,8 +11,10 @@
 #include "FileOp.h"
 #include <SmallFileContainer.hxx>
 #include <SmallFileIndex.hxx>
+#include <FileReader.hxx>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <assert.h>
 #include "Util.h"
@@ -83,10 +86,85 @@ smallfile_fakepath(struct plfs_physpathinfo *ppip, PathExpandInfo &res) {
     return(PLFS_SUCCESS);
 }
 
-SmallFileFS::SmallFileFS(int cache_size) : containers(cache_size) {
+/*
+ * The file systems are never deleted, so the records the writers have
+ * queued for group commit are written by an atexit() handler.
+ */
+static pthread_mutex_t exit_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<SmallFileFS *> exit_flush_fs;
+
+void
+SmallFileFS::exit_flush_main() {
+    pthread_mutex_lock(&exit_flush_lock);
+    for (size_t i = 0; i < exit_flush_fs.size(); i++) {
+        exit_flush_fs[i]->flush_containers();
+    }
+    pthread_mutex_unlock(&exit_flush_lock);
+}
+
+void
+SmallFileFS::flush_containers() {
+    vector<string> dirs;
+
+    containers.keys(&dirs);
+    for (size_t i = 0; i < dirs.size(); i++) {
+        ContainerPtr cached = containers.lookup(dirs[i]);
+        if (cached) cached->flush_writers();
+    }
+}
+
+SmallFileFS::SmallFileFS(int cache_size, unsigned long cache_bytes,
+                         int interval, int garbage, int mbs)
+    : containers(cache_size, cache_bytes) {
+    compact_mount = NULL;
+    compact_interval = interval;
+    compact_garbage = garbage;
+    compact_mbs = mbs;
+    compact_running = false;
+    compact_stopping = false;
+    exit_flush = false;
+    ncompacting = 0;
+    pthread_mutex_init(&compact_lock, NULL);
+    pthread_cond_init(&compact_cond, NULL);
+    pthread_mutex_init(&compacting_lock, NULL);
+    pthread_cond_init(&compacting_cond, NULL);
 }
 
 SmallFileFS::~SmallFileFS() {
+    pthread_mutex_lock(&compact_lock);
+    compact_stopping = true;
+    pthread_cond_signal(&compact_cond);
+    pthread_mutex_unlock(&compact_lock);
+    if (compact_running) pthread_join(compact_thread, NULL);
+    if (exit_flush) {
+        pthread_mutex_lock(&exit_flush_lock);
+        exit_flush_fs.erase(find(exit_flush_fs.begin(), exit_flush_fs.end(),
+                                 this));
+        pthread_mutex_unlock(&exit_flush_lock);
+    }
+    pthread_mutex_destroy(&compact_lock);
+    pthread_cond_destroy(&compact_cond);
+    pthread_mutex_destroy(&compacting_lock);
+    pthread_cond_destroy(&compacting_cond);
+    FileReader::stop_readahead();
+}
+
+/**
+ * Wait until a directory is not being compacted any more.
+ *
+ * @return true if it was being compacted.
+ */
+bool
+SmallFileFS::wait_compaction(const string &dirpath) {
+    bool waited = false;
+
+    pthread_mutex_lock(&compacting_lock);
+    while (compacting.find(dirpath) != compacting.end()) {
+        pthread_cond_wait(&compacting_cond, &compacting_lock);
+        waited = true;
+    }
+    pthread_mutex_unlock(&compacting_lock);
+    return waited;
 }
 
 ContainerPtr
@@ -94,10 +172,148 @@ SmallFileFS::get_container(PathExpandInfo &expinfo) {
     ContainerPtr result;
     bool created;
 
-    result = containers.insert(expinfo.dirpath, &expinfo, created);
+    /*
+     * A container looked up while its directory is being compacted
+     * would write to the dropping groups being replaced. compact_dir()
+     * marks the directory before it checks the cache, so either it
+     * sees our reference, or we see the mark and wait.
+     */
+    while (true) {
+        result = containers.insert(expinfo.dirpath, &expinfo, created);
+        if (__sync_fetch_and_add(&ncompacting, 0) == 0 ||
+            !wait_compaction(expinfo.dirpath)) break;
+        result.reset();
+    }
+    if (expinfo.pmount->smallfile_commit_kbs > 0 && !exit_flush) {
+        pthread_mutex_lock(&exit_flush_lock);
+        if (!exit_flush) {
+            if (exit_flush_fs.empty()) atexit(exit_flush_main);
+            exit_flush_fs.push_back(this);
+            exit_flush = true;
+        }
+        pthread_mutex_unlock(&exit_flush_lock);
+    }
+    if (compact_interval > 0 && !compact_running) {
+        /* All the directories of this file system share one mount. */
+        pthread_mutex_lock(&compact_lock);
+        if (!compact_running && !compact_stopping) {
+            compact_mount = expinfo.pmount;
+            if (pthread_create(&compact_thread, NULL, compact_main,
+                               this) == 0) {
+                compact_running = true;
+            } else {
+                mlog(SMF_ERR, "Can't start the compaction thread.");
+                compact_interval = 0;
+            }
+        }
+        pthread_mutex_unlock(&compact_lock);
+    }
     return result;
 }
 
+/**
+ * Compact the dropping groups of a directory.
+ *
+ * It is skipped with PLFS_EBUSY if any file of the directory is open in
+ * this process. A cached container which has only been written through
+ * is flushed and dropped from the cache, so that its next user starts a
+ * new dropping group instead of appending to the replaced ones. Users
+ * of the directory in this process wait until the compaction is done,
+ * other processes are kept out by SmallFileContainer::compact().
+ */
+plfs_error_t
+SmallFileFS::compact_dir(PathExpandInfo &expinfo,
+                         const SmallFileCompactOpts &opts,
+                         SmallFileCompactStats *stats)
+{
+    ContainerPtr cached;
+    string statfile;
+    struct stat stbuf;
+    plfs_error_t ret;
+
+    get_statfile(expinfo.pmount->backends[0], expinfo.dirpath, statfile);
+    ret = expinfo.pmount->backends[0]->store->Stat(statfile.c_str(), &stbuf);
+    if (ret != PLFS_SUCCESS) return ret;
+    pthread_mutex_lock(&compacting_lock);
+    if (!compacting.insert(expinfo.dirpath).second) {
+        pthread_mutex_unlock(&compacting_lock);
+        return PLFS_EBUSY;
+    }
+    __sync_fetch_and_add(&ncompacting, 1);
+    pthread_mutex_unlock(&compacting_lock);
+
+    cached = containers.lookup(expinfo.dirpath);
+    if (cached) {
+        /* One reference is held by the cache, one by us. */
+        if (cached.use_count() > 2) {
+            ret = PLFS_EBUSY;
+        } else if (cached->has_writers()) {
+            cached->sync_writers(WRITER_SYNC_DATAFILE);
+            containers.erase(expinfo.dirpath);
+        }
+        cached.reset();
+    }
+    if (ret == PLFS_SUCCESS) {
+        SmallFileContainer container(&expinfo);
+        ret = container.compact(opts, stats);
+        if (ret == PLFS_SUCCESS && stats->droppings > 0) {
+            containers.erase(expinfo.dirpath);
+        }
+    }
+
+    pthread_mutex_lock(&compacting_lock);
+    compacting.erase(expinfo.dirpath);
+    __sync_fetch_and_sub(&ncompacting, 1);
+    pthread_cond_broadcast(&compacting_cond);
+    pthread_mutex_unlock(&compacting_lock);
+    return ret;
+}
+
+void *
+SmallFileFS::compact_main(void *arg) {
+    SmallFileFS *fs = (SmallFileFS *)arg;
+    SmallFileCompactOpts opts;
+
+    opts.idle = fs->compact_interval;
+    opts.min_garbage = fs->compact_garbage;
+    opts.max_mbs = fs->compact_mbs;
+    opts.grace = fs->compact_interval;
+    pthread_mutex_lock(&fs->compact_lock);
+    while (!fs->compact_stopping) {
+        struct timespec deadline;
+        vector<string> dirs;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += fs->compact_interval;
+        pthread_cond_timedwait(&fs->compact_cond, &fs->compact_lock,
+                               &deadline);
+        if (fs->compact_stopping) break;
+        pthread_mutex_unlock(&fs->compact_lock);
+        fs->containers.keys(&dirs);
+        for (size_t i = 0; i < dirs.size(); i++) {
+            PathExpandInfo expinfo;
+            SmallFileCompactStats stats;
+            expinfo.pmount = fs->compact_mount;
+            expinfo.dirpath = dirs[i];
+            fs->compact_dir(expinfo, opts, &stats);
+        }
+        pthread_mutex_lock(&fs->compact_lock);
+    }
+    pthread_mutex_unlock(&fs->compact_lock);
+    return NULL;
+}
+
+plfs_error_t
+SmallFileFS::compact(struct plfs_physpathinfo *ppip,
+                     const SmallFileCompactOpts &opts,
+                     SmallFileCompactStats *stats)
+{
+    PathExpandInfo expinfo;
+
+    smallfile_fakepath(ppip, expinfo);
+    return compact_dir(expinfo, opts, stats);
+}
+
 plfs_error_t
 SmallFileFS::open(Plfs_fd **pfd, struct plfs_physpathinfo *ppip,
                   int flags, pid_t pid, mode_t mode, Plfs_open_opt *open_opt)
@@ -121,6 +337,9 @@ SmallFileFS::open(Plfs_fd **pfd, struct plfs_physpathinfo *ppip,
                 return PLFS_ENOENT;
             }
         }
+        if ((flags & O_ACCMODE) == O_RDONLY) {
+            container->prefetch(expinfo.filename);
+        }
         Small_fd *fd = new Small_fd(expinfo.filename, container);
         *pfd = fd;
     }
@@ -470,6 +689,60 @@ SmallFileFS::readdir(struct plfs_physpathinfo *ppip, set<string> *buf)
     return ret;
 }
 
+/**
+ * readdir() with the attributes of the entries.
+ *
+ * The files of the container get their attributes from
+ * SmallFileContainer::readdirplus(), which computes them for the whole
+ * directory at once. The other entries are stat'ed in the first backend
+ * like getattr() does, and are returned with st_mode 0 if that fails.
+ *
+ * That reads the indexes of all the files, so it is only done if the
+ * mount enables smallfile_readdirplus. Otherwise PLFS_ENOTSUP makes
+ * plfs_readdirplus() return the names alone.
+ */
+plfs_error_t
+SmallFileFS::readdirplus(struct plfs_physpathinfo *ppip,
+                         map<string, struct stat> *entries)
+{
+    plfs_error_t ret;
+    set<string> names;
+    set<string>::iterator itr;
+    ReaddirOp op(NULL, &names, false, false);
+    PathExpandInfo expinfo;
+    struct plfs_backend *backend;
+
+    if (!ppip->mnt_pt->smallfile_readdirplus) return PLFS_ENOTSUP;
+    ret = plfs_backends_op(ppip, op);
+    if (ret != PLFS_SUCCESS) return ret;
+    smallfile_fakepath(ppip, expinfo);
+    backend = expinfo.pmount->backends[0];
+    for (itr = names.begin(); itr != names.end(); itr++) {
+        struct stat stbuf;
+        string physical_file;
+
+        if (*itr == SMALLFILE_CONTAINER_NAME) continue;
+        physical_file = backend->bmpoint + "/" + expinfo.dirpath + "/" + *itr;
+        if (backend->store->Lstat(physical_file.c_str(), &stbuf) !=
+            PLFS_SUCCESS) {
+            memset(&stbuf, 0, sizeof stbuf);
+        }
+        (*entries)[*itr] = stbuf;
+    }
+    if (names.find(SMALLFILE_CONTAINER_NAME) != names.end()) {
+        ContainerPtr container;
+        string statfile;
+        struct stat base;
+
+        get_statfile(backend, expinfo.dirpath, statfile);
+        ret = backend->store->Lstat(statfile.c_str(), &base);
+        if (ret != PLFS_SUCCESS) return ret;
+        container = get_container(expinfo);
+        if (container) ret = container->readdirplus(base, entries);
+    }
+    return ret;
+}
+
 plfs_error_t
 SmallFileFS::rmdir(struct plfs_physpathinfo *ppip)
 {
@@ -565,6 +838,54 @@ SmallFileFS::invalidate_cache(struct plfs_physpathinfo *ppip)
     return PLFS_SUCCESS;
 }
 
+/**
+ * Read the beginning of many files, one batch per directory.
+ *
+ * See SmallFileContainer::read_many() for the batching, bytes_read[i]
+ * is -1 for a file which can't be read.
+ */
+plfs_error_t
+SmallFileFS::read_many(int nfiles, struct plfs_physpathinfo **ppips,
+                       char **bufs, const size_t *sizes, ssize_t *bytes_read)
+{
+    vector<PathExpandInfo> expinfo(nfiles);
+    map<string, vector<int> > dirs;
+    map<string, vector<int> >::iterator itr;
+    plfs_error_t ret, result = PLFS_SUCCESS;
+
+    for (int i = 0; i < nfiles; i++) {
+        smallfile_expand_path(ppips[i], expinfo[i]);
+        dirs[expinfo[i].dirpath].push_back(i);
+        bytes_read[i] = -1;
+    }
+    for (itr = dirs.begin(); itr != dirs.end(); itr++) {
+        const vector<int> &files = itr->second;
+        vector<string> names(files.size());
+        vector<char *> dirbufs(files.size());
+        vector<size_t> dirsizes(files.size());
+        vector<ssize_t> dirbytes(files.size());
+        ContainerPtr container;
+
+        container = get_container(expinfo[files[0]]);
+        if (!container) {
+            if (result == PLFS_SUCCESS) result = PLFS_ENOENT;
+            continue;
+        }
+        for (size_t i = 0; i < files.size(); i++) {
+            names[i] = expinfo[files[i]].filename;
+            dirbufs[i] = bufs[files[i]];
+            dirsizes[i] = sizes[files[i]];
+        }
+        ret = container->read_many(names, &dirbufs[0], &dirsizes[0],
+                                   &dirbytes[0]);
+        if (ret != PLFS_SUCCESS && result == PLFS_SUCCESS) result = ret;
+        for (size_t i = 0; i < files.size(); i++) {
+            bytes_read[files[i]] = dirbytes[i];
+        }
+    }
+    return result;
+}
+
 plfs_error_t
 SmallFileFS::flush_writes(struct plfs_physpathinfo *ppip)
 {
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <pthread.h>
 #include "LogicalFS.h"
 #include "LogicalFD.h"
@@ -21,9 +22,39 @@ class SmallFileFS : public LogicalFileSystem
         CacheManager<string, SmallFileContainer> containers;
         ContainerPtr get_container(PathExpandInfo &expinfo);
 
+        /* background compaction of the cached directories */
+        PlfsMount *compact_mount;
+        int compact_interval;
+        int compact_garbage;
+        int compact_mbs;
+        bool compact_running;
+        bool compact_stopping;
+        pthread_t compact_thread;
+        pthread_mutex_t compact_lock;
+        pthread_cond_t compact_cond;
+        static void *compact_main(void *arg);
+        plfs_error_t compact_dir(PathExpandInfo &expinfo,
+                                 const SmallFileCompactOpts &opts,
+                                 SmallFileCompactStats *stats);
+        /* directories being compacted, get_container() waits for them */
+        set<string> compacting;
+        int ncompacting; /* size of compacting, read without the lock */
+        pthread_mutex_t compacting_lock;
+        pthread_cond_t compacting_cond;
+        bool wait_compaction(const string &dirpath);
+
+        /* write the records queued for group commit at exit */
+        bool exit_flush;
+        static void exit_flush_main();
+        void flush_containers();
+
     public:
-        SmallFileFS(int cache_size);
+        SmallFileFS(int cache_size, unsigned long cache_bytes,
+                    int interval = 0, int garbage = 0, int mbs = 0);
         ~SmallFileFS();
+        plfs_error_t compact(struct plfs_physpathinfo *ppip,
+                             const SmallFileCompactOpts &opts,
+                             SmallFileCompactStats *stats);
         // here are the methods for creating an instatiated object
         plfs_error_t open(Plfs_fd **pfd,struct plfs_physpathinfo *ppip,
                  int flags,pid_t pid, mode_t mode, Plfs_open_opt *open_opt);
@@ -47,6 +78,8 @@ class SmallFileFS : public LogicalFileSystem
                    mode_t, int flags, pid_t pid);
         plfs_error_t mkdir(struct plfs_physpathinfo *ppip, mode_t);
         plfs_error_t readdir(struct plfs_physpathinfo *ppip, set<string> *buf);
+        plfs_error_t readdirplus(struct plfs_physpathinfo *ppip,
+                                 map<string, struct stat> *entries);
         plfs_error_t readlink(struct plfs_physpathinfo *ppip, char *buf, size_t bufsize,
                               int *bytes);
         plfs_error_t rmdir(struct plfs_physpathinfo *ppip);
@@ -55,6 +88,9 @@ class SmallFileFS : public LogicalFileSystem
         plfs_error_t statvfs(struct plfs_physpathinfo *ppip, struct statvfs *stbuf);
         plfs_error_t flush_writes(struct plfs_physpathinfo *ppip);
         plfs_error_t invalidate_cache(struct plfs_physpathinfo *ppip);
+        plfs_error_t read_many(int nfiles, struct plfs_physpathinfo **ppips,
+                               char **bufs, const size_t *sizes,
+                               ssize_t *bytes_read);
         plfs_error_t resolvepath_finish(struct plfs_physpathinfo *ppip);
 };
 
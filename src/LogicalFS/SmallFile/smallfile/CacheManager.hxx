@@ -4,18 +4,39 @@
 #include <errno.h>
 #include <pthread.h>
 #include <map>
-#include <queue>
+#include <vector>
 #include <tr1/memory>
+#include <tr1/functional>
+#include "Metrics.h"
 
 using namespace std;
 
+/* upper limit of the number of independently locked shards */
+#define CACHE_MAX_SHARDS 8
+/* a shard is only created for every this many objects of max_size */
+#define CACHE_MIN_SHARD_OBJECTS 8
+
 /**
  * This class implements a thread-safe map with resource control.
  *
- * This uses the std::map container and a read-write lock to protect
- * this map. It using FIFO resource reclaim mechanism. So that when
- * the total number of contained objects exceed the max_size, the
- * oldest object will be removed from the map.
+ * The objects are spread over a few shards by the hash of their keys.
+ * Each shard is a std::map protected by its own read-write lock, so
+ * lookups of different keys rarely contend.
+ *
+ * Objects are reclaimed with the CLOCK algorithm: a lookup sets the
+ * referenced bit of the object (under the read lock), and when a shard
+ * is over its limits, the clock hand sweeps the shard, giving
+ * referenced objects a second chance and removing the first one that
+ * was not referenced since the hand last passed it. Objects still held
+ * by someone else (see below) are never reclaimed, so a shard may stay
+ * over its limits until they are released. The limits are the count of
+ * objects (max_size) and the memory used by the objects (max_bytes),
+ * both split evenly among the shards.
+ *
+ * The memory used by an object is Key::length() + Value::length(). If
+ * max_bytes is set, it is sampled for all objects of a shard whenever
+ * a new object is inserted into the shard, as the objects usually grow
+ * after they are inserted.
  *
  * It uses tr1::shared_ptr to protect the contained object when it is
  * referenced by another piece of code, even after deleted from the map.
@@ -48,17 +69,19 @@ public:
     /**
      * @param maxsize The limitation of maximal count of cached objects. if
      *   maxsize <= 0, then there is no limitation on the count of objects.
+     * @param maxbytes The limitation of the memory used by the cached
+     *   objects. if maxbytes == 0, then there is no limitation on memory.
      */
-    CacheManager(int maxsize);
+    CacheManager(int maxsize, unsigned long maxbytes = 0);
     ~CacheManager();
     /* Element access */
     tr1::shared_ptr<Value> lookup(const Key &k);
     /**
      * Insert a new object to the map if map[k] does not exist.
      *
-     * If the total number of objects exceed the limits, one object will
-     * be deleted from the map. If the object is existent already, this
-     * function acts the same as lookup().
+     * If the objects in the shard of k exceed the limits, the objects
+     * not recently used will be deleted from the map. If the object is
+     * existent already, this function acts the same as lookup().
      *
      * @param k The key of this object.
      * @param initpara The parameter to the constructor of the object. If
@@ -75,48 +98,155 @@ public:
     plfs_error_t transfer(const Key &from, const Key &to);
     void erase(const Key &k);
     void clear();
+    /** Append the keys of all cached objects to res. */
+    void keys(vector<Key> *res);
     /* Capacity */
     unsigned long size();
     /**
      * Get the memory footprint of the this object.
      *
-     * Key::length() and Value::length() must be implemented if you called
-     * this function. This function will add up all the lengths of keys and
-     * values to get the memory usage of this cache.
+     * Key::length() and Value::length() must be implemented. This function
+     * will add up the lengths of keys and values (as sampled by the last
+     * insert into their shards) to get the memory usage of this cache.
+     * It is always 0 if there is no limit on memory.
      *
      * @return The total memory usage in bytes of the cached objects.
      */
     unsigned long length();
+    /**
+     * @return The number of objects reclaimed because of the limits.
+     */
+    unsigned long evictions();
 private:
-    queue<Key> reclaim_queue;
-    int max_size;
-    pthread_rwlock_t mlock;
-    map<Key, tr1::shared_ptr<Value> > mapper;
+    struct CacheEntry {
+        tr1::shared_ptr<Value> value;
+        unsigned long charge; /**< memory usage when last sampled */
+        int referenced;       /**< the CLOCK bit, set by lookups */
+    };
+    typedef map<Key, CacheEntry> CacheMap;
+    struct CacheShard {
+        pthread_rwlock_t mlock;
+        CacheMap mapper;
+        unsigned long bytes; /**< sum of the charges in mapper */
+        Key hand;            /**< the CLOCK hand, next key to check */
+    };
+
+    CacheShard *get_shard(const Key &k);
+    void resample(CacheShard *shard);
+    void reclaim(CacheShard *shard, const Key &keep);
+
+    CacheShard *shards;
+    int nshards;
+    int shard_size;
+    unsigned long shard_bytes;
+    unsigned long evicted;
 };
 
 template <class Key, class Value>
-CacheManager<Key, Value>::CacheManager(int maxsize) {
-    pthread_rwlock_init(&mlock, NULL);
-    max_size = maxsize;
+CacheManager<Key, Value>::CacheManager(int maxsize, unsigned long maxbytes) {
+    nshards = CACHE_MAX_SHARDS;
+    if (maxsize > 0 && maxsize / CACHE_MIN_SHARD_OBJECTS < nshards) {
+        nshards = maxsize / CACHE_MIN_SHARD_OBJECTS;
+        if (nshards < 1) nshards = 1;
+    }
+    shards = new CacheShard[nshards];
+    for (int i = 0; i < nshards; i++) {
+        pthread_rwlock_init(&shards[i].mlock, NULL);
+        shards[i].bytes = 0;
+    }
+    shard_size = (maxsize > 0) ? (maxsize + nshards - 1) / nshards : 0;
+    shard_bytes = maxbytes / nshards;
+    if (maxbytes > 0 && shard_bytes == 0) shard_bytes = 1;
+    evicted = 0;
 };
 
 template <class Key, class Value>
 CacheManager<Key, Value>::~CacheManager() {
-    pthread_rwlock_destroy(&mlock);
+    for (int i = 0; i < nshards; i++) {
+        pthread_rwlock_destroy(&shards[i].mlock);
+    }
+    delete [] shards;
+};
+
+template <class Key, class Value>
+typename CacheManager<Key, Value>::CacheShard *
+CacheManager<Key, Value>::get_shard(const Key &key) {
+    tr1::hash<Key> hasher;
+
+    return &shards[hasher(key) % nshards];
+};
+
+/**
+ * Refresh the charges of all the objects of a shard. The caller must
+ * hold the shard lock for write.
+ */
+template <class Key, class Value>
+void
+CacheManager<Key, Value>::resample(CacheShard *shard) {
+    typename CacheMap::iterator itr;
+
+    shard->bytes = 0;
+    for (itr = shard->mapper.begin(); itr != shard->mapper.end(); itr++) {
+        itr->second.charge = itr->first.length() +
+            itr->second.value->length();
+        shard->bytes += itr->second.charge;
+    }
+};
+
+/**
+ * Run the CLOCK hand until the shard is within its limits. The object
+ * with key keep (the one just inserted) and the objects referenced out
+ * of the map are never reclaimed, so the hand gives up after two turns
+ * without finding a victim. The caller must hold the shard lock for
+ * write.
+ */
+template <class Key, class Value>
+void
+CacheManager<Key, Value>::reclaim(CacheShard *shard, const Key &keep) {
+    typename CacheMap::iterator itr;
+    size_t skipped = 0;
+
+    if (shard_bytes > 0) resample(shard);
+    itr = shard->mapper.lower_bound(shard->hand);
+    while (shard->mapper.size() > 1 &&
+           ((shard_size > 0 && shard->mapper.size() > (size_t)shard_size) ||
+            (shard_bytes > 0 && shard->bytes > shard_bytes)) &&
+           skipped < 2 * shard->mapper.size())
+    {
+        if (itr == shard->mapper.end()) itr = shard->mapper.begin();
+        if (itr->second.referenced || itr->first == keep ||
+            itr->second.value.use_count() > 1) {
+            itr->second.referenced = 0;
+            itr++;
+            skipped++;
+            continue;
+        }
+        skipped = 0;
+        shard->bytes -= itr->second.charge;
+        shard->mapper.erase(itr++);
+        __sync_fetch_and_add(&evicted, 1);
+        Metrics::add(PM_SMF_CACHE_EVICTIONS, 1);
+    }
+    if (itr == shard->mapper.end()) itr = shard->mapper.begin();
+    if (itr != shard->mapper.end()) shard->hand = itr->first;
 };
 
 template <class Key, class Value>
 tr1::shared_ptr<Value>
 CacheManager<Key, Value>::lookup(const Key &key) {
     tr1::shared_ptr<Value> retval;
-    typename map<Key, tr1::shared_ptr<Value> >::iterator itr;
+    typename CacheMap::iterator itr;
+    CacheShard *shard = get_shard(key);
 
-    pthread_rwlock_rdlock(&mlock);
-    itr = mapper.find(key);
-    if (itr != mapper.end()) {
-        retval = itr->second;
+    pthread_rwlock_rdlock(&shard->mlock);
+    itr = shard->mapper.find(key);
+    if (itr != shard->mapper.end()) {
+        retval = itr->second.value;
+        if (!itr->second.referenced) {
+            __sync_bool_compare_and_swap(&itr->second.referenced, 0, 1);
+        }
     }
-    pthread_rwlock_unlock(&mlock);
+    pthread_rwlock_unlock(&shard->mlock);
     return retval;
 };
 
@@ -126,89 +256,126 @@ CacheManager<Key, Value>::insert(const Key &key, void *init_para,
                                  bool &created)
 {
     tr1::shared_ptr<Value> retval = lookup(key);
-    typename map<Key, tr1::shared_ptr<Value> >::iterator itr;
+    typename CacheMap::iterator itr;
+    CacheShard *shard;
 
     created = false;
-    if (retval != NULL) return retval;
-    pthread_rwlock_wrlock(&mlock);
-    itr = mapper.find(key);
-    if (itr != mapper.end()) {
-        retval = itr->second;
+    if (retval != NULL) {
+        Metrics::add(PM_SMF_CACHE_HITS, 1);
+        return retval;
+    }
+    shard = get_shard(key);
+    pthread_rwlock_wrlock(&shard->mlock);
+    itr = shard->mapper.find(key);
+    if (itr != shard->mapper.end()) {
+        retval = itr->second.value;
+        itr->second.referenced = 1;
+        Metrics::add(PM_SMF_CACHE_HITS, 1);
     } else {
+        Metrics::add(PM_SMF_CACHE_MISSES, 1);
         try {
             retval.reset(new Value(init_para));
         }
         catch (const exception) {
-            pthread_rwlock_unlock(&mlock);
+            pthread_rwlock_unlock(&shard->mlock);
             return retval;
         }
         catch (...) {
-            pthread_rwlock_unlock(&mlock);
+            pthread_rwlock_unlock(&shard->mlock);
             throw;
         }
-        mapper[key] = retval;
+        CacheEntry &entry = shard->mapper[key];
+        entry.value = retval;
+        entry.charge = 0;
+        entry.referenced = 0;
         created = true;
-        if (max_size > 0) {
-            reclaim_queue.push(key);
-            if (reclaim_queue.size() >= (size_t)max_size) {
-                int erased;
-                do {
-                    erased = mapper.erase(reclaim_queue.front());
-                    reclaim_queue.pop();
-                } while (erased == 0 && !reclaim_queue.empty());
-            }
-        }
+        if (shard_size > 0 || shard_bytes > 0) reclaim(shard, key);
     }
-    pthread_rwlock_unlock(&mlock);
+    pthread_rwlock_unlock(&shard->mlock);
     return retval;
 };
 
 template <class Key, class Value>
 plfs_error_t
 CacheManager<Key, Value>::transfer(const Key &from, const Key &to) {
-    typename map<Key, tr1::shared_ptr<Value> >::iterator itr;
+    typename CacheMap::iterator itr;
+    CacheShard *fshard = get_shard(from);
+    CacheShard *tshard = get_shard(to);
     plfs_error_t ret = PLFS_SUCCESS;
 
-    pthread_rwlock_wrlock(&mlock);
-    itr = mapper.find(from);
-    if (itr == mapper.end()) {
+    /* lock in shard order so two transfers can't deadlock */
+    pthread_rwlock_wrlock(fshard < tshard ? &fshard->mlock : &tshard->mlock);
+    if (fshard != tshard) {
+        pthread_rwlock_wrlock(fshard < tshard ? &tshard->mlock :
+                              &fshard->mlock);
+    }
+    itr = fshard->mapper.find(from);
+    if (itr == fshard->mapper.end()) {
         ret = PLFS_ENOENT;
-    } else if (mapper.find(to) != mapper.end()) {
+    } else if (tshard->mapper.find(to) != tshard->mapper.end()) {
         ret = PLFS_EEXIST;
     } else {
-        mapper[to] = itr->second;
-        mapper.erase(itr);
-        if (max_size > 0) reclaim_queue.push(to);
+        tshard->mapper[to] = itr->second;
+        fshard->bytes -= itr->second.charge;
+        tshard->bytes += itr->second.charge;
+        fshard->mapper.erase(itr);
     }
-    pthread_rwlock_unlock(&mlock);
+    if (fshard != tshard) pthread_rwlock_unlock(&tshard->mlock);
+    pthread_rwlock_unlock(&fshard->mlock);
     return ret;
 };
 
 template <class Key, class Value>
 void
 CacheManager<Key, Value>::erase(const Key &key) {
-    pthread_rwlock_wrlock(&mlock);
-    mapper.erase(key);
-    pthread_rwlock_unlock(&mlock);
+    typename CacheMap::iterator itr;
+    CacheShard *shard = get_shard(key);
+
+    pthread_rwlock_wrlock(&shard->mlock);
+    itr = shard->mapper.find(key);
+    if (itr != shard->mapper.end()) {
+        shard->bytes -= itr->second.charge;
+        shard->mapper.erase(itr);
+    }
+    pthread_rwlock_unlock(&shard->mlock);
 };
 
 template <class Key, class Value>
 void
 CacheManager<Key, Value>::clear() {
-    pthread_rwlock_wrlock(&mlock);
-    mapper.clear();
-    if (max_size > 0) reclaim_queue.clear();
-    pthread_rwlock_unlock(&mlock);
+    for (int i = 0; i < nshards; i++) {
+        pthread_rwlock_wrlock(&shards[i].mlock);
+        shards[i].mapper.clear();
+        shards[i].bytes = 0;
+        pthread_rwlock_unlock(&shards[i].mlock);
+    }
+};
+
+template <class Key, class Value>
+void
+CacheManager<Key, Value>::keys(vector<Key> *res) {
+    typename CacheMap::iterator itr;
+
+    for (int i = 0; i < nshards; i++) {
+        pthread_rwlock_rdlock(&shards[i].mlock);
+        for (itr = shards[i].mapper.begin(); itr != shards[i].mapper.end();
+             itr++) {
+            res->push_back(itr->first);
+        }
+        pthread_rwlock_unlock(&shards[i].mlock);
+    }
 };
 
 template <class Key, class Value>
 unsigned long
 CacheManager<Key, Value>::size() {
-    unsigned long retval;
+    unsigned long retval = 0;
 
-    pthread_rwlock_rdlock(&mlock);
-    retval = mapper.size();
-    pthread_rwlock_unlock(&mlock);
+    for (int i = 0; i < nshards; i++) {
+        pthread_rwlock_rdlock(&shards[i].mlock);
+        retval += shards[i].mapper.size();
+        pthread_rwlock_unlock(&shards[i].mlock);
+    }
     return retval;
 };
 
@@ -216,15 +383,19 @@ template <class Key, class Value>
 unsigned long
 CacheManager<Key, Value>::length() {
     unsigned long retval = 0;
-    typename map<Key, tr1::shared_ptr<Value> >::iterator itr;
 
-    pthread_rwlock_rdlock(&mlock);
-    for (itr = mapper.begin(); itr != mapper.end(); itr++) {
-        retval += itr->first.length();
-        retval += itr->second.length();
+    for (int i = 0; i < nshards; i++) {
+        pthread_rwlock_rdlock(&shards[i].mlock);
+        retval += shards[i].bytes;
+        pthread_rwlock_unlock(&shards[i].mlock);
     }
-    pthread_rwlock_unlock(&mlock);
     return retval;
 };
 
+template <class Key, class Value>
+unsigned long
+CacheManager<Key, Value>::evictions() {
+    return __sync_fetch_and_add(&evicted, 0);
+};
+
 #endif
@@ -6,24 +6,271 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <list>
+#include <map>
+#include <vector>
 #include "FileReader.hxx"
 
-FileReader::FileReader(struct plfs_pathback &fname, int buf_size) {
+/*
+ * The read-ahead requests of all the readers are served by a few threads,
+ * at most threadpool_size of them, started on demand.  So a merge of N
+ * files keeps several block reads in flight while the records of the
+ * current blocks are being consumed.  The threads are joined by
+ * FileReader::stop_readahead(), which runs at exit.
+ *
+ * Only READAHEAD_PER_BACKEND requests of a backend are read at a time, so
+ * that a slow backend does not hold all the threads while the requests
+ * to the other backends wait in the queue.
+ */
+#define READAHEAD_PER_BACKEND 4
+
+struct ReadAhead {
+    struct plfs_pathback *filename;
+    char *buf;
+    int size;
+    off_t offset;
+    ssize_t bytes_read;
+    plfs_error_t ret;
+    bool pending; /**< Requested and not yet waited for by the reader */
+    bool claimed; /**< Taken by a read-ahead thread */
+    bool done;
+};
+
+static pthread_mutex_t readahead_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t readahead_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t readahead_done = PTHREAD_COND_INITIALIZER;
+static list<ReadAhead *> readahead_queue; /**< queued or being read */
+static map<struct plfs_backend *, int> readahead_inflight; /**< by backend */
+static vector<pthread_t> readahead_tids;
+static bool readahead_stopping = false;
+static pthread_once_t readahead_once = PTHREAD_ONCE_INIT;
+
+static plfs_error_t
+read_block(struct plfs_pathback &filename, char *buf, int size,
+           off_t offset, ssize_t &bytes_read)
+{
+    IOSHandle *handle;
+    plfs_error_t ret;
+
+    bytes_read = -1;
+    ret = filename.back->store->Open(filename.bpath.c_str(), O_RDONLY, 0,
+                                     &handle);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = handle->Pread(buf, size, offset, &bytes_read);
+    filename.back->store->Close(handle);
+    return ret;
+}
+
+/*
+ * Serve the queued requests. Once stopping, a thread leaves as soon as
+ * there is nothing left in the queue for it to claim.
+ */
+static void *
+readahead_main(void * /* unused */)
+{
+    list<ReadAhead *>::iterator itr;
+    struct plfs_backend *backend;
+    ReadAhead *req;
+    bool unclaimed;
+
+    pthread_mutex_lock(&readahead_lock);
+    while (true) {
+        unclaimed = false;
+        for (itr = readahead_queue.begin(); itr != readahead_queue.end();
+             itr++) {
+            if ((*itr)->claimed) continue;
+            unclaimed = true;
+            if (readahead_inflight[(*itr)->filename->back] <
+                READAHEAD_PER_BACKEND) break;
+        }
+        if (itr == readahead_queue.end()) {
+            if (readahead_stopping && !unclaimed) break;
+            pthread_cond_wait(&readahead_queued, &readahead_lock);
+            continue;
+        }
+        req = *itr;
+        req->claimed = true;
+        backend = req->filename->back;
+        readahead_inflight[backend]++;
+        pthread_mutex_unlock(&readahead_lock);
+        req->ret = read_block(*req->filename, req->buf, req->size,
+                              req->offset, req->bytes_read);
+        pthread_mutex_lock(&readahead_lock);
+        readahead_queue.remove(req);
+        req->done = true;
+        /* The requests to this backend left in the queue may go now. */
+        if (--readahead_inflight[backend] == READAHEAD_PER_BACKEND - 1)
+            pthread_cond_broadcast(&readahead_queued);
+        pthread_cond_broadcast(&readahead_done);
+    }
+    pthread_mutex_unlock(&readahead_lock);
+    return NULL;
+}
+
+/*
+ * The read-ahead threads are not inherited by a forked child, so fail the
+ * requests they would have served and let the child start its own ones.
+ * The readers read those blocks again by themselves.
+ */
+static void
+readahead_atfork_child()
+{
+    list<ReadAhead *>::iterator itr;
+
+    pthread_mutex_init(&readahead_lock, NULL);
+    pthread_cond_init(&readahead_queued, NULL);
+    pthread_cond_init(&readahead_done, NULL);
+    for (itr = readahead_queue.begin(); itr != readahead_queue.end(); itr++) {
+        (*itr)->ret = PLFS_EAGAIN;
+        (*itr)->done = true;
+    }
+    readahead_queue.clear();
+    readahead_inflight.clear();
+    readahead_tids.clear();
+    readahead_stopping = false;
+}
+
+static void
+readahead_atexit()
+{
+    FileReader::stop_readahead();
+}
+
+static void
+readahead_init()
+{
+    pthread_atfork(NULL, NULL, readahead_atfork_child);
+    atexit(readahead_atexit);
+}
+
+/**
+ * Join the read-ahead threads once they have served the requests already
+ * queued. The readers submitting new requests meanwhile read the blocks
+ * by themselves, and new threads are started by the next request after
+ * this returns.
+ */
+void
+FileReader::stop_readahead() {
+    vector<pthread_t> tids;
+
+    pthread_mutex_lock(&readahead_lock);
+    if (readahead_stopping || readahead_tids.empty()) {
+        pthread_mutex_unlock(&readahead_lock);
+        return;
+    }
+    readahead_stopping = true;
+    tids.swap(readahead_tids);
+    pthread_cond_broadcast(&readahead_queued);
+    pthread_mutex_unlock(&readahead_lock);
+    for (size_t i = 0; i < tids.size(); i++) pthread_join(tids[i], NULL);
+    pthread_mutex_lock(&readahead_lock);
+    readahead_stopping = false;
+    pthread_mutex_unlock(&readahead_lock);
+}
+
+/* Return false if the request should be read by the caller itself. */
+static bool
+readahead_submit(ReadAhead *req)
+{
+    PlfsConf *pconf = get_plfs_conf();
+    int max_threads = pconf ? pconf->threadpool_size : 1;
+    bool queued = true;
+
+    pthread_once(&readahead_once, readahead_init);
+    pthread_mutex_lock(&readahead_lock);
+    int nthreads = readahead_tids.size();
+    if (!readahead_stopping && nthreads < max_threads &&
+        nthreads < (int)readahead_queue.size() + 1)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, readahead_main, NULL) == 0) {
+            readahead_tids.push_back(thread);
+        } else {
+            mlog(SMF_WARN, "Unable to start a read-ahead thread.");
+        }
+    }
+    if (!readahead_stopping && !readahead_tids.empty()) {
+        readahead_queue.push_back(req);
+        pthread_cond_signal(&readahead_queued);
+    } else {
+        queued = false;
+    }
+    pthread_mutex_unlock(&readahead_lock);
+    return queued;
+}
+
+FileReader::FileReader(struct plfs_pathback &fname, int buf_size,
+                       off_t start_offset) {
     filename = fname;
     assert((buf_size & 3) == 0);
     buffer_size = buf_size;
     buffer_end = -1;
-    buffer_pos = 0;
+    buffer_pos = start_offset;
     buffer = new char[buf_size];
+    spare = NULL;
     data_ptr = NULL;
     next_pos = 0;
     data_pos = -1;
     rec_foff = (off_t)-1;
+    readahead = new ReadAhead;
+    readahead->pending = false;
+    /* Load the first block while the other readers are being created. */
+    start_readahead(buffer, buffer_pos);
 }
 
 FileReader::~FileReader() {
+    ssize_t unused;
+    /* Wait for the read-ahead thread to release our buffer. */
+    if (readahead->pending) finish_readahead(NULL, 0, unused);
+    delete readahead;
     if (data_pos >= 0) delete []data_ptr;
     delete []buffer;
+    delete []spare;
+}
+
+void
+FileReader::start_readahead(char *buf, off_t offset) {
+    readahead->filename = &filename;
+    readahead->buf = buf;
+    readahead->size = buffer_size;
+    readahead->offset = offset;
+    readahead->bytes_read = -1;
+    readahead->ret = PLFS_SUCCESS;
+    readahead->pending = true;
+    readahead->claimed = false;
+    readahead->done = false;
+    if (!readahead_submit(readahead)) {
+        readahead->ret = read_block(filename, buf, buffer_size, offset,
+                                    readahead->bytes_read);
+        readahead->done = true;
+    }
+}
+
+/**
+ * Get the block at the given offset of the file into the given buffer.
+ *
+ * If it has been read ahead, wait for the request. Otherwise, or if the
+ * request has been given up by a forked child, read it now.
+ */
+plfs_error_t
+FileReader::finish_readahead(char *buf, off_t offset, ssize_t &bytes_read) {
+    if (readahead->pending) {
+        pthread_mutex_lock(&readahead_lock);
+        while (!readahead->done) {
+            pthread_cond_wait(&readahead_done, &readahead_lock);
+        }
+        pthread_mutex_unlock(&readahead_lock);
+        readahead->pending = false;
+        if (readahead->ret != PLFS_EAGAIN && readahead->buf == buf &&
+            readahead->offset == offset)
+        {
+            bytes_read = readahead->bytes_read;
+            return readahead->ret;
+        }
+    }
+    if (!buf) return PLFS_SUCCESS;
+    return read_block(filename, buf, buffer_size, offset, bytes_read);
 }
 
 plfs_error_t
@@ -105,11 +352,13 @@ FileReader::read_cross_buffer_record(int first_byte, int rec_size) {
  * Read some data from the file to the buffer.
  *
  * If the buffer is not full filled, then fill the remaining of it.
- * If the buffer is full filled, then we read a new buffer block. And
- * then we need update the buffer_end.
+ * If the buffer is full filled, then we switch to the next buffer block,
+ * which has normally been read ahead. And then we need update the
+ * buffer_end.
  *
- * Once we read a new buffer block from the file, we need to update
- * buffer_pos and next_pos.
+ * Once we switch to a new buffer block, we need to update buffer_pos and
+ * next_pos. And once the buffer is full filled, the next block is read
+ * ahead.
  *
  * @param bytes_read the bytes read to return
  * @return On success, PLFS_SUCCESS is returned. Otherwise, PLFS_E*
@@ -118,45 +367,37 @@ FileReader::read_cross_buffer_record(int first_byte, int rec_size) {
 
 plfs_error_t
 FileReader::read_buffer(ssize_t &bytes_read) {
-    IOSHandle *handle;
-    bytes_read = -1;
     plfs_error_t ret;
 
-    ret = filename.back->store->Open(filename.bpath.c_str(), O_RDONLY, 0,
-                                     &handle);
-    if (ret != PLFS_SUCCESS) return ret;
+    bytes_read = -1;
     if (buffer_end == -1) {
         /* The first call to this function. */
-        ret = handle->Read(&buffer[0], buffer_size, &bytes_read);
-        if (ret != PLFS_SUCCESS) {
-            filename.back->store->Close(handle);
-            return ret;
-        }
+        ret = finish_readahead(buffer, buffer_pos, bytes_read);
+        if (ret != PLFS_SUCCESS) return ret;
         buffer_end = bytes_read;
-        filename.back->store->Close(handle);
-        return ret;
-    }
-    off_t read_pos = buffer_pos + buffer_end;
-    if (buffer_end == buffer_size) {
-        /* A new buffer block is needed to load from the file */
-        ret = handle->Pread(&buffer[0], buffer_size, read_pos, &bytes_read);
-        if (ret != PLFS_SUCCESS) {
-            filename.back->store->Close(handle);
-            return ret;
-        }
+    } else if (buffer_end == buffer_size) {
+        /* Switch to the next buffer block */
+        char *next_block;
+        if (!spare) spare = new char[buffer_size];
+        ret = finish_readahead(spare, buffer_pos + buffer_end, bytes_read);
+        if (ret != PLFS_SUCCESS) return ret;
+        next_block = spare;
+        spare = buffer;
+        buffer = next_block;
         buffer_pos += buffer_size;
         next_pos -= buffer_size;
         buffer_end = bytes_read;
     } else {
         /* We need to full fill the remaining of the buffer block */
-        ret = handle->Pread(&buffer[buffer_end],
-                            buffer_size - buffer_end, read_pos, &bytes_read);
-        if (ret != PLFS_SUCCESS) {
-            filename.back->store->Close(handle);
-            return ret;
-        }
+        ret = read_block(filename, &buffer[buffer_end],
+                         buffer_size - buffer_end, buffer_pos + buffer_end,
+                         bytes_read);
+        if (ret != PLFS_SUCCESS) return ret;
         buffer_end += bytes_read;
     }
-    filename.back->store->Close(handle);
+    if (buffer_end == buffer_size && bytes_read > 0) {
+        if (!spare) spare = new char[buffer_size];
+        start_readahead(spare, buffer_pos + buffer_size);
+    }
     return ret;
 }
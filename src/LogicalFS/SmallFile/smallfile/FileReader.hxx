@@ -8,6 +8,8 @@
 
 using namespace std;
 
+struct ReadAhead;
+
 /**
  * This class implement buffered file reading.
  *
@@ -23,14 +25,28 @@ using namespace std;
  * to read the records one by one.
  *
  * The buffer size MUST be aligned to 4 bytes.
+ *
+ * The file is double-buffered: whenever a buffer block is full filled,
+ * the next block is read ahead into a spare buffer by the read-ahead
+ * threads, so that the records of the current block are consumed while
+ * the next one is being loaded.  The first block is requested as soon as
+ * the reader is created.
+ *
+ * The reading starts from the given offset of the file, which should be
+ * the beginning of a record.
  */
 
 class FileReader : public RecordReader {
 public:
-    FileReader(struct plfs_pathback &filename, int buf_size);
+    FileReader(struct plfs_pathback &filename, int buf_size,
+               off_t start_offset = 0);
     virtual ~FileReader();
     virtual void *front() {return (void *)data_ptr;};
     virtual plfs_error_t pop_front();
+    /**
+     * Join the read-ahead threads shared by all the readers.
+     */
+    static void stop_readahead();
 protected:
     /**
      * Get the size of a given record.
@@ -48,9 +64,14 @@ protected:
     off_t record_foff() {return rec_foff;};
 private:
     plfs_error_t read_buffer(ssize_t &bytes_read);
+    void start_readahead(char *buf, off_t offset);
+    plfs_error_t finish_readahead(char *buf, off_t offset,
+                                  ssize_t &bytes_read);
     plfs_error_t read_cross_buffer_record(int first_byte, int rec_size);
     struct plfs_pathback filename;
     char *buffer;
+    char *spare; /**< The buffer for the next block, allocated on demand */
+    struct ReadAhead *readahead; /**< The outstanding read-ahead request */
     char *data_ptr; /**< Always points to the current record */
     int buffer_size; /**< The total size of the buffer */
     int buffer_end; /**< The end of the valid data in buffer */
@@ -7,9 +7,11 @@
 #include <assert.h>
 #include "FileWriter.hxx"
 #include <Util.h>
+#include <Metrics.h>
 
 FileWriter::FileWriter() {
     pthread_mutex_init(&mlock, NULL);
+    pthread_cond_init(&committed, NULL);
 #ifdef SMALLFILE_USE_LIBC_FILEIO
     fptr = NULL;
 #else
@@ -17,9 +19,19 @@ FileWriter::FileWriter() {
     handle = NULL;
 #endif
     current_pos = 0;
+    written_pos = 0;
+    synced_pos = 0;
+    failed_start = failed_end = 0;
+    failed_ret = PLFS_SUCCESS;
+    lost_ret = PLFS_SUCCESS;
+    pending_records = 0;
+    batch_size = 0;
+    owner = 0;
+    committing = false;
 }
 
 FileWriter::~FileWriter() {
+    pthread_cond_destroy(&committed);
     pthread_mutex_destroy(&mlock);
 }
 
@@ -42,53 +54,232 @@ FileWriter::open_file(const char *filename, IOStore *store) {
                           DEFAULT_FMODE, &handle);
         if (ret == PLFS_SUCCESS) store_ = store;
 #endif
+        owner = getpid();
     }
     Util::MutexUnlock(&mlock, __FUNCTION__);
     return ret;
 }
 
+/**
+ * Write the buffer to the given offset, which is where the file ends.
+ *
+ * The offset is given so that a failed write can be cut off the file and
+ * the next one starts at the same place, see write_failed().
+ */
 plfs_error_t
-FileWriter::append(const void *buf, size_t length, off_t *physical_offset) {
-    Util::MutexLock(&mlock, __FUNCTION__);
-#ifdef SMALLFILE_USE_LIBC_FILEIO
-    assert(fptr);
-#else
-    assert(handle);
-#endif
-    if (physical_offset) *physical_offset = current_pos;
+FileWriter::write_all(const void *buf, size_t length, off_t offset,
+                      size_t *written_bytes) {
+    const char *ptr = (const char *)buf;
+
     while (length > 0) {
 #ifdef SMALLFILE_USE_LIBC_FILEIO
-        ssize_t written = fwrite(buf, 1, length, fptr);
+        ssize_t written = fwrite(ptr, 1, length, fptr);
         if (ferror(fptr)) written = -1;
+        (void)offset;  /* opened for append */
 #else
         ssize_t written;
-        handle->Write(buf, length, &written);
+        handle->Pwrite(ptr, length, offset + (ptr - (const char *)buf),
+                       &written);
 #endif
         if (written < 0) {
             break;
         } else if (written == 0) {
             continue;
         }
-        current_pos += written;
+        ptr += written;
         length -= written;
     }
-    Util::MutexUnlock(&mlock, __FUNCTION__);
+    *written_bytes = ptr - (const char *)buf;
     return (length == 0) ? PLFS_SUCCESS : PLFS_TBD;
 }
 
+/**
+ * Account for a write of the records from start that failed after
+ * writing only some bytes of them.
+ *
+ * The bytes written may end in the middle of a record, which would
+ * misalign every record appended after it (the index records have a
+ * fixed size), so they are cut off the file and all the records from
+ * start to current_pos fail, including the ones queued behind them. The
+ * next record is appended at start.
+ *
+ * It should be called with mlock held.
+ */
+void
+FileWriter::write_failed(off_t start, size_t written, plfs_error_t ret) {
+    plfs_error_t cut_ret = PLFS_SUCCESS;
+
+    if (written > 0) {
+#ifdef SMALLFILE_USE_LIBC_FILEIO
+        if (fflush(fptr) != 0 || ftruncate(fileno(fptr), start) != 0) {
+            cut_ret = errno_to_plfs_error(errno);
+        }
+        clearerr(fptr);
+#else
+        cut_ret = handle->Ftruncate(start);
+#endif
+        if (cut_ret != PLFS_SUCCESS) {
+            /* The next write at start still covers the partial record. */
+            mlog(SMF_ERR, "Can't cut %lu bytes of failed records, "
+                 "ret = %d.", (unsigned long)written, cut_ret);
+        }
+    }
+    failed_start = start;
+    failed_end = current_pos;
+    failed_ret = lost_ret = ret;
+    current_pos = written_pos = start;
+    pending.clear();
+    pending_records = 0;
+}
+
+/**
+ * Make sure that the records before the given offset are written to the
+ * file, or synced to the backend if durable is set.
+ *
+ * The first caller finding no commit in progress becomes the committer:
+ * it takes all the queued records, including the ones of the other
+ * threads, and writes them with one append. The others wait for it and
+ * return as soon as a commit has covered their records.
+ *
+ * It should be called with mlock held.
+ *
+ * @return On success, PLFS_SUCCESS is returned. If the commit of some
+ *    records before the given offset has failed, its error is returned.
+ *    A failed write fails every record of its batch and the ones queued
+ *    behind them, see write_failed().
+ */
 plfs_error_t
-FileWriter::sync() {
+FileWriter::commit(off_t end, bool durable) {
+    plfs_error_t ret = PLFS_SUCCESS;
+
+    while (written_pos < end || (durable && synced_pos < end)) {
+        string batch;
+        size_t records, written = 0;
+        off_t batch_start, batch_end;
+        bool write_ok;
+
+        if (committing) {
+            pthread_cond_wait(&committed, &mlock);
+            if (end > failed_start && end <= failed_end) return failed_ret;
+            continue;
+        }
+        committing = true;
+        batch.swap(pending);
+        records = pending_records;
+        pending_records = 0;
+        batch_start = written_pos;
+        batch_end = current_pos;
+        Util::MutexUnlock(&mlock, __FUNCTION__);
+        if (!batch.empty() && getpid() != owner) {
+            /* Inherited through fork(), the parent will write them. */
+            batch.clear();
+        }
+        if (!batch.empty()) {
+            ret = write_all(batch.data(), batch.size(), batch_start,
+                            &written);
+            Metrics::add(PM_SMF_COMMITS, 1);
+            Metrics::add(PM_SMF_COMMIT_RECORDS, records);
+        }
+        write_ok = (ret == PLFS_SUCCESS);
+        if (ret == PLFS_SUCCESS && durable) {
+#ifdef SMALLFILE_USE_LIBC_FILEIO
+            if (fflush(fptr) != 0) ret = errno_to_plfs_error(errno);
+#else
+            ret = handle->Fsync();
+#endif
+        }
+        Util::MutexLock(&mlock, __FUNCTION__);
+        committing = false;
+        if (!write_ok) {
+            mlog(SMF_ERR, "Failed to commit %lu records, %lu of %lu bytes "
+                 "written, ret = %d.", (unsigned long)records,
+                 (unsigned long)written, (unsigned long)batch.size(), ret);
+            write_failed(batch_start, written, ret);
+        } else {
+            written_pos = batch_end;
+            if (ret == PLFS_SUCCESS && durable) synced_pos = batch_end;
+        }
+        if (write_ok && ret != PLFS_SUCCESS) {
+            mlog(SMF_ERR, "Failed to sync %lu records, ret = %d.",
+                 (unsigned long)records, ret);
+            failed_start = batch_start;
+            failed_end = batch_end;
+            failed_ret = lost_ret = ret;
+        }
+        pthread_cond_broadcast(&committed);
+        if (ret != PLFS_SUCCESS) break;
+    }
+    return ret;
+}
+
+plfs_error_t
+FileWriter::append(const void *buf, size_t length, off_t *physical_offset) {
     plfs_error_t ret = PLFS_SUCCESS;
+
+    Util::MutexLock(&mlock, __FUNCTION__);
+#ifdef SMALLFILE_USE_LIBC_FILEIO
+    assert(fptr);
+#else
+    assert(handle);
+#endif
+    if (physical_offset) *physical_offset = current_pos;
+    if (batch_size == 0 && !committing && pending.empty()) {
+        /* Nobody to group with, write the record in place. */
+        off_t start = current_pos;
+        size_t written;
+        committing = true;
+        current_pos += length;
+        Util::MutexUnlock(&mlock, __FUNCTION__);
+        ret = write_all(buf, length, start, &written);
+        Metrics::add(PM_SMF_COMMITS, 1);
+        Metrics::add(PM_SMF_COMMIT_RECORDS, 1);
+        Util::MutexLock(&mlock, __FUNCTION__);
+        committing = false;
+        if (ret == PLFS_SUCCESS) {
+            written_pos = start + length;
+        } else {
+            write_failed(start, written, ret);
+            lost_ret = PLFS_SUCCESS;   /* reported to our caller */
+        }
+        pthread_cond_broadcast(&committed);
+    } else {
+        pending.append((const char *)buf, length);
+        pending_records++;
+        current_pos += length;
+        if (pending.size() >= batch_size) ret = commit(current_pos, false);
+    }
+    Util::MutexUnlock(&mlock, __FUNCTION__);
+    return ret;
+}
+
+plfs_error_t
+FileWriter::flush() {
+    plfs_error_t ret;
     Util::MutexLock(&mlock, __FUNCTION__);
+    ret = commit(current_pos, false);
 #ifdef SMALLFILE_USE_LIBC_FILEIO
-    if (fptr) {
-        int rv = fflush(fptr);
-        if (rv != 0) rv = errno;
-        ret = errno_to_plfs_error(rv);
+    if (ret == PLFS_SUCCESS && fptr && fflush(fptr) != 0) {
+        ret = errno_to_plfs_error(errno);
     }
+#endif
+    /* The records queued without waiting may have been lost meanwhile. */
+    if (ret == PLFS_SUCCESS) ret = lost_ret;
+    lost_ret = PLFS_SUCCESS;
+    Util::MutexUnlock(&mlock, __FUNCTION__);
+    return ret;
+}
+
+plfs_error_t
+FileWriter::sync() {
+    plfs_error_t ret = PLFS_SUCCESS;
+    Util::MutexLock(&mlock, __FUNCTION__);
+#ifdef SMALLFILE_USE_LIBC_FILEIO
+    if (fptr) ret = commit(current_pos, true);
 #else
-    if (handle) ret = handle->Fsync();
+    if (handle) ret = commit(current_pos, true);
 #endif
+    if (ret == PLFS_SUCCESS) ret = lost_ret;
+    lost_ret = PLFS_SUCCESS;
     Util::MutexUnlock(&mlock, __FUNCTION__);
     return ret;
 }
@@ -98,15 +289,21 @@ FileWriter::close_file() {
     Util::MutexLock(&mlock, __FUNCTION__);
 #ifdef SMALLFILE_USE_LIBC_FILEIO
     if (fptr != NULL) {
+        commit(current_pos, false);
         fclose(fptr);
         fptr = NULL;
-        current_pos = 0;
+        current_pos = written_pos = synced_pos = 0;
+        failed_start = failed_end = 0;
+        lost_ret = PLFS_SUCCESS;
     }
 #else
     if (handle) {
+        commit(current_pos, false);
         store_->Close(handle);
         handle = NULL;
-        current_pos = 0;
+        current_pos = written_pos = synced_pos = 0;
+        failed_start = failed_end = 0;
+        lost_ret = PLFS_SUCCESS;
         store_ = NULL;
     }
 #endif
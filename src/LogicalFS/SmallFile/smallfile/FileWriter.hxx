@@ -5,11 +5,18 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <string>
 #include <Util.h>
 #include "SmallFileLayout.h"
 
 /**
  * It represents a physical file for writing.
+ *
+ * Appends are group committed: while one thread is writing a batch to
+ * the file, the records appended by the other threads are queued in
+ * memory and the next committer writes them all with a single append.
+ * With a batch size, the records are also held back until that many
+ * bytes are queued or a commit is requested by flush() or sync().
  */
 
 class FileWriter {
@@ -20,11 +27,33 @@ private:
     IOStore *store_;
     IOSHandle *handle;
 #endif
-    off_t current_pos;
+    off_t current_pos; /**< The end of the file including queued records */
+    off_t written_pos; /**< The end of the records written to the file */
+    off_t synced_pos; /**< The end of the records synced to the backend */
+    off_t failed_start; /**< The records in [failed_start, failed_end) */
+    off_t failed_end;   /**< were lost by a failed commit */
+    plfs_error_t failed_ret;
+    plfs_error_t lost_ret; /**< A loss not yet reported by flush()/sync() */
+    string pending; /**< The queued records, starting at written_pos */
+    size_t pending_records;
+    size_t batch_size;
+    pid_t owner; /**< The process which has opened the file */
+    bool committing;
     pthread_mutex_t mlock;
+    pthread_cond_t committed;
+    plfs_error_t write_all(const void *buf, size_t length, off_t offset,
+                           size_t *written);
+    void write_failed(off_t start, size_t written, plfs_error_t ret);
+    plfs_error_t commit(off_t end, bool durable);
 public:
     FileWriter();
     ~FileWriter();
+    /**
+     * Queue up to batch_size bytes of records before writing them.
+     *
+     * 0, the default, writes every record before append() returns.
+     */
+    void set_batch_size(size_t size) { batch_size = size; };
     plfs_error_t open_file(const char *filename, class IOStore *store);
     /**
      * Append some data to this file.
@@ -36,6 +65,9 @@ public:
      * @return On success, PLFS_SUCCESS is returned. On error, PLFS_TBD is returned.
      */
     plfs_error_t append(const void *buf, size_t length, off_t *physical_offset);
+    /** Write all the queued records to the file. */
+    plfs_error_t flush();
+    /** Write all the queued records and sync them to the backend. */
     plfs_error_t sync();
     plfs_error_t close_file();
     bool is_opened();
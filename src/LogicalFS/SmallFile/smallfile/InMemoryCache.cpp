@@ -11,6 +11,7 @@ struct MemCacheUpdateEntry {
 InMemoryCache::InMemoryCache() {
     data_source = NULL;
     fully_loaded = false;
+    mem_bytes = 0;
 }
 
 InMemoryCache::~InMemoryCache() {
@@ -58,11 +59,14 @@ InMemoryCache::add_resource(int type, void *resource) {
         }
         delete data_source;
         data_source = NULL;
+        if (fully_loaded) load_finished();
+        mem_bytes = memory_usage();
     } else if (type == MEMCACHE_MERGEUPDATE) {
         MemCacheUpdateEntry *entry = (MemCacheUpdateEntry *)resource;
         if (fully_loaded && !entry->merged) {
             ret = merge_object(entry->record, entry->metadata);
             if (ret == PLFS_SUCCESS) entry->merged = true;
+            mem_bytes = memory_usage();
         }
     } else {
         assert(0);
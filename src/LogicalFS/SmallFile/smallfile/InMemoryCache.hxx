@@ -5,6 +5,8 @@
 #include "RecordReader.hxx"
 
 #define MEMCACHE_MINTYPEVALUE 0
+/* estimated overhead of a node in a std::map, for memory_usage() */
+#define MEMCACHE_NODE_OVERHEAD (4 * sizeof(void *))
 enum MemCacheResourceType {
     MEMCACHE_DATASOURCE = MEMCACHE_MINTYPEVALUE,
     MEMCACHE_FULLYLOADED,
@@ -47,6 +49,20 @@ public:
      * same parameters.
      */
     virtual plfs_error_t update(void *record, void *metadata);
+    /**
+     * Get the estimated memory used by the cached information.
+     *
+     * It is the value returned by memory_usage() after the last merge, so
+     * it can be read without taking any lock.
+     */
+    unsigned long length() { return mem_bytes; };
+    /**
+     * Whether the cached object has been fully loaded.
+     *
+     * Once loaded, it is kept up-to-date by update(), so the caller can
+     * skip whatever it needs to do before loading it from the data source.
+     */
+    bool loaded() { return fully_loaded; };
 
 protected:
     virtual bool resource_available(int type, void *resource);
@@ -72,8 +88,24 @@ protected:
      * @return On success, PLFS_SUCCESS is returned. Otherwise PLFS_E* is returned.
      */
     virtual plfs_error_t merge_object(void *object, void *meta) = 0;
+    /**
+     * Estimate the memory used by the cached object.
+     *
+     * This is called with ResourceUnit::item_lock locked for write after
+     * records are merged. It should be cheap, it is called for every
+     * merged update.
+     */
+    virtual unsigned long memory_usage() { return 0; };
+    /**
+     * Called when all the records in the data_source have been merged.
+     *
+     * This is called with ResourceUnit::item_lock locked for write, so
+     * that the derived class could persist what it has built.
+     */
+    virtual void load_finished() {};
 
 private:
+    volatile unsigned long mem_bytes;
     bool fully_loaded;
     RecordReader *data_source; /**< The data source to build the cache. */
 };
@@ -0,0 +1,197 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <Util.h>
+#include <Metrics.h>
+#include "IndexSegment.hxx"
+
+/* Larger index files are left unsealed rather than sorted in memory. */
+#define INDEX_SEGMENT_MAX_BYTES (16 * READBUFFER_MAXSIZE)
+/* The footer and the fence table of most segments are read at once. */
+#define INDEX_SEGMENT_TAIL_SIZE 4096
+
+static plfs_error_t
+pread_all(IOSHandle *handle, void *buf, size_t length, off_t offset) {
+    char *ptr = (char *)buf;
+
+    while (length > 0) {
+        ssize_t bytes;
+        plfs_error_t ret = handle->Pread(ptr, length, offset, &bytes);
+        if (ret != PLFS_SUCCESS) return ret;
+        if (bytes <= 0) return PLFS_EINVAL; /* shorter than expected */
+        ptr += bytes;
+        offset += bytes;
+        length -= bytes;
+    }
+    return PLFS_SUCCESS;
+}
+
+static bool
+index_entry_fid_less(const struct IndexEntry &entry1,
+                     const struct IndexEntry &entry2)
+{
+    return entry1.fid < entry2.fid;
+}
+
+plfs_error_t
+seal_index_segment(const struct plfs_pathback &indexfile,
+                   const string &segmentfile)
+{
+    IOStore *store = indexfile.back->store;
+    vector<struct IndexEntry> records;
+    struct IndexSegmentFooter footer;
+    string buf, tmpname;
+    IOSHandle *handle;
+    ssize_t written;
+    off_t size;
+    plfs_error_t ret, ret2;
+
+    ret = store->Open(indexfile.bpath.c_str(), O_RDONLY, 0, &handle);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = handle->Size(&size);
+    if (ret == PLFS_SUCCESS && size > INDEX_SEGMENT_MAX_BYTES)
+        ret = PLFS_EFBIG;
+    if (ret == PLFS_SUCCESS) {
+        /* A partial record at the end has not been written completely. */
+        records.resize(size / sizeof(struct IndexEntry));
+        if (!records.empty())
+            ret = pread_all(handle, &records[0],
+                            records.size() * sizeof(struct IndexEntry), 0);
+    }
+    store->Close(handle);
+    if (ret != PLFS_SUCCESS || records.empty()) return ret;
+
+    /* A stable sort keeps the records of every file in the log order. */
+    stable_sort(records.begin(), records.end(), index_entry_fid_less);
+    buf.append((const char *)&records[0],
+               records.size() * sizeof(struct IndexEntry));
+    for (size_t i = 0; i < records.size(); i += INDEX_SEGMENT_INTERVAL) {
+        FileID fence = records[i].fid;
+        buf.append((const char *)&fence, sizeof fence);
+    }
+    footer.magic = INDEX_SEGMENT_MAGIC;
+    footer.version = INDEX_SEGMENT_VERSION;
+    footer.nrecords = records.size();
+    footer.interval = INDEX_SEGMENT_INTERVAL;
+    footer.nfences = (records.size() + INDEX_SEGMENT_INTERVAL - 1) /
+        INDEX_SEGMENT_INTERVAL;
+    footer.min_fid = records.front().fid;
+    footer.max_fid = records.back().fid;
+    footer.index_size = records.size() * sizeof(struct IndexEntry);
+    buf.append((const char *)&footer, sizeof footer);
+
+    tmpname = segmentfile;
+    tmpname.insert(tmpname.rfind('/') + 1, COMPACT_PREFIX);
+    ret = store->Open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                      DEFAULT_FMODE, &handle);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = Util::Writen(buf.data(), buf.length(), handle, &written);
+    ret2 = store->Close(handle);
+    if (ret == PLFS_SUCCESS) ret = ret2;
+    if (ret == PLFS_SUCCESS)
+        ret = store->Rename(tmpname.c_str(), segmentfile.c_str());
+    if (ret != PLFS_SUCCESS) {
+        store->Unlink(tmpname.c_str());
+        return ret;
+    }
+    Metrics::add(PM_SMF_SEGMENTS_SEALED, 1);
+    mlog(SMF_DAPI, "Sealed %lu index records of %s.",
+         (unsigned long)records.size(), indexfile.bpath.c_str());
+    return PLFS_SUCCESS;
+}
+
+plfs_error_t
+SegmentReader::load(struct plfs_pathback &segment,
+                    const struct plfs_pathback &indexfile, FileID fid) {
+    IOSHandle *handle;
+    struct IndexSegmentFooter footer;
+    struct IndexEntry key;
+    struct stat stbuf;
+    vector<char> tail;
+    vector<FileID> fences;
+    size_t fence_bytes, record_bytes, first, last;
+    off_t size;
+    plfs_error_t ret;
+
+    records.clear();
+    current = 0;
+    ret = segment.back->store->Open(segment.bpath.c_str(), O_RDONLY, 0,
+                                    &handle);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = handle->Size(&size);
+    if (ret == PLFS_SUCCESS && size < (off_t)sizeof footer)
+        ret = PLFS_EINVAL;
+    if (ret == PLFS_SUCCESS) {
+        tail.resize(min(size, (off_t)INDEX_SEGMENT_TAIL_SIZE));
+        ret = pread_all(handle, &tail[0], tail.size(), size - tail.size());
+    }
+    if (ret != PLFS_SUCCESS) goto out;
+    memcpy(&footer, &tail[tail.size() - sizeof footer], sizeof footer);
+    fence_bytes = (size_t)footer.nfences * sizeof(FileID);
+    record_bytes = footer.nrecords * sizeof(struct IndexEntry);
+    if (footer.magic != INDEX_SEGMENT_MAGIC ||
+        footer.version != INDEX_SEGMENT_VERSION || footer.interval == 0 ||
+        footer.nfences != (footer.nrecords + footer.interval - 1) /
+        footer.interval ||
+        (off_t)(record_bytes + fence_bytes + sizeof footer) != size) {
+        mlog(SMF_ERR, "%s is not a valid index segment.",
+             segment.bpath.c_str());
+        ret = PLFS_EINVAL;
+        goto out;
+    }
+    /* Only whole records were sealed, as in seal_index_segment(). */
+    ret = indexfile.back->store->Lstat(indexfile.bpath.c_str(), &stbuf);
+    if (ret == PLFS_SUCCESS &&
+        (uint64_t)(stbuf.st_size - stbuf.st_size %
+                   sizeof(struct IndexEntry)) != footer.index_size) {
+        mlog(SMF_DAPI, "%s has changed since it was sealed.",
+             indexfile.bpath.c_str());
+        ret = PLFS_EAGAIN;
+        goto out;
+    }
+    /* The index file is removed some time after a compaction. */
+    if (ret == PLFS_ENOENT) ret = PLFS_SUCCESS;
+    if (ret != PLFS_SUCCESS) goto out;
+    if (fid < footer.min_fid || fid > footer.max_fid) goto out;
+
+    /* The fences are in the tail already unless there are many of them. */
+    fences.resize(footer.nfences);
+    if (fence_bytes + sizeof footer <= tail.size()) {
+        memcpy(&fences[0], &tail[tail.size() - sizeof footer - fence_bytes],
+               fence_bytes);
+    } else {
+        ret = pread_all(handle, &fences[0], fence_bytes, record_bytes);
+        if (ret != PLFS_SUCCESS) goto out;
+    }
+    /*
+     * The records of fid start in the last block whose fence is less
+     * than fid, and end before the first block whose fence is greater.
+     */
+    first = lower_bound(fences.begin(), fences.end(), fid) - fences.begin();
+    if (first > 0) first--;
+    last = upper_bound(fences.begin(), fences.end(), fid) - fences.begin();
+    first *= footer.interval;
+    last = min((size_t)footer.nrecords, last * footer.interval);
+    records.resize(last - first);
+    ret = pread_all(handle, &records[0],
+                    records.size() * sizeof(struct IndexEntry),
+                    first * sizeof(struct IndexEntry));
+    if (ret != PLFS_SUCCESS) goto out;
+    memset(&key, 0, sizeof key);
+    key.fid = fid;
+    first = lower_bound(records.begin(), records.end(), key,
+                        index_entry_fid_less) - records.begin();
+    last = upper_bound(records.begin(), records.end(), key,
+                       index_entry_fid_less) - records.begin();
+    records.erase(records.begin() + last, records.end());
+    records.erase(records.begin(), records.begin() + first);
+    Metrics::add(PM_SMF_SEGMENT_LOADS, 1);
+
+out:
+    segment.back->store->Close(handle);
+    if (ret != PLFS_SUCCESS) records.clear();
+    return ret;
+}
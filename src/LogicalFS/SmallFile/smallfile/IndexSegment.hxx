@@ -0,0 +1,69 @@
+#ifndef __INDEXSEGMENT_HXX__
+#define __INDEXSEGMENT_HXX__
+
+#include <sys/types.h>
+#include <vector>
+#include <string>
+#include "RecordReader.hxx"
+#include "SmallFileLayout.h"
+
+using namespace std;
+
+/**
+ * Write the sealed segment of an index file which is complete.
+ *
+ * The records of an index file are in the order they are written, so the
+ * whole file has to be read to build the index of any file. The segment
+ * holds the same records sorted by file id, with a fence table and a
+ * footer at its end (see IndexSegmentFooter), so that a reader finds the
+ * records of one file with a few small reads.
+ *
+ * The segment is written under COMPACT_PREFIX and renamed in place, so a
+ * reader never sees a partial one.
+ *
+ * @param indexfile The index file, which must not be appended any more.
+ * @param segmentfile The full pathname of the segment to write.
+ * @return On success, PLFS_SUCCESS is returned. Otherwise PLFS_E* is
+ *    returned and no segment is left.
+ */
+plfs_error_t seal_index_segment(const struct plfs_pathback &indexfile,
+                                const string &segmentfile);
+
+/**
+ * Serve the records of one file from a sealed index segment.
+ *
+ * load() binary searches the fence table and reads only the blocks of
+ * records which might belong to the file.
+ */
+class SegmentReader : public RecordReader {
+public:
+    SegmentReader(ssize_t dropping) : did(dropping), current(0) {};
+    /**
+     * Read the records of the given file.
+     *
+     * A writer may have appended to the index file after it was sealed,
+     * so the segment is only used if the index file has the size it was
+     * sealed at, or is gone.
+     *
+     * @return On success, PLFS_SUCCESS is returned, even if the file has
+     *    no record in this segment. PLFS_EINVAL is returned if it is not
+     *    a valid segment, PLFS_EAGAIN if the index file has changed since
+     *    it was sealed.
+     */
+    plfs_error_t load(struct plfs_pathback &segment,
+                      const struct plfs_pathback &indexfile, FileID fid);
+    virtual void *front() {
+        return current < records.size() ? &records[current] : NULL;
+    };
+    virtual void *metadata() { return &did; };
+    virtual plfs_error_t pop_front() {
+        if (current < records.size()) current++;
+        return current < records.size() ? PLFS_SUCCESS : PLFS_EEOF;
+    };
+private:
+    ssize_t did;
+    vector<struct IndexEntry> records;
+    size_t current;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "LoserTree.hxx"
+#include <errno.h>
+
+LoserTree::LoserTree(size_t maxsize, compare_func_t func) {
+    max_size = maxsize;
+    if (max_size > 0) {
+        sources = new RecordReader *[max_size];
+        nodes = new size_t[max_size];
+    }
+    cfunc = func;
+    leaves = 0;
+    current_size = 0;
+    built = false;
+}
+
+LoserTree::~LoserTree() {
+    while (leaves > 0) {
+        leaves--;
+        delete sources[leaves];
+    }
+    if (max_size > 0) {
+        delete []sources;
+        delete []nodes;
+    }
+}
+
+/*
+ * An exhausted source loses to everybody.  Ties are broken by dropping
+ * order: if leaf2 is the incumbent (the source of the record just popped)
+ * it keeps winning them, as with the old heap, so records with equal
+ * timestamps come out in the order one writer logged them, e.g. a create
+ * before a rename of the same file logged by another writer in the same
+ * microsecond.  Otherwise the leaf pushed first wins.
+ */
+bool
+LoserTree::beats(size_t leaf1, size_t leaf2, bool incumbent) {
+    int result;
+    if (!sources[leaf1]) return false;
+    if (!sources[leaf2]) return true;
+    result = cfunc(sources[leaf1]->front(), sources[leaf2]->front());
+    return result < 0 || (result == 0 && !incumbent && leaf1 < leaf2);
+}
+
+/*
+ * Node n has children 2n and 2n+1, and the node leaves+i is the leaf i, so
+ * nodes 1 .. leaves-1 are the internal nodes for any number of leaves.
+ */
+size_t
+LoserTree::build(size_t node) {
+    size_t left, right;
+    if (node >= leaves) return node - leaves;
+    left = build(node << 1);
+    right = build((node << 1) + 1);
+    if (beats(left, right, false)) {
+        nodes[node] = right;
+        return left;
+    }
+    nodes[node] = left;
+    return right;
+}
+
+/* The front of the given leaf has changed, play its matches again. */
+void
+LoserTree::replay(size_t leaf) {
+    size_t node = (leaf + leaves) >> 1;
+    size_t winner = leaf;
+    while (node > 0) {
+        if (beats(nodes[node], winner, winner == leaf)) {
+            size_t loser = winner;
+            winner = nodes[node];
+            nodes[node] = loser;
+        }
+        node >>= 1;
+    }
+    nodes[0] = winner;
+}
+
+RecordReader *
+LoserTree::winner() {
+    if (current_size == 0) return NULL;
+    if (!built) {
+        nodes[0] = build(1);
+        built = true;
+    }
+    return sources[nodes[0]];
+}
+
+plfs_error_t
+LoserTree::pop_front() {
+    RecordReader *top = winner();
+    if (!top) return PLFS_ENOENT;
+    top->pop_front();
+    if (!top->front()) {
+        /* If the data source becomes empty, delete it. */
+        delete top;
+        sources[nodes[0]] = NULL;
+        current_size--;
+        if (current_size == 0) return PLFS_ENOENT;
+    }
+    replay(nodes[0]);
+    return PLFS_SUCCESS;
+}
+
+void *
+LoserTree::front(){
+    RecordReader *top = winner();
+    if (!top) return NULL;
+    return top->front();
+}
+
+void *
+LoserTree::metadata(){
+    RecordReader *top = winner();
+    if (!top) return NULL;
+    return top->metadata();
+}
+
+plfs_error_t
+LoserTree::push_back(RecordReader *ptr) {
+    if (leaves >= max_size)
+        return PLFS_ENOMEM;
+    sources[leaves] = ptr;
+    leaves++;
+    current_size++;
+    built = false;
+    return PLFS_SUCCESS;
+}
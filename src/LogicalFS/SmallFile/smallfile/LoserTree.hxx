@@ -0,0 +1,53 @@
+#ifndef __LOSERTREE_HXX__
+#define __LOSERTREE_HXX__
+
+#include <stdlib.h>
+#include "RecordReader.hxx"
+
+typedef int (*compare_func_t)(void *, void *);
+
+/**
+ * This class implements the tournament tree of losers.
+ *
+ * It could be used to compound several RecordReader and merge them and
+ * then act as a single RecordReader.
+ *
+ * Every internal node remembers the loser of the match played there, so
+ * popping a record only replays the matches on the path from the leaf of
+ * the winner to the root: log2(N) comparisons against the stored losers,
+ * instead of the two comparisons per level a binary heap needs to sift
+ * down.  The tree is built on the first access after push_back().
+ */
+
+class LoserTree : public RecordReader {
+private:
+    RecordReader **sources; /**< The leaves, NULL once exhausted */
+    size_t *nodes; /**< nodes[0] is the winner, others are the losers */
+    size_t max_size;
+    size_t leaves;
+    size_t current_size; /**< The number of sources not exhausted yet */
+    bool built;
+    compare_func_t cfunc;
+    bool beats(size_t leaf1, size_t leaf2, bool incumbent);
+    size_t build(size_t node);
+    void replay(size_t leaf);
+    RecordReader *winner();
+public:
+    LoserTree(size_t max_size, compare_func_t func);
+    ~LoserTree();
+    size_t size() const { return current_size; };
+    /**
+     * Add a given data source to the tree.
+     *
+     * @param ptr The pointer to the data source to be added. Do not delete
+     *    it yourself if it is successfully pushed to the tree.
+     * @return On success, PLFS_SUCCESS is returned. If the size has exceeded
+     *    the max size of this tree, PLFS_ENOMEM is returned.
+     */
+    plfs_error_t push_back(RecordReader *ptr);
+    virtual plfs_error_t pop_front();
+    virtual void *front();
+    virtual void *metadata();
+};
+
+#endif
@@ -4,11 +4,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
 #include <iostream>
+#include <sstream>
 #include <Util.h>
 #include "NamesMapping.hxx"
 #include "FileReader.hxx"
-#include "MinimumHeap.hxx"
+#include "LoserTree.hxx"
 
 using namespace std;
 
@@ -18,7 +20,8 @@ using namespace std;
 
 class NameReader : public FileReader {
 public:
-    NameReader(struct plfs_pathback &fname, size_t id, int buf_size);
+    NameReader(struct plfs_pathback &fname, size_t id, int buf_size,
+               off_t start_offset);
     virtual void *metadata() { meta.first = record_foff(); return &meta;};
 protected:
     virtual int record_size(void *ptr) { return *(uint32_t *)ptr; };
@@ -27,7 +30,8 @@ private:
 };
 
 NameReader::NameReader(struct plfs_pathback &fname, size_t id,
-                       int buf_size) : FileReader(fname, buf_size)
+                       int buf_size, off_t start_offset)
+    : FileReader(fname, buf_size, start_offset)
 {
     meta.second = id;
 }
@@ -46,36 +50,120 @@ compare_name_file(void *para1, void *para2) {
 }
 
 NamesMapping::NamesMapping() {
+    snapshot.back = NULL;
+    snapshot_min_records = SMF_SNAPSHOT_MIN_RECORDS;
+    loading = false;
+    load_records = 0;
+    load_timestamp = 0;
 }
 
 NamesMapping::~NamesMapping() {
 }
 
+/**
+ * Estimate: the file names themselves and the index_mapping lists of
+ * the files are not counted.
+ */
+unsigned long
+NamesMapping::memory_usage() {
+    return metadata_cache.size() * (sizeof(FileMetaData) +
+        sizeof(map<string, FileMetaDataPtr>::value_type) +
+        MEMCACHE_NODE_OVERHEAD);
+}
+
+void
+NamesMapping::set_snapshot(const struct plfs_pathback &file,
+                           unsigned long min_records)
+{
+    snapshot = file;
+    snapshot_min_records = min_records;
+}
+
 plfs_error_t
 NamesMapping::init_data_source(void *resource, RecordReader **reader) {
     vector<plfs_pathback> &files = *(vector<plfs_pathback> *)resource;
     size_t i;
-    MinimumHeap *min_heap = new MinimumHeap(files.size(), compare_name_file);
+    LoserTree *merger = new LoserTree(files.size(), compare_name_file);
     plfs_error_t ret;
 
-    *reader = min_heap;
-    if (files.size() == 0) return PLFS_SUCCESS;
-    unsigned int buf_size = get_read_buffer_size(files.size());
+    *reader = merger;
+    loading = true;
+    load_names.clear();
     for (i = 0; i < files.size(); i++) {
-        NameReader *namefile = new NameReader(files[i], i, buf_size);
-        mlog(SMF_DAPI, "Load names from %s.", files[i].bpath.c_str());
-        ret = namefile->pop_front();
-        if (ret == PLFS_SUCCESS && namefile->front()) {
-            min_heap->push_back(namefile);
-        } else if (ret == PLFS_EEOF) { // Skip empty files.
-            delete namefile;
-            mlog(SMF_DAPI, "Skip empty name file:%s.", files[i].bpath.c_str());
-        } else {
-            delete namefile;
-            mlog(SMF_WARN, "Error read name file:%s.", files[i].bpath.c_str());
+        const string &bpath = files[i].bpath;
+        load_names.push_back(bpath.substr(bpath.rfind('/') + 1));
+    }
+    bool use_snapshot = !snapshot.bpath.empty();
+    unsigned int buf_size = get_read_buffer_size(files.size());
+    for (;;) {
+        /* Drop whatever a failed load or an unusable snapshot has left. */
+        metadata_cache.clear();
+        load_records = 0;
+        load_timestamp = 0;
+        load_offsets.assign(files.size(), 0);
+        if (files.size() == 0) return PLFS_SUCCESS;
+        if (use_snapshot) {
+            ret = load_snapshot();
+            if (ret != PLFS_SUCCESS) {
+                if (ret != PLFS_ENOENT) {
+                    mlog(SMF_WARN, "Ignore names snapshot %s, ret = %d.",
+                         snapshot.bpath.c_str(), ret);
+                }
+                use_snapshot = false;
+                metadata_cache.clear();
+                load_timestamp = 0;
+                load_offsets.assign(files.size(), 0);
+            }
+        }
+        vector<NameReader *> namefiles;
+        vector<NameReader *> ready;
+        bool stale = false;
+        /*
+         * Every reader queues the read of its first block when it is
+         * created, so all the name files are opened and read in parallel
+         * before the first record is taken from any of them.
+         */
+        for (i = 0; i < files.size(); i++) {
+            namefiles.push_back(new NameReader(files[i], i, buf_size,
+                                               load_offsets[i]));
+            mlog(SMF_DAPI, "Load names from %s at %llu.",
+                 files[i].bpath.c_str(),
+                 (unsigned long long)load_offsets[i]);
+        }
+        for (i = 0; i < files.size(); i++) {
+            NameReader *namefile = namefiles[i];
+            ret = namefile->pop_front();
+            if (ret == PLFS_SUCCESS && namefile->front()) {
+                struct NameEntryHeader *header;
+                header = (struct NameEntryHeader *)namefile->front();
+                /*
+                 * The tails are merged after the snapshot, so a record
+                 * that is not newer than everything in the snapshot would
+                 * be merged out of order.
+                 */
+                if (use_snapshot && header->timestamp <= load_timestamp) {
+                    stale = true;
+                }
+                ready.push_back(namefile);
+            } else if (ret == PLFS_EEOF) { // Skip empty files.
+                delete namefile;
+                mlog(SMF_DAPI, "Skip empty name file:%s.",
+                     files[i].bpath.c_str());
+            } else {
+                delete namefile;
+                mlog(SMF_WARN, "Error read name file:%s.",
+                     files[i].bpath.c_str());
+            }
+        }
+        if (!stale) {
+            for (i = 0; i < ready.size(); i++) merger->push_back(ready[i]);
+            return PLFS_SUCCESS;
         }
+        for (i = 0; i < ready.size(); i++) delete ready[i];
+        mlog(SMF_INFO, "Names snapshot %s is older than a record after it, "
+             "merge all the records.", snapshot.bpath.c_str());
+        use_snapshot = false;
     }
-    return PLFS_SUCCESS;
 }
 
 plfs_error_t
@@ -83,6 +171,15 @@ NamesMapping::merge_object(void *record, void *metadata) {
     plfs_error_t ret = PLFS_SUCCESS;
     struct NameEntryHeader *header = (struct NameEntryHeader *)record;
     time_t op_time = TS2TIME(header->timestamp);
+    if (loading && metadata) {
+        /* Records of a name file are merged in the order of offset. */
+        index_mapping_t *position = (index_mapping_t *)metadata;
+        load_offsets[position->second] = position->first + header->length;
+        if (header->timestamp > load_timestamp) {
+            load_timestamp = header->timestamp;
+        }
+        load_records++;
+    }
     if (header->operation != SM_RENAME) {
         string filename(header->filename);
         switch (header->operation) {
@@ -149,6 +246,185 @@ NamesMapping::merge_object(void *record, void *metadata) {
     return ret;
 }
 
+void
+NamesMapping::load_finished() {
+    plfs_error_t ret;
+
+    loading = false;
+    if (!snapshot.bpath.empty() && load_records >= snapshot_min_records) {
+        ret = write_snapshot();
+        mlog(SMF_INFO, "Write names snapshot %s after merging %lu records, "
+             "ret = %d.", snapshot.bpath.c_str(), load_records, ret);
+    }
+    load_names.clear();
+    load_offsets.clear();
+}
+
+/**
+ * Read the snapshot file into metadata_cache, load_offsets and
+ * load_timestamp.
+ *
+ * The droppings in the snapshot are matched by their basenames, since the
+ * dropping_ids depend on the order the name files are listed.
+ *
+ * @return PLFS_ENOENT if there is no snapshot or a name file in it no
+ *    longer exists, PLFS_EINVAL if it is corrupted.
+ */
+plfs_error_t
+NamesMapping::load_snapshot() {
+    IOSHandle *handle;
+    off_t size;
+    ssize_t bytes_read;
+    vector<char> buf;
+    plfs_error_t ret;
+
+    ret = snapshot.back->store->Open(snapshot.bpath.c_str(), O_RDONLY, 0,
+                                     &handle);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = handle->Size(&size);
+    if (ret == PLFS_SUCCESS && size < (off_t)sizeof(NameSnapshotHeader)) {
+        ret = PLFS_EINVAL;
+    }
+    if (ret == PLFS_SUCCESS) buf.resize(size);
+    for (off_t done = 0; ret == PLFS_SUCCESS && done < size;
+         done += bytes_read) {
+        ret = handle->Pread(&buf[done], size - done, done, &bytes_read);
+        if (ret == PLFS_SUCCESS && bytes_read <= 0) ret = PLFS_EINVAL;
+    }
+    snapshot.back->store->Close(handle);
+    if (ret != PLFS_SUCCESS) return ret;
+
+    const char *ptr = &buf[0];
+    const char *end = ptr + size;
+    struct NameSnapshotHeader header;
+    map<string, size_t> current;
+    vector<size_t> remap;
+
+    memcpy(&header, ptr, sizeof header);
+    if (header.magic != NAME_SNAPSHOT_MAGIC ||
+        header.version != NAME_SNAPSHOT_VERSION) return PLFS_EINVAL;
+    load_timestamp = header.merged_timestamp;
+    ptr += sizeof header;
+    for (size_t i = 0; i < load_names.size(); i++) current[load_names[i]] = i;
+    for (uint32_t i = 0; i < header.ndroppings; i++) {
+        struct NameSnapshotDropping dropping;
+        map<string, size_t>::iterator itr;
+        if (end - ptr < (ssize_t)sizeof dropping) return PLFS_EINVAL;
+        memcpy(&dropping, ptr, sizeof dropping);
+        if (dropping.length <= sizeof dropping ||
+            dropping.length > (size_t)(end - ptr)) return PLFS_EINVAL;
+        string name(ptr + sizeof dropping,
+                    strnlen(ptr + sizeof dropping,
+                            dropping.length - sizeof dropping));
+        itr = current.find(name);
+        if (itr == current.end()) {
+            mlog(SMF_INFO, "Name file %s in the snapshot is gone.",
+                 name.c_str());
+            return PLFS_ENOENT;
+        }
+        remap.push_back(itr->second);
+        load_offsets[itr->second] = dropping.merged_offset;
+        ptr += dropping.length;
+    }
+    for (uint64_t i = 0; i < header.nfiles; i++) {
+        struct NameSnapshotFile file;
+        struct NameSnapshotMapping mapping;
+        size_t name_pos;
+        if (end - ptr < (ssize_t)sizeof file) return PLFS_EINVAL;
+        memcpy(&file, ptr, sizeof file);
+        name_pos = sizeof file + (size_t)file.nmappings * sizeof mapping;
+        if (file.length <= name_pos ||
+            file.length > (size_t)(end - ptr)) return PLFS_EINVAL;
+        FileMetaDataPtr metadata(new FileMetaData);
+        metadata->mtime = file.mtime;
+        for (uint32_t j = 0; j < file.nmappings; j++) {
+            memcpy(&mapping, ptr + sizeof file + j * sizeof mapping,
+                   sizeof mapping);
+            if (mapping.dropping >= remap.size()) return PLFS_EINVAL;
+            uint64_t fileid = mapping.fileid;
+            metadata->index_mapping.push_back(
+                index_mapping_t(fileid, remap[mapping.dropping]));
+        }
+        string name(ptr + name_pos, strnlen(ptr + name_pos,
+                                            file.length - name_pos));
+        /* The files are sorted, so the hint makes the inserts cheap. */
+        metadata_cache.insert(metadata_cache.end(), make_pair(name, metadata));
+        ptr += file.length;
+    }
+    return PLFS_SUCCESS;
+}
+
+/**
+ * Write metadata_cache, load_offsets and load_timestamp to the snapshot
+ * file.
+ *
+ * The snapshot is written to a temporary file and then renamed, so a
+ * reader always sees a complete snapshot.
+ */
+plfs_error_t
+NamesMapping::write_snapshot() {
+    string buf;
+    struct NameSnapshotHeader header;
+    map<string, FileMetaDataPtr>::iterator itr;
+    list<index_mapping_t>::iterator index_itr;
+    ostringstream tmpname;
+    char *hostname;
+    IOSHandle *handle;
+    ssize_t written;
+    plfs_error_t ret, ret2;
+
+    header.magic = NAME_SNAPSHOT_MAGIC;
+    header.version = NAME_SNAPSHOT_VERSION;
+    header.ndroppings = load_names.size();
+    header.reserved = 0;
+    header.nfiles = metadata_cache.size();
+    header.merged_timestamp = load_timestamp;
+    buf.append((const char *)&header, sizeof header);
+    for (size_t i = 0; i < load_names.size(); i++) {
+        struct NameSnapshotDropping dropping;
+        dropping.length = sizeof dropping + load_names[i].length() + 1;
+        dropping.reserved = 0;
+        dropping.merged_offset = load_offsets[i];
+        buf.append((const char *)&dropping, sizeof dropping);
+        buf.append(load_names[i].c_str(), load_names[i].length() + 1);
+    }
+    for (itr = metadata_cache.begin(); itr != metadata_cache.end(); itr++) {
+        struct NameSnapshotFile file;
+        struct NameSnapshotMapping mapping;
+        file.nmappings = itr->second->index_mapping.size();
+        file.length = sizeof file + file.nmappings * sizeof mapping +
+            itr->first.length() + 1;
+        file.mtime = itr->second->mtime;
+        buf.append((const char *)&file, sizeof file);
+        for (index_itr = itr->second->index_mapping.begin();
+             index_itr != itr->second->index_mapping.end(); index_itr++) {
+            mapping.fileid = index_itr->first;
+            mapping.dropping = index_itr->second;
+            buf.append((const char *)&mapping, sizeof mapping);
+        }
+        buf.append(itr->first.c_str(), itr->first.length() + 1);
+    }
+
+    Util::hostname(&hostname);
+    tmpname << snapshot.bpath << ".tmp." << (hostname ? hostname : "")
+            << "." << getpid();
+    ret = snapshot.back->store->Open(tmpname.str().c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC,
+                                     DEFAULT_FMODE, &handle);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = Util::Writen(buf.data(), buf.length(), handle, &written);
+    ret2 = snapshot.back->store->Close(handle);
+    if (ret == PLFS_SUCCESS) ret = ret2;
+    if (ret == PLFS_SUCCESS) {
+        ret = snapshot.back->store->Rename(tmpname.str().c_str(),
+                                           snapshot.bpath.c_str());
+    }
+    if (ret != PLFS_SUCCESS) {
+        snapshot.back->store->Unlink(tmpname.str().c_str());
+    }
+    return ret;
+}
+
 FileMetaDataPtr
 NamesMapping::get_metadata(const string &filename) {
     FileMetaDataPtr retval;
@@ -160,6 +436,19 @@ NamesMapping::get_metadata(const string &filename) {
     return retval;
 }
 
+void
+NamesMapping::get_next_names(const string &filename, size_t count,
+                             vector<string> *res)
+{
+    map<string, FileMetaDataPtr>::iterator names_itr;
+
+    names_itr = metadata_cache.lower_bound(filename);
+    for (; names_itr != metadata_cache.end() && res->size() < count;
+         names_itr++) {
+        res->push_back(names_itr->first);
+    }
+}
+
 /**
  * Dump all mapping information in metadata_cache to stdout.
  *
@@ -217,6 +506,34 @@ NamesMapping::read_names(set<string> *res, vector<plfs_pathback> *namefiles) {
     return PLFS_SUCCESS;
 }
 
+/**
+ * Read all filenames in metadata_cache with their modification time.
+ *
+ * @param res Return the names and mtimes of the regular files.
+ * @param namefiles The full pathnames of the dropping.name.x files.
+ *
+ * @return On success, PLFS_SUCCESS is returned, otherwise it fails and res is untouched.
+ */
+
+plfs_error_t
+NamesMapping::read_mtimes(map<string, time_t> *res,
+                          vector<plfs_pathback> *namefiles)
+{
+    map<string, FileMetaDataPtr>::iterator names_itr;
+    plfs_error_t ret;
+
+    ret = require(MEMCACHE_FULLYLOADED, namefiles);
+    if (ret != PLFS_SUCCESS) return ret;
+    for (names_itr = metadata_cache.begin();
+         names_itr != metadata_cache.end();
+         names_itr++)
+    {
+        (*res)[names_itr->first] = names_itr->second->mtime;
+    }
+    release(MEMCACHE_FULLYLOADED, namefiles);
+    return PLFS_SUCCESS;
+}
+
 plfs_error_t
 NamesMapping::set_attr_cache(const string &filename, struct stat *stbuf) {
     plfs_error_t ret;
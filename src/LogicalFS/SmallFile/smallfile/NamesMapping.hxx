@@ -57,26 +57,61 @@ private:
 
 typedef tr1::shared_ptr<FileMetaData> FileMetaDataPtr;
 
+/* write a new names snapshot when a load replays this many name records */
+#define SMF_SNAPSHOT_MIN_RECORDS 4096
+
 /**
  * Cache all the metadata of the regular files in a given directory.
  *
  * This is the metadata cache of the regular files. It is built from the
  * dropping.name.x files. We built the cache for a given logical directory
  * by reading and merging all name files in all backends.
+ *
+ * If a snapshot file is set, the cache starts from the snapshot and only
+ * the records appended to the name files after it was taken are merged.
+ * When a load has to merge too many records, a new snapshot is written
+ * so that the next load is cheaper. The records in the tails are merged
+ * in timestamp order after the records in the snapshot, so if one of them
+ * is not newer than all the records in the snapshot (e.g. it was queued
+ * by a writer while the snapshot was taken, or written by the compactor),
+ * the snapshot is dropped and all the records are merged again, so that
+ * the result is always the same as without a snapshot.
  */
 
 class NamesMapping : public InMemoryCache {
 private:
     map<string, FileMetaDataPtr> metadata_cache;
     /**< The map is protected by ResourceUnit::item_lock. */
+    struct plfs_pathback snapshot; /**< Empty bpath: no snapshot */
+    unsigned long snapshot_min_records;
+    /* The state of the current load, protected by ResourceUnit::item_lock */
+    bool loading;
+    unsigned long load_records; /**< records merged from the name files */
+    vector<string> load_names; /**< basenames of the name files */
+    vector<uint64_t> load_offsets; /**< merged offset of every name file */
+    uint64_t load_timestamp; /**< the newest record merged */
+
+    plfs_error_t load_snapshot();
+    plfs_error_t write_snapshot();
 
 protected:
     virtual plfs_error_t init_data_source(void *resource, RecordReader **reader);
     virtual plfs_error_t merge_object(void *object, void *meta);
+    virtual unsigned long memory_usage();
+    virtual void load_finished();
 
 public:
     NamesMapping();
     ~NamesMapping();
+    /**
+     * Set the snapshot file of this directory, call it before loading.
+     *
+     * @param file The pathname of the snapshot file.
+     * @param min_records Write a new snapshot when a load merges at least
+     *    this many records from the name files.
+     */
+    void set_snapshot(const struct plfs_pathback &file,
+                      unsigned long min_records = SMF_SNAPSHOT_MIN_RECORDS);
     /**
      * Get the metadata information of the given file.
      *
@@ -89,7 +124,22 @@ public:
      *   Otherwise, a NULL shared_ptr will be returned.
      */
     FileMetaDataPtr get_metadata(const string &fname);
+    /**
+     * Get the names of the files following the given one in directory
+     * order, the given file included if it exists.
+     *
+     * Attention: This function is not protected by lock itself, the user
+     * should call require() and release() like get_metadata().
+     *
+     * @param fname The name to start from.
+     * @param count The maximum number of names to return.
+     * @param res Returns the names in directory order.
+     */
+    void get_next_names(const string &fname, size_t count,
+                        vector<string> *res);
     plfs_error_t read_names(set<string> *res, vector<plfs_pathback> *names);
+    plfs_error_t read_mtimes(map<string, time_t> *res,
+                             vector<plfs_pathback> *names);
     // getattr is a very common operation, cache it in memory might help.
     plfs_error_t set_attr_cache(const string &filename, struct stat *stbuf);
     plfs_error_t get_attr_cache(const string &filename, struct stat *stbuf);
@@ -16,9 +16,13 @@
 #include <Util.h>
 using namespace std;
 
-SMF_Writer::SMF_Writer(const plfs_pathback &fname, ssize_t did)
+SMF_Writer::SMF_Writer(const plfs_pathback &fname, ssize_t did,
+                       size_t commit_batch)
     : filename_(fname) {
     dropping_id = did;
+    fixed_timestamp = 0;
+    name_file.set_batch_size(commit_batch);
+    index_file.set_batch_size(commit_batch);
 }
 
 SMF_Writer::~SMF_Writer() {
@@ -107,7 +111,7 @@ SMF_Writer::add_single_record(const string &filename, enum SmallFileOps op,
     }
     header->length = recordsize;
     header->operation = op;
-    header->timestamp = get_current_timestamp();
+    header->timestamp = record_timestamp();
     memcpy((void *)header->filename, (void *)filename.c_str(), namelength);
     ret = name_file.append(header, recordsize, fileid);
     if (meta) {
@@ -157,7 +161,7 @@ SMF_Writer::rename(const string &from, const string &to, InMemoryCache *meta) {
     }
     header[0].operation = SM_RENAME;
     header[0].length = recordsize;
-    header[0].timestamp = get_current_timestamp();
+    header[0].timestamp = record_timestamp();
     memcpy((void *)&header[1], (void *)from.c_str(), from.length());
     char *name_addr = (char *)&header[1];
     name_addr[from.length()] = '\0';
@@ -186,7 +190,7 @@ SMF_Writer::write(const FileID fileid, const void *buf, off_t offset,
     entry.fid = fileid;
     entry.offset = offset;
     entry.length = length;
-    entry.timestamp = get_current_timestamp();
+    entry.timestamp = record_timestamp();
     entry.physical_offset = physical_offset;
     ret = index_file.append(&entry, sizeof entry, NULL);
     if (ret != PLFS_SUCCESS) return ret;
@@ -208,7 +212,7 @@ SMF_Writer::truncate(const FileID fileid, off_t offset,
     entry.fid = fileid;
     entry.offset = offset;
     entry.length = 0;
-    entry.timestamp = get_current_timestamp();
+    entry.timestamp = record_timestamp();
     entry.physical_offset = HOLE_PHYSICAL_OFFSET;
     ret = index_file.append(&entry, sizeof entry, NULL);
     if (index) index->update(&entry, &dropping_id);
@@ -237,7 +241,7 @@ SMF_Writer::utime(const string &filename, struct utimbuf *ut,
     header->length = recordsize;
     header->operation = SM_UTIME;
     if (ut == NULL) {
-        header->timestamp = get_current_timestamp();
+        header->timestamp = record_timestamp();
     } else {
         header->timestamp = TIME2TS(ut->modtime);
     }
@@ -280,3 +284,14 @@ SMF_Writer::sync(int sync_level) {
     }
     return ret;
 }
+
+plfs_error_t
+SMF_Writer::flush() {
+    plfs_error_t ret;
+
+    /* Data first, the index records point into the data file. */
+    ret = data_file.flush();
+    if (ret == PLFS_SUCCESS) ret = index_file.flush();
+    if (ret == PLFS_SUCCESS) ret = name_file.flush();
+    return ret;
+}
@@ -50,6 +50,11 @@ private:
     /* The above members are protected by ResourceUnit::item_lock (rwlock). */
 
     ssize_t dropping_id; /**< Set by the constructor and never changes. */
+    uint64_t fixed_timestamp; /**< If not 0, the timestamp of all records */
+
+    uint64_t record_timestamp() {
+        return fixed_timestamp ? fixed_timestamp : get_current_timestamp();
+    };
 
     plfs_error_t add_single_record(const string &, enum SmallFileOps, off_t *,
                                    InMemoryCache *);
@@ -79,11 +84,22 @@ public:
      *    The NamesMapping uses it to identify the dropping files who contains
      *    the data of a given logical file.
      *
+     * @param commit_batch The name and index records are queued until so
+     *    many bytes of them can be written at once, or until they are
+     *    flushed or synced. 0 writes them before returning. In both cases,
+     *    the records of the concurrent threads are written together.
+     *
+     * When SmallFileContainer::compact() rewrites the droppings, the
+     * index file of the new group is sealed into a dropping.segment.x
+     * file.
+     *
      * @see dropping_name2index()
      * @see dropping_name2data()
+     * @see seal_index_segment()
      *
      */
-    SMF_Writer(const plfs_pathback &filename, ssize_t did);
+    SMF_Writer(const plfs_pathback &filename, ssize_t did,
+               size_t commit_batch = 0);
     ~SMF_Writer();
     plfs_error_t create(const string &filename, InMemoryCache *cached);
     plfs_error_t remove(const string &filename, InMemoryCache *cached);
@@ -94,8 +110,18 @@ public:
                           InMemoryCache *index);
     plfs_error_t utime(const string &filename, struct utimbuf *ut, InMemoryCache *meta);
     plfs_error_t sync(int sync_level);
+    /** Write the queued records without syncing them. */
+    plfs_error_t flush();
     FileID get_fileid(const string &filename, InMemoryCache *meta);
     ssize_t get_droppingid() const { return dropping_id; };
+    /**
+     * Give the following records the given timestamp instead of the
+     * current time, 0 goes back to the current time.
+     *
+     * The compactor uses it to write records which are merged before
+     * any record written after the compaction started.
+     */
+    void set_timestamp(uint64_t timestamp) { fixed_timestamp = timestamp; };
 };
 
 #endif
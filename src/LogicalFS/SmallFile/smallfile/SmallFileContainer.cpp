@@ -9,18 +9,43 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <list>
 #include <algorithm>
 #include <iostream>
 #include <Util.h>
 #include <FileOp.h>
-#include "MinimumHeap.hxx"
+#include <Metrics.h>
+#include <ThreadPool.h>
+#include "LoserTree.hxx"
 #include "SmallFileLayout.h"
 #include "SmallFileContainer.hxx"
 #include "SmallFileIndex.hxx"
+#include "IndexSegment.hxx"
 
 using namespace std;
 
-SmallFileContainer::SmallFileContainer(void *init_para) : index_cache(16)
+/* The names snapshot always lives in the first backend. */
+static void
+get_snapshot_file(PlfsMount *pmount, const string &dirpath,
+                  struct plfs_pathback &snapshot)
+{
+    snapshot.back = pmount->backends[0];
+    snapshot.bpath = snapshot.back->bmpoint + DIR_SEPERATOR + dirpath +
+        DIR_SEPERATOR SMALLFILE_CONTAINER_NAME DIR_SEPERATOR
+        NAME_SNAPSHOT_FILENAME;
+}
+
+/* Keep room in the index cache for the prefetched indexes. */
+static int
+index_cache_objects(void *init_para) {
+    PathExpandInfo *expinfo = (PathExpandInfo *)init_para;
+    int prefetch = expinfo->pmount->smallfile_prefetch;
+
+    return max(SMF_INDEX_CACHE_OBJECTS, 2 * prefetch);
+}
+
+SmallFileContainer::SmallFileContainer(void *init_para)
+    : index_cache(index_cache_objects(init_para), SMF_INDEX_CACHE_BYTES)
 {
     PathExpandInfo *expinfo = (PathExpandInfo *)init_para;
 
@@ -39,14 +64,19 @@ SmallFileContainer::SmallFileContainer(void *init_para) : index_cache(16)
                 mlog(SMF_ERR, "Failed to create SMFContainer:%d.", ret);
         }
     }
+    struct plfs_pathback snapshot;
+    get_snapshot_file(pmount, dirpath, snapshot);
+    files.set_snapshot(snapshot);
     pthread_rwlock_init(&writers_lock, NULL);
     pthread_mutex_init(&chunk_lock, NULL);
+    pthread_mutex_init(&prefetch_lock, NULL);
 }
 
 SmallFileContainer::~SmallFileContainer() {
     clear_chunk_cache();
     pthread_rwlock_destroy(&writers_lock);
     pthread_mutex_destroy(&chunk_lock);
+    pthread_mutex_destroy(&prefetch_lock);
 }
 
 plfs_error_t
@@ -67,28 +97,98 @@ SmallFileContainer::makeTopLevelDir(struct plfs_backend *backend,
     return ret;
 }
 
+/* The dropping files found in the container directory of a backend. */
+struct BackendListing {
+    struct plfs_backend *backend;
+    string container_dir;
+    set<string> dir_contents;
+    plfs_error_t ret;
+};
+
+struct ListingArgs {
+    vector<BackendListing> *listings;
+    size_t next;
+    pthread_mutex_t mux;
+};
+
+static void
+list_droppings(BackendListing &listing) {
+    ReaddirOp op(NULL, &listing.dir_contents, true, true);
+
+    op.filter(NAME_PREFIX);
+    op.filter(SEGMENT_PREFIX);
+    listing.ret = op.do_op(listing.container_dir.c_str(), DT_DIR,
+                           listing.backend->store);
+}
+
+static void *
+list_droppings_thread(void *va) {
+    ListingArgs *args = (ListingArgs *)va;
+
+    while (true) {
+        BackendListing *listing;
+        pthread_mutex_lock(&args->mux);
+        listing = args->next < args->listings->size() ?
+            &(*args->listings)[args->next++] : NULL;
+        pthread_mutex_unlock(&args->mux);
+        if (!listing) break;
+        list_droppings(*listing);
+    }
+    pthread_exit(NULL);
+}
+
 plfs_error_t
 SmallFileContainer::init_data_source(void * /* resource */, RecordReader **reader) {
-    for (int i = 0; i < pmount->nback; i++)
+    PlfsConf *pconf = get_plfs_conf();
+    vector<BackendListing> listings(pmount->nback);
+    size_t num_threads = pconf ? (size_t)pconf->threadpool_size : 1;
+    plfs_error_t ret;
+
+    for (int i = 0; i < pmount->nback; i++) {
+        listings[i].backend = pmount->backends[i];
+        listings[i].container_dir = pmount->backends[i]->bmpoint +
+            DIR_SEPERATOR + dirpath + DIR_SEPERATOR + SMALLFILE_CONTAINER_NAME;
+    }
+    /* A slow backend should not delay reading the others. */
+    num_threads = min(num_threads, listings.size());
+    if (num_threads > 1) {
+        ListingArgs args;
+        args.listings = &listings;
+        args.next = 0;
+        pthread_mutex_init(&args.mux, NULL);
+        ThreadPool threadpool(num_threads, list_droppings_thread,
+                              (void *)&args);
+        ret = threadpool.threadError();
+        pthread_mutex_destroy(&args.mux);
+        if (ret != PLFS_SUCCESS) {
+            mlog(SMF_ERR, "THREAD pool error %s", strplfserr(ret));
+            return ret;
+        }
+    } else {
+        for (size_t i = 0; i < listings.size(); i++)
+            list_droppings(listings[i]);
+    }
+    // Read all dropping.name.x from every backends, in the backend order.
+    for (size_t i = 0; i < listings.size(); i++)
     {
-        // Read all dropping.name.x from every backends.
-        struct plfs_backend *backend = pmount->backends[i];
-        set<string> dir_contents;
+        set<string> &dir_contents = listings[i].dir_contents;
         set<string>::iterator itr;
-        ReaddirOp op(NULL, &dir_contents, true, true);
-        plfs_error_t ret;
         struct plfs_pathback entry;
-        string container_dir(backend->bmpoint + DIR_SEPERATOR + dirpath +
-                             DIR_SEPERATOR + SMALLFILE_CONTAINER_NAME);
 
-        op.filter(NAME_PREFIX);
-        ret = op.do_op(container_dir.c_str(), DT_DIR, backend->store);
-        if (ret != PLFS_SUCCESS && ret != PLFS_ENOENT) return ret;
-        entry.back = backend;
+        if (listings[i].ret != PLFS_SUCCESS &&
+            listings[i].ret != PLFS_ENOENT) return listings[i].ret;
+        entry.back = listings[i].backend;
         for (itr = dir_contents.begin(); itr != dir_contents.end(); itr++)
         {
+            size_t base = itr->rfind('/') + 1;
+            string segment;
+
+            if (itr->compare(base, strlen(NAME_PREFIX), NAME_PREFIX) != 0)
+                continue;
             entry.bpath = *itr;
             droppings_names.push_back(entry);
+            dropping_name2segment(entry.bpath, segment);
+            sealed_droppings.push_back(dir_contents.count(segment) > 0);
         }
     }
     *reader = new EmptyRecordReader();
@@ -102,6 +202,7 @@ SmallFileContainer::merge_object(void *object, void *meta) {
 
     if (did) *did = droppings_names.size();
     droppings_names.push_back(*file);
+    sealed_droppings.push_back(false); /* It is being written */
     return PLFS_SUCCESS;
 }
 
@@ -146,7 +247,8 @@ SmallFileContainer::get_writer(pid_t pid) {
         release(MEMCACHE_FULLYLOADED, this);
         update(&newWriter, &did);
         assert(did != -1); // Make sure we get the right dropping id.
-        retval.reset(new SMF_Writer(newWriter, did));
+        retval.reset(new SMF_Writer(newWriter, did,
+                                    pmount->smallfile_commit_kbs * 1024));
         writers[pid] = retval;
     }
     pthread_rwlock_unlock(&writers_lock);
@@ -158,9 +260,7 @@ SmallFileContainer::file_exist(const string &filename) {
     bool exist = false;
     plfs_error_t ret;
 
-#ifdef SMALLFILE_USE_LIBC_FILEIO
-    sync_writers(WRITER_SYNC_NAMEFILE);
-#endif
+    if (!files.loaded()) flush_writers();
     ret = require(MEMCACHE_FULLYLOADED, this);
     if (ret == PLFS_SUCCESS) {
         ret = files.require(MEMCACHE_FULLYLOADED, &droppings_names);
@@ -177,9 +277,7 @@ SmallFileContainer::file_exist(const string &filename) {
 
 plfs_error_t
 SmallFileContainer::readdir(set<string> *res) {
-#ifdef SMALLFILE_USE_LIBC_FILEIO
-    sync_writers(WRITER_SYNC_NAMEFILE);
-#endif
+    if (!files.loaded()) flush_writers();
     plfs_error_t ret = require(MEMCACHE_FULLYLOADED, this);
     if (ret != PLFS_SUCCESS) return ret;
     ret = files.read_names(res, &droppings_names);
@@ -193,9 +291,8 @@ SmallFileContainer::get_index(const string &filename) {
     FileMetaDataPtr metadata;
     plfs_error_t ret;
 
-#ifdef SMALLFILE_USE_LIBC_FILEIO
-    sync_writers(WRITER_SYNC_INDEXFILE);
-#endif
+    /* The cached names mapping and indexes are updated by our writers. */
+    if (!files.loaded() || !index_cache.lookup(filename)) flush_writers();
     ret = require(MEMCACHE_FULLYLOADED, this);
     if (ret == PLFS_SUCCESS) {
         ret = files.require(MEMCACHE_FULLYLOADED, &droppings_names);
@@ -206,6 +303,8 @@ SmallFileContainer::get_index(const string &filename) {
                 bool created;
                 init_para.namefiles = &droppings_names;
                 init_para.fids = &metadata->index_mapping;
+                init_para.records = NULL;
+                init_para.sealed = &sealed_droppings;
                 retval = index_cache.insert(filename, &init_para, created);
             }
             files.release(MEMCACHE_FULLYLOADED, &droppings_names);
@@ -219,6 +318,408 @@ SmallFileContainer::get_index(const string &filename) {
     return retval;
 }
 
+static bool
+index_record_older(const IndexRecord &record1, const IndexRecord &record2) {
+    return record1.entry.timestamp < record2.entry.timestamp;
+}
+
+/*
+ * Read every given index file once, keeping the records of the wanted
+ * {fileid, did} pairs in the records of their file.
+ */
+static plfs_error_t
+read_index_records(const map<size_t, struct plfs_pathback> &indexfiles,
+                   const map<index_mapping_t, size_t> &wanted,
+                   vector<vector<IndexRecord> > *records)
+{
+    map<size_t, struct plfs_pathback>::const_iterator file_itr;
+    map<index_mapping_t, size_t>::const_iterator wanted_itr;
+    size_t bufsize = READBUFFER_MAXSIZE / sizeof(struct IndexEntry) *
+        sizeof(struct IndexEntry);
+    plfs_error_t ret = PLFS_SUCCESS;
+    char *buf;
+
+    buf = new char[bufsize];
+    for (file_itr = indexfiles.begin(); file_itr != indexfiles.end();
+         file_itr++) {
+        IOStore *store = file_itr->second.back->store;
+        IOSHandle *fh;
+        off_t offset = 0;
+
+        ret = store->Open(file_itr->second.bpath.c_str(), O_RDONLY, 0, &fh);
+        if (ret == PLFS_ENOENT) {
+            ret = PLFS_SUCCESS;
+            continue;
+        }
+        if (ret != PLFS_SUCCESS) break;
+        while (true) {
+            ssize_t bytes;
+            size_t nrecords;
+
+            ret = fh->Pread(buf, bufsize, offset, &bytes);
+            if (ret != PLFS_SUCCESS) break;
+            nrecords = bytes / sizeof(struct IndexEntry);
+            if (nrecords == 0) break;
+            for (size_t j = 0; j < nrecords; j++) {
+                IndexRecord record;
+                FileID fileid;
+                memcpy(&record.entry, buf + j * sizeof(struct IndexEntry),
+                       sizeof(struct IndexEntry));
+                fileid = record.entry.fid;
+                wanted_itr = wanted.find(index_mapping_t(fileid,
+                                                         file_itr->first));
+                if (wanted_itr == wanted.end()) continue;
+                record.did = file_itr->first;
+                (*records)[wanted_itr->second].push_back(record);
+            }
+            offset += nrecords * sizeof(struct IndexEntry);
+        }
+        store->Close(fh);
+        if (ret != PLFS_SUCCESS) break;
+    }
+    delete []buf;
+    if (ret != PLFS_SUCCESS) {
+        mlog(SMF_ERR, "Can't read %s, ret = %d.",
+             file_itr->second.bpath.c_str(), ret);
+    }
+    return ret;
+}
+
+/*
+ * Find the index files holding the records of a file. Both the caller
+ * and the names mapping must hold MEMCACHE_FULLYLOADED.
+ */
+void
+SmallFileContainer::want_index_records(const FileMetaDataPtr &metadata,
+    size_t file, map<index_mapping_t, size_t> *wanted,
+    map<size_t, struct plfs_pathback> *indexfiles)
+{
+    list<index_mapping_t>::iterator itr;
+
+    for (itr = metadata->index_mapping.begin();
+         itr != metadata->index_mapping.end(); itr++) {
+        (*wanted)[*itr] = file;
+        if (indexfiles->find(itr->second) == indexfiles->end()) {
+            struct plfs_pathback &indexfile = (*indexfiles)[itr->second];
+            indexfile.back = droppings_names[itr->second].back;
+            dropping_name2index(droppings_names[itr->second].bpath,
+                                indexfile.bpath);
+        }
+    }
+}
+
+/**
+ * Get the indexes of many files at once.
+ *
+ * Building the indexes one by one reads every index file once per file.
+ * This resolves all the files through one names mapping lookup, reads
+ * every index file they use once, and puts the indexes in index_cache.
+ *
+ * @param names The files to get the index of.
+ * @param indexes Returns the indexes in the order of names, with a NULL
+ *    index for a file which does not exist.
+ * @return On success, PLFS_SUCCESS is returned. Otherwise PLFS_E* is
+ *    returned.
+ */
+plfs_error_t
+SmallFileContainer::load_indexes(const vector<string> &names,
+                                 vector<IndexPtr> *indexes)
+{
+    map<index_mapping_t, size_t> wanted; /* {fileid, did} => file */
+    map<size_t, struct plfs_pathback> indexfiles;
+    vector<vector<IndexRecord> > records(names.size());
+    vector<bool> found(names.size(), false);
+    plfs_error_t ret;
+
+    indexes->assign(names.size(), IndexPtr());
+    flush_writers();
+    ret = require(MEMCACHE_FULLYLOADED, this);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = files.require(MEMCACHE_FULLYLOADED, &droppings_names);
+    if (ret != PLFS_SUCCESS) {
+        release(MEMCACHE_FULLYLOADED, this);
+        mlog(SMF_ERR, "Can't build names mapping! ret = %d.", ret);
+        return ret;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        FileMetaDataPtr metadata;
+
+        (*indexes)[i] = index_cache.lookup(names[i]);
+        if ((*indexes)[i]) continue;
+        metadata = files.get_metadata(names[i]);
+        if (!metadata) continue;
+        found[i] = true;
+        want_index_records(metadata, i, &wanted, &indexfiles);
+    }
+    files.release(MEMCACHE_FULLYLOADED, &droppings_names);
+    release(MEMCACHE_FULLYLOADED, this);
+
+    /* Read every index file once, keeping the records of these files. */
+    ret = read_index_records(indexfiles, wanted, &records);
+    if (ret != PLFS_SUCCESS) return ret;
+    for (size_t i = 0; i < names.size(); i++) {
+        struct index_init_para_t init_para;
+        bool created;
+
+        if (!found[i]) continue;
+        /* The same order as merging the index files by timestamp. */
+        stable_sort(records[i].begin(), records[i].end(), index_record_older);
+        init_para.namefiles = NULL;
+        init_para.fids = NULL;
+        init_para.records = &records[i];
+        init_para.sealed = NULL;
+        (*indexes)[i] = index_cache.insert(names[i], &init_para, created);
+    }
+    return PLFS_SUCCESS;
+}
+
+/**
+ * Get the names and the attributes of all the files at once.
+ *
+ * Getting the size of a file builds its index. This reads every index
+ * file once and computes the sizes of all the files whose attributes
+ * are not cached yet from their records, without building any index.
+ * The attributes are put in the attribute cache of the names mapping.
+ *
+ * @param base The attributes shared by the files, st_size and the
+ *    times are overwritten.
+ * @param res Returns the attributes of every file by name.
+ * @return On success, PLFS_SUCCESS is returned. Otherwise PLFS_E* is
+ *    returned.
+ */
+plfs_error_t
+SmallFileContainer::readdirplus(const struct stat &base,
+                                map<string, struct stat> *res)
+{
+    map<string, time_t> mtimes;
+    map<string, time_t>::iterator name_itr;
+    vector<string> names;
+    map<index_mapping_t, size_t> wanted; /* {fileid, did} => file */
+    map<size_t, struct plfs_pathback> indexfiles;
+    vector<vector<IndexRecord> > records;
+    plfs_error_t ret;
+
+    flush_writers();
+    ret = require(MEMCACHE_FULLYLOADED, this);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = files.read_mtimes(&mtimes, &droppings_names);
+    release(MEMCACHE_FULLYLOADED, this);
+    if (ret != PLFS_SUCCESS) return ret;
+    for (name_itr = mtimes.begin(); name_itr != mtimes.end(); name_itr++) {
+        struct stat stbuf;
+
+        if (files.get_attr_cache(name_itr->first, &stbuf) == PLFS_SUCCESS) {
+            (*res)[name_itr->first] = stbuf;
+        } else {
+            names.push_back(name_itr->first);
+        }
+    }
+    if (names.empty()) return PLFS_SUCCESS;
+
+    ret = require(MEMCACHE_FULLYLOADED, this);
+    if (ret != PLFS_SUCCESS) return ret;
+    ret = files.require(MEMCACHE_FULLYLOADED, &droppings_names);
+    if (ret != PLFS_SUCCESS) {
+        release(MEMCACHE_FULLYLOADED, this);
+        mlog(SMF_ERR, "Can't build names mapping! ret = %d.", ret);
+        return ret;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        FileMetaDataPtr metadata = files.get_metadata(names[i]);
+        if (metadata) want_index_records(metadata, i, &wanted, &indexfiles);
+    }
+    files.release(MEMCACHE_FULLYLOADED, &droppings_names);
+    release(MEMCACHE_FULLYLOADED, this);
+    records.resize(names.size());
+    ret = read_index_records(indexfiles, wanted, &records);
+    if (ret != PLFS_SUCCESS) return ret;
+
+    for (size_t i = 0; i < names.size(); i++) {
+        struct stat stbuf = base;
+        off_t size = 0;
+
+        /*
+         * Replay the records in the order the index is built: a write
+         * extends the file, a truncate record sets its size.
+         */
+        stable_sort(records[i].begin(), records[i].end(), index_record_older);
+        for (size_t j = 0; j < records[i].size(); j++) {
+            const struct IndexEntry &entry = records[i][j].entry;
+            off_t end = entry.offset + entry.length;
+            if (entry.length == 0 &&
+                entry.physical_offset == HOLE_PHYSICAL_OFFSET) {
+                size = entry.offset;
+            } else if (end > size) {
+                size = end;
+            }
+        }
+        stbuf.st_size = size;
+        stbuf.st_blocks = size / 512 + 1;
+        /* It is gone if it has been removed since read_mtimes() */
+        if (files.set_attr_cache(names[i], &stbuf) == PLFS_SUCCESS)
+            (*res)[names[i]] = stbuf;
+    }
+    Metrics::add(PM_SMF_BULK_STATS, names.size());
+    return PLFS_SUCCESS;
+}
+
+/* A piece of data to be read by read_many(). */
+struct ReadManyExtent {
+    ssize_t did;
+    off_t physical;
+    size_t length;
+    size_t file; /**< the file it belongs to */
+    char *buf;
+};
+
+static bool
+read_many_order(const ReadManyExtent &extent1, const ReadManyExtent &extent2) {
+    if (extent1.did != extent2.did) return extent1.did < extent2.did;
+    return extent1.physical < extent2.physical;
+}
+
+/**
+ * Read the beginning of many files at once.
+ *
+ * The indexes are loaded with load_indexes(), then the data of all the
+ * files is sorted by dropping and physical offset and read with a few
+ * large reads from every data file.
+ *
+ * @param names The files to read.
+ * @param bufs Where to read every file.
+ * @param sizes The size of every buffer.
+ * @param bytes_read Returns the number of bytes read from every file, or
+ *    -1 if it fails.
+ * @return PLFS_SUCCESS if every file is read. Otherwise the error of the
+ *    first failure is returned.
+ */
+plfs_error_t
+SmallFileContainer::read_many(const vector<string> &names, char **bufs,
+                              const size_t *sizes, ssize_t *bytes_read)
+{
+    vector<IndexPtr> indexes;
+    vector<ReadManyExtent> extents;
+    vector<char> scratch;
+    plfs_error_t ret, result = PLFS_SUCCESS;
+
+    for (size_t i = 0; i < names.size(); i++) bytes_read[i] = -1;
+    ret = load_indexes(names, &indexes);
+    if (ret != PLFS_SUCCESS) return ret;
+    for (size_t i = 0; i < names.size(); i++) {
+        off_t filesize;
+        size_t length;
+
+        if (!indexes[i]) {
+            if (result == PLFS_SUCCESS) result = PLFS_ENOENT;
+            continue;
+        }
+        filesize = indexes[i]->get_filesize();
+        if (filesize < 0) {
+            if (result == PLFS_SUCCESS) result = PLFS_EIO;
+            continue;
+        }
+        length = (size_t)filesize < sizes[i] ? (size_t)filesize : sizes[i];
+        memset(bufs[i], 0, length); /* for the holes */
+        for (size_t offset = 0; offset < length; ) {
+            DataEntry entry;
+            ret = indexes[i]->lookup(offset, entry);
+            if (ret != PLFS_SUCCESS || entry.length == 0) break;
+            if (entry.length > length - offset) entry.length = length - offset;
+            if (entry.did != HOLE_DROPPING_ID &&
+                entry.offset != HOLE_PHYSICAL_OFFSET) {
+                ReadManyExtent extent;
+                extent.did = entry.did;
+                extent.physical = entry.offset;
+                extent.length = entry.length;
+                extent.file = i;
+                extent.buf = bufs[i] + offset;
+                extents.push_back(extent);
+            }
+            offset += entry.length;
+        }
+        if (ret != PLFS_SUCCESS) {
+            if (result == PLFS_SUCCESS) result = ret;
+            continue;
+        }
+        bytes_read[i] = length;
+    }
+    sort(extents.begin(), extents.end(), read_many_order);
+    for (size_t first = 0, last; first < extents.size(); first = last) {
+        off_t start = extents[first].physical;
+        off_t end = start + extents[first].length;
+        IOSHandle *fh;
+        ssize_t bytes = 0;
+
+        /* Merge the following extents of the same data file. */
+        for (last = first + 1; last < extents.size(); last++) {
+            const ReadManyExtent &next = extents[last];
+            off_t next_end = next.physical + next.length;
+            if (next.did != extents[first].did ||
+                next.physical > end + (off_t)SMF_READ_MANY_GAP ||
+                max(end, next_end) - start > (off_t)SMF_READ_MANY_SIZE) break;
+            end = max(end, next_end);
+        }
+        ret = get_data_handle(extents[first].did, &fh);
+        if (ret == PLFS_SUCCESS && last == first + 1) {
+            ret = fh->Pread(extents[first].buf, end - start, start, &bytes);
+        } else if (ret == PLFS_SUCCESS) {
+            scratch.resize(end - start);
+            ret = fh->Pread(&scratch[0], end - start, start, &bytes);
+        }
+        if (ret == PLFS_SUCCESS && bytes < end - start) ret = PLFS_EIO;
+        Metrics::add(PM_SMF_BATCH_READS, 1);
+        for (size_t i = first; i < last; i++) {
+            if (ret != PLFS_SUCCESS) {
+                bytes_read[extents[i].file] = -1;
+            } else if (last > first + 1) {
+                memcpy(extents[i].buf, &scratch[extents[i].physical - start],
+                       extents[i].length);
+            }
+        }
+        if (ret != PLFS_SUCCESS && result == PLFS_SUCCESS) result = ret;
+    }
+    Metrics::add(PM_SMF_BATCH_FILES, names.size());
+    mlog(SMF_DAPI, "Read %lu files of %s in %lu extents, ret = %d.",
+         (unsigned long)names.size(), dirpath.c_str(),
+         (unsigned long)extents.size(), result);
+    return result;
+}
+
+/**
+ * Prefetch the indexes when the files are opened in directory order.
+ *
+ * When a file is opened for reading after the file preceding it in
+ * directory order, the indexes of the next smallfile_prefetch files are
+ * loaded at once with load_indexes().
+ */
+void
+SmallFileContainer::prefetch(const string &filename) {
+    vector<string> names;
+    vector<IndexPtr> indexes;
+    bool sequential;
+
+    if (pmount->smallfile_prefetch <= 0) return;
+    pthread_mutex_lock(&prefetch_lock);
+    sequential = !prefetch_last.empty() && filename > prefetch_last;
+    prefetch_last = filename;
+    if (!sequential || filename <= prefetch_end) {
+        pthread_mutex_unlock(&prefetch_lock);
+        return;
+    }
+    if (!files.loaded()) flush_writers();
+    if (require(MEMCACHE_FULLYLOADED, this) == PLFS_SUCCESS) {
+        if (files.require(MEMCACHE_FULLYLOADED, &droppings_names) ==
+            PLFS_SUCCESS) {
+            files.get_next_names(filename, pmount->smallfile_prefetch, &names);
+            files.release(MEMCACHE_FULLYLOADED, &droppings_names);
+        }
+        release(MEMCACHE_FULLYLOADED, this);
+    }
+    if (!names.empty()) prefetch_end = names.back();
+    pthread_mutex_unlock(&prefetch_lock);
+    if (!names.empty()) load_indexes(names, &indexes);
+}
+
 plfs_error_t
 SmallFileContainer::create(const string &filename, pid_t pid) {
     plfs_error_t ret;
@@ -275,6 +776,23 @@ SmallFileContainer::sync_writers(int sync_level) {
     return ret;
 }
 
+/**
+ * Write the records queued by the writers of this process to the
+ * droppings, so that reading the droppings will get them.
+ */
+plfs_error_t
+SmallFileContainer::flush_writers() {
+    plfs_error_t ret = PLFS_SUCCESS;
+    map<pid_t, WriterPtr>::iterator itr;
+    pthread_rwlock_rdlock(&writers_lock);
+    for (itr = writers.begin(); itr != writers.end(); itr++) {
+        ret = itr->second->flush();
+        if (ret != PLFS_SUCCESS) break;
+    }
+    pthread_rwlock_unlock(&writers_lock);
+    return ret;
+}
+
 /**
  * Delete all dropping files and the container directory.
  *
@@ -285,9 +803,7 @@ SmallFileContainer::sync_writers(int sync_level) {
 plfs_error_t
 SmallFileContainer::delete_if_empty() {
 #ifdef CHECK_DIR_EMPTY_BEFORE_DELETE
-#ifdef SMALLFILE_USE_LIBC_FILEIO
-    sync_writers(WRITER_SYNC_NAMEFILE);
-#endif
+    if (!files.loaded()) flush_writers();
     plfs_error_t ret = require(MEMCACHE_FULLYLOADED, this);
     set<string> res;
     if (ret != PLFS_SUCCESS) return ret;
@@ -311,6 +827,493 @@ SmallFileContainer::delete_if_empty() {
     return PLFS_SUCCESS;
 }
 
+bool
+SmallFileContainer::has_writers() {
+    bool retval;
+
+    pthread_rwlock_rdlock(&writers_lock);
+    retval = !writers.empty();
+    pthread_rwlock_unlock(&writers_lock);
+    return retval;
+}
+
+/* The live data of a logical file, collected by compact(). */
+struct CompactExtent {
+    off_t logical;
+    ssize_t did;
+    off_t physical;
+    size_t length;
+};
+
+struct CompactFile {
+    string name;
+    time_t mtime;
+    off_t size;
+    vector<CompactExtent> extents;
+};
+
+static bool
+compact_file_older(const CompactFile *file1, const CompactFile *file2) {
+    return file1->mtime < file2->mtime;
+}
+
+#define COMPACT_COPY_SIZE 1048576
+
+/* Sleep if 'bytes' have been copied faster than max_mbs since start. */
+static void
+compact_throttle(double start, uint64_t bytes, int max_mbs) {
+    double expected, spent;
+
+    if (max_mbs <= 0) return;
+    expected = (double)bytes / ((double)max_mbs * 1048576);
+    spent = Util::getTime() - start;
+    if (expected > spent) usleep((useconds_t)((expected - spent) * 1000000));
+}
+
+/*
+ * Get the sizes of the name, index and data files of a dropping group,
+ * -1 for a missing index or data file. It fails with PLFS_EBUSY if any
+ * of them is modified after 'before'.
+ */
+static plfs_error_t
+compact_stat_dropping(const struct plfs_pathback &namefile, time_t before,
+                      off_t *sizes)
+{
+    string paths[3];
+    struct stat stbuf;
+    plfs_error_t ret;
+
+    paths[0] = namefile.bpath;
+    dropping_name2index(namefile.bpath, paths[1]);
+    dropping_name2data(namefile.bpath, paths[2]);
+    for (int i = 0; i < 3; i++) {
+        ret = namefile.back->store->Lstat(paths[i].c_str(), &stbuf);
+        if (ret == PLFS_ENOENT && i > 0) {
+            sizes[i] = -1;
+            continue;
+        }
+        if (ret != PLFS_SUCCESS) return ret;
+        if (stbuf.st_mtime > before) return PLFS_EBUSY;
+        sizes[i] = stbuf.st_size;
+    }
+    return PLFS_SUCCESS;
+}
+
+/*
+ * A compaction lock older than this is left by a compactor which died,
+ * compact_write() refreshes it more often than that.
+ */
+#define COMPACT_LOCK_STALE 3600
+
+/*
+ * Take the compaction lock of a directory. It fails with PLFS_EBUSY if
+ * another process (or thread) is compacting it.
+ */
+static plfs_error_t
+compact_lock(const struct plfs_pathback &lock)
+{
+    IOSHandle *fh;
+    struct stat stbuf;
+    plfs_error_t ret;
+
+    for (int tries = 0; tries < 2; tries++) {
+        ret = lock.back->store->Open(lock.bpath.c_str(),
+                                     O_WRONLY|O_CREAT|O_EXCL, DEFAULT_FMODE,
+                                     &fh);
+        if (ret == PLFS_SUCCESS) return lock.back->store->Close(fh);
+        if (ret != PLFS_EEXIST) return ret;
+        ret = lock.back->store->Lstat(lock.bpath.c_str(), &stbuf);
+        if (ret == PLFS_ENOENT) continue;
+        if (ret != PLFS_SUCCESS) return ret;
+        if (stbuf.st_mtime > time(NULL) - COMPACT_LOCK_STALE) break;
+        mlog(SMF_INFO, "Remove stale compaction lock %s.", lock.bpath.c_str());
+        lock.back->store->Unlink(lock.bpath.c_str());
+    }
+    return PLFS_EBUSY;
+}
+
+/* Remove the name, index, segment and data files of a dropping group. */
+static void
+compact_unlink_dropping(const struct plfs_pathback &namefile) {
+    string path;
+
+    namefile.back->store->Unlink(namefile.bpath.c_str());
+    if (dropping_name2index(namefile.bpath, path) == PLFS_SUCCESS)
+        namefile.back->store->Unlink(path.c_str());
+    if (dropping_name2segment(namefile.bpath, path) == PLFS_SUCCESS)
+        namefile.back->store->Unlink(path.c_str());
+    if (dropping_name2data(namefile.bpath, path) == PLFS_SUCCESS)
+        namefile.back->store->Unlink(path.c_str());
+}
+
+/**
+ * Remove the droppings left over by earlier compactions.
+ *
+ * These are the index, segment and data files whose name file has been
+ * removed, and unfinished compaction output. Only files not modified
+ * since 'before' are removed, so that readers which still use the
+ * replaced droppings keep working for a while.
+ */
+plfs_error_t
+SmallFileContainer::remove_orphans(time_t before) {
+    for (int i = 0; i < pmount->nback; i++) {
+        struct plfs_backend *backend = pmount->backends[i];
+        set<string> dir_contents;
+        set<string>::iterator itr;
+        ReaddirOp op(NULL, &dir_contents, true, true);
+        string container_dir(backend->bmpoint + DIR_SEPERATOR + dirpath +
+                             DIR_SEPERATOR + SMALLFILE_CONTAINER_NAME);
+        plfs_error_t ret;
+
+        op.filter(INDEX_PREFIX);
+        op.filter(DATA_PREFIX);
+        op.filter(SEGMENT_PREFIX);
+        op.filter(COMPACT_PREFIX);
+        ret = op.do_op(container_dir.c_str(), DT_DIR, backend->store);
+        if (ret == PLFS_ENOENT) continue;
+        if (ret != PLFS_SUCCESS) return ret;
+        for (itr = dir_contents.begin(); itr != dir_contents.end(); itr++) {
+            const string &path = *itr;
+            size_t base = path.rfind('/') + 1;
+            struct stat stbuf;
+
+            if (path.compare(base, strlen(COMPACT_PREFIX),
+                             COMPACT_PREFIX) != 0) {
+                string namefile(path);
+                size_t prefix_len = strlen(DATA_PREFIX);
+                if (path.compare(base, strlen(INDEX_PREFIX),
+                                 INDEX_PREFIX) == 0) {
+                    prefix_len = strlen(INDEX_PREFIX);
+                } else if (path.compare(base, strlen(SEGMENT_PREFIX),
+                                        SEGMENT_PREFIX) == 0) {
+                    prefix_len = strlen(SEGMENT_PREFIX);
+                }
+                namefile.replace(base, prefix_len, NAME_PREFIX);
+                if (backend->store->Lstat(namefile.c_str(), &stbuf) !=
+                    PLFS_ENOENT) continue;
+            }
+            if (backend->store->Lstat(path.c_str(), &stbuf) != PLFS_SUCCESS
+                || stbuf.st_mtime >= before) continue;
+            mlog(SMF_INFO, "Remove orphan dropping %s.", path.c_str());
+            backend->store->Unlink(path.c_str());
+        }
+    }
+    return PLFS_SUCCESS;
+}
+
+/**
+ * Write the live files to a new dropping group.
+ *
+ * The name records get the mtime of the files, so that they are merged
+ * before any record written after the compaction started. The index
+ * records get extent_ts, which is newer than any replaced record.
+ */
+plfs_error_t
+SmallFileContainer::compact_write(SMF_Writer *writer,
+                                  const vector<CompactFile *> &order,
+                                  uint64_t extent_ts, int max_mbs,
+                                  const struct plfs_pathback &lock)
+{
+    map<ssize_t, pair<struct plfs_backend *, IOSHandle *> > sources;
+    map<ssize_t, pair<struct plfs_backend *, IOSHandle *> >::iterator itr;
+    char *buf = new char[COMPACT_COPY_SIZE];
+    double start = Util::getTime();
+    double touched = start;
+    uint64_t copied = 0;
+    plfs_error_t ret = PLFS_SUCCESS;
+
+    for (size_t i = 0; i < order.size() && ret == PLFS_SUCCESS; i++) {
+        CompactFile *file = order[i];
+        FileID fileid;
+        off_t end = 0;
+
+        if (Util::getTime() - touched > COMPACT_LOCK_STALE / 4) {
+            lock.back->store->Utime(lock.bpath.c_str(), NULL);
+            touched = Util::getTime();
+        }
+        writer->set_timestamp(TIME2TS(file->mtime));
+        ret = writer->create(file->name, NULL);
+        if (ret != PLFS_SUCCESS || file->size == 0) continue;
+        fileid = writer->get_fileid(file->name, NULL);
+        if (fileid == INVALID_FILEID) {
+            ret = PLFS_EIO;
+            break;
+        }
+        writer->set_timestamp(extent_ts);
+        for (size_t j = 0; j < file->extents.size(); j++) {
+            const CompactExtent &extent = file->extents[j];
+            IOSHandle *source;
+            size_t done = 0;
+
+            itr = sources.find(extent.did);
+            if (itr == sources.end()) {
+                struct plfs_backend *back;
+                string path;
+                get_data_file(extent.did, path, &back);
+                ret = back->store->Open(path.c_str(), O_RDONLY, 0, &source);
+                if (ret != PLFS_SUCCESS) {
+                    mlog(SMF_ERR, "Can't open %s to compact, ret = %d.",
+                         path.c_str(), ret);
+                    break;
+                }
+                sources[extent.did] = make_pair(back, source);
+            } else {
+                source = itr->second.second;
+            }
+            while (done < extent.length) {
+                size_t count = extent.length - done;
+                ssize_t bytes;
+                if (count > COMPACT_COPY_SIZE) count = COMPACT_COPY_SIZE;
+                ret = source->Pread(buf, count, extent.physical + done, &bytes);
+                if (ret == PLFS_SUCCESS && bytes <= 0) ret = PLFS_EIO;
+                if (ret != PLFS_SUCCESS) break;
+                ret = writer->write(fileid, buf, extent.logical + done, bytes,
+                                    NULL, NULL);
+                if (ret != PLFS_SUCCESS) break;
+                done += bytes;
+                copied += bytes;
+                compact_throttle(start, copied, max_mbs);
+            }
+            if (ret != PLFS_SUCCESS) break;
+            end = extent.logical + extent.length;
+        }
+        /* Keep the size of a file which ends with a hole. */
+        if (ret == PLFS_SUCCESS && end < file->size) {
+            ret = writer->truncate(fileid, file->size, NULL, NULL);
+        }
+    }
+    for (itr = sources.begin(); itr != sources.end(); itr++) {
+        itr->second.first->store->Close(itr->second.second);
+    }
+    delete []buf;
+    if (ret == PLFS_SUCCESS) ret = writer->sync(WRITER_SYNC_DATAFILE);
+    return ret;
+}
+
+/**
+ * Rewrite the live files of this directory into a new dropping group.
+ *
+ * Deletes, renames, truncates and overwrites only append records, so the
+ * droppings keep growing. This copies the live extents of every file to
+ * a fresh dropping group, then replaces all the existing groups by it:
+ *     -# The new group is written under COMPACT_PREFIX so readers ignore
+ *        it, its index file is sealed (see seal_index_segment()), and
+ *        then it is renamed in place. From then on, readers see both
+ *        the new and the old records, which build the same files.
+ *     -# The old name files are removed, so new readers only see the new
+ *        group. The old index and data files are kept for opts.grace
+ *        seconds for the readers which are still using them, and are
+ *        removed by a later compaction.
+ *
+ * A dropping which is still being written would lose its new records,
+ * so the compaction is skipped with PLFS_EBUSY unless no dropping has
+ * changed for opts.idle seconds, or if one changes during the copy.
+ * Writers of this object would keep appending to the old droppings, so
+ * this object should not be used any more after a compaction. Only one
+ * process at a time compacts a directory, the others get PLFS_EBUSY.
+ *
+ * @param opts How and when to compact.
+ * @param stats Returns what has been done. stats->droppings is 0 if the
+ *    directory is not worth compacting.
+ * @return On success, PLFS_SUCCESS is returned. Otherwise PLFS_E* is
+ *    returned and the droppings are untouched.
+ */
+plfs_error_t
+SmallFileContainer::compact(const SmallFileCompactOpts &opts,
+                            SmallFileCompactStats *stats)
+{
+    struct plfs_pathback lock;
+    plfs_error_t ret;
+
+    memset(stats, 0, sizeof *stats);
+    lock.back = pmount->backends[0];
+    lock.bpath = lock.back->bmpoint + DIR_SEPERATOR + dirpath +
+        DIR_SEPERATOR SMALLFILE_CONTAINER_NAME DIR_SEPERATOR
+        COMPACT_LOCK_FILENAME;
+    ret = compact_lock(lock);
+    if (ret != PLFS_SUCCESS) {
+        mlog(SMF_DAPI, "Skip compacting %s, it is locked. ret = %d.",
+             dirpath.c_str(), ret);
+        return ret;
+    }
+    ret = compact_locked(opts, stats, lock);
+    lock.back->store->Unlink(lock.bpath.c_str());
+    return ret;
+}
+
+/* compact() with the compaction lock held. */
+plfs_error_t
+SmallFileContainer::compact_locked(const SmallFileCompactOpts &opts,
+                                   SmallFileCompactStats *stats,
+                                   const struct plfs_pathback &lock)
+{
+    uint64_t start_ts = get_current_timestamp();
+    time_t now = TS2TIME(start_ts);
+    vector<struct plfs_pathback> victims;
+    vector<off_t> victim_sizes;
+    map<string, time_t> names;
+    map<string, time_t>::iterator name_itr;
+    list<CompactFile> live; /* a list, pointers to its elements are kept */
+    vector<CompactFile *> order;
+    struct plfs_pathback newfile, tmpfile, snapshot;
+    string tmp_path, new_path;
+    uint64_t dead_bytes;
+    plfs_error_t ret;
+
+    remove_orphans(now - opts.grace);
+    ret = require(MEMCACHE_FULLYLOADED, this);
+    if (ret != PLFS_SUCCESS) return ret;
+    victims = droppings_names;
+    release(MEMCACHE_FULLYLOADED, this);
+    if (victims.empty()) return PLFS_SUCCESS;
+    victim_sizes.resize(victims.size() * 3);
+    for (size_t i = 0; i < victims.size(); i++) {
+        ret = compact_stat_dropping(victims[i], now - opts.idle,
+                                    &victim_sizes[i * 3]);
+        if (ret != PLFS_SUCCESS) {
+            mlog(SMF_DAPI, "Skip compacting %s, %s is in use. ret = %d.",
+                 dirpath.c_str(), victims[i].bpath.c_str(), ret);
+            return ret;
+        }
+        if (victim_sizes[i * 3 + 2] > 0)
+            stats->total_bytes += victim_sizes[i * 3 + 2];
+    }
+
+    /* Collect the live extents of all the files. */
+    ret = files.read_mtimes(&names, &victims);
+    if (ret != PLFS_SUCCESS) return ret;
+    for (name_itr = names.begin(); name_itr != names.end(); name_itr++) {
+        IndexPtr index = get_index(name_itr->first);
+        if (!index) {
+            ret = PLFS_EIO;
+            break;
+        }
+        live.push_back(CompactFile());
+        CompactFile &file = live.back();
+        file.name = name_itr->first;
+        file.mtime = name_itr->second;
+        file.size = index->get_filesize();
+        if (file.size < 0) ret = PLFS_EIO;
+        for (off_t offset = 0; offset < file.size; ) {
+            DataEntry entry;
+            ret = index->lookup(offset, entry);
+            if (ret != PLFS_SUCCESS || entry.length == 0) break;
+            if (entry.did != HOLE_DROPPING_ID &&
+                entry.offset != HOLE_PHYSICAL_OFFSET) {
+                CompactExtent extent;
+                extent.logical = offset;
+                extent.did = entry.did;
+                extent.physical = entry.offset;
+                extent.length = entry.length;
+                file.extents.push_back(extent);
+                stats->live_bytes += entry.length;
+            }
+            offset += entry.length;
+        }
+        index_cache.erase(name_itr->first);
+        if (ret != PLFS_SUCCESS) break;
+        order.push_back(&file);
+    }
+    if (ret != PLFS_SUCCESS) {
+        mlog(SMF_ERR, "Can't read the files of %s to compact, ret = %d.",
+             dirpath.c_str(), ret);
+        return ret;
+    }
+    dead_bytes = stats->total_bytes > stats->live_bytes ?
+        stats->total_bytes - stats->live_bytes : 0;
+    if ((victims.size() == 1 && dead_bytes == 0) ||
+        dead_bytes * 100 < stats->total_bytes * opts.min_garbage) {
+        mlog(SMF_DAPI, "Skip compacting %s, %llu of %llu bytes are dead.",
+             dirpath.c_str(), (unsigned long long)dead_bytes,
+             (unsigned long long)stats->total_bytes);
+        return PLFS_SUCCESS;
+    }
+
+    /* Write the new dropping group under a name readers ignore. */
+    newfile.back = pmount->backends[getpid() % pmount->nback];
+    string container_dir = newfile.back->bmpoint + DIR_SEPERATOR +
+        dirpath + DIR_SEPERATOR SMALLFILE_CONTAINER_NAME;
+    ret = generate_dropping_name(container_dir, getpid(), newfile.bpath);
+    if (ret != PLFS_SUCCESS) return ret;
+    tmpfile.back = newfile.back;
+    tmpfile.bpath = container_dir + DIR_SEPERATOR COMPACT_PREFIX +
+        newfile.bpath.substr(newfile.bpath.rfind('/') + 1);
+    sort(order.begin(), order.end(), compact_file_older);
+    SMF_Writer *writer = new SMF_Writer(tmpfile, HOLE_DROPPING_ID);
+    ret = compact_write(writer, order, start_ts, opts.max_mbs, lock);
+    delete writer;
+    if (ret == PLFS_SUCCESS &&
+        dropping_name2index(tmpfile.bpath, tmp_path) == PLFS_SUCCESS &&
+        dropping_name2segment(tmpfile.bpath, new_path) == PLFS_SUCCESS) {
+        struct plfs_pathback indexfile = {tmp_path, tmpfile.back};
+        if (seal_index_segment(indexfile, new_path) == PLFS_SUCCESS) {
+            stats->sealed++;
+        } else {
+            mlog(SMF_INFO, "Can't seal %s.", tmp_path.c_str());
+        }
+    }
+    for (size_t i = 0; ret == PLFS_SUCCESS && i < victims.size(); i++) {
+        off_t sizes[3];
+        ret = compact_stat_dropping(victims[i],
+                                    TS2TIME(get_current_timestamp()), sizes);
+        if (ret == PLFS_SUCCESS &&
+            memcmp(sizes, &victim_sizes[i * 3], sizeof sizes) != 0) {
+            mlog(SMF_INFO, "%s changed during compaction.",
+                 victims[i].bpath.c_str());
+            ret = PLFS_EBUSY;
+        }
+    }
+
+    /* Switch the readers over to the new group. */
+    if (ret == PLFS_SUCCESS &&
+        dropping_name2segment(tmpfile.bpath, tmp_path) == PLFS_SUCCESS &&
+        dropping_name2segment(newfile.bpath, new_path) == PLFS_SUCCESS) {
+        ret = newfile.back->store->Rename(tmp_path.c_str(), new_path.c_str());
+        if (ret == PLFS_ENOENT) ret = PLFS_SUCCESS;
+    }
+    if (ret == PLFS_SUCCESS &&
+        dropping_name2data(tmpfile.bpath, tmp_path) == PLFS_SUCCESS &&
+        dropping_name2data(newfile.bpath, new_path) == PLFS_SUCCESS) {
+        ret = newfile.back->store->Rename(tmp_path.c_str(), new_path.c_str());
+        if (ret == PLFS_ENOENT) ret = PLFS_SUCCESS;
+    }
+    if (ret == PLFS_SUCCESS &&
+        dropping_name2index(tmpfile.bpath, tmp_path) == PLFS_SUCCESS &&
+        dropping_name2index(newfile.bpath, new_path) == PLFS_SUCCESS) {
+        ret = newfile.back->store->Rename(tmp_path.c_str(), new_path.c_str());
+        if (ret == PLFS_ENOENT) ret = PLFS_SUCCESS;
+    }
+    if (ret == PLFS_SUCCESS) {
+        ret = newfile.back->store->Rename(tmpfile.bpath.c_str(),
+                                          newfile.bpath.c_str());
+    }
+    if (ret != PLFS_SUCCESS) {
+        compact_unlink_dropping(tmpfile);
+        compact_unlink_dropping(newfile);
+        mlog(SMF_INFO, "Failed to compact %s, ret = %d.", dirpath.c_str(),
+             ret);
+        return ret;
+    }
+    get_snapshot_file(pmount, dirpath, snapshot);
+    snapshot.back->store->Unlink(snapshot.bpath.c_str());
+    for (size_t i = 0; i < victims.size(); i++) {
+        if (opts.grace > 0) {
+            victims[i].back->store->Unlink(victims[i].bpath.c_str());
+        } else {
+            compact_unlink_dropping(victims[i]);
+        }
+    }
+    stats->droppings = victims.size();
+    stats->files = order.size();
+    Metrics::add(PM_SMF_COMPACTIONS, 1);
+    Metrics::add(PM_SMF_COMPACT_BYTES, stats->live_bytes);
+    mlog(SMF_INFO, "Compacted %lu droppings of %s into %s, %llu of %llu "
+         "bytes are live.", (unsigned long)victims.size(), dirpath.c_str(),
+         newfile.bpath.c_str(), (unsigned long long)stats->live_bytes,
+         (unsigned long long)stats->total_bytes);
+    return PLFS_SUCCESS;
+}
+
 void
 SmallFileContainer::get_data_file(ssize_t did, string &pathname,
                                   struct plfs_backend **backp) {
@@ -322,6 +1325,27 @@ SmallFileContainer::get_data_file(ssize_t did, string &pathname,
     release(MEMCACHE_FULLYLOADED, this);
 }
 
+/* Get a handle of a data file from the chunk_map, open it if needed. */
+plfs_error_t
+SmallFileContainer::get_data_handle(ssize_t did, IOSHandle **fh) {
+    map<pid_t, IOSHandle *>::iterator itr;
+    plfs_error_t ret = PLFS_SUCCESS;
+
+    pthread_mutex_lock(&chunk_lock);
+    itr = chunk_map.find(did);
+    if (itr != chunk_map.end()) {
+        *fh = itr->second;
+    } else {
+        struct plfs_backend *back;
+        string path;
+        get_data_file(did, path, &back);
+        ret = back->store->Open(path.c_str(), O_RDONLY, 0, fh);
+        if (ret == PLFS_SUCCESS) chunk_map[did] = *fh;
+    }
+    pthread_mutex_unlock(&chunk_lock);
+    return ret;
+}
+
 void
 SmallFileContainer::clear_chunk_cache() {
     map<pid_t, IOSHandle *>::iterator itr;
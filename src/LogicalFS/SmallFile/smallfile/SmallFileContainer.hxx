@@ -19,6 +19,33 @@ using namespace std;
 typedef tr1::shared_ptr<SMF_Writer> WriterPtr;
 typedef tr1::shared_ptr<SmallFileIndex> IndexPtr;
 
+/* Options of SmallFileContainer::compact() */
+struct SmallFileCompactOpts {
+    time_t idle; /**< Skip unless no dropping changed for this long */
+    int min_garbage; /**< Percent of dead data needed, 0 to always compact */
+    int max_mbs; /**< Limit of the copy bandwidth in MB/s, 0 for none */
+    time_t grace; /**< Keep the replaced index and data files this long */
+};
+
+struct SmallFileCompactStats {
+    size_t droppings; /**< dropping groups replaced, 0 if skipped */
+    size_t sealed; /**< index files sealed into segments */
+    size_t files; /**< live files copied */
+    uint64_t live_bytes; /**< data bytes copied */
+    uint64_t total_bytes; /**< size of the replaced data files */
+};
+
+struct CompactFile;
+
+/* limits of the per-container cache of SmallFileIndex objects */
+#define SMF_INDEX_CACHE_OBJECTS 16
+#define SMF_INDEX_CACHE_BYTES   (8UL << 20)
+
+/* read_many() merges the reads of a dropping up to this size ... */
+#define SMF_READ_MANY_SIZE (4UL << 20)
+/* ... and reads through gaps up to this size between them */
+#define SMF_READ_MANY_GAP  (64UL << 10)
+
 /**
  * The most important interface to the outside world.
  *
@@ -39,8 +66,15 @@ public:
     ~SmallFileContainer();
 
     plfs_error_t readdir(set<string> *res);
+    plfs_error_t readdirplus(const struct stat &base,
+                             map<string, struct stat> *res);
     bool file_exist(const string &filename);
     IndexPtr get_index(const string &filename);
+    plfs_error_t load_indexes(const vector<string> &names,
+                              vector<IndexPtr> *indexes);
+    plfs_error_t read_many(const vector<string> &names, char **bufs,
+                           const size_t *sizes, ssize_t *bytes_read);
+    void prefetch(const string &filename);
     void get_data_file(ssize_t did, string &pathname, struct plfs_backend **);
 
     plfs_error_t create(const string &filename, pid_t pid);
@@ -49,8 +83,14 @@ public:
     plfs_error_t utime(const string &filename, struct utimbuf *ut, pid_t pid);
 
     plfs_error_t delete_if_empty();
+    plfs_error_t compact(const SmallFileCompactOpts &opts,
+                         SmallFileCompactStats *stats);
+    bool has_writers();
     WriterPtr get_writer(pid_t pid);
     plfs_error_t sync_writers(int sync_level);
+    plfs_error_t flush_writers();
+    /* memory of the names mapping and the cached indexes, for CacheManager */
+    unsigned long length() { return files.length() + index_cache.length(); };
 
     NamesMapping files;
     CacheManager<string, SmallFileIndex> index_cache;
@@ -66,11 +106,27 @@ private:
     string dirpath;
     vector<struct plfs_pathback> droppings_names;
     /**< protected by ResourceUnit::item_lock */
+    vector<bool> sealed_droppings; /**< has an index segment, by did */
     map<pid_t, WriterPtr> writers;
     pthread_rwlock_t writers_lock;
+    string prefetch_last; /**< the last file opened for reading */
+    string prefetch_end; /**< the last file whose index is prefetched */
+    pthread_mutex_t prefetch_lock;
 
     plfs_error_t makeTopLevelDir(plfs_backend *, const string &, const string &);
+    plfs_error_t remove_orphans(time_t before);
+    void want_index_records(const FileMetaDataPtr &metadata, size_t file,
+                            map<index_mapping_t, size_t> *wanted,
+                            map<size_t, struct plfs_pathback> *indexfiles);
+    plfs_error_t compact_locked(const SmallFileCompactOpts &opts,
+                                SmallFileCompactStats *stats,
+                                const struct plfs_pathback &lock);
+    plfs_error_t compact_write(SMF_Writer *writer,
+                               const vector<CompactFile *> &order,
+                               uint64_t extent_ts, int max_mbs,
+                               const struct plfs_pathback &lock);
     void clear_chunk_cache();
+    plfs_error_t get_data_handle(ssize_t did, IOSHandle **fh);
 };
 
 #endif
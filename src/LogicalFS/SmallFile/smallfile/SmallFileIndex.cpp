@@ -6,9 +6,11 @@
 #include <assert.h>
 #include <iostream>
 #include <Util.h>
+#include <ThreadPool.h>
 #include "SmallFileIndex.hxx"
 #include "FileReader.hxx"
-#include "MinimumHeap.hxx"
+#include "LoserTree.hxx"
+#include "IndexSegment.hxx"
 #include "SmallFileLayout.h"
 
 using namespace std;
@@ -19,17 +21,20 @@ public:
                 int bufsize);
     virtual void *metadata() {return &fid_did.second;};
     virtual plfs_error_t pop_front();
+    const string &path() {return bpath;};
 protected:
     /* Index file has fixed-length records */
     virtual int record_size(void * /* unused */) { return sizeof(struct IndexEntry);};
 private:
     index_mapping_t fid_did;
+    string bpath;
 };
 
 IndexReader::IndexReader(plfs_pathback &fname, const index_mapping_t &meta,
                          int bufsize) : FileReader(fname, bufsize)
 {
     fid_did = meta;
+    bpath = fname.bpath;
 }
 
 plfs_error_t
@@ -45,6 +50,26 @@ IndexReader::pop_front() {
     return ret;
 }
 
+/* Serve the records which have been read by the caller. */
+class IndexRecordReader : public RecordReader {
+public:
+    IndexRecordReader(vector<IndexRecord> *loaded) :
+        records(loaded), current(0) {};
+    virtual void *front() {
+        return current < records->size() ? &(*records)[current].entry : NULL;
+    };
+    virtual void *metadata() {
+        return current < records->size() ? &(*records)[current].did : NULL;
+    };
+    virtual plfs_error_t pop_front() {
+        if (current < records->size()) current++;
+        return current < records->size() ? PLFS_SUCCESS : PLFS_EEOF;
+    };
+private:
+    vector<IndexRecord> *records;
+    size_t current;
+};
+
 static int
 index_compare_func(void *index1, void *index2) {
     const struct IndexEntry *entry1 = (const struct IndexEntry *)index1;
@@ -54,6 +79,77 @@ index_compare_func(void *index1, void *index2) {
     return 0;
 }
 
+/* A sealed segment to be loaded, and its index file as the fallback. */
+struct SegmentTask {
+    SegmentReader *segment;
+    struct plfs_pathback segfile;
+    struct plfs_pathback indexfile;
+    index_mapping_t fid_did;
+    size_t slot; /**< The position of the reader in the merge */
+    plfs_error_t ret;
+};
+
+struct SegmentLoadArgs {
+    vector<SegmentTask> *tasks;
+    size_t next;
+    pthread_mutex_t mux;
+};
+
+static void *
+segment_load_thread(void *va) {
+    SegmentLoadArgs *args = (SegmentLoadArgs *)va;
+
+    while (true) {
+        SegmentTask *task;
+        pthread_mutex_lock(&args->mux);
+        task = args->next < args->tasks->size() ?
+            &(*args->tasks)[args->next++] : NULL;
+        pthread_mutex_unlock(&args->mux);
+        if (!task) break;
+        task->ret = task->segment->load(task->segfile, task->indexfile,
+                                        task->fid_did.first);
+    }
+    pthread_exit(NULL);
+}
+
+/*
+ * Every segment load is a few small reads, so they are spread over a
+ * pool of threads when there are many of them. Starting the threads
+ * costs more than a few loads, so every thread gets at least
+ * SEGMENT_LOADS_PER_THREAD of them, and the common index build over a
+ * handful of droppings loads them in the calling thread.
+ */
+#define SEGMENT_LOADS_PER_THREAD 8
+
+static plfs_error_t
+load_segments(vector<SegmentTask> &tasks) {
+    PlfsConf *pconf = get_plfs_conf();
+    size_t num_threads = pconf ? (size_t)pconf->threadpool_size : 1;
+    plfs_error_t ret = PLFS_SUCCESS;
+
+    num_threads = min(num_threads, tasks.size() / SEGMENT_LOADS_PER_THREAD);
+    if (num_threads > 1) {
+        SegmentLoadArgs args;
+        args.tasks = &tasks;
+        args.next = 0;
+        pthread_mutex_init(&args.mux, NULL);
+        ThreadPool threadpool(num_threads, segment_load_thread,
+                              (void *)&args);
+        ret = threadpool.threadError();
+        if (ret != PLFS_SUCCESS) {
+            mlog(SMF_ERR, "THREAD pool error %s", strplfserr(ret));
+        }
+        pthread_mutex_destroy(&args.mux);
+        return ret;
+    }
+    for (size_t i = 0; i < tasks.size(); i++) {
+        SegmentTask &task = tasks[i];
+        task.ret = task.segment->load(task.segfile, task.indexfile,
+                                      task.fid_did.first);
+    }
+    return ret;
+}
+
 SmallFileIndex::SmallFileIndex(void *init_para) {
     plfs_error_t ret = require(MEMCACHE_FULLYLOADED, init_para);
     if (ret != PLFS_SUCCESS) throw IndexBuildError();
@@ -68,21 +164,34 @@ SmallFileIndex::init_data_source(void *init_para,
                                  RecordReader **reader)
 {
     plfs_error_t ret = PLFS_SUCCESS;
+    vector<IndexRecord> *records = ((index_init_para_t *)init_para)->records;
+
+    if (records) {
+        mlog(SMF_DAPI, "Build index %p from %lu records.", this,
+             (unsigned long)records->size());
+        *reader = new IndexRecordReader(records);
+        return PLFS_SUCCESS;
+    }
     vector<plfs_pathback> &droppings = *(((index_init_para_t *)init_para)->namefiles);
     list<index_mapping_t> *fid = ((index_init_para_t *)init_para)->fids;
-    MinimumHeap *min_heap = new MinimumHeap(fid->size(), index_compare_func);
-
+    vector<bool> *sealed = ((index_init_para_t *)init_para)->sealed;
+    LoserTree *merger = new LoserTree(fid->size(), index_compare_func);
     mlog(SMF_DAPI, "Start to build index %p.", this);
     if (fid->size() == 0) {
-        *reader = min_heap;
+        *reader = merger;
         return PLFS_SUCCESS;
     }
     unsigned int buf_size = get_read_buffer_size(fid->size());
+    vector<RecordReader *> sources;
+    vector<SegmentTask> segments;
     list<index_mapping_t>::const_iterator itr;
+    /*
+     * Create every reader before the first record is taken from any of
+     * them. An IndexReader queues the read of its first block when it is
+     * created, and many sealed segments are loaded by a pool of threads,
+     * so the droppings on all the backends are read in parallel.
+     */
     for (itr = fid->begin(); itr != fid->end(); itr++ ) {
-        string index_fname;
-        IndexReader *indexfile;
-        plfs_error_t pop_result;
         struct plfs_pathback entry;
         entry.back = droppings[itr->second].back;
         assert(itr->second < droppings.size());
@@ -92,34 +201,84 @@ SmallFileIndex::init_data_source(void *init_para,
                  droppings[itr->second].bpath.c_str());
             break;
         }
-        indexfile = new IndexReader(entry, *itr, buf_size);
+        if (sealed && itr->second < sealed->size() &&
+            (*sealed)[itr->second]) {
+            SegmentTask task;
+            task.segment = new SegmentReader(itr->second);
+            task.segfile.back = entry.back;
+            dropping_name2segment(droppings[itr->second].bpath,
+                                  task.segfile.bpath);
+            task.indexfile = entry;
+            task.fid_did = *itr;
+            task.slot = sources.size();
+            task.ret = PLFS_SUCCESS;
+            segments.push_back(task);
+            sources.push_back(task.segment);
+            continue;
+        }
+        sources.push_back(new IndexReader(entry, *itr, buf_size));
+    }
+    if (ret == PLFS_SUCCESS) ret = load_segments(segments);
+    for (size_t i = 0; i < segments.size(); i++) {
+        SegmentTask &task = segments[i];
+        if (ret == PLFS_SUCCESS && task.ret == PLFS_SUCCESS) {
+            if (task.segment->front()) {
+                mlog(SMF_DAPI, "Load index entries from %s.",
+                     task.segfile.bpath.c_str());
+            }
+            continue;
+        }
+        /* Removed, damaged or stale, the index file is still there. */
+        delete task.segment;
+        sources[task.slot] = ret == PLFS_SUCCESS ?
+            new IndexReader(task.indexfile, task.fid_did, buf_size) : NULL;
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        RecordReader *source = sources[i];
+        IndexReader *indexfile = dynamic_cast<IndexReader *>(source);
+        plfs_error_t pop_result;
+
+        if (ret != PLFS_SUCCESS || !indexfile) {
+            if (ret == PLFS_SUCCESS && source->front()) {
+                merger->push_back(source);
+            } else {
+                delete source;
+            }
+            continue;
+        }
         /* Only after this pop_front(), we can get the first record. */
         pop_result = indexfile->pop_front();
         if (pop_result == PLFS_SUCCESS && indexfile->front()) {
-            mlog(SMF_DAPI, "Load index entries from %s.", entry.bpath.c_str());
-            min_heap->push_back(indexfile);
+            mlog(SMF_DAPI, "Load index entries from %s.",
+                 indexfile->path().c_str());
+            merger->push_back(indexfile);
         } else if (pop_result == PLFS_EEOF || pop_result == PLFS_ENOENT) {
-            delete indexfile;
             mlog(SMF_DAPI, "Skip empty or non-existent index file:%s.",
-                 entry.bpath.c_str());
-        } else {
+                 indexfile->path().c_str());
             delete indexfile;
+        } else {
             mlog(SMF_ERR, "Unable to read index entries from %s, err = %d!",
-                 entry.bpath.c_str(), pop_result);
+                 indexfile->path().c_str(), pop_result);
+            delete indexfile;
             ret = pop_result;
-            break;
         }
     }
     if (ret == PLFS_SUCCESS) {
         mlog(SMF_DAPI, "Successfully build index %p.", this);
-        *reader = min_heap;
+        *reader = merger;
     } else {
-        delete min_heap;
+        delete merger;
         mlog(SMF_DAPI, "Failed to build index %p. errno = %d.", this, ret);
     }
     return ret;
 }
 
+unsigned long
+SmallFileIndex::memory_usage() {
+    return index_mapping.size() * (sizeof(map<off_t, DataEntry>::value_type)
+                                   + MEMCACHE_NODE_OVERHEAD);
+}
+
 plfs_error_t
 SmallFileIndex::merge_object(void *record, void *meta) {
     const struct IndexEntry *entry = (const struct IndexEntry *)record;
@@ -27,9 +27,23 @@ public:
     size_t length; /**< the length of this mapping info. */
 };
 
+/**
+ * An index record read ahead of time, with the dropping it belongs to.
+ */
+struct IndexRecord {
+    struct IndexEntry entry;
+    ssize_t did;
+};
+
 struct index_init_para_t {
     vector<struct plfs_pathback> *namefiles;
     list<index_mapping_t> *fids;
+    /**< If not NULL, build the index from these records instead of
+     * reading the index files. They must be sorted by timestamp. */
+    vector<IndexRecord> *records;
+    /**< If not NULL, the droppings whose index file is sealed in a segment,
+     * by did. Their records are read from the segment. */
+    vector<bool> *sealed;
 };
 
 /**
@@ -52,6 +66,7 @@ private:
 protected:
     virtual plfs_error_t merge_object(void *entry, void *did);
     virtual plfs_error_t init_data_source(void *resource, RecordReader **reader);
+    virtual unsigned long memory_usage();
 public:
     SmallFileIndex(void *init_para);
     virtual ~SmallFileIndex();
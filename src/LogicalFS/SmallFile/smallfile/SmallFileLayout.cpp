@@ -52,6 +52,18 @@ dropping_name2data(const string &namefile, string &datafile) {
     return PLFS_SUCCESS;
 }
 
+plfs_error_t
+dropping_name2segment(const string &namefile, string &segmentfile) {
+    size_t found;
+    string nameprefix(NAME_PREFIX);
+
+    segmentfile = namefile;
+    found = segmentfile.rfind(nameprefix);
+    if (found == string::npos) return PLFS_EINVAL;
+    segmentfile.replace(found, nameprefix.length(), SEGMENT_PREFIX);
+    return PLFS_SUCCESS;
+}
+
 void
 get_statfile(struct plfs_backend *backend, const string &dirpath,
              string &statfile) {
@@ -79,7 +91,8 @@ unsigned int
 get_read_buffer_size(int num_of_files) {
     PlfsConf *pconf = get_plfs_conf();
     int buf_size = pconf->read_buffer_mbs * 1048576;
-    int divider = next_highest_power_of_2(num_of_files);
+    /* Every reader keeps a second buffer for the block read ahead */
+    int divider = next_highest_power_of_2(num_of_files) * 2;
 
     buf_size /= divider;
     return buf_size < READBUFFER_MINSIZE ? READBUFFER_MINSIZE :
@@ -40,10 +40,79 @@ struct __attribute__ ((__packed__)) IndexEntry {
     off_t physical_offset;
 };
 
+/*
+ * The names snapshot: the merged names mapping of a directory, sorted by
+ * filename, with the offset in every name file up to which it has been
+ * merged and the timestamp of the newest record merged.  Layout:
+ *     NameSnapshotHeader
+ *     ndroppings * NameSnapshotDropping (followed by the basename)
+ *     nfiles * NameSnapshotFile (followed by nmappings *
+ *         NameSnapshotMapping, then the filename)
+ * Every record starts with its total length.
+ */
+#define NAME_SNAPSHOT_MAGIC   0x50414e53 /* "SNAP" */
+#define NAME_SNAPSHOT_VERSION 2
+
+struct __attribute__ ((__packed__)) NameSnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ndroppings;
+    uint32_t reserved;
+    uint64_t nfiles;
+    uint64_t merged_timestamp; /**< the newest record merged */
+};
+
+struct __attribute__ ((__packed__)) NameSnapshotDropping {
+    uint32_t length;
+    uint32_t reserved;
+    uint64_t merged_offset; /**< end of the last merged record */
+    char basename[0];
+};
+
+struct __attribute__ ((__packed__)) NameSnapshotFile {
+    uint32_t length;
+    uint32_t nmappings;
+    uint64_t mtime;
+};
+
+struct __attribute__ ((__packed__)) NameSnapshotMapping {
+    uint64_t fileid;
+    uint64_t dropping; /**< index in the dropping table of the snapshot */
+};
+
+/*
+ * The sealed segment of an index file: its records sorted by file id,
+ * the records of every file staying in the order they were written, and
+ * the size of the index file they were read from. Layout:
+ *     nrecords * IndexEntry
+ *     nfences * FileID, the file id of every interval-th record
+ *     IndexSegmentFooter
+ */
+#define INDEX_SEGMENT_MAGIC    0x4d474553 /* "SEGM" */
+#define INDEX_SEGMENT_VERSION  2
+#define INDEX_SEGMENT_INTERVAL 64
+
+struct __attribute__ ((__packed__)) IndexSegmentFooter {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t nrecords;
+    uint32_t interval;
+    uint32_t nfences;
+    uint64_t min_fid;
+    uint64_t max_fid;
+    uint64_t index_size; /**< bytes of whole records in the index file */
+};
+
 #define NAME_PREFIX  "dropping.name"
 #define INDEX_PREFIX "dropping.index"
 #define DATA_PREFIX  "dropping.data"
+#define SEGMENT_PREFIX "dropping.segment"
+/* new droppings are written under this prefix until they are complete */
+#define COMPACT_PREFIX "compacting."
 #define STAT_FILENAME "meta-file-for-stat-operation"
+#define NAME_SNAPSHOT_FILENAME "names.snapshot"
+/* held by the process compacting the directory */
+#define COMPACT_LOCK_FILENAME "compact.lock"
 
 #define SMALLFILE_CONTAINER_NAME "SMALLFILECONTAINER"
 
@@ -68,6 +137,9 @@ plfs_error_t dropping_name2index(const string &namefile, string &indexfile);
 
 plfs_error_t dropping_name2data(const string &namefile, string &datafile);
 
+plfs_error_t dropping_name2segment(const string &namefile,
+                                   string &segmentfile);
+
 void get_statfile(plfs_backend *backend, const string &dir, string &file);
 
 unsigned int get_read_buffer_size(int number_of_files);
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "COPYRIGHT.h"
+#include "plfs.h"
+#include "plfs_private.h"
+
+#include "SmallFileFS.h"
+
+#include "smallfile_tools.h"
+
+using namespace std;
+
+/**
+ * smallfile_compact: rewrite the live data of a small_file directory
+ * into a new dropping and remove the old droppings.
+ *
+ * XXX: this is a top-level function that bypasses the LogicalFS layer
+ *
+ * only used by the plfs_compact tool
+ *
+ * @param fp the FILE to print what has been done on
+ * @param logical the logical path of the directory to compact
+ * @param idle seconds the droppings must have been untouched
+ * @param min_garbage percent of dead data needed to compact
+ * @param max_mbs limit of the copy bandwidth in MB/s, 0 for none
+ * @param grace seconds to keep the old index and data droppings
+ * @return PLFS_SUCCESS or an error code
+ */
+plfs_error_t
+smallfile_compact(FILE *fp, const char *logical, int idle, int min_garbage,
+                  int max_mbs, int grace)
+{
+    plfs_error_t ret;
+    struct plfs_physpathinfo ppi;
+    SmallFileFS *smallfs;
+    SmallFileCompactOpts opts;
+    SmallFileCompactStats stats;
+
+    ret = plfs_resolvepath(logical, &ppi);
+    if (ret) {
+        return(ret);
+    }
+    smallfs = dynamic_cast<SmallFileFS *>(ppi.mnt_pt->fs_ptr);
+    if (smallfs == NULL) {
+        return(PLFS_EINVAL);
+    }
+    opts.idle = idle;
+    opts.min_garbage = min_garbage;
+    opts.max_mbs = max_mbs;
+    opts.grace = grace;
+    ret = smallfs->compact(&ppi, opts, &stats);
+    if (ret != PLFS_SUCCESS) {
+        return(ret);
+    }
+    if (stats.droppings == 0) {
+        fprintf(fp, "%s: skipped, %llu of %llu bytes are live\n", logical,
+                (unsigned long long)stats.live_bytes,
+                (unsigned long long)stats.total_bytes);
+    } else {
+        fprintf(fp, "%s: compacted %lu droppings, %lu files, "
+                "%llu of %llu bytes are live\n", logical,
+                (unsigned long)stats.droppings, (unsigned long)stats.files,
+                (unsigned long long)stats.live_bytes,
+                (unsigned long long)stats.total_bytes);
+    }
+    return(PLFS_SUCCESS);
+}
@@ -0,0 +1,39 @@
+#ifndef __SMALLFILE_TOOLS_H_
+#define __SMALLFILE_TOOLS_H_
+
+/*
+ * smallfile_tools.h  PLFS library functions for plfs tools
+ *
+ * PLFS lib functions used only by plfs-core/tools programs
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /**
+     * smallfile_compact: rewrite the live data of a small_file directory
+     * into a new dropping and remove the old droppings.  The directory
+     * is skipped if any of its droppings has changed in the last 'idle'
+     * seconds.
+     *
+     * XXX: this is a top-level function that bypasses the LogicalFS layer
+     *
+     * only used by the plfs_compact tool
+     *
+     * @param fp the FILE to print what has been done on
+     * @param logical the logical path of the directory to compact
+     * @param idle seconds the droppings must have been untouched
+     * @param min_garbage percent of dead data needed to compact
+     * @param max_mbs limit of the copy bandwidth in MB/s, 0 for none
+     * @param grace seconds to keep the old index and data droppings
+     * @return PLFS_SUCCESS or an error code
+     */
+    plfs_error_t smallfile_compact(FILE *fp, const char *logical, int idle,
+                                   int min_garbage, int max_mbs, int grace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+#include <sstream>
+#include "Metrics.h"
+
+/* names as they appear in the JSON, same order as the enums */
+static const char *counter_names[] = {
+    "open_ops",
+    "close_ops",
+    "read_ops",
+    "write_ops",
+    "read_bytes",
+    "write_bytes",
+    "op_errors",
+    "backend_reads",
+    "backend_read_bytes",
+    "index_loads",
+    "index_extents",
+    "index_shared_attaches",
+    "index_loads_skipped",
+    "chunkfh_cache_hits",
+    "chunkfh_cache_misses",
+    "smallfile_cache_hits",
+    "smallfile_cache_misses",
+    "smallfile_cache_evictions",
+    "smallfile_compactions",
+    "smallfile_compact_bytes",
+    "smallfile_batch_files",
+    "smallfile_batch_reads",
+    "smallfile_commits",
+    "smallfile_commit_records",
+    "smallfile_segments_sealed",
+    "smallfile_segment_loads",
+    "smallfile_bulk_stats",
+    "zdrop_frames",
+    "zdrop_bytes_in",
+    "zdrop_bytes_stored",
+    "checksum_blocks_verified",
+    "checksum_errors",
+    "zero_block_bytes",
+    "clone_links",
+    "clone_copies",
+    "append_seeds",
+    "open_handles",
+    "open_chunk_handles",
+};
+
+static const char *histogram_names[] = {
+    "open_latency_us",
+    "close_latency_us",
+    "read_latency_us",
+    "write_latency_us",
+    "index_load_latency_us",
+};
+
+/* fail the build if a metric is added without a name */
+typedef char counter_names_check
+    [(sizeof(counter_names)/sizeof(counter_names[0]) == PM_NCOUNTERS) ? 1 : -1];
+typedef char histogram_names_check
+    [(sizeof(histogram_names)/sizeof(histogram_names[0]) == PMH_NHISTOGRAMS)
+     ? 1 : -1];
+
+int64_t Metrics::counters[PM_NCOUNTERS];
+struct plfs_histogram Metrics::histograms[PMH_NHISTOGRAMS];
+
+void
+Metrics::time(enum plfs_metric_histogram id, double secs)
+{
+    struct plfs_histogram *h = &histograms[id];
+    int64_t usec = (secs > 0) ? (int64_t)(secs * 1000000) : 0;
+    int bucket = 0;
+
+    while (bucket < PM_HIST_BUCKETS - 1 && (usec >> bucket) != 0) {
+        bucket++;
+    }
+    __sync_fetch_and_add(&h->count, 1);
+    __sync_fetch_and_add(&h->sum_usec, usec);
+    __sync_fetch_and_add(&h->buckets[bucket], 1);
+}
+
+/*
+ * the histogram buckets are printed as "upper bound in usec": count,
+ * skipping empty buckets, so a scraper can rebuild the distribution.
+ */
+string
+Metrics::toJSON()
+{
+    ostringstream oss;
+    int i, b;
+
+    oss << "{\"counters\":{";
+    for (i = 0; i < PM_NCOUNTERS; i++) {
+        oss << (i ? "," : "") << "\"" << counter_names[i] << "\":"
+            << __sync_fetch_and_add(&counters[i], 0);
+    }
+    oss << "},\"histograms\":{";
+    for (i = 0; i < PMH_NHISTOGRAMS; i++) {
+        struct plfs_histogram *h = &histograms[i];
+        bool first = true;
+        oss << (i ? "," : "") << "\"" << histogram_names[i] << "\":{"
+            << "\"count\":" << __sync_fetch_and_add(&h->count, 0)
+            << ",\"sum\":" << __sync_fetch_and_add(&h->sum_usec, 0)
+            << ",\"buckets\":{";
+        for (b = 0; b < PM_HIST_BUCKETS; b++) {
+            int64_t n = __sync_fetch_and_add(&h->buckets[b], 0);
+            if (n == 0) {
+                continue;
+            }
+            oss << (first ? "" : ",") << "\"";
+            if (b == PM_HIST_BUCKETS - 1) {
+                oss << "+Inf";
+            } else {
+                oss << ((int64_t)1 << b);
+            }
+            oss << "\":" << n;
+            first = false;
+        }
+        oss << "}}";
+    }
+    oss << "}}\n";
+    return oss.str();
+}
@@ -0,0 +1,110 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+/*
+ * Metrics: process-wide counters and latency histograms.
+ *
+ * each metric has a fixed id, so an update is one atomic add on a
+ * static slot: no lock, no name lookup.  metrics are read by dumping
+ * them as JSON (plfs_get_metrics(), the FUSE .plfsmetrics file).  a
+ * dump is not an atomic snapshot across metrics, each value is just
+ * read once.
+ *
+ * to add a metric: add an id to the enum below and a matching name to
+ * the table in Metrics.cpp (the two must stay in the same order).
+ */
+enum plfs_metric_counter {
+    /* API operations (plfs_open/close/read/write) */
+    PM_OPEN_OPS,
+    PM_CLOSE_OPS,
+    PM_READ_OPS,
+    PM_WRITE_OPS,
+    PM_READ_BYTES,
+    PM_WRITE_BYTES,
+    PM_OP_ERRORS,
+    /* reads issued to backend data droppings */
+    PM_BACKEND_READS,
+    PM_BACKEND_READ_BYTES,
+    /* container index */
+    PM_INDEX_LOADS,
+    PM_INDEX_EXTENTS,
+    PM_INDEX_SHARED_ATTACHES, /* shared_index images mapped, not built */
+    PM_INDEX_LOADS_SKIPPED,   /* RDONLY opens closed before any read */
+    /* caches */
+    PM_CHUNKFH_HITS,
+    PM_CHUNKFH_MISSES,
+    PM_SMF_CACHE_HITS,
+    PM_SMF_CACHE_MISSES,
+    PM_SMF_CACHE_EVICTIONS,
+    /* smallfile compaction */
+    PM_SMF_COMPACTIONS,
+    PM_SMF_COMPACT_BYTES,
+    /* smallfile batch reads */
+    PM_SMF_BATCH_FILES,
+    PM_SMF_BATCH_READS,
+    /* smallfile group commit: appends to droppings, records in them */
+    PM_SMF_COMMITS,
+    PM_SMF_COMMIT_RECORDS,
+    /* smallfile index segments: sealed, and searched to build an index */
+    PM_SMF_SEGMENTS_SEALED,
+    PM_SMF_SEGMENT_LOADS,
+    /* smallfile readdirplus: files whose attributes are computed at once */
+    PM_SMF_BULK_STATS,
+    /* compressed data droppings: frames written, data bytes in and out */
+    PM_ZDROP_FRAMES,
+    PM_ZDROP_BYTES_IN,
+    PM_ZDROP_BYTES_STORED,
+    /* data_checksums: blocks verified on read, and reads failing it */
+    PM_SUM_BLOCKS_VERIFIED,
+    PM_SUM_ERRORS,
+    /* zero_blocks: bytes of zeros indexed instead of written */
+    PM_ZERO_BLOCK_BYTES,
+    /* plfs_clone: data droppings linked, and copied where links failed */
+    PM_CLONE_LINKS,
+    PM_CLONE_COPIES,
+    /* O_APPEND: append counters seeded from the container metadata */
+    PM_APPEND_SEEDS,
+    /* gauges: these go up and down */
+    PM_OPEN_HANDLES,
+    PM_CHUNK_HANDLES,
+    PM_NCOUNTERS
+};
+
+enum plfs_metric_histogram {
+    PMH_OPEN,
+    PMH_CLOSE,
+    PMH_READ,
+    PMH_WRITE,
+    PMH_INDEX_LOAD,
+    PMH_NHISTOGRAMS
+};
+
+/* bucket i counts latencies < 2^i usec, the last bucket is overflow */
+#define PM_HIST_BUCKETS 32
+
+struct plfs_histogram {
+    int64_t count;
+    int64_t sum_usec;
+    int64_t buckets[PM_HIST_BUCKETS];
+};
+
+class Metrics
+{
+    public:
+        static void add(enum plfs_metric_counter id, int64_t val) {
+            __sync_fetch_and_add(&counters[id], val);
+        }
+        static void time(enum plfs_metric_histogram id, double secs);
+        static string toJSON();
+
+    private:
+        static int64_t counters[PM_NCOUNTERS];
+        static struct plfs_histogram histograms[PMH_NHISTOGRAMS];
+};
+
+#endif
@@ -109,9 +109,52 @@ struct mlog_state {
     int stderr_isatty;              /*!< non-zero if stderr is a tty */
 #ifdef MLOG_MUTEX
     pthread_mutex_t mlogmux;        /*!< protect mlog in threaded env */
+    /* async mode (MLOG_ASYNC) state, see mlog_aenqueue() */
+    pthread_mutex_t aringmux;       /*!< protects arings list */
+    struct mlog_aring *arings;      /*!< per-thread rings */
+    pthread_key_t aringkey;         /*!< thread's ring */
+    pthread_t adrainer;             /*!< drainer thread */
+    pid_t apid;                     /*!< pid that owns adrainer */
+    volatile int arunning;          /*!< drainer was started */
+    volatile int astop;             /*!< tell drainer to exit */
+    unsigned long alogged;          /*!< msgs written by the drainer */
+    unsigned long adropped;         /*!< drops from freed rings */
 #endif
 };
 
+#ifdef MLOG_MUTEX
+/*
+ * async ring: each logging thread owns one of these.  the thread is the
+ * only producer and the drainer is the only consumer, so head and tail
+ * are each written by just one side and no lock is needed.  they are
+ * free running counters, use MLOG_ARINGMASK to get a buffer offset.
+ * records are 8 byte aligned, a zero ar_len means "wrap to start".
+ */
+#define MLOG_ARINGSZ    (64 * 1024)     /* must be a power of 2 */
+#define MLOG_ARINGMASK  (MLOG_ARINGSZ - 1)
+#define MLOG_ADRAINUSEC 10000           /* drainer idle poll time */
+
+struct mlog_arec {
+    uint32_t ar_len;                /*!< record len w/header, 0 == wrap */
+    uint32_t ar_mlen;               /*!< length of message text */
+    int ar_flags;                   /*!< flags, as filtered by vmlog */
+    struct timeval ar_tv;           /*!< when it was logged */
+    /* followed by ar_mlen bytes of message text (not null terminated) */
+};
+
+struct mlog_aring {
+    volatile uint32_t head;         /*!< producer position */
+    char pad0[64 - sizeof(uint32_t)];
+    volatile uint32_t tail;         /*!< consumer position */
+    char pad1[64 - sizeof(uint32_t)];
+    volatile unsigned long dropped; /*!< msgs dropped, ring was full */
+    unsigned long dropseen;         /*!< drops the drainer reported */
+    volatile int dead;              /*!< owning thread has exited */
+    struct mlog_aring *next;        /*!< list linkage (aringmux) */
+    char buf[MLOG_ARINGSZ];
+};
+#endif
+
 /*
  * global data.  this sets mlog_xst.tag to 0, meaning the log is not open.
  * this is global so mlog_filter() in mlog.h can get at it.
@@ -155,7 +198,15 @@ static const char *mlog_pristr(int);
 static int mlog_resolvhost(struct sockaddr_in *, char *, char *);
 static int mlog_setnfac(int);
 static uint32_t wswap(uint32_t);
-static void vmlog(int, const char *, va_list);
+static void vmlog(int, int, const char *, va_list);
+static void mlog_voutput(int, int, int, struct timeval *,
+                         const char *, va_list);
+#ifdef MLOG_MUTEX
+static int mlog_aenqueue(int, const char *, va_list);
+static void mlog_astart(void);
+static void mlog_astop(void);
+static void mlog_aflush(void);
+#endif
 
 /*
  * local helper functions
@@ -435,7 +486,8 @@ static uint32_t wswap(uint32_t w)
  * mlog_cleanout: release previously allocated resources (e.g. from a
  * close or during a failed open).  this function assumes the mlogmux
  * has been allocated (caller must ensure that this is true or we'll
- * die when attempting a mlog_lock()).  we will dispose of mlogmux.
+ * die when attempting a mlog_lock()).  we will dispose of mlogmux
+ * and the async logging state (stopping the drainer if needed).
  * (XXX: might want to switch over to a PTHREAD_MUTEX_INITIALIZER for
  * mlogmux at some point?).
  *
@@ -444,6 +496,18 @@ static uint32_t wswap(uint32_t w)
 static void mlog_cleanout()
 {
     int lcv;
+#ifdef MLOG_MUTEX
+    struct mlog_aring *ar;
+    mlog_astop();
+    pthread_mutex_lock(&mst.aringmux);
+    while ((ar = mst.arings) != NULL) {
+        mst.arings = ar->next;
+        free(ar);
+    }
+    pthread_mutex_unlock(&mst.aringmux);
+    pthread_key_delete(mst.aringkey);
+    pthread_mutex_destroy(&mst.aringmux);
+#endif
     mlog_lock();
     if (mst.logfile) {
         if (mst.logfd >= 0) {
@@ -493,33 +557,26 @@ static void mlog_cleanout()
 }
 
 
+#define MLOG_TBSIZ    4096    /* bigger than any line should be */
+
 /**
  * vmlog: core log function, front-ended by mlog/mlog_abort/mlog_exit.
- * we vsnprintf the message into a holding buffer to format it.  then we
- * send it to all target output logs.  the holding buffer is set to
- * MLOG_TBSIZ, if the message is too long it will be silently truncated.
- * caller should not hold mlog_lock, vmlog will grab it as needed.
+ * filters the message by level (without locking), then either hands it
+ * to mlog_voutput() or, in async mode, queues it for the drainer.
+ * caller should not hold mlog_lock.
  *
  * @param flags the flags (mainly fac+pri) for this log message
+ * @param sync non-zero to output now, even in async mode
  * @param fmt the printf(3) format to use
  * @param ap the stdargs va_list to use for the printf format
  */
-static void vmlog(int flags, const char *fmt, va_list ap)
+static void vmlog(int flags, int sync, const char *fmt, va_list ap)
 {
-#define MLOG_TBSIZ    4096    /* bigger than any line should be */
     int fac, lvl, msk;
-    char b[MLOG_TBSIZ], *bp, *b_nopt1hdr;
-    char facstore[16], *facstr;
     struct timeval tv;
-    struct tm *tm;
-    unsigned int hlen_pt1, hlen, mlen, tlen, thisflag;
-    unsigned int resid;
-    char *m1, *m2;
-    int m1len, m2len, ncpy;
     //since we ignore any potential errors in MLOG let's always re-set 
     //errno to its orginal value
     int save_errno = errno;
-    struct mlog_mbhead *mb;
     /*
      * make sure the mlog is open
      */
@@ -565,7 +622,60 @@ static void vmlog(int flags, const char *fmt, va_list ap)
         }
     }
     /*
-     * we must log it, start computing the parts of the log we'll need.
+     * we must log it.  in async mode the message is queued for the
+     * drainer thread, unless the ring can't be set up.
+     */
+#ifdef MLOG_MUTEX
+    if (!sync && (mst.oflags & MLOG_ASYNC) != 0 &&
+            mlog_aenqueue(flags, fmt, ap) == 0) {
+        errno = save_errno;
+        return;
+    }
+#endif
+    (void) gettimeofday(&tv, 0);
+    mlog_voutput(flags, fac, lvl, &tv, fmt, ap);
+    errno = save_errno;
+}
+
+/**
+ * mlog_doutput: mlog_voutput front end for when we already have
+ * the args (used by the drainer).
+ */
+static void mlog_doutput(int flags, int fac, int lvl, struct timeval *tvp,
+                         const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    mlog_voutput(flags, fac, lvl, tvp, fmt, ap);
+    va_end(ap);
+}
+
+/**
+ * mlog_voutput: format a message that passed the filter and send it to
+ * all the target output logs.  the holding buffer is set to MLOG_TBSIZ,
+ * if the message is too long it will be silently truncated.  caller
+ * should not hold mlog_lock, we will grab it as needed.
+ *
+ * @param flags the flags for this log message, after filtering
+ * @param fac the facility (already checked against fac_cnt)
+ * @param lvl the level
+ * @param tvp time of the log message
+ * @param fmt the printf(3) format to use
+ * @param ap the stdargs va_list to use for the printf format
+ */
+static void mlog_voutput(int flags, int fac, int lvl, struct timeval *tvp,
+                         const char *fmt, va_list ap)
+{
+    char b[MLOG_TBSIZ], *bp, *b_nopt1hdr;
+    char facstore[16], *facstr;
+    struct tm *tm;
+    unsigned int hlen_pt1, hlen, mlen, tlen, thisflag;
+    unsigned int resid;
+    char *m1, *m2;
+    int m1len, m2len, ncpy;
+    struct mlog_mbhead *mb;
+    /*
+     * start computing the parts of the log we'll need.
      */
     mlog_lock();      /* lock out other threads */
     if (mlog_xst.mlog_facs[fac].fac_aname) {
@@ -574,8 +684,7 @@ static void vmlog(int flags, const char *fmt, va_list ap)
         snprintf(facstore, sizeof(facstore), "%d", fac);
         facstr = facstore;
     }
-    (void) gettimeofday(&tv, 0);
-    tm = localtime(&tv.tv_sec);
+    tm = localtime(&tvp->tv_sec);
     thisflag = (mst.oflags | flags);
     /*
      * ok, first, put the header into b[]
@@ -584,7 +693,7 @@ static void vmlog(int flags, const char *fmt, va_list ap)
                     "%04d/%02d/%02d-%02d:%02d:%02d.%02ld %s %s ",
                     tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday,
                     tm->tm_hour, tm->tm_min, tm->tm_sec,
-                    (long int)tv.tv_usec / 10000, mst.uts.nodename,
+                    (long int)tvp->tv_usec / 10000, mst.uts.nodename,
                     mlog_xst.tag);
     hlen_pt1 = hlen;    /* save part 1 length */
     if (hlen < sizeof(b)) {
@@ -600,7 +709,6 @@ static void vmlog(int flags, const char *fmt, va_list ap)
         mlog_unlock();      /* drop lock, this is the only early exit */
         fprintf(stderr, "mlog: header overflowed %zd byte buffer (%d)\n",
                 sizeof(b), hlen + 1);
-        errno = save_errno;
         return;
     }
     /*
@@ -728,10 +836,269 @@ static void vmlog(int flags, const char *fmt, va_list ap)
     /*
      * done!
      */
-    errno = save_errno;
     return;
 }
 
+#ifdef MLOG_MUTEX
+/*
+ * async logging (MLOG_ASYNC).  the logging thread only formats the
+ * user's part of the message and copies it with a timestamp into its
+ * own ring.  the drainer thread builds the header and does the writes
+ * to the msgbuf/file/ucon/stderr/syslog (with mlog_voutput, so output
+ * looks the same as in sync mode).  if a ring is full the message is
+ * dropped and counted, the drainer logs the drop count when it next
+ * sees that ring.
+ */
+
+/**
+ * mlog_aring_free: ring destructor, runs in an exiting thread.  the
+ * drainer frees the ring after it has been emptied.
+ *
+ * @param arg the ring
+ */
+static void mlog_aring_free(void *arg)
+{
+    struct mlog_aring *ar = (struct mlog_aring *)arg;
+    __sync_synchronize();
+    ar->dead = 1;
+}
+
+/**
+ * mlog_aring_get: get this thread's ring, allocating it on first use.
+ *
+ * @return the ring, or NULL on error
+ */
+static struct mlog_aring *mlog_aring_get(void)
+{
+    struct mlog_aring *ar;
+    ar = pthread_getspecific(mst.aringkey);
+    if (ar) {
+        return(ar);
+    }
+    ar = calloc(1, sizeof(*ar));
+    if (!ar) {
+        return(NULL);
+    }
+    if (pthread_setspecific(mst.aringkey, ar) != 0) {
+        free(ar);
+        return(NULL);
+    }
+    pthread_mutex_lock(&mst.aringmux);
+    ar->next = mst.arings;
+    mst.arings = ar;
+    pthread_mutex_unlock(&mst.aringmux);
+    return(ar);
+}
+
+/**
+ * mlog_aenqueue: format the user part of a message and queue it on
+ * the calling thread's ring.  no locks are taken (except on the first
+ * message from a thread).
+ *
+ * @param flags the flags for this log message, after filtering
+ * @param fmt the printf(3) format to use
+ * @param ap the stdargs va_list to use for the printf format
+ * @return 0 if queued or dropped, -1 if the caller should log it sync
+ */
+static int mlog_aenqueue(int flags, const char *fmt, va_list ap)
+{
+    struct mlog_aring *ar;
+    struct mlog_arec *rec;
+    char m[MLOG_TBSIZ];
+    int mlen;
+    uint32_t head, need, contig, avail;
+    if (!mst.arunning || mst.apid != getpid() ||
+            (ar = mlog_aring_get()) == NULL) {
+        return(-1);
+    }
+    mlen = vsnprintf(m, sizeof(m), fmt, ap);
+    if (mlen < 0) {
+        return(0);
+    }
+    if (mlen >= (int)sizeof(m)) {
+        mlen = sizeof(m) - 1;   /* truncated, as in sync mode */
+    }
+    need = (sizeof(*rec) + mlen + 7) & ~7;
+    head = ar->head;
+    contig = MLOG_ARINGSZ - (head & MLOG_ARINGMASK);
+    avail = MLOG_ARINGSZ - (head - ar->tail);
+    if (need > contig) {    /* must skip the end of the buffer */
+        if (need + contig > avail) {
+            ar->dropped++;
+            return(0);
+        }
+        *(uint32_t *)(ar->buf + (head & MLOG_ARINGMASK)) = 0;
+        head += contig;
+    } else if (need > avail) {
+        ar->dropped++;
+        return(0);
+    }
+    rec = (struct mlog_arec *)(ar->buf + (head & MLOG_ARINGMASK));
+    rec->ar_len = need;
+    rec->ar_mlen = mlen;
+    rec->ar_flags = flags;
+    (void) gettimeofday(&rec->ar_tv, 0);
+    memcpy(rec + 1, m, mlen);
+    __sync_synchronize();   /* record must be visible before head */
+    ar->head = head + need;
+    return(0);
+}
+
+/**
+ * mlog_adrain_ring: output everything queued on a ring.  drainer only.
+ *
+ * @param ar the ring to drain
+ * @return number of messages output
+ */
+static int mlog_adrain_ring(struct mlog_aring *ar)
+{
+    struct mlog_arec *rec;
+    uint32_t head, tail;
+    unsigned long dropped;
+    struct timeval now;
+    int fac, cnt;
+    cnt = 0;
+    head = ar->head;
+    __sync_synchronize();   /* read head before the records */
+    for (tail = ar->tail ; tail != head ; ) {
+        rec = (struct mlog_arec *)(ar->buf + (tail & MLOG_ARINGMASK));
+        if (rec->ar_len == 0) {
+            tail += MLOG_ARINGSZ - (tail & MLOG_ARINGMASK);
+            continue;
+        }
+        fac = rec->ar_flags & MLOG_FACMASK;
+        if (fac >= mlog_xst.fac_cnt) {
+            fac = 0;
+        }
+        mlog_doutput(rec->ar_flags, fac, rec->ar_flags & MLOG_PRIMASK,
+                     &rec->ar_tv, "%.*s", (int)rec->ar_mlen,
+                     (char *)(rec + 1));
+        tail += rec->ar_len;
+        cnt++;
+    }
+    __sync_synchronize();   /* done with the records before moving tail */
+    ar->tail = tail;
+    dropped = ar->dropped;
+    if (dropped != ar->dropseen) {
+        (void) gettimeofday(&now, 0);
+        mlog_doutput(MLOG_WARN, 0, MLOG_WARN, &now,
+                     "mlog: async ring full, dropped %lu messages\n",
+                     dropped - ar->dropseen);
+        ar->dropseen = dropped;
+    }
+    return(cnt);
+}
+
+/**
+ * mlog_adrain: drain all rings once, freeing rings of exited threads.
+ *
+ * @return number of messages output
+ */
+static int mlog_adrain(void)
+{
+    struct mlog_aring **arp, *ar;
+    int dead, cnt;
+    cnt = 0;
+    pthread_mutex_lock(&mst.aringmux);
+    arp = &mst.arings;
+    while ((ar = *arp) != NULL) {
+        dead = ar->dead;    /* check before draining, so we get it all */
+        cnt += mlog_adrain_ring(ar);
+        if (dead) {
+            *arp = ar->next;
+            mst.adropped += ar->dropped;
+            free(ar);
+        } else {
+            arp = &ar->next;
+        }
+    }
+    mst.alogged += cnt;
+    pthread_mutex_unlock(&mst.aringmux);
+    return(cnt);
+}
+
+/**
+ * mlog_adrainer: main loop of the drainer thread.
+ *
+ * @param arg unused
+ * @return NULL
+ */
+static void *mlog_adrainer(void *arg)
+{
+    int stopping;
+    (void) arg;
+    for (;;) {
+        stopping = mst.astop;   /* do one final pass after a stop */
+        __sync_synchronize();
+        if (mlog_adrain() == 0) {
+            if (stopping) {
+                break;
+            }
+            usleep(MLOG_ADRAINUSEC);
+        }
+    }
+    return(NULL);
+}
+
+/**
+ * mlog_astart: start the drainer thread.  on failure we stay in sync
+ * mode (mlog_aenqueue checks arunning).
+ */
+static void mlog_astart(void)
+{
+    mst.astop = 0;
+    mst.apid = getpid();
+    if (pthread_create(&mst.adrainer, NULL, mlog_adrainer, NULL) == 0) {
+        mst.arunning = 1;
+    } else {
+        fprintf(stderr, "mlog: cannot start drainer, logging sync\n");
+    }
+}
+
+/**
+ * mlog_astop: stop the drainer thread after it drains all the rings.
+ * no-op if it isn't running.
+ */
+static void mlog_astop(void)
+{
+    if (!mst.arunning) {
+        return;
+    }
+    mst.arunning = 0;       /* new messages go sync */
+    __sync_synchronize();
+    mst.astop = 1;
+    if (mst.apid == getpid()) {
+        pthread_join(mst.adrainer, NULL);
+    }
+}
+
+/**
+ * mlog_aflush: wait (briefly) for the drainer to empty the rings, so
+ * that earlier messages come out before a message we log sync.
+ */
+static void mlog_aflush(void)
+{
+    int tries;
+    unsigned long last;
+    struct mlog_aring *ar;
+    if (!mst.arunning || mst.apid != getpid()) {
+        return;
+    }
+    for (tries = 0 ; tries < 100 ; tries++) {
+        pthread_mutex_lock(&mst.aringmux);
+        last = 0;
+        for (ar = mst.arings ; ar != NULL ; ar = ar->next) {
+            last += ar->head - ar->tail;
+        }
+        pthread_mutex_unlock(&mst.aringmux);
+        if (last == 0) {
+            break;
+        }
+        usleep(MLOG_ADRAINUSEC);
+    }
+}
+#endif /* MLOG_MUTEX */
+
 /*
  * API functions
  */
@@ -819,6 +1186,17 @@ int mlog_open(char *tag, int maxfac_hint, int default_mask, int stderr_mask,
         free(newtag);
         return(-1);
     }
+    if (pthread_mutex_init(&mst.aringmux, NULL) != 0) {
+        pthread_mutex_destroy(&mst.mlogmux);
+        free(newtag);
+        return(-1);
+    }
+    if (pthread_key_create(&mst.aringkey, mlog_aring_free) != 0) {
+        pthread_mutex_destroy(&mst.aringmux);
+        pthread_mutex_destroy(&mst.mlogmux);
+        free(newtag);
+        return(-1);
+    }
 #endif
     /* it is now safe to use mlog_cleanout() for error handling */
     
@@ -910,6 +1288,11 @@ int mlog_open(char *tag, int maxfac_hint, int default_mask, int stderr_mask,
     }
     mlog_xst.tag = newtag;
     mlog_unlock();
+#ifdef MLOG_MUTEX
+    if (mst.oflags & MLOG_ASYNC) {
+        mlog_astart();
+    }
+#endif
     return(0);
 error:
     /*
@@ -992,6 +1375,23 @@ int mlog_reopen(char *logfile)
     }
 done:
     mlog_unlock();
+#ifdef MLOG_MUTEX
+    /*
+     * after a fork the drainer is left behind in the parent.  the
+     * queued messages are the parent's to log, so drop our copy of
+     * them and start a new drainer.  we don't take aringmux, the
+     * parent's drainer may have held it when we forked.
+     */
+    if ((mst.oflags & MLOG_ASYNC) != 0 && mst.apid != getpid()) {
+        struct mlog_aring *ar;
+        pthread_mutex_init(&mst.aringmux, NULL);
+        for (ar = mst.arings ; ar != NULL ; ar = ar->next) {
+            ar->tail = ar->head;
+            ar->dropseen = ar->dropped;
+        }
+        mlog_astart();
+    }
+#endif
     return(rv);
 }
 
@@ -1005,6 +1405,9 @@ void mlog_close()
     if (!mlog_xst.tag) {
         return;    /* return if already closed */
     }
+#ifdef MLOG_MUTEX
+    mlog_astop();              /* drainer needs the tag */
+#endif
     free(mlog_xst.tag);
     mlog_xst.tag = NULL;       /* marks us as down */
     mlog_cleanout();
@@ -1403,7 +1806,7 @@ void plfs_debug(const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    vmlog(MLOG_DBG, fmt, ap);
+    vmlog(MLOG_DBG, 0, fmt, ap);
     va_end(ap);
 }
 /* XXXCDC: END TMP */
@@ -1417,7 +1820,7 @@ void mlog(int flags, const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    vmlog(flags, fmt, ap);
+    vmlog(flags, 0, fmt, ap);
     va_end(ap);
 }
 
@@ -1428,8 +1831,11 @@ void mlog(int flags, const char *fmt, ...)
 void mlog_abort(int flags, const char *fmt, ...)
 {
     va_list ap;
+#ifdef MLOG_MUTEX
+    mlog_aflush();      /* get queued messages out first */
+#endif
     va_start(ap, fmt);
-    vmlog(flags|MLOG_STDERR, fmt, ap);
+    vmlog(flags|MLOG_STDERR, 1, fmt, ap);
     va_end(ap);
     if (mlog_xst.tag && mst.abort_hook) { /* call hook? */
         mst.abort_hook();
@@ -1445,13 +1851,40 @@ void mlog_abort(int flags, const char *fmt, ...)
 void mlog_exit(int status, int flags, const char *fmt, ...)
 {
     va_list ap;
+#ifdef MLOG_MUTEX
+    mlog_aflush();      /* get queued messages out first */
+#endif
     va_start(ap, fmt);
-    vmlog(flags|MLOG_STDERR, fmt, ap);
+    vmlog(flags|MLOG_STDERR, 1, fmt, ap);
     va_end(ap);
     exit(status);
     /*NOTREACHED*/
 }
 
+/*
+ * mlog_async_stats: get the async mode message counts.
+ * return 0 on success, -1 on error (not open, or not in async mode)
+ */
+int mlog_async_stats(unsigned long *logged, unsigned long *dropped)
+{
+#ifdef MLOG_MUTEX
+    struct mlog_aring *ar;
+    if (!mlog_xst.tag || (mst.oflags & MLOG_ASYNC) == 0) {
+        return(-1);
+    }
+    pthread_mutex_lock(&mst.aringmux);
+    *logged = mst.alogged;
+    *dropped = mst.adropped;
+    for (ar = mst.arings ; ar != NULL ; ar = ar->next) {
+        *dropped += ar->dropped;
+    }
+    pthread_mutex_unlock(&mst.aringmux);
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
 /*
  * mlog_findmesgbuf: search for a message buffer inside another buffer
  * (typically a mmaped core file).  does not access mlog global state.
@@ -45,7 +45,8 @@
 #define MLOG_LOGPID     0x08000000      /* include pid in log tag */
 #define MLOG_FQDN       0x04000000      /* log fully quallified domain name */
 #define MLOG_STDOUT     0x02000000      /* always log to stdout */
-/* spare bits: 0x01000000-0x00800000 */
+#define MLOG_ASYNC      0x01000000      /* output from a drainer thread */
+/* spare bits: 0x00800000 */
 #define MLOG_PRIMASK    0x007f0000      /* priority mask */
 #define MLOG_EMERG      0x00700000      /* emergency */
 #define MLOG_ALERT      0x00600000      /* alert */
@@ -199,6 +200,18 @@ extern "C" {   /* __BEGIN_DECLS */
      */
     int mlog_allocfacility(char *aname, char *lname);
 
+    /**
+     * mlog_async_stats: get message counts for async mode (MLOG_ASYNC).
+     * in async mode each thread queues its messages on its own ring and
+     * a drainer thread writes them out.  messages are dropped if a ring
+     * fills up.
+     *
+     * @param logged returns number of messages written by the drainer
+     * @param dropped returns number of messages dropped
+     * @return 0 on success, -1 on error (not open, or not async)
+     */
+    int mlog_async_stats(unsigned long *logged, unsigned long *dropped);
+
     /**
      * mlog_close: close off an mlog and release any allocated resources.
      * if already close, this function is a noop.
@@ -291,7 +304,7 @@ extern "C" {   /* __BEGIN_DECLS */
      *        (either in mlog_open or in mlog).
      * @param logfile log file name, or null if no log file
      * @param msgbuf_len size of message buffer, or zero if no message buffer
-     * @param flags STDERR, UCON_ON, UCON_ENV, SYSLOG, LOGPID
+     * @param flags STDERR, UCON_ON, UCON_ENV, SYSLOG, LOGPID, ASYNC
      * @param syslogfac facility to use if MLOG_SYSLOG is set in flags
      * @return 0 on success, -1 on error.
      */
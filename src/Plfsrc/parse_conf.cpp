@@ -19,6 +19,20 @@ set_default_mount(PlfsMount *pmnt)
     pmnt->max_writers = 4;
     pmnt->glib_buffer_mbs = 16;
     pmnt->max_smallfile_containers = 32;
+    pmnt->smallfile_cache_mbs = 0;
+    pmnt->smallfile_compact_interval = 0;
+    pmnt->smallfile_compact_garbage = 50;
+    pmnt->smallfile_compact_mbs = 0;
+    pmnt->smallfile_prefetch = 0;
+    pmnt->smallfile_commit_kbs = 0;
+    pmnt->smallfile_readdirplus = 0;
+    pmnt->shared_index = 0;
+    pmnt->shared_append = 0;
+    pmnt->coordinated_create = 0;
+    pmnt->open_lease = 0;
+    pmnt->compress_droppings = 0;
+    pmnt->data_checksums = 0;
+    pmnt->zero_blocks = 0;
     pmnt->checksum = (unsigned)-1;
     pmnt->backspec = pmnt->canspec = pmnt->shadowspec = NULL;
     pmnt->attached = pmnt->nback = pmnt->ncanback = pmnt->nshadowback = 0;
@@ -121,7 +135,13 @@ string Valid_Keys[] = {
     "syncer_ip", "global_summary_dir", "statfs", "test_metalink", 
     "mlog_defmask", "mlog_setmasks", "mlog_stderrmask", "mlog_stderr", 
     "mlog_file", "mlog_msgbuf_size", "mlog_syslog", "mlog_syslogfac", 
-    "mlog_ucon", "include", "type", "compress_contiguous"
+    "mlog_ucon", "mlog_async", "include", "type", "compress_contiguous",
+    "max_writers", "max_smallfile_containers", "smallfile_cache_mbs",
+    "smallfile_compact_interval", "smallfile_compact_garbage",
+    "smallfile_compact_mbs", "smallfile_prefetch", "smallfile_commit_kbs",
+    "smallfile_readdirplus",
+    "shared_index", "shared_append", "coordinated_create", "open_lease",
+    "compress_droppings", "data_checksums", "zero_blocks"
 };
 
 /*
@@ -270,6 +290,17 @@ namespace YAML {
                            pconf.mlog_flags &= ~(MLOG_UCON_ON|MLOG_UCON_ENV);
                    }
                }
+               if(node["mlog_async"]) {
+                   bool temp;
+                   if(!conv(node["mlog_async"],temp))
+                       pconf.err_msg = new string ("Illegal mlog_async");
+                   else {
+                       if (temp)
+                           pconf.mlog_flags |= MLOG_ASYNC;
+                       else
+                           pconf.mlog_flags &= ~MLOG_ASYNC;
+                   }
+               }
                if(node["mlog_syslog"]) {
                    bool temp;
                    if(!conv(node["mlog_syslog"],temp))
@@ -399,6 +430,104 @@ namespace YAML {
                            new string("Illegal max_smallfile_containers");
                    }
                }
+               if(node["smallfile_cache_mbs"]) {
+                   if(!conv(node["smallfile_cache_mbs"],
+                            pmntp.smallfile_cache_mbs) ||
+                      pmntp.smallfile_cache_mbs < 0) {
+                       pmntp.err_msg = 
+                           new string("Illegal smallfile_cache_mbs");
+                   }
+               }
+               if(node["smallfile_compact_interval"]) {
+                   if(!conv(node["smallfile_compact_interval"],
+                            pmntp.smallfile_compact_interval) ||
+                      pmntp.smallfile_compact_interval < 0) {
+                       pmntp.err_msg = 
+                           new string("Illegal smallfile_compact_interval");
+                   }
+               }
+               if(node["smallfile_compact_garbage"]) {
+                   if(!conv(node["smallfile_compact_garbage"],
+                            pmntp.smallfile_compact_garbage) ||
+                      pmntp.smallfile_compact_garbage < 0 ||
+                      pmntp.smallfile_compact_garbage > 100) {
+                       pmntp.err_msg = 
+                           new string("Illegal smallfile_compact_garbage");
+                   }
+               }
+               if(node["smallfile_compact_mbs"]) {
+                   if(!conv(node["smallfile_compact_mbs"],
+                            pmntp.smallfile_compact_mbs) ||
+                      pmntp.smallfile_compact_mbs < 0) {
+                       pmntp.err_msg = 
+                           new string("Illegal smallfile_compact_mbs");
+                   }
+               }
+               if(node["smallfile_prefetch"]) {
+                   if(!conv(node["smallfile_prefetch"],
+                            pmntp.smallfile_prefetch) ||
+                      pmntp.smallfile_prefetch < 0) {
+                       pmntp.err_msg = 
+                           new string("Illegal smallfile_prefetch");
+                   }
+               }
+               if(node["smallfile_commit_kbs"]) {
+                   if(!conv(node["smallfile_commit_kbs"],
+                            pmntp.smallfile_commit_kbs) ||
+                      pmntp.smallfile_commit_kbs < 0) {
+                       pmntp.err_msg = 
+                           new string("Illegal smallfile_commit_kbs");
+                   }
+               }
+               if(node["smallfile_readdirplus"]) {
+                   if(!conv(node["smallfile_readdirplus"],
+                            pmntp.smallfile_readdirplus)) {
+                       pmntp.err_msg =
+                           new string("Illegal smallfile_readdirplus");
+                   }
+               }
+               if(node["shared_index"]) {
+                   if(!conv(node["shared_index"], pmntp.shared_index)) {
+                       pmntp.err_msg = new string("Illegal shared_index");
+                   }
+               }
+               if(node["shared_append"]) {
+                   if(!conv(node["shared_append"], pmntp.shared_append)) {
+                       pmntp.err_msg = new string("Illegal shared_append");
+                   }
+               }
+               if(node["coordinated_create"]) {
+                   if(!conv(node["coordinated_create"],
+                            pmntp.coordinated_create)) {
+                       pmntp.err_msg =
+                           new string("Illegal coordinated_create");
+                   }
+               }
+               if(node["open_lease"]) {
+                   if(!conv(node["open_lease"], pmntp.open_lease) ||
+                      pmntp.open_lease < 0) {
+                       pmntp.err_msg = new string("Illegal open_lease");
+                   }
+               }
+               if(node["compress_droppings"]) {
+                   if(!conv(node["compress_droppings"],
+                            pmntp.compress_droppings)) {
+                       pmntp.err_msg =
+                           new string("Illegal compress_droppings");
+                   }
+               }
+               if(node["data_checksums"]) {
+                   if(!conv(node["data_checksums"], pmntp.data_checksums) ||
+                      pmntp.data_checksums < 0) {
+                       pmntp.err_msg = new string("Illegal data_checksums");
+                   }
+               }
+               if(node["zero_blocks"]) {
+                   if(!conv(node["zero_blocks"], pmntp.zero_blocks) ||
+                      pmntp.zero_blocks < 0) {
+                       pmntp.err_msg = new string("Illegal zero_blocks");
+                   }
+               }
                if(node["workload"]) {
                    string temp, temp2;
                    size_t cloc;
@@ -437,7 +566,12 @@ namespace YAML {
                            pmntp.file_type = SMALL_FILE;
                            pmntp.fileindex_type = 0;   /* default */
                            pmntp.fs_ptr =
-                               new SmallFileFS(pmntp.max_smallfile_containers);
+                               new SmallFileFS(pmntp.max_smallfile_containers,
+                                   (unsigned long)pmntp.smallfile_cache_mbs
+                                   << 20,
+                                   pmntp.smallfile_compact_interval,
+                                   pmntp.smallfile_compact_garbage,
+                                   pmntp.smallfile_compact_mbs);
                            if (temp2 != "") {
                                pmntp.err_msg = new
                                    string("1-n index type not supported");
@@ -799,7 +933,7 @@ setup_mlog(PlfsConf *pconf)
                                    "PLFS_MLOG_STDERRMASK", "PLFS_MLOG_FILE",
                                    "PLFS_MLOG_MSGBUF_SIZE",
                                    "PLFS_MLOG_SYSLOGFAC",
-                                   "PLFS_MLOG_SETMASKS", 0
+                                   "PLFS_MLOG_SETMASKS", "PLFS_MLOG_ASYNC", 0
                                  };
     int lcv, mac;
     char *ev, *p, **mav, *start;
@@ -44,6 +44,20 @@ typedef struct  PlfsMount {
     int max_writers;
     int glib_buffer_mbs;
     int max_smallfile_containers; /* max cached smallfile containers */
+    int smallfile_cache_mbs; /* memory limit of the cached containers */
+    int smallfile_compact_interval; /* secs between compactions, 0 = off */
+    int smallfile_compact_garbage; /* percent of dead data to compact */
+    int smallfile_compact_mbs; /* compaction bandwidth limit, 0 = none */
+    int smallfile_prefetch; /* indexes to prefetch in readdir order */
+    int smallfile_commit_kbs; /* metadata records to queue, 0 = none */
+    int smallfile_readdirplus; /* readdir computes the file attributes */
+    int shared_index; /* share RDONLY container indexes on a node */
+    int shared_append; /* O_APPEND writers on a node share the eof */
+    int coordinated_create; /* one creator per container, others wait */
+    int open_lease; /* secs, host open records expire instead of unlink */
+    int compress_droppings; /* write data droppings as compressed frames */
+    int data_checksums; /* checksum droppings, verify 1 in N reads (0=off) */
+    int zero_blocks; /* bytes, index aligned zero blocks as holes (0=off) */
     unsigned checksum;
 
     /* backend filesystem info */
@@ -46,10 +46,6 @@ using namespace std;
 // TODO.  Some functions in here return -err.  Probably none of them
 // should
 
-// shoot.  I just realized.  All this close timing stuff is not thread safe.
-// maybe we should add a mutex in addBytes and addTime.
-// might slow things down but this is supposed to just be for debugging...
-
 #ifndef UTIL_COLLECT_TIMES
 off_t total_ops = 0;
 #define ENTER_UTIL int ret = 0; total_ops++;
@@ -84,6 +80,7 @@ off_t total_ops = 0;
                          ENTER_SHARED;
 
 #define ENTER_SHARED double begin,end;  \
+                        static const int timer_id = timerId(__FUNCTION__); \
                         DEBUG_ENTER;        \
                         begin = getTime();
 
@@ -96,7 +93,7 @@ off_t total_ops = 0;
                         ENTER_SHARED;
 
 #define EXIT_SHARED DEBUG_EXIT;                                 \
-                        addTime( __FUNCTION__, end - begin, (ret!=0) );       \
+                        addTime( timer_id, end - begin, (ret!=0) );       \
                         if ( end - begin > SLOW_UTIL ) {            \
                             LogMessage lm3;                         \
                             lm3 << "WTF: " << __FUNCTION__          \
@@ -107,7 +104,7 @@ off_t total_ops = 0;
                         return ret;
 
 #define EXIT_IO     end   = getTime();              \
-                        addBytes( __FUNCTION__, size ); \
+                        addBytes( timer_id, size ); \
                         EXIT_SHARED;
 
 // hmm, want to pass an arg to this macro but it didn't work...
@@ -398,11 +395,119 @@ Util::SeriousError( string msg, pid_t pid )
 }
  */
 
-// initialize static variables
-HASH_MAP<string, double> utimers;
-HASH_MAP<string, off_t>  kbytes;
-HASH_MAP<string, off_t>  counters;
-HASH_MAP<string, off_t>  errors;
+/*
+ * util timers.  each timed call site registers its name once (the
+ * ENTER_SHARED macro keeps the id in a function static) and from then
+ * on updates only slots owned by the calling thread: no lock, no map
+ * lookup, no string building.  each thread gets its own block of
+ * cache-line padded slots the first time it records something.  the
+ * blocks are only summed up when someone asks for the stats, so the
+ * totals may be a little stale while other threads are still running.
+ * when a thread exits its block goes back on the list with its counts
+ * intact and the next new thread just keeps adding to it.
+ */
+#define UTIL_MAXTIMERS  128
+#define UTIL_CACHELINE  64
+
+struct util_timer_slot {
+    double time;
+    off_t  count;
+    off_t  errs;
+    off_t  kbytes;
+    char   pad[UTIL_CACHELINE - sizeof(double) - 3 * sizeof(off_t)];
+};
+
+struct util_timer_block {
+    struct util_timer_slot slots[UTIL_MAXTIMERS];
+    struct util_timer_block *next;
+    int in_use;
+};
+
+static pthread_mutex_t timer_mux = PTHREAD_MUTEX_INITIALIZER;
+static const char *timer_names[UTIL_MAXTIMERS];
+static int timer_count = 0;
+static struct util_timer_block *timer_blocks = NULL;
+static pthread_key_t timer_key;
+static pthread_once_t timer_key_once = PTHREAD_ONCE_INIT;
+
+static void
+timer_block_release(void *vblock)
+{
+    struct util_timer_block *block = (struct util_timer_block *)vblock;
+    pthread_mutex_lock(&timer_mux);
+    block->in_use = 0;
+    pthread_mutex_unlock(&timer_mux);
+}
+
+static void
+timer_key_init()
+{
+    pthread_key_create(&timer_key, timer_block_release);
+}
+
+/*
+ * returns the calling thread's block, reusing the block of an exited
+ * thread if there is one.  NULL if we are out of memory, in which case
+ * the sample is dropped.
+ */
+static struct util_timer_block *
+timer_block_get()
+{
+    struct util_timer_block *block;
+    void *mem;
+    pthread_once(&timer_key_once, timer_key_init);
+    block = (struct util_timer_block *)pthread_getspecific(timer_key);
+    if (block) {
+        return block;
+    }
+    pthread_mutex_lock(&timer_mux);
+    for (block = timer_blocks; block != NULL; block = block->next) {
+        if (!block->in_use) {
+            break;
+        }
+    }
+    if (block == NULL &&
+        posix_memalign(&mem, UTIL_CACHELINE, sizeof(*block)) == 0) {
+        block = (struct util_timer_block *)mem;
+        memset(block, 0, sizeof(*block));
+        block->next = timer_blocks;
+        timer_blocks = block;
+    }
+    if (block) {
+        block->in_use = 1;
+    }
+    pthread_mutex_unlock(&timer_mux);
+    if (block) {
+        pthread_setspecific(timer_key, block);
+    }
+    return block;
+}
+
+/*
+ * map a call site name to its timer id.  meant to be called once per
+ * call site, not per call.  the name is kept, not copied, so pass
+ * something static like __FUNCTION__.  returns -1 if the table is
+ * full, the add functions ignore negative ids.
+ */
+int Util::timerId( const char *function )
+{
+    int id;
+    pthread_mutex_lock(&timer_mux);
+    for (id = 0; id < timer_count; id++) {
+        if (strcmp(timer_names[id], function) == 0) {
+            break;
+        }
+    }
+    if (id == timer_count) {
+        if (timer_count < UTIL_MAXTIMERS) {
+            timer_names[timer_count++] = function;
+        } else {
+            id = -1;
+        }
+    }
+    pthread_mutex_unlock(&timer_mux);
+    return id;
+}
 
 string Util::toString( )
 {
@@ -411,17 +516,30 @@ string Util::toString( )
     off_t  tops  = 0;
     off_t  total_errs = 0;
     double total_time = 0.0;
-    HASH_MAP<string,double>::iterator itr;
-    HASH_MAP<string,off_t> ::iterator kitr;
-    HASH_MAP<string,off_t> ::iterator count;
-    HASH_MAP<string,off_t> ::iterator err;
-    for( itr = utimers.begin(); itr != utimers.end(); itr++ ) {
-        count  = counters.find( itr->first );
-        err = errors.find( itr->first );
-        output += timeToString( itr, err, count, &total_errs,
-                                &tops, &total_time );
-        if ( ( kitr = kbytes.find(itr->first) ) != kbytes.end() ) {
-            output += bandwidthToString( itr, kitr );
+    struct util_timer_slot totals[UTIL_MAXTIMERS];
+    struct util_timer_block *block;
+    int ntimers, id;
+    memset(totals, 0, sizeof(totals));
+    pthread_mutex_lock(&timer_mux);
+    ntimers = timer_count;
+    for (block = timer_blocks; block != NULL; block = block->next) {
+        for (id = 0; id < ntimers; id++) {
+            totals[id].time   += block->slots[id].time;
+            totals[id].count  += block->slots[id].count;
+            totals[id].errs   += block->slots[id].errs;
+            totals[id].kbytes += block->slots[id].kbytes;
+        }
+    }
+    pthread_mutex_unlock(&timer_mux);
+    for (id = 0; id < ntimers; id++) {
+        if (totals[id].count == 0) {
+            continue;
+        }
+        output += timeToString( timer_names[id], totals[id].time,
+                                totals[id].count, totals[id].errs,
+                                &total_errs, &tops, &total_time );
+        if ( totals[id].kbytes ) {
+            output += bandwidthToString( totals[id].time, totals[id].kbytes );
         }
         output += "\n";
     }
@@ -432,11 +550,8 @@ string Util::toString( )
     return output;
 }
 
-string Util::bandwidthToString( HASH_MAP<string,double>::iterator itr,
-                                HASH_MAP<string,off_t> ::iterator kitr )
+string Util::bandwidthToString( double time, off_t kbs )
 {
-    off_t kbs   = kitr->second;
-    double time = itr->second;
     double bw   = (kbs/time) / 1024;
     ostringstream oss;
     oss << ", " << setw(6) << kbs << "KBs "
@@ -444,22 +559,18 @@ string Util::bandwidthToString( HASH_MAP<string,double>::iterator itr,
     return oss.str();
 }
 
-string Util::timeToString( HASH_MAP<string,double>::iterator itr,
-                           HASH_MAP<string,off_t>::iterator eitr,
-                           HASH_MAP<string,off_t>::iterator citr,
+string Util::timeToString( const char *function, double value, off_t count,
+                           off_t errs,
                            off_t *total_errs,
                            off_t *tops,
                            double *total_time )
 {
-    double value    = itr->second;
-    off_t  count    = citr->second;
-    off_t  errs     = eitr->second;
     double avg      = (double) count / value;
     ostringstream oss;
     *total_errs += errs;
     *tops  += count;
     *total_time += value;
-    oss << setw(12) << itr->first << ": " << setw(8) << count << " ops, "
+    oss << setw(12) << function << ": " << setw(8) << count << " ops, "
         << setw(8) << errs << " errs, "
         << std::setprecision(2)
         << std::fixed
@@ -472,48 +583,26 @@ string Util::timeToString( HASH_MAP<string,double>::iterator itr,
     return oss.str();
 }
 
-void Util::addBytes( string function, size_t size )
+void Util::addBytes( int id, size_t size )
 {
-    HASH_MAP<string,off_t>::iterator itr;
-    itr = kbytes.find( function );
-    if ( itr == kbytes.end( ) ) {
-        kbytes[function] = (size / 1024);
-    } else {
-        kbytes[function] += (size / 1024);
+    struct util_timer_block *block;
+    if ( id < 0 || (block = timer_block_get()) == NULL ) {
+        return;
     }
+    block->slots[id].kbytes += (size / 1024);
 }
 
-pthread_mutex_t time_mux;
-void Util::addTime( string function, double elapsed, bool error )
+void Util::addTime( int id, double elapsed, bool error )
 {
-    HASH_MAP<string,double>::iterator itr;
-    HASH_MAP<string,off_t>::iterator two;
-    HASH_MAP<string,off_t>::iterator three;
-    // plfs is hanging in here for some reason
-    // is it a concurrency problem?
-    // idk.  be safe and put it in a mux.  testing
-    // or rrp3 is where I saw the problem and
-    // adding this lock didn't slow it down
-    // also, if you're worried, just turn off
-    // both util timing (-DUTIL) and -DNPLFS_TIMES
-    pthread_mutex_lock( &time_mux );
-    itr   = utimers.find( function );
-    two   = counters.find( function );
-    three = errors.find( function );
-    if ( itr == utimers.end( ) ) {
-        utimers[function] = elapsed;
-        counters[function] = 1;
-        if ( error ) {
-            errors[function] = 1;
-        }
-    } else {
-        utimers[function] += elapsed;
-        counters[function] ++;
-        if ( error ) {
-            errors[function] ++;
-        }
+    struct util_timer_block *block;
+    if ( id < 0 || (block = timer_block_get()) == NULL ) {
+        return;
+    }
+    block->slots[id].time += elapsed;
+    block->slots[id].count++;
+    if ( error ) {
+        block->slots[id].errs++;
     }
-    pthread_mutex_unlock( &time_mux );
 }
 
 int Util::MutexLock(  pthread_mutex_t *mux , const char *where )
@@ -723,6 +812,9 @@ double Util::getTime( )
 plfs_error_t Util::Writen(const void *vptr, size_t n, IOSHandle *hand,
                           ssize_t *bytes_writen)
 {
+#ifdef UTIL_COLLECT_TIMES
+    const char *path = "";  // only for the ENTER_PATH message
+#endif
     ENTER_PATH;
     size_t      nleft;
     ssize_t     nwritten;
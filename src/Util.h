@@ -95,17 +95,15 @@ class Util
         static plfs_error_t Writen(const void *, size_t, IOSHandle *, ssize_t *);
         static string toString();
         static string openFlagsToString( int );
-        static void addTime( string, double, bool );
+        static int timerId( const char * );
+        static void addTime( int, double, bool );
         static plfs_error_t hostname(char **ret_name);
 
     private:
-        static void addBytes( string, size_t );
-        static string timeToString(      HASH_MAP<string,double>::iterator,
-                                         HASH_MAP<string,off_t>::iterator,
-                                         HASH_MAP<string,off_t>::iterator,
-                                         off_t *, off_t *, double * );
-        static string bandwidthToString( HASH_MAP<string,double>::iterator,
-                                         HASH_MAP<string,off_t>::iterator );
+        static void addBytes( int, size_t );
+        static string timeToString( const char *, double, off_t, off_t,
+                                    off_t *, off_t *, double * );
+        static string bandwidthToString( double, off_t );
 };
 
 #endif
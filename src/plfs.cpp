@@ -3,6 +3,7 @@
 #include "LogicalFS.h"
 #include "LogicalFD.h"
 #include "XAttrs.h"
+#include "Metrics.h"
 #include <assert.h>
 #include "mlog_oss.h"
 
@@ -20,6 +21,20 @@ debug_exit(const char *func, string msg, plfs_error_t ret)
         func, msg.c_str(),ret,ret==PLFS_SUCCESS?"SUCCESS":strplfserr(ret));
 }
 
+/*
+ * account one API operation in the metrics registry
+ */
+static void
+metric_op(enum plfs_metric_counter op, enum plfs_metric_histogram lat,
+          double begin, plfs_error_t ret)
+{
+    Metrics::add(op, 1);
+    Metrics::time(lat, Util::getTime() - begin);
+    if (ret != PLFS_SUCCESS) {
+        Metrics::add(PM_OP_ERRORS, 1);
+    }
+}
+
 plfs_error_t
 plfs_get_logical_fs(const char *path, LogicalFileSystem **logicalFS)
 {
@@ -210,12 +225,47 @@ plfs_close(Plfs_fd *fd, pid_t pid, uid_t u, int open_flags,
            Plfs_close_opt *close_opt, int *num_ref)
 {
     string debug_out = fd->backing_path();
+    double begin = Util::getTime();
     debug_enter(__FUNCTION__,debug_out);
     plfs_error_t ret = fd->close(pid, u, open_flags, close_opt, num_ref);
     debug_exit(__FUNCTION__,debug_out,ret);
     if (*num_ref <= 0) {
         delete fd;
+        Metrics::add(PM_OPEN_HANDLES, -1);
     }
+    metric_op(PM_CLOSE_OPS, PMH_CLOSE, begin, ret);
+    return ret;
+}
+
+plfs_error_t
+plfs_clone(const char *from, const char *to)
+{
+    plfs_error_t ret = PLFS_SUCCESS;
+    struct plfs_physpathinfo ppi, ppi_to;
+    mss::mlog_oss oss;
+    oss << from << " -> " << to;
+    debug_enter(__FUNCTION__,oss.str());
+
+    const char *stripped_from;
+    stripped_from = skipPrefixPath(from);
+    const char *stripped_to;
+    stripped_to = skipPrefixPath(to);
+
+    ret = plfs_resolvepath(stripped_from, &ppi);
+    if (ret != PLFS_SUCCESS)
+        goto err;
+    ret = plfs_resolvepath(stripped_to, &ppi_to);
+    if (ret != PLFS_SUCCESS)
+        goto err;
+
+    if (ppi.mnt_pt != ppi_to.mnt_pt) {
+        ret = PLFS_EXDEV;  /* droppings can't be shared across mounts */
+    } else {
+        ret = ppi.mnt_pt->fs_ptr->clone(&ppi, &ppi_to);
+    }
+
+ err:
+    debug_exit(__FUNCTION__,oss.str(),ret);
     return ret;
 }
 
@@ -239,6 +289,70 @@ plfs_create(const char *path, mode_t mode, int flags, pid_t pid)
     return ret;
 }
 
+/* fd->extent_map, or all of the file as data if it can't tell */
+static plfs_error_t
+extent_map_fd(Plfs_fd *fd, off_t offset, size_t length,
+              Plfs_extent *extents, int *nextents)
+{
+    plfs_error_t ret;
+    struct stat st;
+    off_t end;
+
+    ret = fd->extent_map(offset, length, extents, nextents);
+    if (ret != PLFS_ENOTSUP) {
+        return ret;
+    }
+    ret = fd->getattr(&st, 1);
+    if (ret != PLFS_SUCCESS) {
+        return ret;
+    }
+    end = min((off_t)(offset + length), st.st_size);
+    if (offset >= end) {
+        *nextents = 0;
+        return PLFS_SUCCESS;
+    }
+    if (*nextents > 0) {
+        extents[0].logical = offset;
+        extents[0].physical = offset;
+        extents[0].length = end - offset;
+        extents[0].dropping = 0;
+        extents[0].flags = 0;
+    }
+    *nextents = 1;
+    return PLFS_SUCCESS;
+}
+
+plfs_error_t
+plfs_extent_map(Plfs_fd *fd, off_t offset, size_t length,
+                Plfs_extent *extents, int *nextents)
+{
+    mss::mlog_oss oss;
+    oss << fd->backing_path() << " -> " << offset << ", " << length;
+    debug_enter(__FUNCTION__,oss.str());
+    plfs_error_t ret = PLFS_SUCCESS;
+    if (offset < 0 || *nextents < 0) {
+        ret = PLFS_EINVAL;
+    } else {
+        ret = extent_map_fd(fd, offset, length, extents, nextents);
+    }
+    debug_exit(__FUNCTION__,oss.str(),ret);
+    return ret;
+}
+
+plfs_error_t
+plfs_get_metrics(char *buf, size_t bufsz, size_t *len)
+{
+    string metrics;
+    plfs_metrics(&metrics);
+    *len = metrics.size() + 1;
+    if (*len > bufsz) {
+        // caller can retry with a buffer of *len bytes
+        return PLFS_ENOMEM;
+    }
+    memcpy(buf, metrics.c_str(), *len);
+    return PLFS_SUCCESS;
+}
+
 plfs_error_t
 plfs_getattr(Plfs_fd *fd, const char *path, struct stat *st, int size_only)
 {
@@ -294,6 +408,67 @@ plfs_link(const char *path, const char *to)
     return ret;
 }
 
+/* extents asked for at a time by plfs_lseek */
+#define LSEEK_EXTENTS 16
+
+plfs_error_t
+plfs_lseek(Plfs_fd *fd, off_t offset, int whence, off_t *result)
+{
+    mss::mlog_oss oss;
+    oss << fd->backing_path() << " -> " << offset << ", " << whence;
+    debug_enter(__FUNCTION__,oss.str());
+    plfs_error_t ret = PLFS_SUCCESS;
+    Plfs_extent exts[LSEEK_EXTENTS];
+    struct stat st;
+    off_t pos;
+    int n, lcv;
+
+    st.st_size = 0;
+    if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+        ret = PLFS_EINVAL;
+    } else if (offset < 0) {
+        ret = PLFS_ENXIO;
+    } else {
+        ret = fd->getattr(&st, 1);
+    }
+    if (ret == PLFS_SUCCESS && offset >= st.st_size) {
+        ret = PLFS_ENXIO;
+    }
+
+    /*
+     * SEEK_DATA is the start of the first extent.  SEEK_HOLE walks
+     * the extents until one doesn't start where the last one ended
+     * (there is always a hole at EOF).
+     */
+    pos = offset;
+    while (ret == PLFS_SUCCESS && pos < st.st_size) {
+        n = LSEEK_EXTENTS;
+        ret = extent_map_fd(fd, pos, st.st_size - pos, exts, &n);
+        if (ret != PLFS_SUCCESS) {
+            break;
+        }
+        if (whence == SEEK_DATA) {
+            if (n == 0) {
+                ret = PLFS_ENXIO;
+            } else {
+                pos = exts[0].logical;
+            }
+            break;
+        }
+        for (lcv = 0 ; lcv < n && exts[lcv].logical == pos ; lcv++) {
+            pos += exts[lcv].length;
+        }
+        if (lcv < n || n < LSEEK_EXTENTS) {
+            break;
+        }
+    }
+    if (ret == PLFS_SUCCESS) {
+        *result = min(pos, st.st_size);
+    }
+    debug_exit(__FUNCTION__,oss.str(),ret);
+    return ret;
+}
+
 plfs_error_t
 plfs_mode(const char *path, mode_t *mode)
 {
@@ -341,6 +516,7 @@ plfs_open(Plfs_fd **pfd, const char *path, int flags, pid_t pid, mode_t m,
     assert( *pfd || path );
     plfs_error_t ret = PLFS_SUCCESS;
     struct plfs_physpathinfo ppi;
+    double begin = Util::getTime();
     debug_enter(__FUNCTION__,(*pfd) ? (*pfd)->backing_path(): path);
     const char *stripped_path;
     /*
@@ -357,9 +533,13 @@ plfs_open(Plfs_fd **pfd, const char *path, int flags, pid_t pid, mode_t m,
             ret = (*pfd)->open(&ppi, flags, pid, m, open_opt);
         } else {
             ret = ppi.mnt_pt->fs_ptr->open(pfd, &ppi, flags, pid, m, open_opt);
+            if (ret == PLFS_SUCCESS) {
+                Metrics::add(PM_OPEN_HANDLES, 1);
+            }
         }
     }
     debug_exit(__FUNCTION__,(*pfd) ? (*pfd)->backing_path(): path,ret);
+    metric_op(PM_OPEN_OPS, PMH_OPEN, begin, ret);
     return ret;
 }
 
@@ -387,9 +567,110 @@ plfs_read(Plfs_fd *fd, char *buf, size_t size, off_t offset, ssize_t *bytes_read
     mss::mlog_oss oss;
     oss << fd->backing_path() << " -> " <<offset << ", " << size;
     debug_enter(__FUNCTION__,oss.str());
+    double begin = Util::getTime();
     memset(buf, (int)'z', size);
     plfs_error_t ret = fd->read(buf, size, offset, bytes_read);
     debug_exit(__FUNCTION__,oss.str(),ret);
+    if (ret == PLFS_SUCCESS) {
+        Metrics::add(PM_READ_BYTES, *bytes_read);
+    }
+    metric_op(PM_READ_OPS, PMH_READ, begin, ret);
+    return ret;
+}
+
+/* read one file for plfs_read_many on a mount without read_many */
+static plfs_error_t
+read_one(const char *path, char *buf, size_t size, ssize_t *bytes_read)
+{
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    int num_ref;
+
+    ret = plfs_open(&fd, path, O_RDONLY, getpid(), 0, NULL);
+    if (ret != PLFS_SUCCESS) {
+        return ret;
+    }
+    ret = plfs_read(fd, buf, size, 0, bytes_read);
+    plfs_close(fd, getpid(), getuid(), O_RDONLY, NULL, &num_ref);
+    return ret;
+}
+
+plfs_error_t
+plfs_read_many(int nfiles, const char **paths, char **bufs,
+               const size_t *sizes, ssize_t *bytes_read)
+{
+    debug_enter(__FUNCTION__, nfiles > 0 ? paths[0] : "");
+    double begin = Util::getTime();
+    vector<struct plfs_physpathinfo> ppis(nfiles);
+    map<LogicalFileSystem *, vector<int> > mounts;
+    map<LogicalFileSystem *, vector<int> >::iterator itr;
+    plfs_error_t ret, result = PLFS_SUCCESS;
+
+    for (int i = 0; i < nfiles; i++) {
+        bytes_read[i] = -1;
+        ret = plfs_resolvepath(skipPrefixPath(paths[i]), &ppis[i]);
+        if (ret != PLFS_SUCCESS) {
+            if (result == PLFS_SUCCESS) result = ret;
+            continue;
+        }
+        mounts[ppis[i].mnt_pt->fs_ptr].push_back(i);
+    }
+    for (itr = mounts.begin(); itr != mounts.end(); itr++) {
+        const vector<int> &files = itr->second;
+        vector<struct plfs_physpathinfo *> fsppis(files.size());
+        vector<char *> fsbufs(files.size());
+        vector<size_t> fssizes(files.size());
+        vector<ssize_t> fsbytes(files.size());
+
+        for (size_t i = 0; i < files.size(); i++) {
+            fsppis[i] = &ppis[files[i]];
+            fsbufs[i] = bufs[files[i]];
+            fssizes[i] = sizes[files[i]];
+        }
+        ret = itr->first->read_many(files.size(), &fsppis[0], &fsbufs[0],
+                                    &fssizes[0], &fsbytes[0]);
+        if (ret == PLFS_ENOTSUP) {
+            /* plfs_read() counts these bytes */
+            for (size_t i = 0; i < files.size(); i++) {
+                ret = read_one(paths[files[i]], fsbufs[i], fssizes[i],
+                               &fsbytes[i]);
+                if (ret != PLFS_SUCCESS) {
+                    fsbytes[i] = -1;
+                    if (result == PLFS_SUCCESS) result = ret;
+                }
+            }
+        } else {
+            if (ret != PLFS_SUCCESS && result == PLFS_SUCCESS) result = ret;
+            for (size_t i = 0; i < files.size(); i++) {
+                if (fsbytes[i] > 0) Metrics::add(PM_READ_BYTES, fsbytes[i]);
+            }
+        }
+        for (size_t i = 0; i < files.size(); i++) {
+            bytes_read[files[i]] = fsbytes[i];
+        }
+    }
+    debug_exit(__FUNCTION__, nfiles > 0 ? paths[0] : "", result);
+    metric_op(PM_READ_OPS, PMH_READ, begin, result);
+    return result;
+}
+
+plfs_error_t
+plfs_read_fdextent(Plfs_fd *fd, size_t size, off_t offset, int *fdp,
+                   off_t *fdoff, size_t *len)
+{
+    mss::mlog_oss oss;
+    oss << fd->backing_path() << " -> " <<offset << ", " << size;
+    debug_enter(__FUNCTION__,oss.str());
+    double begin = Util::getTime();
+    plfs_error_t ret = fd->read_fdextent(size, offset, fdp, fdoff, len);
+    debug_exit(__FUNCTION__,oss.str(),ret);
+    /* ENOTSUP is not a read, the caller falls back to plfs_read */
+    if (ret == PLFS_SUCCESS) {
+        Metrics::add(PM_READ_BYTES, *len);
+    }
+    if (ret != PLFS_ENOTSUP) {
+        metric_op(PM_READ_OPS, PMH_READ, begin, ret);
+    }
     return ret;
 }
 
@@ -397,6 +678,8 @@ typedef struct {
     set<string> entries;
     set<string>::iterator itr;
     string path;
+    map<string, struct stat> attrs; /* read by the first readdirplus */
+    bool attrs_read;
 } plfs_dir;
 
 plfs_error_t
@@ -418,6 +701,7 @@ plfs_opendir_c(const char *path, Plfs_dirp **pdirp) {
     } else {
         pdir->itr = pdir->entries.begin();
         pdir->path = stripped_path;
+        pdir->attrs_read = false;
     }
     debug_exit(__FUNCTION__,path,ret);
     return ret;
@@ -457,6 +741,27 @@ plfs_readdir_c(Plfs_dirp *pdirp, char *dname, size_t bufsz) {
     return ret;
 }
 
+plfs_error_t
+plfs_readdirplus_c(Plfs_dirp *pdirp, char *dname, size_t bufsz,
+                   struct stat *stbuf)
+{
+    plfs_dir *pdir = (plfs_dir*)pdirp;
+    map<string, struct stat>::iterator attr;
+    plfs_error_t ret;
+
+    memset(stbuf, 0, sizeof *stbuf);
+    if (!pdir->attrs_read && pdir->itr != pdir->entries.end()) {
+        /* entries missing from the attributes are returned without */
+        ret = plfs_readdirplus(pdir->path.c_str(), (void*)&(pdir->attrs));
+        if (ret != PLFS_SUCCESS) return ret;
+        pdir->attrs_read = true;
+    }
+    if (pdir->itr != pdir->entries.end()) {
+        attr = pdir->attrs.find(*(pdir->itr));
+        if (attr != pdir->attrs.end()) *stbuf = attr->second;
+    }
+    return plfs_readdir_c(pdirp, dname, bufsz);
+}
 
 plfs_error_t
 plfs_readdir(const char *path, void *buf)
@@ -478,6 +783,39 @@ plfs_readdir(const char *path, void *buf)
     return ret;
 }
 
+plfs_error_t
+plfs_readdirplus(const char *path, void *buf)
+{
+    plfs_error_t ret = PLFS_SUCCESS;
+    struct plfs_physpathinfo ppi;
+    map<string, struct stat> *attrs = (map<string, struct stat> *)buf;
+    debug_enter(__FUNCTION__,path);
+    const char *stripped_path;
+    stripped_path = skipPrefixPath(path);
+
+    ret = plfs_resolvepath(stripped_path, &ppi);
+    if (ret == PLFS_SUCCESS) {
+        ret = ppi.mnt_pt->fs_ptr->readdirplus(&ppi, attrs);
+        if (ret == PLFS_ENOTSUP) {
+            /* only the names, the caller gets the attributes itself */
+            set<string> names;
+            set<string>::iterator itr;
+            struct stat unknown;
+
+            memset(&unknown, 0, sizeof unknown);
+            ret = ppi.mnt_pt->fs_ptr->readdir(&ppi, &names);
+            for (itr = names.begin(); itr != names.end(); itr++) {
+                (*attrs)[*itr] = unknown;
+            }
+        }
+    }
+    else {
+        ret = PLFS_EINVAL;
+    }
+    debug_exit(__FUNCTION__,path,ret);
+    return ret;
+}
+
 plfs_error_t
 plfs_readlink(const char *path, char *buf, size_t bufsize, int *bytes)
 {
@@ -686,11 +1024,16 @@ plfs_write(Plfs_fd *fd, const char *buf, size_t size,
     mss::mlog_oss oss(PLFS_DAPI);
     oss << fd->backing_path() << " -> " <<offset << ", " << size;
     debug_enter(__FUNCTION__,oss.str());
+    double begin = Util::getTime();
     plfs_error_t wret = PLFS_SUCCESS;
     if (size > 0){
          wret = fd->write(buf, size, offset, pid, bytes_written);
+         if (wret == PLFS_SUCCESS) {
+             Metrics::add(PM_WRITE_BYTES, *bytes_written);
+         }
     }
     debug_exit(__FUNCTION__,oss.str(),wret);
+    metric_op(PM_WRITE_OPS, PMH_WRITE, begin, wret);
     return wret;
 }
 
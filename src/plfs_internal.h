@@ -10,6 +10,7 @@
 #define DROPPINGPREFIX "dropping."
 #define DATAPREFIX     DROPPINGPREFIX"data."
 #define INDEXPREFIX    DROPPINGPREFIX"index."
+#define SUMPREFIX      DROPPINGPREFIX"sum."   // see data_checksums
 #define TMPPREFIX      "tmp."
 #define METADIR        "meta"         // where to stash shortcut metadata
 #define XATTRSDIR      "xattrs"       // where to store xattrs
@@ -18,10 +19,13 @@
 //#define OPENHOSTDIR    "openhosts"    // where to stash whether file open
 // where to stash the chmods and chowns, and identify containers
 #define OPENPREFIX     "open."
+#define LEASETAG       "lease"        // open.host.leaseEXPIRY, see open_lease
 #define ACCESSFILE     ".plfsaccess113918400"
 //#define CREATORFILE    "creator" // no separate creator anymore:use accessfile
 #define GLOBALINDEX    "global.index"
 #define GLOBALCHUNK    "global.chunk"
+#define TRUNCLOG       "truncate.log" // shrinking truncates, see BRI_Truncate
+#define FANOUTFILE     "fanout"       // number of hostdirs, if not num_hostdirs
 #define MAX_HOSTDIRS 1024
 #define METALINK_MAX 2048
 
@@ -2,6 +2,7 @@
 #include "plfs_internal.h"
 #include "plfs_private.h"
 #include "Util.h"
+#include "Metrics.h"
 #include "LogMessage.h"
 
 /**
@@ -708,6 +709,31 @@ plfs_dump_config(int check_dirs, int make_dir)
             cout << "\tMax writers: " << pmnt->max_writers << endl;
             cout << "\tMax cached smallfile containers: " 
                 << pmnt->max_smallfile_containers << endl;
+            cout << "\tSmallfile cache MBs: "
+                << pmnt->smallfile_cache_mbs << endl;
+            cout << "\tSmallfile compact interval: "
+                << pmnt->smallfile_compact_interval << endl;
+            cout << "\tSmallfile compact garbage: "
+                << pmnt->smallfile_compact_garbage << "%" << endl;
+            cout << "\tSmallfile compact MB/s: "
+                << pmnt->smallfile_compact_mbs << endl;
+            cout << "\tSmallfile prefetch: "
+                << pmnt->smallfile_prefetch << endl;
+            cout << "\tSmallfile commit KBs: "
+                << pmnt->smallfile_commit_kbs << endl;
+            cout << "\tSmallfile readdirplus: "
+                << pmnt->smallfile_readdirplus << endl;
+        }
+        if (pmnt->file_type == CONTAINER) {
+            cout << "\tShared index: " << pmnt->shared_index << endl;
+            cout << "\tShared append: " << pmnt->shared_append << endl;
+            cout << "\tCoordinated create: " << pmnt->coordinated_create
+                << endl;
+            cout << "\tOpen lease: " << pmnt->open_lease << endl;
+            cout << "\tCompress droppings: " << pmnt->compress_droppings
+                << endl;
+            cout << "\tData checksums: " << pmnt->data_checksums << endl;
+            cout << "\tZero blocks: " << pmnt->zero_blocks << endl;
         }
         cout << "\tChecksum: " << pmnt->checksum << endl;
     }
@@ -757,10 +783,16 @@ plfs_backends_op(struct plfs_physpathinfo *ppip, FileOp& op)
     return(ret);
 }
 
+int
+plfs_stat_id(const char *func)
+{
+    return Util::timerId(func);
+}
+
 void
-plfs_stat_add(const char *func, double elapsed, int ret)
+plfs_stat_add(int id, double elapsed, int ret)
 {
-    Util::addTime(func,elapsed,ret);
+    Util::addTime(id,elapsed,ret);
 }
 
 void
@@ -771,6 +803,13 @@ plfs_stats( void *vptr )
     (*stats) = ustats;
 }
 
+void
+plfs_metrics( void *vptr )
+{
+    string *metrics = (string *)vptr;
+    (*metrics) = Metrics::toJSON();
+}
+
 // this code just iterates up a path and makes sure all the component
 // directories exist.  It's not particularly efficient since it starts
 // at the beginning and works up and many of the dirs probably already
@@ -76,7 +76,8 @@ plfs_error_t plfs_attach(PlfsMount *pmnt);
 plfs_error_t plfs_chmod_cleanup(const char *logical,mode_t mode );
 plfs_error_t plfs_chown_cleanup (const char *logical,uid_t uid,gid_t gid );
 
-void plfs_stat_add(const char *func, double time, int );
+int plfs_stat_id(const char *func);
+void plfs_stat_add(int id, double time, int );
 
 int plfs_mutex_lock( pthread_mutex_t *mux, const char *whence );
 int plfs_mutex_unlock( pthread_mutex_t *mux, const char *whence );
@@ -117,6 +118,13 @@ plfs_error_t plfs_gethostname(char **hname);
 
 void plfs_stats( void *vptr );
 
+/*
+ * Same as plfs_stats but for the Metrics registry: the counters and
+ * latency histograms formatted as a JSON object.
+ */
+
+void plfs_metrics( void *vptr );
+
 /*
  * This function returns the PLFS version that is built.
  */
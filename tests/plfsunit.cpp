@@ -6,6 +6,18 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <set>
+#include <vector>
+#include <plfs_private.h>
+#include <Container.h>
+#include <Util.h>
+#include <container_compress.h>
+#include <Crc32c.h>
+#include <container_checksum.h>
+#include <smallfile_tools.h>
 
 CPPUNIT_TEST_SUITE_REGISTRATION(PlfsUnit);
 
@@ -154,6 +166,77 @@ PlfsUnit::readWriteTest() {
     CPPUNIT_ASSERT_EQUAL(0, (int)ret);
 }
 
+void
+PlfsUnit::fdextentTest() {
+    string path = mountpoint + "/fdextenttest1";
+    const char *pathname = path.c_str();
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    char rbuf[16];
+    off_t fdoff;
+    size_t len;
+    int kfd;
+
+    ret = plfs_open(&fd, pathname, O_CREAT | O_RDWR, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "0123456789", 10, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL(10, (int)written);
+    ret = plfs_sync(fd);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // the extent stops at EOF, even if more was asked for
+    ret = plfs_read_fdextent(fd, 100, 4, &kfd, &fdoff, &len);
+    if (ret != PLFS_ENOTSUP) {
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+        CPPUNIT_ASSERT_EQUAL((size_t)6, len);
+        CPPUNIT_ASSERT_EQUAL((ssize_t)6, pread(kfd, rbuf, len, fdoff));
+        CPPUNIT_ASSERT(memcmp(rbuf, "456789", 6) == 0);
+        ret = plfs_read_fdextent(fd, 100, 10, &kfd, &fdoff, &len);
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+        CPPUNIT_ASSERT_EQUAL((size_t)0, len);
+        ret = plfs_read_fdextent(fd, 100, 50, &kfd, &fdoff, &len);
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+        CPPUNIT_ASSERT_EQUAL((size_t)0, len);
+    }
+    ret = plfs_close(fd, pid, uid, 0, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::writenTest() {
+    string path = mountpoint + "/writentest1";
+    struct plfs_physpathinfo ppi;
+    IOSHandle *fh = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    struct stat st;
+
+    // Writen has no path of its own, stats builds log it as ""
+    ret = plfs_resolvepath(path.c_str(), &ppi);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    if (ppi.canback == NULL) {
+        return;    /* small_file mounts have no canonical backend */
+    }
+    ret = ppi.canback->store->Open(ppi.canbpath.c_str(),
+                                   O_CREAT | O_TRUNC | O_WRONLY, 0666, &fh);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = Util::Writen("WRITEN TEST", 11, fh, &written);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)11, written);
+    ret = fh->Fstat(&st);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((off_t)11, st.st_size);
+    ppi.canback->store->Close(fh);
+#ifdef UTIL_COLLECT_TIMES
+    CPPUNIT_ASSERT(Util::toString().find("Writen") != string::npos);
+#endif
+    ret = ppi.canback->store->Unlink(ppi.canbpath.c_str());
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
 void
 PlfsUnit::chmodTest() {
     string path = mountpoint + "/chmodetest1";
@@ -403,6 +486,1457 @@ PlfsUnit::truncateTest() {
     ret = plfs_getattr(NULL, pathname, &stbuf, 1);
     CPPUNIT_ASSERT_EQUAL(0, (int)ret);
     CPPUNIT_ASSERT(stbuf.st_size == 5);
+
+    // a new reader sees the shrunk file through the truncate log
+    char rbuf[32];
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_read(fd, rbuf, sizeof(rbuf), 0, &written);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(5, (int)written);
+    CPPUNIT_ASSERT(memcmp(rbuf, "SIMPL", 5) == 0);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // extending it again must not bring back the cut off data
+    ret = plfs_trunc(NULL, pathname, 12, true);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_getattr(NULL, pathname, &stbuf, 1);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(12, (int)stbuf.st_size);
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    memset(rbuf, 'x', sizeof(rbuf));
+    ret = plfs_read(fd, rbuf, sizeof(rbuf), 0, &written);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(12, (int)written);
+    CPPUNIT_ASSERT(memcmp(rbuf, "SIMPL\0\0\0\0\0\0\0", 12) == 0);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // and the same through an fd open for writing
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDWR, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_trunc(fd, pathname, 3, true);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_trunc(fd, pathname, 8, true);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_sync(fd);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    memset(rbuf, 'x', sizeof(rbuf));
+    ret = plfs_read(fd, rbuf, sizeof(rbuf), 0, &written);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(8, (int)written);
+    CPPUNIT_ASSERT(memcmp(rbuf, "SIM\0\0\0\0\0", 8) == 0);
+    ret = plfs_close(fd, pid, uid, O_RDWR, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+/* the value of a counter, or the count of a histogram, in a metrics dump */
+static long long
+metric_value(const string &json, const string &name) {
+    string key = "\"" + name + "\":";
+    size_t pos = json.find(key);
+
+    if (pos == string::npos) {
+        return -1;
+    }
+    pos += key.size();
+    if (json.compare(pos, 9, "{\"count\":") == 0) {
+        pos += 9;
+    }
+    return atoll(json.c_str() + pos);
+}
+
+static string
+metrics_dump() {
+    size_t len = 0;
+    char small[1];
+    plfs_error_t ret;
+    string json;
+
+    ret = plfs_get_metrics(small, sizeof(small), &len);
+    CPPUNIT_ASSERT_EQUAL(PLFS_ENOMEM, ret);
+    CPPUNIT_ASSERT(len > sizeof(small));
+    // leave room for metrics that show up between the two calls
+    size_t bufsz = len + 1024;
+    char *buf = new char[bufsz];
+    ret = plfs_get_metrics(buf, bufsz, &len);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    json = buf;
+    delete[] buf;
+    return json;
+}
+
+void
+PlfsUnit::metricsTest() {
+    string path = mountpoint + "/metricstest1";
+    const char *pathname = path.c_str();
+    const char *names[] = {"open_ops", "close_ops", "read_ops", "write_ops",
+                           "read_bytes", "write_bytes", "op_errors",
+                           "open_latency_us", "write_latency_us"};
+    long long deltas[] = {2, 1, 1, 2, 5, 16, 1, 2, 2};
+    const int nnames = sizeof(deltas) / sizeof(deltas[0]);
+    long long before[nnames];
+    Plfs_fd *fd = NULL, *bad = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    char rbuf[8];
+    string json;
+
+    json = metrics_dump();
+    for (int i = 0; i < nnames; i++) {
+        before[i] = metric_value(json, names[i]);
+        CPPUNIT_ASSERT_MESSAGE(names[i], before[i] >= 0);
+    }
+    ret = plfs_open(&fd, pathname, O_CREAT | O_RDWR, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "METRICS", 8, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL(8, (int)written);
+    ret = plfs_write(fd, "METRICS", 8, 8, pid, &written);
+    CPPUNIT_ASSERT_EQUAL(8, (int)written);
+    ret = plfs_sync(fd);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_read(fd, rbuf, 5, 2, &written);
+    CPPUNIT_ASSERT_EQUAL(5, (int)written);
+    ret = plfs_close(fd, pid, uid, 0, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    // a failed open counts as an op and an error
+    ret = plfs_open(&bad, (mountpoint + "/metricstest2").c_str(), O_RDONLY,
+                    pid, 0666, NULL);
+    CPPUNIT_ASSERT(ret != PLFS_SUCCESS);
+
+    // nothing else runs in this process, so the counters moved by as much
+    json = metrics_dump();
+    for (int i = 0; i < nnames; i++) {
+        CPPUNIT_ASSERT_EQUAL_MESSAGE(names[i], before[i] + deltas[i],
+                                     metric_value(json, names[i]));
+    }
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+/*
+ * mount options are set per mount in the plfsrc, the tests that need
+ * one turn it on in the mount of the test directory for a while.  this
+ * returns that mount, or NULL if it is not a container mount.
+ */
+static PlfsMount *
+container_mount(const char *logical) {
+    struct plfs_physpathinfo ppi;
+
+    if (plfs_resolvepath(logical, &ppi) != PLFS_SUCCESS ||
+        ppi.mnt_pt->file_type != CONTAINER) {
+        return NULL;
+    }
+    return ppi.mnt_pt;
+}
+
+/*
+ * the container on the backend, for the tests that change it behind
+ * the back of plfs.  empty unless the mount has a single backend.
+ */
+static string
+backend_path(const char *logical) {
+    struct plfs_physpathinfo ppi;
+
+    if (plfs_resolvepath(logical, &ppi) != PLFS_SUCCESS ||
+        ppi.mnt_pt->nback != 1) {
+        return "";
+    }
+    return ppi.mnt_pt->backends[0]->bmpoint + "/" + ppi.bnode;
+}
+
+static void
+remove_tree(const string &path) {
+    DIR *dp = opendir(path.c_str());
+    struct dirent *de;
+
+    while (dp != NULL && (de = readdir(dp)) != NULL) {
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            remove_tree(path + "/" + de->d_name);
+        }
+    }
+    if (dp != NULL) {
+        closedir(dp);
+        rmdir(path.c_str());
+    } else {
+        unlink(path.c_str());
+    }
+}
+
+/* the ids of the hostdirs in a container on the backend */
+static set<int>
+hostdir_ids(const string &bpath) {
+    set<int> ids;
+    DIR *dp = opendir(bpath.c_str());
+    struct dirent *de;
+
+    while (dp != NULL && (de = readdir(dp)) != NULL) {
+        if (strncmp(de->d_name, HOSTDIRPREFIX, strlen(HOSTDIRPREFIX)) == 0) {
+            ids.insert(atoi(de->d_name + strlen(HOSTDIRPREFIX)));
+        }
+    }
+    if (dp != NULL) {
+        closedir(dp);
+    }
+    return ids;
+}
+
+/* the data droppings in the hostdirs of a container on the backend */
+static vector<string>
+data_droppings(const string &bpath) {
+    vector<string> paths;
+    set<int> ids = hostdir_ids(bpath);
+    set<int>::iterator itr;
+    ostringstream hostdir;
+    DIR *dp;
+    struct dirent *de;
+
+    for (itr = ids.begin() ; itr != ids.end() ; itr++) {
+        hostdir.str("");
+        hostdir << bpath << "/" << HOSTDIRPREFIX << *itr;
+        dp = opendir(hostdir.str().c_str());
+        while (dp != NULL && (de = readdir(dp)) != NULL) {
+            if (strncmp(de->d_name, DATAPREFIX, strlen(DATAPREFIX)) == 0) {
+                paths.push_back(hostdir.str() + "/" + de->d_name);
+            }
+        }
+        if (dp != NULL) {
+            closedir(dp);
+        }
+    }
+    return paths;
+}
+
+/* the frame headers of a compressed data dropping, slot by slot */
+static vector<struct zframe_header>
+zframe_headers(const string &dropping) {
+    vector<struct zframe_header> hdrs;
+    struct zframe_header hdr;
+    int fd = open(dropping.c_str(), O_RDONLY);
+
+    while (fd >= 0 && pread(fd, &hdr, sizeof(hdr), hdrs.size() *
+                            ZFRAME_SLOT) == (ssize_t)sizeof(hdr)) {
+        hdrs.push_back(hdr);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return hdrs;
+}
+
+/* the expiries of the open_lease records in a container */
+static vector<time_t>
+lease_expiries(const string &bpath) {
+    vector<time_t> expiries;
+    string metadir = bpath + "/" + METADIR;
+    DIR *dp = opendir(metadir.c_str());
+    struct dirent *de;
+    const char *tag;
+
+    while (dp != NULL && (de = readdir(dp)) != NULL) {
+        tag = strrchr(de->d_name, '.');
+        if (strncmp(de->d_name, OPENPREFIX, strlen(OPENPREFIX)) == 0 &&
+            tag != NULL && strncmp(tag + 1, LEASETAG, strlen(LEASETAG)) == 0) {
+            expiries.push_back(atol(tag + 1 + strlen(LEASETAG)));
+        }
+    }
+    if (dp != NULL) {
+        closedir(dp);
+    }
+    return expiries;
+}
+
+/*
+ * the shared images in /dev/shm: index images by default (see
+ * BRI_Shared.cpp), or append counters with "plfs.app."
+ */
+static set<string>
+shared_images(const char *prefix = "plfs.bri.") {
+    set<string> names;
+    DIR *dp = opendir("/dev/shm");
+    struct dirent *de;
+
+    while (dp != NULL && (de = readdir(dp)) != NULL) {
+        if (strncmp(de->d_name, prefix, strlen(prefix)) == 0) {
+            names.insert(string("/") + de->d_name);
+        }
+    }
+    if (dp != NULL) {
+        closedir(dp);
+    }
+    return names;
+}
+
+static void
+read_check(Plfs_fd *fd, const char *expect, size_t len) {
+    char rbuf[64];
+    ssize_t bytes;
+    plfs_error_t ret;
+
+    ret = plfs_read(fd, rbuf, sizeof(rbuf), 0, &bytes);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((int)len, (int)bytes);
+    CPPUNIT_ASSERT(memcmp(rbuf, expect, len) == 0);
+}
+
+void
+PlfsUnit::sharedIndexTest() {
+    string path = mountpoint + "/sharedindextest1";
+    const char *pathname = path.c_str();
+    const char *data = "SHARED_INDEX_TEST";
+    size_t len = strlen(data);
+    PlfsMount *pmnt = container_mount(pathname);
+    Plfs_fd *fd1 = NULL, *fd2 = NULL, *fd3 = NULL;
+    set<string> before, during;
+    string name;
+    plfs_error_t ret;
+    ssize_t written;
+    int shm_fd, old_shared;
+    struct stat st;
+    char *image;
+
+    if (pmnt == NULL) {
+        return;    /* shared_index is a container option */
+    }
+    old_shared = pmnt->shared_index;
+    pmnt->shared_index = 1;
+    ret = plfs_open(&fd1, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd1, data, len, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((int)len, (int)written);
+    ret = plfs_close(fd1, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fd1 = NULL;
+    before = shared_images();
+
+    // the first reader builds the image, the second one attaches to it
+    ret = plfs_open(&fd1, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd1, data, len);
+    during = shared_images();
+    CPPUNIT_ASSERT_EQUAL(before.size() + 1, during.size());
+    for (set<string>::iterator itr = during.begin(); itr != during.end();
+         itr++) {
+        if (before.find(*itr) == before.end()) {
+            name = *itr;
+        }
+    }
+    ret = plfs_open(&fd2, pathname, O_RDONLY, pid + 1, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(fd2 != fd1);
+    read_check(fd2, data, len);
+    CPPUNIT_ASSERT(shared_images() == during);
+
+    // the image goes away with its last reader
+    ret = plfs_close(fd1, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(shared_images() == during);
+    read_check(fd2, data, len);
+
+    // keep a copy of the image to fake one that is being removed
+    shm_fd = shm_open(name.c_str(), O_RDONLY, 0);
+    CPPUNIT_ASSERT(shm_fd >= 0);
+    CPPUNIT_ASSERT_EQUAL(0, fstat(shm_fd, &st));
+    image = new char[st.st_size];
+    CPPUNIT_ASSERT_EQUAL((ssize_t)st.st_size,
+                         pread(shm_fd, image, st.st_size, 0));
+    close(shm_fd);
+    ret = plfs_close(fd2, pid + 1, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(shared_images() == before);
+
+    // a new reader builds a new image
+    fd1 = NULL;
+    ret = plfs_open(&fd1, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd1, data, len);
+    CPPUNIT_ASSERT(shared_images() == during);
+    ret = plfs_close(fd1, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(shared_images() == before);
+
+    /*
+     * an image with no refs left is being removed by its last reader.
+     * a new reader retries, then falls back to a private index (refs
+     * is the 4th 32 bit word of BRISharedImage).
+     */
+    ((int32_t *)image)[3] = 0;
+    shm_fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    CPPUNIT_ASSERT(shm_fd >= 0);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)st.st_size,
+                         pwrite(shm_fd, image, st.st_size, 0));
+    close(shm_fd);
+    delete[] image;
+    fd3 = NULL;
+    ret = plfs_open(&fd3, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd3, data, len);
+    ret = plfs_close(fd3, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(shared_images() == during);
+    CPPUNIT_ASSERT_EQUAL(0, shm_unlink(name.c_str()));
+
+    pmnt->shared_index = old_shared;
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::coordinatedCreateTest() {
+    string path = mountpoint + "/coordcreatetest1";
+    const char *pathname = path.c_str();
+    PlfsMount *pmnt = container_mount(pathname);
+    string bpath = backend_path(pathname);
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    struct stat st;
+    set<int> ids;
+    int old_coordinated;
+
+    if (pmnt == NULL || bpath.empty()) {
+        return;    /* coordinated_create is a container option */
+    }
+    old_coordinated = pmnt->coordinated_create;
+    pmnt->coordinated_create = 1;
+
+    // another node removes the file, a creat() makes it again at once
+    ret = plfs_create(pathname, 0666, 0, pid);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    remove_tree(bpath);
+    ret = plfs_create(pathname, 0666, 0, pid);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(0, lstat(bpath.c_str(), &st));
+
+    // and so does an exclusive one, or an open
+    remove_tree(bpath);
+    ret = plfs_create(pathname, 0666, O_EXCL, pid);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    remove_tree(bpath);
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(0, lstat(bpath.c_str(), &st));
+    ret = plfs_write(fd, "COORD", 5, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)5, written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    /*
+     * the first writer to find its hostdir gone makes it again and
+     * remembers it, the next one must not trust that once it is gone
+     */
+    for (int round = 0; round < 2; round++) {
+        ids = hostdir_ids(bpath);
+        CPPUNIT_ASSERT(ids.size() > 0);
+        for (set<int>::iterator itr = ids.begin(); itr != ids.end();
+             itr++) {
+            ostringstream hostdir;
+            hostdir << bpath << "/" << HOSTDIRPREFIX << *itr;
+            remove_tree(hostdir.str());
+        }
+        fd = NULL;
+        ret = plfs_open(&fd, pathname, O_WRONLY, pid, 0666, NULL);
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+        ret = plfs_write(fd, "COORDINATED", 11, 0, pid, &written);
+        CPPUNIT_ASSERT_EQUAL((ssize_t)11, written);
+        ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    }
+    ret = plfs_getattr(NULL, pathname, &st, 1);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(11, (int)st.st_size);
+
+    pmnt->coordinated_create = old_coordinated;
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::fanoutTest() {
+    string path = mountpoint + "/fanouttest1";
+    const char *pathname = path.c_str();
+    string bpath = backend_path(pathname);
+    Plfs_open_opt opt;
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    set<int> ids;
+    char *hostname;
+    char rbuf[32];
+    FILE *fp;
+    int fanout = 0;
+
+    if (container_mount(pathname) == NULL || bpath.empty()) {
+        return;    /* hostdirs are a container thing */
+    }
+    Util::hostname(&hostname);
+
+    // 50 writers: the lowest prime at least sqrt(50)
+    memset(&opt, 0, sizeof(opt));
+    opt.pinter = PLFS_API;
+    opt.num_writers = 50;
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, &opt);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "FANOUT", 6, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL(6, (int)written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fp = fopen((bpath + "/" + FANOUTFILE).c_str(), "r");
+    CPPUNIT_ASSERT(fp != NULL);
+    CPPUNIT_ASSERT_EQUAL(1, fscanf(fp, "%d", &fanout));
+    fclose(fp);
+    CPPUNIT_ASSERT_EQUAL(11, fanout);
+    ids = hostdir_ids(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, ids.size());
+    CPPUNIT_ASSERT_EQUAL((int)Container::getHostDirId(hostname, 11),
+                         *ids.begin());
+
+    // a reopen without the hint writes to the same hostdir
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_WRONLY, pid + 1, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "FANOUT", 6, 6, pid + 1, &written);
+    CPPUNIT_ASSERT_EQUAL(6, (int)written);
+    ret = plfs_close(fd, pid + 1, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(hostdir_ids(bpath) == ids);
+
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_read(fd, rbuf, sizeof(rbuf), 0, &written);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(12, (int)written);
+    CPPUNIT_ASSERT(memcmp(rbuf, "FANOUTFANOUT", 12) == 0);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // a truncate to zero keeps the fan-out, and so the hostdir
+    ret = plfs_trunc(NULL, pathname, 0, true);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fp = fopen((bpath + "/" + FANOUTFILE).c_str(), "r");
+    CPPUNIT_ASSERT(fp != NULL);
+    fanout = 0;
+    CPPUNIT_ASSERT_EQUAL(1, fscanf(fp, "%d", &fanout));
+    fclose(fp);
+    CPPUNIT_ASSERT_EQUAL(11, fanout);
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_WRONLY, pid + 1, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "FANOUT", 6, 0, pid + 1, &written);
+    CPPUNIT_ASSERT_EQUAL(6, (int)written);
+    ret = plfs_close(fd, pid + 1, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(hostdir_ids(bpath) == ids);
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::openLeaseTest() {
+    string path = mountpoint + "/openleasetest1";
+    const char *pathname = path.c_str();
+    PlfsMount *pmnt = container_mount(pathname);
+    string bpath = backend_path(pathname);
+    vector<time_t> expiries;
+    Plfs_open_opt opt;
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    struct stat st;
+    int old_lease;
+
+    if (pmnt == NULL || bpath.empty()) {
+        return;    /* open_lease is a container option */
+    }
+    old_lease = pmnt->open_lease;
+    pmnt->open_lease = 2;
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "LEASE!", 6, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL(6, (int)written);
+    expiries = lease_expiries(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, expiries.size());
+    CPPUNIT_ASSERT(expiries[0] > time(NULL));
+
+    // an fd that only stats or syncs still keeps the lease going
+    sleep(2);
+    ret = plfs_getattr(fd, pathname, &st, 0);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(6, (int)st.st_size);
+    expiries = lease_expiries(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, expiries.size());
+    CPPUNIT_ASSERT(expiries[0] > time(NULL));
+    sleep(2);
+    ret = plfs_sync(fd);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    expiries = lease_expiries(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, expiries.size());
+    CPPUNIT_ASSERT(expiries[0] > time(NULL));
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // a stat reaps the lease once it has expired
+    sleep(2);
+    ret = plfs_getattr(NULL, pathname, &st, 0);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(6, (int)st.st_size);
+    CPPUNIT_ASSERT(lease_expiries(bpath).empty());
+
+    // an MPI rank other than 0 makes no lease, but renews it
+    memset(&opt, 0, sizeof(opt));
+    opt.pinter = PLFS_MPIIO;
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_WRONLY, 1, 0666, &opt);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(lease_expiries(bpath).empty());
+    sleep(2);
+    ret = plfs_write(fd, "LEASE!", 6, 6, 1, &written);
+    CPPUNIT_ASSERT_EQUAL(6, (int)written);
+    expiries = lease_expiries(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, expiries.size());
+    CPPUNIT_ASSERT(expiries[0] > time(NULL));
+    ret = plfs_close(fd, 1, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    pmnt->open_lease = old_lease;
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::compressTest() {
+    string path = mountpoint + "/compresstest1";
+    const char *pathname = path.c_str();
+    PlfsMount *pmnt = container_mount(pathname);
+    string bpath = backend_path(pathname);
+    vector<char> src(ZFRAME_SIZE), comp(2 * ZFRAME_SIZE), out(ZFRAME_SIZE);
+    vector<char> expect, rbuf;
+    vector<string> drops;
+    vector<struct zframe_header> hdrs, synced;
+    const char bad_literals[] = { (char)0xf0, 0, 'a', 'b', 'c' };
+    const char bad_offset[] = { 0x10, 'a', 0x05, 0x00 };
+    Plfs_fd *fd = NULL, *rfd = NULL;
+    plfs_error_t ret;
+    ssize_t written, bytes;
+    size_t clen, i;
+    bool old_compress;
+
+    // round trip of data that does not compress and data that does
+    srandom(getpid());
+    for (i = 0 ; i < src.size() ; i++) {
+        src[i] = random();
+    }
+    clen = zdrop_compress(&src[0], src.size(), &comp[0], comp.size());
+    CPPUNIT_ASSERT(clen > 0);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)src.size(),
+                         zdrop_decompress(&comp[0], clen, &out[0],
+                                          out.size()));
+    CPPUNIT_ASSERT(src == out);
+    // so it is stored raw, its frame must be smaller than the data
+    CPPUNIT_ASSERT_EQUAL((size_t)0, zdrop_compress(&src[0], src.size(),
+                                                   &comp[0],
+                                                   src.size() - 1));
+    for (i = 0 ; i < src.size() ; i++) {
+        src[i] = "COMPRESSIBLE"[(i * 7 / 5) % 12] + (i % 1000 == 0);
+    }
+    clen = zdrop_compress(&src[0], src.size(), &comp[0], src.size() - 1);
+    CPPUNIT_ASSERT(clen > 0 && clen < src.size() / 4);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)src.size(),
+                         zdrop_decompress(&comp[0], clen, &out[0],
+                                          out.size()));
+    CPPUNIT_ASSERT(src == out);
+
+    // corrupt input is refused, not decoded past the buffers
+    CPPUNIT_ASSERT_EQUAL((ssize_t)-1,
+                         zdrop_decompress(&comp[0], clen, &out[0],
+                                          out.size() - 1));
+    CPPUNIT_ASSERT_EQUAL((ssize_t)-1,
+                         zdrop_decompress(bad_literals, sizeof(bad_literals),
+                                          &out[0], out.size()));
+    CPPUNIT_ASSERT_EQUAL((ssize_t)-1,
+                         zdrop_decompress(bad_offset, sizeof(bad_offset),
+                                          &out[0], out.size()));
+
+    if (pmnt == NULL || bpath.empty() ||
+        pmnt->fileindex_type != CI_BYTERANGE) {
+        return;    /* compress_droppings is a byterange index option */
+    }
+    old_compress = pmnt->compress_droppings;
+    pmnt->compress_droppings = true;
+
+    // the index records of buffered data are not written before it is
+    ret = plfs_open(&fd, pathname, O_CREAT | O_RDWR, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    for (i = 0 ; i < 1024 ; i++) {
+        ret = plfs_write(fd, &src[i * 50], 50, i * 50, pid, &written);
+        CPPUNIT_ASSERT_EQUAL(50, (int)written);
+    }
+    expect.assign(src.begin(), src.begin() + 1024 * 50);
+    ret = plfs_open(&rfd, pathname, O_RDONLY, pid + 1, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    rbuf.assign(expect.size() + 100, 0);
+    ret = plfs_read(rfd, &rbuf[0], rbuf.size(), 0, &bytes);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)expect.size(), bytes);
+    CPPUNIT_ASSERT(memcmp(&rbuf[0], &expect[0], bytes) == 0);
+    ret = plfs_close(rfd, pid + 1, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // a sync writes a short frame, the next data goes in the next slot
+    ret = plfs_write(fd, "SYNCED", 6, expect.size(), pid, &written);
+    CPPUNIT_ASSERT_EQUAL(6, (int)written);
+    expect.insert(expect.end(), "SYNCED", "SYNCED" + 6);
+    ret = plfs_sync(fd);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    drops = data_droppings(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, drops.size());
+    synced = zframe_headers(drops[0]);
+    ret = plfs_write(fd, "AGAIN!", 6, expect.size(), pid, &written);
+    CPPUNIT_ASSERT_EQUAL(6, (int)written);
+    expect.insert(expect.end(), "AGAIN!", "AGAIN!" + 6);
+    ret = plfs_sync(fd);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    hdrs = zframe_headers(drops[0]);
+    CPPUNIT_ASSERT_EQUAL(synced.size() + 1, hdrs.size());
+    CPPUNIT_ASSERT(memcmp(&hdrs[0], &synced[0],
+                          synced.size() * sizeof(hdrs[0])) == 0);
+    for (i = 0 ; i < hdrs.size() ; i++) {
+        CPPUNIT_ASSERT_EQUAL(ZFRAME_MAGIC, hdrs[i].magic);
+        CPPUNIT_ASSERT_EQUAL((uint64_t)(i == 0 ? 0 : hdrs[i - 1].voff +
+                                        hdrs[i - 1].ulen), hdrs[i].voff);
+    }
+    CPPUNIT_ASSERT_EQUAL((uint64_t)expect.size(),
+                         hdrs.back().voff + hdrs.back().ulen);
+
+    // incompressible data is stored raw
+    for (i = 0 ; i < src.size() ; i++) {
+        src[i] = random();
+    }
+    ret = plfs_write(fd, &src[0], src.size(), expect.size(), pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)src.size(), written);
+    expect.insert(expect.end(), src.begin(), src.end());
+    ret = plfs_close(fd, pid, uid, O_RDWR, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    hdrs = zframe_headers(drops[0]);
+    CPPUNIT_ASSERT_EQUAL(synced.size() + 2, hdrs.size());
+    CPPUNIT_ASSERT_EQUAL((uint32_t)ZFRAME_SIZE, hdrs[synced.size() + 1].ulen);
+    CPPUNIT_ASSERT(hdrs[synced.size() + 1].flags & ZFRAME_RAW);
+
+    // appending after a reopen
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "REOPEN", 6, expect.size(), pid, &written);
+    CPPUNIT_ASSERT_EQUAL(6, (int)written);
+    expect.insert(expect.end(), "REOPEN", "REOPEN" + 6);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // the frames past the short ones are found by their headers
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    rbuf.assign(expect.size() + 100, 0);
+    ret = plfs_read(fd, &rbuf[0], rbuf.size(), 0, &bytes);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)expect.size(), bytes);
+    CPPUNIT_ASSERT(memcmp(&rbuf[0], &expect[0], bytes) == 0);
+    ret = plfs_read(fd, &rbuf[0], 100, expect.size() - 50, &bytes);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)50, bytes);
+    CPPUNIT_ASSERT(memcmp(&rbuf[0], &expect[expect.size() - 50], 50) == 0);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    pmnt->compress_droppings = old_compress;
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::checksumTest() {
+    string path = mountpoint + "/checksumtest1";
+    const char *pathname = path.c_str();
+    PlfsMount *pmnt = container_mount(pathname);
+    string bpath = backend_path(pathname);
+    const char *check = "123456789";
+    vector<char> data(100000), rbuf(100000);
+    vector<string> drops;
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    ssize_t written, bytes;
+    uint32_t crc, crc8;
+    size_t i, start;
+    int old_checksums, dfd;
+    char c;
+
+    // the check value, with the crc32 instruction (if the cpu has it)
+    // and with the table
+    CPPUNIT_ASSERT_EQUAL(0xe3069283U, crc32c(0, check, strlen(check)));
+    CPPUNIT_ASSERT_EQUAL(0xe3069283U, crc32c_table8(0, check, strlen(check)));
+
+    // the two agree at any alignment, and piece by piece is the same
+    srandom(getpid());
+    for (i = 0 ; i < data.size() ; i++) {
+        data[i] = random();
+    }
+    for (start = 0 ; start < 8 ; start++) {
+        crc = crc32c(0, &data[start], 1000 + start);
+        CPPUNIT_ASSERT_EQUAL(crc, crc32c_table8(0, &data[start], 1000 + start));
+        crc8 = 0;
+        for (i = 0 ; i < 1000 + start ; i += 7) {
+            crc8 = crc32c(crc8, &data[start + i], min((size_t)7,
+                                                      1000 + start - i));
+        }
+        CPPUNIT_ASSERT_EQUAL(crc, crc8);
+        crc8 = crc32c_table8(0, &data[start], 13);
+        crc8 = crc32c_table8(crc8, &data[start + 13], 1000 + start - 13);
+        CPPUNIT_ASSERT_EQUAL(crc, crc8);
+    }
+
+    if (pmnt == NULL || bpath.empty()) {
+        return;    /* data_checksums is a container option */
+    }
+    old_checksums = pmnt->data_checksums;
+    pmnt->data_checksums = 1;
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, &data[0], data.size(), 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)data.size(), written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_read(fd, &rbuf[0], rbuf.size(), 0, &bytes);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)data.size(), bytes);
+    CPPUNIT_ASSERT(rbuf == data);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // flip one byte of the first block behind the back of plfs
+    drops = data_droppings(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, drops.size());
+    dfd = open(drops[0].c_str(), O_RDWR);
+    CPPUNIT_ASSERT(dfd >= 0);
+    CPPUNIT_ASSERT_EQUAL(1, (int)pread(dfd, &c, 1, 1000));
+    c ^= 0x20;
+    CPPUNIT_ASSERT_EQUAL(1, (int)pwrite(dfd, &c, 1, 1000));
+    close(dfd);
+
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_read(fd, &rbuf[0], 100, 950, &bytes);
+    CPPUNIT_ASSERT_EQUAL((int)PLFS_EIO, (int)ret);
+    // the other block is still fine
+    ret = plfs_read(fd, &rbuf[0], 1000, SUMBLOCK_SIZE, &bytes);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)1000, bytes);
+    CPPUNIT_ASSERT(memcmp(&rbuf[0], &data[SUMBLOCK_SIZE], 1000) == 0);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // a dropping cut shorter than its sums fails the check too
+    CPPUNIT_ASSERT_EQUAL(0, truncate(drops[0].c_str(), SUMBLOCK_SIZE + 2000));
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_read(fd, &rbuf[0], 1000, SUMBLOCK_SIZE, &bytes);
+    CPPUNIT_ASSERT_EQUAL((int)PLFS_EIO, (int)ret);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    pmnt->data_checksums = old_checksums;
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::zeroBlocksTest() {
+    string path = mountpoint + "/zeroblockstest1";
+    const char *pathname = path.c_str();
+    PlfsMount *pmnt = container_mount(pathname);
+    string bpath = backend_path(pathname);
+    const off_t start = 100, zblock = 4096;
+    vector<char> data(5 * zblock + 1000 - start, 0), rbuf;
+    vector<string> drops;
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    ssize_t written, bytes;
+    struct stat st;
+    size_t i;
+    int old_zero;
+
+    if (pmnt == NULL || bpath.empty() ||
+        pmnt->fileindex_type != CI_BYTERANGE) {
+        return;    /* zero_blocks is a byterange index option */
+    }
+    old_zero = pmnt->zero_blocks;
+    pmnt->zero_blocks = zblock;
+
+    // in the file: [100,4096) zeros but not a whole block, [4096,8192)
+    // data, [8192,16384) zero blocks, [16384,20480) data with a zero
+    // byte at the end, [20480,21480) zeros but not a whole block
+    for (i = zblock - start ; i < 2 * zblock - start ; i++) {
+        data[i] = 'a' + i % 26;
+    }
+    for (i = 4 * zblock - start ; i < 5 * zblock - start - 1 ; i++) {
+        data[i] = 'A' + i % 26;
+    }
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, &data[0], data.size(), start, pid, &written);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)data.size(), written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // only the two zero blocks are left out of the dropping
+    drops = data_droppings(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, drops.size());
+    CPPUNIT_ASSERT_EQUAL(0, stat(drops[0].c_str(), &st));
+    CPPUNIT_ASSERT_EQUAL((off_t)(data.size() - 2 * zblock), st.st_size);
+
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_getattr(fd, pathname, &st, 0);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((off_t)(start + data.size()), st.st_size);
+    rbuf.assign(data.size() + start, 'x');
+    ret = plfs_read(fd, &rbuf[0], rbuf.size(), 0, &bytes);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)rbuf.size(), bytes);
+    for (i = 0 ; i < (size_t)start ; i++) {
+        CPPUNIT_ASSERT_EQUAL(0, (int)rbuf[i]);
+    }
+    CPPUNIT_ASSERT(memcmp(&rbuf[start], &data[0], data.size()) == 0);
+
+    // reads that start inside a zero run and end in data after it
+    rbuf.assign(zblock, 'x');
+    ret = plfs_read(fd, &rbuf[0], zblock, 3 * zblock + 10, &bytes);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)zblock, bytes);
+    CPPUNIT_ASSERT(memcmp(&rbuf[0], &data[3 * zblock + 10 - start],
+                          zblock) == 0);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    pmnt->zero_blocks = old_zero;
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::cloneTest() {
+    string path = mountpoint + "/clonetest1";
+    string path2 = mountpoint + "/clonetest2";
+    string path3 = mountpoint + "/clonetest3";
+    const char *pathname = path.c_str();
+    const char *pathname2 = path2.c_str();
+    const char *pathname3 = path3.c_str();
+    string bpath = backend_path(pathname);
+    const char *data = "CLONE_SOURCE_DATA";
+    size_t len = strlen(data);
+    PlfsMount *pmnt = container_mount(pathname);
+    vector<string> drops;
+    Plfs_fd *fd = NULL, *fd2 = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    struct stat st;
+    int old_lease;
+
+    if (pmnt == NULL || bpath.empty()) {
+        return;    /* clones are made of containers */
+    }
+    old_lease = pmnt->open_lease;
+    pmnt->open_lease = 0;    /* open records say who is writing */
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, data, len, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)len, written);
+
+    // not while it is open for writing
+    ret = plfs_clone(pathname, pathname2);
+    CPPUNIT_ASSERT_EQUAL((int)PLFS_EBUSY, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((int)PLFS_ENOENT,
+                         (int)plfs_getattr(NULL, pathname2, &st, 0));
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // the clone has the same data, in the same dropping
+    ret = plfs_clone(pathname, pathname2);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    drops = data_droppings(bpath);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, drops.size());
+    CPPUNIT_ASSERT_EQUAL(0, stat(drops[0].c_str(), &st));
+    CPPUNIT_ASSERT_EQUAL(2, (int)st.st_nlink);
+    fd2 = NULL;
+    ret = plfs_open(&fd2, pathname2, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd2, data, len);
+    ret = plfs_close(fd2, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // a write to the clone is not seen in the source
+    fd2 = NULL;
+    ret = plfs_open(&fd2, pathname2, O_RDWR, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd2, "XXXXX", 5, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL(5, (int)written);
+    ret = plfs_close(fd2, pid, uid, O_RDWR, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd, data, len);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // the clone outlives the source
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(stat(drops[0].c_str(), &st) != 0);    // its link is gone
+    fd2 = NULL;
+    ret = plfs_open(&fd2, pathname2, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd2, "XXXXX_SOURCE_DATA", len);
+    ret = plfs_close(fd2, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // truncating an open file to zero leaves its clone alone
+    ret = plfs_clone(pathname2, pathname3);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fd2 = NULL;
+    ret = plfs_open(&fd2, pathname2, O_RDWR, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_trunc(fd2, pathname2, 0, true);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd2, "NEW", 3, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL(3, (int)written);
+    ret = plfs_close(fd2, pid, uid, O_RDWR, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fd = NULL;
+    ret = plfs_open(&fd, pathname3, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd, "XXXXX_SOURCE_DATA", len);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fd2 = NULL;
+    ret = plfs_open(&fd2, pathname2, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd2, "NEW", 3);
+    ret = plfs_close(fd2, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    ret = plfs_unlink(pathname2);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_unlink(pathname3);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // a lease left by a writer that has closed doesn't make it busy
+    pmnt->open_lease = 60;
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, data, len, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)len, written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, lease_expiries(bpath).size());
+    ret = plfs_clone(pathname, pathname2);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    pmnt->open_lease = old_lease;
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_unlink(pathname2);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+void
+PlfsUnit::extentTest() {
+    string path = mountpoint + "/extenttest1";
+    const char *pathname = path.c_str();
+    PlfsMount *pmnt = container_mount(pathname);
+    const off_t zblock = 4096;
+    vector<char> buf(4 * zblock, 0);
+    Plfs_extent exts[4];
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    off_t result;
+    int n, old_zero;
+
+    if (pmnt == NULL || pmnt->fileindex_type != CI_BYTERANGE) {
+        return;    /* holes come from the byterange index */
+    }
+    old_zero = pmnt->zero_blocks;
+    pmnt->zero_blocks = zblock;
+
+    // data [0,4K), a hole [4K,8K), data [8K,12K), two zero blocks
+    // [12K,20K), data [20K,24K), and a hole at the end to 28K
+    memset(&buf[0], 'A', zblock);
+    memset(&buf[3 * zblock], 'C', zblock);
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, &buf[0], zblock, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)zblock, written);
+    memset(&buf[0], 'B', zblock);
+    ret = plfs_write(fd, &buf[0], buf.size(), 2 * zblock, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)buf.size(), written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_trunc(NULL, pathname, 7 * zblock, true);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    n = 0;
+    ret = plfs_extent_map(fd, 0, 7 * zblock, NULL, &n);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(3, n);
+    n = 2;
+    ret = plfs_extent_map(fd, 0, 7 * zblock, exts, &n);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(2, n);
+    CPPUNIT_ASSERT_EQUAL((off_t)0, exts[0].logical);
+    CPPUNIT_ASSERT_EQUAL((size_t)zblock, exts[0].length);
+    CPPUNIT_ASSERT_EQUAL(2 * zblock, exts[1].logical);
+    CPPUNIT_ASSERT_EQUAL((size_t)zblock, exts[1].length);
+    CPPUNIT_ASSERT_EQUAL(exts[0].dropping, exts[1].dropping);
+    CPPUNIT_ASSERT_EQUAL(exts[0].physical + zblock, exts[1].physical);
+    // the array was full, go on from the end of the last one
+    n = 4;
+    ret = plfs_extent_map(fd, 3 * zblock, 4 * zblock, exts, &n);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(1, n);
+    CPPUNIT_ASSERT_EQUAL(5 * zblock, exts[0].logical);
+    CPPUNIT_ASSERT_EQUAL((size_t)zblock, exts[0].length);
+
+    // SEEK_DATA and SEEK_HOLE from the start of each piece, and inside
+    ret = plfs_lseek(fd, 0, SEEK_DATA, &result);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL((off_t)0, result);
+    ret = plfs_lseek(fd, 10, SEEK_HOLE, &result);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(zblock, result);
+    ret = plfs_lseek(fd, zblock, SEEK_DATA, &result);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(2 * zblock, result);
+    ret = plfs_lseek(fd, zblock + 10, SEEK_HOLE, &result);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(zblock + 10, result);
+    ret = plfs_lseek(fd, 2 * zblock, SEEK_HOLE, &result);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(3 * zblock, result);
+    ret = plfs_lseek(fd, 3 * zblock + 10, SEEK_DATA, &result);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(5 * zblock, result);
+    ret = plfs_lseek(fd, 5 * zblock, SEEK_HOLE, &result);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(6 * zblock, result);
+
+    // the hole at the end: no data after it, EOF ends it, ENXIO at EOF
+    ret = plfs_lseek(fd, 6 * zblock, SEEK_DATA, &result);
+    CPPUNIT_ASSERT_EQUAL((int)PLFS_ENXIO, (int)ret);
+    ret = plfs_lseek(fd, 6 * zblock + 10, SEEK_HOLE, &result);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(6 * zblock + 10, result);
+    ret = plfs_lseek(fd, 7 * zblock, SEEK_DATA, &result);
+    CPPUNIT_ASSERT_EQUAL((int)PLFS_ENXIO, (int)ret);
+    ret = plfs_lseek(fd, 7 * zblock, SEEK_HOLE, &result);
+    CPPUNIT_ASSERT_EQUAL((int)PLFS_ENXIO, (int)ret);
+    ret = plfs_lseek(fd, 0, SEEK_SET, &result);
+    CPPUNIT_ASSERT_EQUAL((int)PLFS_EINVAL, (int)ret);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    pmnt->zero_blocks = old_zero;
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+}
+
+/* the layout of the append counter images of container_append.cpp */
+struct append_test_image {
+    uint32_t magic;
+    uint32_t version;
+    int32_t state;
+    int32_t pad;
+    off_t eof;
+};
+
+void
+PlfsUnit::appendTest() {
+    string path = mountpoint + "/appendtest1";
+    const char *pathname = path.c_str();
+    PlfsMount *pmnt = container_mount(pathname);
+    struct plfs_physpathinfo ppi;
+    struct append_test_image image;
+    Plfs_fd *fd = NULL, *fd2 = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    struct stat st;
+    ostringstream name;
+    set<string> before;
+    string remote;
+    char expect[34];
+    int sfd, old_append;
+
+    if (pmnt == NULL) {
+        return;    /* shared_append is a container option */
+    }
+    old_append = pmnt->shared_append;
+    pmnt->shared_append = 0;
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "0123456789", 10, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)10, written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // without shared_append the offsets given are used
+    before = shared_images("plfs.app.");
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_WRONLY | O_APPEND, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(shared_images("plfs.app.") == before);
+    ret = plfs_write(fd, "01", 2, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)2, written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    pmnt->shared_append = 1;
+
+    // two appenders share one counter, their writes go one after the
+    // other at the end whatever offset they give
+    before = shared_images("plfs.app.");
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_WRONLY | O_APPEND, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_open(&fd2, pathname, O_WRONLY | O_APPEND, pid + 1, 0666,
+                    NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(before.size() + 1,
+                         shared_images("plfs.app.").size());
+    ret = plfs_write(fd, "AAAA", 4, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)4, written);
+    ret = plfs_write(fd2, "BBBB", 4, 0, pid + 1, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)4, written);
+    ret = plfs_write(fd, "CCCC", 4, 4, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)4, written);
+
+    // a truncate through the path moves the counter too
+    ret = plfs_trunc(NULL, pathname, 30, true);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd2, "DD", 2, 0, pid + 1, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)2, written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_close(fd2, pid + 1, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(shared_images("plfs.app.") == before);   // removed
+
+    // a counter left behind by appenders that died is seeded again
+    ret = plfs_resolvepath(pathname, &ppi);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = ppi.canback->store->Lstat(ppi.canbpath.c_str(), &st);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    name << hex << "/plfs.app."
+         << Util::hashValue((string(ppi.canback->prefix) +
+                             ppi.canbpath).c_str())
+         << "." << (unsigned long)st.st_ino;
+    sfd = shm_open(name.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    CPPUNIT_ASSERT(sfd >= 0);
+    image.magic = 0x50504141;
+    image.version = 2;
+    image.state = 1;    // ready
+    image.pad = 0;
+    image.eof = 1000;
+    CPPUNIT_ASSERT_EQUAL((ssize_t)sizeof(image),
+                         write(sfd, &image, sizeof(image)));
+    close(sfd);
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_WRONLY | O_APPEND, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "EE", 2, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)2, written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(shared_images("plfs.app.") == before);
+
+    // nor is there one while another host has it open for writing
+    remote = Container::getMetaDirPath(ppi.canbpath) + "/" + OPENPREFIX +
+        "plfsunit-remote.1";
+    ret = Util::MakeFile(remote.c_str(), 0644, ppi.canback->store);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_WRONLY | O_APPEND, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(shared_images("plfs.app.") == before);
+    ret = plfs_write(fd, "FF", 2, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)2, written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = ppi.canback->store->Unlink(remote.c_str());
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    memcpy(expect, "FF23456789AAAABBBBCCCC", 22);
+    memset(expect + 22, 0, 8);
+    memcpy(expect + 30, "DDEE", 4);
+    read_check(fd, expect, 34);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    pmnt->shared_append = old_append;
+}
+
+void
+PlfsUnit::compactOpenTest() {
+    string dir = mountpoint + "/compactopentest";
+    string path = dir + "/file1";
+    const char *pathname = path.c_str();
+    Plfs_fd *fd = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    FILE *devnull;
+
+    if (plfs_get_filetype(mountpoint.c_str()) != SMALL_FILE) {
+        return;    /* only small_file directories are compacted */
+    }
+    ret = plfs_mkdir(dir.c_str(), 0777);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_open(&fd, pathname, O_CREAT | O_RDWR, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "0123456789", 10, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)10, written);
+
+    // push the open directory out of the container cache
+    for (int i = 0; i < 64; i++) {
+        ostringstream other;
+        other << mountpoint << "/compactopentest" << i;
+        ret = plfs_mkdir(other.str().c_str(), 0777);
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+        ret = plfs_create((other.str() + "/file").c_str(), 0666, 0, pid);
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    }
+    devnull = fopen("/dev/null", "w");
+    CPPUNIT_ASSERT(devnull != NULL);
+    ret = smallfile_compact(devnull, dir.c_str(), 0, 0, 0, 0);
+    CPPUNIT_ASSERT_EQUAL(PLFS_EBUSY, ret);
+    ret = plfs_write(fd, "ABCDE", 5, 10, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)5, written);
+    ret = plfs_close(fd, pid, uid, O_RDWR, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = smallfile_compact(devnull, dir.c_str(), 0, 0, 0, 0);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fclose(devnull);
+
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd, "0123456789ABCDE", 15);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_unlink(pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_rmdir(dir.c_str());
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    for (int i = 0; i < 64; i++) {
+        ostringstream other;
+        other << mountpoint << "/compactopentest" << i;
+        ret = plfs_unlink((other.str() + "/file").c_str());
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+        ret = plfs_rmdir(other.str().c_str());
+        CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    }
+}
+
+void
+PlfsUnit::flattenOpenTest() {
+    string path = mountpoint + "/flattenopentest1";
+    const char *pathname = path.c_str();
+    string bpath = backend_path(pathname);
+    string logpath = bpath + "/" + TRUNCLOG;
+    string globalpath = bpath + "/" + GLOBALINDEX;
+    PlfsMount *pmnt = container_mount(pathname);
+    Plfs_fd *fd = NULL, *wfd = NULL;
+    plfs_error_t ret;
+    ssize_t written;
+    int old_lease;
+
+    if (pmnt == NULL || bpath.empty()) {
+        return;    /* the truncate log is a container thing */
+    }
+    old_lease = pmnt->open_lease;
+    pmnt->open_lease = 0;    /* a lease would outlive the writer */
+    ret = plfs_open(&fd, pathname, O_CREAT | O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(fd, "0123456789ABCDEFGHIJ", 20, 0, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)20, written);
+    ret = plfs_close(fd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_trunc(NULL, pathname, 10, true);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(0, access(logpath.c_str(), F_OK));
+
+    // a flatten while a writer has the file open leaves the droppings
+    // and the truncate log alone
+    ret = plfs_open(&wfd, pathname, O_WRONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_write(wfd, "KLMNO", 5, 10, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)5, written);
+    ret = plfs_sync(wfd);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid + 1, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_flatten_index(fd, pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_close(fd, pid + 1, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT_EQUAL(0, access(logpath.c_str(), F_OK));
+    ret = plfs_write(wfd, "PQRST", 5, 15, pid, &written);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)5, written);
+    ret = plfs_close(wfd, pid, uid, O_WRONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+
+    // the flattened index predates the last write, read the droppings
+    CPPUNIT_ASSERT_EQUAL(0, unlink(globalpath.c_str()));
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd, "0123456789KLMNOPQRST", 20);
+
+    // with the writer gone the log is folded into the droppings
+    ret = plfs_flatten_index(fd, pathname);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    CPPUNIT_ASSERT(access(logpath.c_str(), F_OK) != 0);
+    CPPUNIT_ASSERT_EQUAL(0, unlink(globalpath.c_str()));
+    fd = NULL;
+    ret = plfs_open(&fd, pathname, O_RDONLY, pid, 0666, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    read_check(fd, "0123456789KLMNOPQRST", 20);
+    ret = plfs_close(fd, pid, uid, O_RDONLY, NULL, &ref_count);
+    CPPUNIT_ASSERT_EQUAL(0, (int)ret);
     ret = plfs_unlink(pathname);
     CPPUNIT_ASSERT_EQUAL(0, (int)ret);
+    pmnt->open_lease = old_lease;
 }
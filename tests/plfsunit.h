@@ -13,6 +13,8 @@ class PlfsUnit : public CPPUNIT_NS::TestFixture
 	CPPUNIT_TEST (createTest);
 	CPPUNIT_TEST (openCloseTest);
 	CPPUNIT_TEST (readWriteTest);
+	CPPUNIT_TEST (fdextentTest);
+	CPPUNIT_TEST (writenTest);
 	CPPUNIT_TEST (chmodTest);
 	CPPUNIT_TEST (chmodDirTest);
 	CPPUNIT_TEST (linkTest);
@@ -21,6 +23,19 @@ class PlfsUnit : public CPPUNIT_NS::TestFixture
 	CPPUNIT_TEST (renameTest);
 	CPPUNIT_TEST (dirTest);
 	CPPUNIT_TEST (truncateTest);
+	CPPUNIT_TEST (metricsTest);
+	CPPUNIT_TEST (sharedIndexTest);
+	CPPUNIT_TEST (coordinatedCreateTest);
+	CPPUNIT_TEST (fanoutTest);
+	CPPUNIT_TEST (openLeaseTest);
+	CPPUNIT_TEST (compressTest);
+	CPPUNIT_TEST (checksumTest);
+	CPPUNIT_TEST (zeroBlocksTest);
+	CPPUNIT_TEST (cloneTest);
+	CPPUNIT_TEST (extentTest);
+	CPPUNIT_TEST (appendTest);
+	CPPUNIT_TEST (compactOpenTest);
+	CPPUNIT_TEST (flattenOpenTest);
 	CPPUNIT_TEST_SUITE_END ();
 
 public:
@@ -31,6 +46,8 @@ protected:
 	void createTest();
 	void openCloseTest();
 	void readWriteTest();
+	void fdextentTest();
+	void writenTest();
 	void chmodTest();
 	void chmodDirTest();
 	void linkTest();
@@ -39,6 +56,19 @@ protected:
 	void renameTest();
 	void dirTest();
 	void truncateTest();
+	void metricsTest();
+	void sharedIndexTest();
+	void coordinatedCreateTest();
+	void fanoutTest();
+	void openLeaseTest();
+	void compressTest();
+	void checksumTest();
+	void zeroBlocksTest();
+	void cloneTest();
+	void extentTest();
+	void appendTest();
+	void compactOpenTest();
+	void flattenOpenTest();
 private:
 	string mountpoint;
 	pid_t pid;
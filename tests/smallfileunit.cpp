@@ -1,13 +1,17 @@
 #include "smallfileunit.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <list>
+#include <map>
 #include <set>
 #include <vector>
 #include <algorithm>
@@ -16,6 +20,12 @@
 #include <NamesMapping.hxx>
 #include <SmallFileLayout.h>
 #include <SmallFileIndex.hxx>
+#include <SmallFileContainer.hxx>
+#include <FileReader.hxx>
+#include <parse_conf.h>
+#include <CacheManager.hxx>
+#include <LoserTree.hxx>
+#include <IndexSegment.hxx>
 #include <IOStore.h>
 #include <PosixIOStore.h>
 
@@ -24,6 +34,9 @@ using namespace std;
 CPPUNIT_TEST_SUITE_REGISTRATION(WriterUnit);
 CPPUNIT_TEST_SUITE_REGISTRATION(NamesMappingUnit);
 CPPUNIT_TEST_SUITE_REGISTRATION(IndexUnit);
+CPPUNIT_TEST_SUITE_REGISTRATION(ContainerUnit);
+CPPUNIT_TEST_SUITE_REGISTRATION(CacheManagerUnit);
+CPPUNIT_TEST_SUITE_REGISTRATION(LoserTreeUnit);
 
 extern string plfsmountpoint;
 class IOStore *store = new PosixIOStore();
@@ -285,6 +298,84 @@ WriterUnit::truncfileTest() {
     store->Close(iop.fh);
 }
 
+void
+WriterUnit::groupcommitTest() {
+    struct plfs_pathback fileinfo;
+    struct stat stbuf;
+    string batchfile;
+    int ret;
+
+    generate_dropping_name(testdir, getpid() + 1, batchfile);
+    fileinfo.bpath = batchfile;
+    fileinfo.back = backend;
+    SMF_Writer batched(fileinfo, 1, 4096);
+    for (int i = 0; i < 10; i++) {
+        char created[256];
+        sprintf(created, "TESTFILE-%03d", i);
+        ret = batched.create(created, NULL);
+        CPPUNIT_ASSERT_EQUAL(0, ret);
+    }
+    /* The records are queued until the batch is full. */
+    CPPUNIT_ASSERT_EQUAL(0, lstat(batchfile.c_str(), &stbuf));
+    CPPUNIT_ASSERT_EQUAL((off_t)0, stbuf.st_size);
+    ret = batched.flush();
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    CPPUNIT_ASSERT_EQUAL(0, lstat(batchfile.c_str(), &stbuf));
+    CPPUNIT_ASSERT_EQUAL((off_t)(10 * 32), stbuf.st_size);
+    for (int i = 0; i < 200; i++) {
+        ret = batched.create("TESTFILE-NNN", NULL);
+        CPPUNIT_ASSERT_EQUAL(0, ret);
+    }
+    /* 4096 bytes are 128 records */
+    CPPUNIT_ASSERT_EQUAL(0, lstat(batchfile.c_str(), &stbuf));
+    CPPUNIT_ASSERT_EQUAL((off_t)(138 * 32), stbuf.st_size);
+    ret = batched.sync(WRITER_SYNC_NAMEFILE);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    CPPUNIT_ASSERT_EQUAL(0, lstat(batchfile.c_str(), &stbuf));
+    CPPUNIT_ASSERT_EQUAL((off_t)(210 * 32), stbuf.st_size);
+}
+
+void
+WriterUnit::shortwriteTest() {
+    struct rlimit saved, limited;
+    struct IndexEntry index;
+    struct stat stbuf;
+    string indexfile;
+    IOSHandle *fh;
+    ssize_t len;
+    int ret;
+
+    FileID fileid = writer->get_fileid("TESTFILE", NULL);
+    for (int i = 0; i < 3; i++) {
+        ret = writer->truncate(fileid, i, NULL, NULL);
+        CPPUNIT_ASSERT_EQUAL(0, ret);
+    }
+    /* The file size limit stops the 4th record in the middle. */
+    CPPUNIT_ASSERT_EQUAL(0, getrlimit(RLIMIT_FSIZE, &saved));
+    limited = saved;
+    limited.rlim_cur = 3 * sizeof index + sizeof index / 2;
+    signal(SIGXFSZ, SIG_IGN);
+    CPPUNIT_ASSERT_EQUAL(0, setrlimit(RLIMIT_FSIZE, &limited));
+    ret = writer->truncate(fileid, 3, NULL, NULL);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, SIG_DFL);
+    CPPUNIT_ASSERT(ret != 0);
+    /* The partial record is cut off, the next one is aligned. */
+    ret = writer->truncate(fileid, 4, NULL, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    writer->sync(WRITER_SYNC_INDEXFILE);
+    dropping_name2index(namefile, indexfile);
+    CPPUNIT_ASSERT_EQUAL(0, lstat(indexfile.c_str(), &stbuf));
+    CPPUNIT_ASSERT_EQUAL((off_t)(4 * sizeof index), stbuf.st_size);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, store->Open(indexfile.c_str(),
+                                                   O_RDONLY, 0666, &fh));
+    fh->Pread(&index, sizeof index, 3 * sizeof index, &len);
+    store->Close(fh);
+    CPPUNIT_ASSERT_EQUAL((ssize_t)sizeof index, len);
+    CPPUNIT_ASSERT_EQUAL(fileid, (FileID)index.fid);
+    CPPUNIT_ASSERT_EQUAL((off_t)4, (off_t)index.offset);
+}
+
 void
 NamesMappingUnit::setUp() {
     int ret;
@@ -386,6 +477,100 @@ NamesMappingUnit::namescacheTest() {
     return;
 }
 
+void
+NamesMappingUnit::snapshotTest() {
+    vector<SMF_Writer> writers;
+    vector<struct plfs_pathback> namefiles;
+    struct plfs_pathback snapshot;
+    struct plfs_pathback newfile;
+    struct plfs_pathback latefile;
+    struct stat stbuf;
+    set<string> results;
+    set<string> expected;
+    map<string, time_t> mtimes;
+    map<string, time_t> replayed;
+    uint64_t early = get_current_timestamp();
+    int ret;
+
+    snapshot.bpath = testdir + DIR_SEPERATOR NAME_SNAPSHOT_FILENAME;
+    snapshot.back = backend;
+    for (int i = 0; i < 12; i++) {
+        string namefile;
+        struct plfs_pathback fileinfo;
+        generate_dropping_name(testdir, 1000 + i, namefile);
+        fileinfo.bpath = namefile;
+        fileinfo.back = backend;
+        writers.push_back(SMF_Writer(fileinfo, i));
+        if (i < 10) {
+            namefiles.push_back(fileinfo);
+        } else if (i == 10) {
+            newfile = fileinfo;
+        } else {
+            latefile = fileinfo;
+        }
+    }
+    for (int i = 0; i < 1000; i++) {
+        char buf[64];
+        sprintf(buf, "TESTFILE-%d", i);
+        ret = writers[i%10].create(buf, NULL);
+        CPPUNIT_ASSERT_EQUAL(0, ret);
+        expected.insert(buf);
+    }
+    for (int i = 0; i < 10; i++) writers[i].sync(WRITER_SYNC_NAMEFILE);
+    NamesMapping *nm = new NamesMapping();
+    nm->set_snapshot(snapshot, 1);
+    nm->read_names(&results, &namefiles);
+    CPPUNIT_ASSERT(results == expected);
+    delete nm;
+    CPPUNIT_ASSERT_EQUAL(0, lstat(snapshot.bpath.c_str(), &stbuf));
+    /* Records after the snapshot, one of them in a new name file. */
+    namefiles.insert(namefiles.begin(), namefiles.back());
+    namefiles.pop_back();
+    namefiles.push_back(newfile);
+    for (int i = 0; i < 900; i++) {
+        char buf[64];
+        char buf_to[64];
+        sprintf(buf, "TESTFILE-%d", i);
+        if (i % 2) {
+            ret = writers[(i+1)%11].remove(buf, NULL);
+        } else {
+            sprintf(buf_to, "RENAMED-%d", i);
+            ret = writers[(i+1)%11].rename(buf, buf_to, NULL);
+            expected.insert(buf_to);
+        }
+        CPPUNIT_ASSERT_EQUAL(0, ret);
+        expected.erase(buf);
+    }
+    for (int i = 0; i < 11; i++) writers[i].sync(WRITER_SYNC_NAMEFILE);
+    nm = new NamesMapping();
+    nm->set_snapshot(snapshot, 1000000);
+    results.clear();
+    nm->read_names(&results, &namefiles);
+    CPPUNIT_ASSERT(results == expected);
+    delete nm;
+    /*
+     * A record older than the snapshot (like the ones the compactor
+     * writes): it must be merged where a full replay merges it, before
+     * TESTFILE-950 is created, so the rename fails.
+     */
+    namefiles.push_back(latefile);
+    writers[11].set_timestamp(early);
+    ret = writers[11].rename("TESTFILE-950", "EARLY-950", NULL);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    writers[11].sync(WRITER_SYNC_NAMEFILE);
+    nm = new NamesMapping();
+    nm->set_snapshot(snapshot, 1000000);
+    nm->read_mtimes(&mtimes, &namefiles);
+    delete nm;
+    nm = new NamesMapping();
+    nm->read_mtimes(&replayed, &namefiles);
+    delete nm;
+    CPPUNIT_ASSERT(mtimes == replayed);
+    CPPUNIT_ASSERT(mtimes.find("TESTFILE-950") != mtimes.end());
+    CPPUNIT_ASSERT(mtimes.find("EARLY-950") == mtimes.end());
+    CPPUNIT_ASSERT_EQUAL(expected.size(), mtimes.size());
+}
+
 void
 IndexUnit::setUp() {
     int ret;
@@ -469,3 +654,498 @@ IndexUnit::loadindexTest() {
     }
     delete index;
 }
+
+static void
+add_index_record(vector<IndexRecord> &records, ssize_t did, uint64_t offset,
+                 uint64_t length, off_t physical_offset)
+{
+    IndexRecord record;
+
+    record.entry.fid = 0;
+    record.entry.offset = offset;
+    record.entry.length = length;
+    record.entry.timestamp = records.size();
+    record.entry.physical_offset = physical_offset;
+    record.did = did;
+    records.push_back(record);
+}
+
+void
+IndexUnit::recordsindexTest() {
+    vector<IndexRecord> records;
+    DataEntry res;
+    int ret;
+
+    add_index_record(records, 0, 0, 100, 1000);
+    add_index_record(records, 1, 50, 10, 2000);
+    add_index_record(records, 0, 80, 0, HOLE_PHYSICAL_OFFSET);
+    index_init_para_t init_para = {NULL, NULL, &records};
+    SmallFileIndex *index = new SmallFileIndex(&init_para);
+    CPPUNIT_ASSERT(index->get_filesize() == 80);
+    ret = index->lookup(10, res);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    CPPUNIT_ASSERT(res.did == 0 && res.offset == 1010 && res.length == 40);
+    ret = index->lookup(55, res);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    CPPUNIT_ASSERT(res.did == 1 && res.offset == 2005 && res.length == 5);
+    ret = index->lookup(60, res);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    CPPUNIT_ASSERT(res.did == 0 && res.offset == 1060 && res.length == 20);
+    ret = index->lookup(80, res);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    CPPUNIT_ASSERT(res.length == 0);
+    delete index;
+}
+
+void
+IndexUnit::segmentindexTest() {
+    vector<struct plfs_pathback> namefiles(1);
+    vector<bool> sealed(1, true);
+    struct plfs_pathback segment, indexpath;
+    string indexfile;
+    FileID fileids[3];
+    DataEntry res;
+    int ret;
+
+    generate_dropping_name(testdir, 1000, namefiles[0].bpath);
+    namefiles[0].back = backend;
+    SMF_Writer *writer = new SMF_Writer(namefiles[0], 0);
+    for (int i = 0; i < 3; i++) {
+        char filename[16];
+        sprintf(filename, "TESTFILE-%d", i);
+        writer->create(filename, NULL);
+        fileids[i] = writer->get_fileid(filename, NULL);
+    }
+    /* Interleave the records of the files over several fences. */
+    for (int i = 0; i < 300; i++) {
+        ret = writer->write(fileids[i % 3], "0123456789", 10 * (i / 3), 10,
+                            NULL, NULL);
+        CPPUNIT_ASSERT_EQUAL(0, ret);
+    }
+    writer->truncate(fileids[1], 995, NULL, NULL);
+    delete writer;
+
+    /* The writer is gone, so its index file can be sealed. */
+    segment.back = backend;
+    dropping_name2segment(namefiles[0].bpath, segment.bpath);
+    indexpath.back = backend;
+    dropping_name2index(namefiles[0].bpath, indexpath.bpath);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS,
+                         seal_index_segment(indexpath, segment.bpath));
+    for (int i = 0; i < 3; i++) {
+        SegmentReader reader(0);
+        struct IndexEntry *entry;
+        int nrecords = 0;
+        CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS,
+                             reader.load(segment, indexpath, fileids[i]));
+        for (entry = (struct IndexEntry *)reader.front(); entry;
+             entry = (struct IndexEntry *)reader.front()) {
+            CPPUNIT_ASSERT(entry->fid == fileids[i]);
+            if (entry->length > 0)
+                CPPUNIT_ASSERT(entry->offset == (uint64_t)nrecords * 10);
+            nrecords++;
+            reader.pop_front();
+        }
+        CPPUNIT_ASSERT_EQUAL(i == 1 ? 101 : 100, nrecords);
+    }
+
+    /* The index is built from the segment alone. */
+    dropping_name2index(namefiles[0].bpath, indexfile);
+    CPPUNIT_ASSERT_EQUAL(0, unlink(indexfile.c_str()));
+    NamesMapping nm;
+    ret = nm.require(MEMCACHE_FULLYLOADED, &namefiles);
+    FileMetaDataPtr filemeta = nm.get_metadata("TESTFILE-1");
+    CPPUNIT_ASSERT(filemeta);
+    index_init_para_t init_para = {&namefiles, &filemeta->index_mapping,
+                                   NULL, &sealed};
+    SmallFileIndex *index = new SmallFileIndex(&init_para);
+    nm.release(MEMCACHE_FULLYLOADED, &namefiles);
+    CPPUNIT_ASSERT(index->get_filesize() == 995);
+    ret = index->lookup(500, res);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    CPPUNIT_ASSERT(res.did == 0 && res.offset == 1510 && res.length == 10);
+    delete index;
+}
+
+void
+IndexUnit::segmentstaleTest() {
+    vector<struct plfs_pathback> namefiles(1);
+    vector<bool> sealed(1, true);
+    struct plfs_pathback segment, indexpath;
+    FileID fileid;
+    DataEntry res;
+    int ret;
+
+    generate_dropping_name(testdir, 1000, namefiles[0].bpath);
+    namefiles[0].back = backend;
+    SMF_Writer *writer = new SMF_Writer(namefiles[0], 0);
+    writer->create("TESTFILE", NULL);
+    fileid = writer->get_fileid("TESTFILE", NULL);
+    ret = writer->write(fileid, "0123456789", 0, 10, NULL, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    writer->sync(WRITER_SYNC_INDEXFILE);
+    segment.back = backend;
+    dropping_name2segment(namefiles[0].bpath, segment.bpath);
+    indexpath.back = backend;
+    dropping_name2index(namefiles[0].bpath, indexpath.bpath);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS,
+                         seal_index_segment(indexpath, segment.bpath));
+
+    /* The writer goes on after the seal. */
+    ret = writer->write(fileid, "ABCDEFGHIJ", 10, 10, NULL, NULL);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    writer->sync(WRITER_SYNC_INDEXFILE);
+    SegmentReader reader(0);
+    CPPUNIT_ASSERT_EQUAL(PLFS_EAGAIN,
+                         reader.load(segment, indexpath, fileid));
+
+    /* The index is built from the index file instead. */
+    NamesMapping nm;
+    ret = nm.require(MEMCACHE_FULLYLOADED, &namefiles);
+    FileMetaDataPtr filemeta = nm.get_metadata("TESTFILE");
+    CPPUNIT_ASSERT(filemeta);
+    index_init_para_t init_para = {&namefiles, &filemeta->index_mapping,
+                                   NULL, &sealed};
+    SmallFileIndex *index = new SmallFileIndex(&init_para);
+    nm.release(MEMCACHE_FULLYLOADED, &namefiles);
+    CPPUNIT_ASSERT(index->get_filesize() == 20);
+    ret = index->lookup(10, res);
+    CPPUNIT_ASSERT_EQUAL(0, ret);
+    CPPUNIT_ASSERT(res.did == 0 && res.offset == 10 && res.length == 10);
+    delete index;
+    delete writer;
+}
+
+void
+ContainerUnit::setUp() {
+    int ret;
+    struct stat stbuf;
+
+    testdir = plfsmountpoint;
+    ret = lstat(testdir.c_str(), &stbuf);
+    if (ret == 0 || errno != ENOENT) exit(-1);
+    CPPUNIT_ASSERT_EQUAL(mkdir(testdir.c_str(), 0777), 0);
+    get_plfs_conf();
+}
+
+void
+ContainerUnit::tearDown() {
+    string rmcmd = "rm -rf " + testdir;
+    system(rmcmd.c_str());
+}
+
+void
+ContainerUnit::readdirplusTest() {
+    PlfsMount pmount;
+    PathExpandInfo expinfo;
+    map<string, struct stat> attrs;
+    struct stat base;
+    char data[100];
+    const char *names[] = {"WRITTEN", "SPARSE", "TRUNCATED", "RENAMED"};
+    const off_t sizes[] = {100, 60, 5, 20};
+    plfs_error_t ret;
+
+    set_default_mount(&pmount);
+    pmount.nback = 1;
+    pmount.backends = &backend;
+    expinfo.pmount = &pmount;
+    expinfo.dirpath = testdir;
+    memset(data, 'x', sizeof data);
+
+    SmallFileContainer *container = new SmallFileContainer(&expinfo);
+    WriterPtr writer = container->get_writer(getpid());
+    const char *created[] = {"WRITTEN", "SPARSE", "TRUNCATED", "REMOVED",
+                             "TORENAME"};
+    FileID fids[5];
+    for (int i = 0; i < 5; i++) {
+        ret = container->create(created[i], getpid());
+        CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+        fids[i] = writer->get_fileid(created[i], &container->files);
+    }
+    writer->write(fids[0], data, 0, 100, NULL, NULL);
+    writer->write(fids[1], data, 50, 10, NULL, NULL);
+    writer->write(fids[2], data, 0, 30, NULL, NULL);
+    writer->truncate(fids[2], 5, NULL, NULL);
+    writer->write(fids[3], data, 0, 40, NULL, NULL);
+    writer->write(fids[4], data, 0, 20, NULL, NULL);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, container->remove("REMOVED", getpid()));
+    ret = container->rename("TORENAME", "RENAMED", getpid());
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+    writer.reset();
+    delete container;
+
+    /* The attributes are computed from the records alone. */
+    memset(&base, 0, sizeof base);
+    base.st_mode = S_IFREG | 0644;
+    container = new SmallFileContainer(&expinfo);
+    ret = container->readdirplus(base, &attrs);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+    CPPUNIT_ASSERT_EQUAL((size_t)4, attrs.size());
+    for (int i = 0; i < 4; i++) {
+        map<string, struct stat>::iterator itr = attrs.find(names[i]);
+        CPPUNIT_ASSERT(itr != attrs.end());
+        CPPUNIT_ASSERT_EQUAL(sizes[i], itr->second.st_size);
+        CPPUNIT_ASSERT(itr->second.st_mode == base.st_mode);
+        CPPUNIT_ASSERT(itr->second.st_mtime != 0);
+        /* The same size as the index says. */
+        IndexPtr index = container->get_index(names[i]);
+        CPPUNIT_ASSERT(index);
+        CPPUNIT_ASSERT_EQUAL(sizes[i], index->get_filesize());
+    }
+
+    /* The second call is served by the attribute cache. */
+    attrs.clear();
+    ret = container->readdirplus(base, &attrs);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+    CPPUNIT_ASSERT_EQUAL((size_t)4, attrs.size());
+    CPPUNIT_ASSERT_EQUAL((off_t)60, attrs["SPARSE"].st_size);
+    delete container;
+}
+
+void
+ContainerUnit::compactTest() {
+    PlfsMount pmount;
+    PathExpandInfo expinfo;
+    SmallFileCompactOpts opts = {0, 0, 0, 0};
+    SmallFileCompactStats stats;
+    vector<string> names;
+    set<string> listed;
+    plfs_error_t ret;
+
+    set_default_mount(&pmount);
+    pmount.nback = 1;
+    pmount.backends = &backend;
+    expinfo.pmount = &pmount;
+    expinfo.dirpath = testdir;
+
+    /* Write 20 files and remove every other one. */
+    SmallFileContainer *container = new SmallFileContainer(&expinfo);
+    WriterPtr writer = container->get_writer(getpid());
+    for (int i = 0; i < 20; i++) {
+        char filename[16], data[64];
+        sprintf(filename, "TESTFILE-%d", i);
+        memset(data, 'a' + i, sizeof data);
+        ret = container->create(filename, getpid());
+        CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+        FileID fid = writer->get_fileid(filename, &container->files);
+        ret = writer->write(fid, data, 0, 10 + i, NULL, NULL);
+        CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+    }
+    for (int i = 0; i < 20; i += 2) {
+        char filename[16];
+        sprintf(filename, "TESTFILE-%d", i);
+        ret = container->remove(filename, getpid());
+        CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+    }
+    writer.reset();
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS,
+                         container->sync_writers(WRITER_SYNC_DATAFILE));
+    delete container;
+
+    /* Another compactor holds the directory. */
+    string lockfile = testdir + "/" SMALLFILE_CONTAINER_NAME "/"
+        COMPACT_LOCK_FILENAME;
+    int fd = open(lockfile.c_str(), O_WRONLY|O_CREAT|O_EXCL, 0644);
+    CPPUNIT_ASSERT(fd >= 0);
+    close(fd);
+    container = new SmallFileContainer(&expinfo);
+    ret = container->compact(opts, &stats);
+    CPPUNIT_ASSERT_EQUAL(PLFS_EBUSY, ret);
+    CPPUNIT_ASSERT_EQUAL(0, unlink(lockfile.c_str()));
+    ret = container->compact(opts, &stats);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+    CPPUNIT_ASSERT(access(lockfile.c_str(), F_OK) != 0);
+    CPPUNIT_ASSERT(stats.droppings > 0);
+    CPPUNIT_ASSERT_EQUAL((size_t)10, stats.files);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, stats.sealed);
+    delete container;
+
+    /* The index of the new dropping group is sealed too. */
+    DIR *dirp = opendir((testdir + "/" SMALLFILE_CONTAINER_NAME).c_str());
+    struct dirent *dent;
+    int segments = 0;
+    CPPUNIT_ASSERT(dirp != NULL);
+    while ((dent = readdir(dirp)) != NULL) {
+        if (strncmp(dent->d_name, SEGMENT_PREFIX,
+                    strlen(SEGMENT_PREFIX)) == 0) segments++;
+    }
+    closedir(dirp);
+    CPPUNIT_ASSERT_EQUAL(1, segments);
+
+    /* Every surviving file reads back from the new droppings. */
+    FileReader::stop_readahead();   /* restarted on demand */
+    container = new SmallFileContainer(&expinfo);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, container->readdir(&listed));
+    CPPUNIT_ASSERT_EQUAL((size_t)10, listed.size());
+    for (int i = 1; i < 20; i += 2) {
+        char filename[16];
+        sprintf(filename, "TESTFILE-%d", i);
+        CPPUNIT_ASSERT(listed.count(filename) == 1);
+        names.push_back(filename);
+    }
+    vector<char *> bufs(names.size());
+    vector<size_t> sizes(names.size(), 64);
+    vector<ssize_t> nread(names.size());
+    for (size_t i = 0; i < names.size(); i++) bufs[i] = new char[64];
+    ret = container->read_many(names, &bufs[0], &sizes[0], &nread[0]);
+    CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, ret);
+    for (size_t i = 0; i < names.size(); i++) {
+        int n = 2 * i + 1;
+        CPPUNIT_ASSERT_EQUAL((ssize_t)(10 + n), nread[i]);
+        for (int j = 0; j < 10 + n; j++)
+            CPPUNIT_ASSERT(bufs[i][j] == 'a' + n);
+        delete [] bufs[i];
+    }
+    delete container;
+}
+
+/* a cached object whose size is given to the constructor */
+class SizedObject {
+public:
+    SizedObject(void *init_para) { size = *(unsigned long *)init_para; };
+    unsigned long length() { return size; };
+    unsigned long size;
+};
+
+void
+CacheManagerUnit::countlimitTest() {
+    CacheManager<string, SizedObject> cache(4);
+    unsigned long size = 0;
+    bool created;
+
+    for (int i = 0; i < 4; i++) {
+        cache.insert(string(1, 'a' + i), &size, created);
+        CPPUNIT_ASSERT(created);
+    }
+    CPPUNIT_ASSERT_EQUAL(4UL, cache.size());
+    /* 'a' is referenced, so the CLOCK hand should skip it */
+    CPPUNIT_ASSERT(cache.lookup("a") != NULL);
+    cache.insert("e", &size, created);
+    CPPUNIT_ASSERT_EQUAL(4UL, cache.size());
+    CPPUNIT_ASSERT_EQUAL(1UL, cache.evictions());
+    CPPUNIT_ASSERT(cache.lookup("a") != NULL);
+    CPPUNIT_ASSERT(cache.lookup("b") == NULL);
+    CPPUNIT_ASSERT(cache.lookup("e") != NULL);
+}
+
+void
+CacheManagerUnit::bytelimitTest() {
+    /* few enough objects to get a single shard */
+    CacheManager<string, SizedObject> cache(4, 1000);
+    unsigned long size = 299;
+    bool created;
+
+    for (int i = 0; i < 3; i++) {
+        cache.insert(string(1, 'a' + i), &size, created);
+    }
+    /* keys are one byte, so 3 objects take 900 bytes */
+    CPPUNIT_ASSERT_EQUAL(3UL, cache.size());
+    CPPUNIT_ASSERT_EQUAL(900UL, cache.length());
+    cache.insert("d", &size, created);
+    CPPUNIT_ASSERT_EQUAL(3UL, cache.size());
+    CPPUNIT_ASSERT(cache.length() <= 1000);
+    CPPUNIT_ASSERT(cache.lookup("d") != NULL);
+    cache.erase("d");
+    CPPUNIT_ASSERT_EQUAL(2UL, cache.size());
+    CPPUNIT_ASSERT_EQUAL(600UL, cache.length());
+}
+
+void
+CacheManagerUnit::pinnedTest() {
+    CacheManager<string, SizedObject> cache(4);
+    vector<tr1::shared_ptr<SizedObject> > held;
+    unsigned long size = 0;
+    bool created;
+
+    for (int i = 0; i < 4; i++) {
+        held.push_back(cache.insert(string(1, 'a' + i), &size, created));
+    }
+    /* every object is still in use, so none of them can go */
+    cache.insert("e", &size, created);
+    CPPUNIT_ASSERT_EQUAL(5UL, cache.size());
+    CPPUNIT_ASSERT_EQUAL(0UL, cache.evictions());
+    for (int i = 0; i < 4; i++) {
+        CPPUNIT_ASSERT(cache.lookup(string(1, 'a' + i)) == held[i]);
+    }
+    held.clear();
+    cache.insert("f", &size, created);
+    CPPUNIT_ASSERT_EQUAL(4UL, cache.size());
+    CPPUNIT_ASSERT_EQUAL(2UL, cache.evictions());
+}
+
+class IntReader : public RecordReader {
+public:
+    IntReader() : current(0) {};
+    virtual void *front() {
+        return current < values.size() ? &values[current] : NULL;
+    };
+    virtual plfs_error_t pop_front() {
+        if (current < values.size()) current++;
+        return current < values.size() ? PLFS_SUCCESS : PLFS_EEOF;
+    };
+    vector<int> values;
+private:
+    size_t current;
+};
+
+static int
+int_compare_func(void *int1, void *int2) {
+    return *(int *)int1 - *(int *)int2;
+}
+
+void
+LoserTreeUnit::mergeTest() {
+    /* Cover the trees with one leaf and with a number of leaves which is
+     * not a power of two. */
+    for (int sources = 1; sources <= 13; sources += 3) {
+        LoserTree tree(sources, int_compare_func);
+        vector<int> merged;
+
+        for (int i = 0; i < sources; i++) {
+            IntReader *reader = new IntReader();
+            for (int j = 0; j <= i * 7 % 5; j++) {
+                reader->values.push_back(j * 3 + i % 4);
+                merged.push_back(j * 3 + i % 4);
+            }
+            CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, tree.push_back(reader));
+        }
+        CPPUNIT_ASSERT_EQUAL(PLFS_ENOMEM, tree.push_back(NULL));
+        sort(merged.begin(), merged.end());
+        for (size_t i = 0; i < merged.size(); i++) {
+            CPPUNIT_ASSERT(tree.front() != NULL);
+            CPPUNIT_ASSERT_EQUAL(merged[i], *(int *)tree.front());
+            CPPUNIT_ASSERT_EQUAL(i + 1 < merged.size() ? PLFS_SUCCESS :
+                                 PLFS_ENOENT, tree.pop_front());
+        }
+        CPPUNIT_ASSERT(tree.front() == NULL);
+        CPPUNIT_ASSERT_EQUAL((size_t)0, tree.size());
+    }
+}
+
+static int
+int_compare_hundreds(void *int1, void *int2) {
+    return *(int *)int1 / 100 - *(int *)int2 / 100;
+}
+
+void
+LoserTreeUnit::tieTest() {
+    /* Only the hundreds are compared.  On a tie the source which gave
+     * the last record goes on, and otherwise the one pushed first. */
+    int values[][3] = {{100, 101, 300}, {0, 110, 111}, {120, 200, -1}};
+    int merged[] = {0, 110, 111, 100, 101, 120, 200, 300};
+    LoserTree tree(3, int_compare_hundreds);
+
+    for (int i = 0; i < 3; i++) {
+        IntReader *reader = new IntReader();
+        for (int j = 0; j < 3 && values[i][j] >= 0; j++) {
+            reader->values.push_back(values[i][j]);
+        }
+        CPPUNIT_ASSERT_EQUAL(PLFS_SUCCESS, tree.push_back(reader));
+    }
+    for (size_t i = 0; i < sizeof(merged) / sizeof(merged[0]); i++) {
+        CPPUNIT_ASSERT(tree.front() != NULL);
+        CPPUNIT_ASSERT_EQUAL(merged[i], *(int *)tree.front());
+        tree.pop_front();
+    }
+    CPPUNIT_ASSERT(tree.front() == NULL);
+}
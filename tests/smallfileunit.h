@@ -16,6 +16,8 @@ class WriterUnit : public CPPUNIT_NS::TestFixture
 	CPPUNIT_TEST (renamefileTest);
     CPPUNIT_TEST (writefileTest);
     CPPUNIT_TEST (truncfileTest);
+    CPPUNIT_TEST (groupcommitTest);
+    CPPUNIT_TEST (shortwriteTest);
 	CPPUNIT_TEST_SUITE_END ();
 
 public:
@@ -29,6 +31,8 @@ protected:
         void openfileTest();
         void writefileTest();
         void truncfileTest();
+        void groupcommitTest();
+        void shortwriteTest();
 private:
         string testdir;
         string namefile;
@@ -41,6 +45,7 @@ class NamesMappingUnit : public CPPUNIT_NS::TestFixture
 	CPPUNIT_TEST (loadfileTest);
 	CPPUNIT_TEST (renamefileTest);
         CPPUNIT_TEST (namescacheTest);
+        CPPUNIT_TEST (snapshotTest);
 	CPPUNIT_TEST_SUITE_END ();
 
 public:
@@ -51,6 +56,7 @@ protected:
         void loadfileTest();
         void renamefileTest();
         void namescacheTest();
+        void snapshotTest();
 
 private:
         string testdir;
@@ -60,6 +66,9 @@ class IndexUnit : public CPPUNIT_NS::TestFixture
 {
 	CPPUNIT_TEST_SUITE (IndexUnit);
         CPPUNIT_TEST (loadindexTest);
+        CPPUNIT_TEST (recordsindexTest);
+        CPPUNIT_TEST (segmentindexTest);
+        CPPUNIT_TEST (segmentstaleTest);
 	CPPUNIT_TEST_SUITE_END ();
 
 public:
@@ -68,9 +77,65 @@ public:
 
 protected:
         void loadindexTest();
+        void recordsindexTest();
+        void segmentindexTest();
+        void segmentstaleTest();
 
 private:
         string testdir;
 };
 
+class ContainerUnit : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE (ContainerUnit);
+        CPPUNIT_TEST (readdirplusTest);
+        CPPUNIT_TEST (compactTest);
+	CPPUNIT_TEST_SUITE_END ();
+
+public:
+        void setUp (void);
+        void tearDown (void);
+
+protected:
+        void readdirplusTest();
+        void compactTest();
+
+private:
+        string testdir;
+};
+
+class CacheManagerUnit : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE (CacheManagerUnit);
+        CPPUNIT_TEST (countlimitTest);
+        CPPUNIT_TEST (bytelimitTest);
+        CPPUNIT_TEST (pinnedTest);
+	CPPUNIT_TEST_SUITE_END ();
+
+public:
+        void setUp (void) {};
+        void tearDown (void) {};
+
+protected:
+        void countlimitTest();
+        void bytelimitTest();
+        void pinnedTest();
+};
+
+class LoserTreeUnit : public CPPUNIT_NS::TestFixture
+{
+	CPPUNIT_TEST_SUITE (LoserTreeUnit);
+        CPPUNIT_TEST (mergeTest);
+        CPPUNIT_TEST (tieTest);
+	CPPUNIT_TEST_SUITE_END ();
+
+public:
+        void setUp (void) {};
+        void tearDown (void) {};
+
+protected:
+        void mergeTest();
+        void tieTest();
+};
+
 #endif
@@ -0,0 +1,27 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "plfs_tool_common.h"
+#include "COPYRIGHT.h"
+
+int main (int argc, char **argv) {
+    plfs_error_t ret;
+
+    if (argc > 1) {
+        plfs_handle_version_arg(argc, argv[1]);
+    }
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <file> <newfile>\n", argv[0]);
+        exit(1);
+    }
+
+    ret = plfs_clone(argv[1], argv[2]);
+
+    if (ret != PLFS_SUCCESS) {
+        fprintf(stderr, "plfs_clone: %s -> %s failed (%s)\n",
+                argv[1], argv[2], strplfserr(ret));
+    }
+
+    exit(( ret == PLFS_SUCCESS) ?  0  : 1);
+}
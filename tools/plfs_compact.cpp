@@ -0,0 +1,67 @@
+#include <string.h>
+#include <stdlib.h>
+#include "plfs_tool_common.h"
+#include "smallfile_tools.h"
+
+void show_usage(char* app_name) {
+    fprintf(stderr, "Usage: %s [-version] [--idle secs] [--garbage percent] "
+            "[--mbs MB/s] [--grace secs] <directory> ...\n", app_name);
+}
+
+int main (int argc, char **argv) {
+    int i;
+    int idle = 60;
+    int min_garbage = 0;
+    int max_mbs = 0;
+    int grace = 60;
+    int first_target = 0;
+    for (i = 1; i < argc; i++) {
+        plfs_handle_version_arg(argc, argv[i]);
+        if (i + 1 < argc && strcmp(argv[i], "--idle") == 0) {
+            idle = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--garbage") == 0) {
+            min_garbage = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--mbs") == 0) {
+            max_mbs = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--grace") == 0) {
+            grace = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            show_usage(argv[0]);
+            exit(1);
+        } else {
+            first_target = i;
+            break;
+        }
+    }
+    if (!first_target || idle < 0 || min_garbage < 0 || min_garbage > 100
+        || max_mbs < 0 || grace < 0) {
+        show_usage(argv[0]);
+        exit(1);
+    }
+
+    plfs_error_t ret = PLFS_SUCCESS;
+    for (i = first_target; i < argc; i++) {
+        plfs_error_t err;
+        err = smallfile_compact(stdout, argv[i], idle, min_garbage, max_mbs,
+                                grace);
+        switch(err) {
+            case PLFS_SUCCESS:
+                break;
+            case PLFS_EBUSY:
+                fprintf(stderr, "%s is in use, try again later\n", argv[i]);
+                ret = err;
+                break;
+            case PLFS_EINVAL:
+                fprintf(stderr, "Error: %s is not in a PLFS mountpoint"
+                        " configured with 'workload small_file'\n", argv[i]);
+                ret = err;
+                break;
+            default:
+                fprintf(stderr, "Couldn't compact %s: %s\n", argv[i],
+                        strplfserr(err));
+                ret = err;
+                break;
+        }
+    }
+    exit( plfs_error_to_errno(ret) );
+}